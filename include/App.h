@@ -0,0 +1,93 @@
+#ifndef __App__
+#define __App__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <PersistSettings.h>
+#include "Config.h"
+#include "WxSample.h"
+
+// Version info
+#define MAJOR 1
+#define MINOR 3
+#define PATCH 0
+
+// Debug Info, debug() records above the level compile away (see Log.h)
+#define DEBUG 2
+#include "Log.h"
+
+// Input/Output Settings, the gauge outputs are routed in the settings
+#define BTNPIN1 33
+#define BTNPIN2 32
+#define LED1 27
+#define LED1CHANNEL 2
+#define LED2 15
+#define LED2CHANNEL 3
+
+// WiFi Parameters
+#define AP_MODE_SSID "WeatherFlowGauges"
+extern bool bSoftApActive;
+
+// Persistent Settings Handler
+extern PersistSettings<AppConfig> Settings;
+
+// Calibration.h, range tests every output, sweep calibrates one gauge
+enum CalMode { none, range, sweep };
+extern CalMode CalibrationMode;
+
+// Gauge pipeline
+void ledcAnalogWrite(uint8_t channel, uint32_t value, uint32_t valueMax = 8191);
+uint32_t scalePwmOutput(double dataVal, double minScale, double maxScale, double halfScalePWM = 3600);
+void gaugeTablesBuild(void);
+uint8_t encodeWind(int windDir);
+uint8_t encodeWindArc(float fDirection, float fSpread);
+void writeExpander(uint8_t u8Bank, uint8_t u8Pattern);
+void invalidateExpanders(void);
+extern uint32_t u32ExpanderWrites;
+extern uint32_t u32ExpanderWritesSkipped;
+void processWeather(const WxSample &sample);
+void gaugeOutput(const WxSample &sample);
+uint32_t gaugeService(void);
+
+// Housekeeping jobs, run by the scheduler as they fall due
+struct ScheduledJob;
+extern const ScheduledJob StationJobs[];
+extern const size_t NumStationJobs;
+extern const ScheduledJob SoftApJobs[];
+extern const size_t NumSoftApJobs;
+
+// Event pipeline (per platform): UDP receive task -> sample queue ->
+// gauge output task, plus the housekeeping jobs.  pipelineLoop() is
+// all that is left of the Arduino loop().
+void pipelineBegin(const ScheduledJob *jobs, size_t numJobs);
+void pipelineLoop(void);
+// Have the housekeeping jobs work out their deadlines again (settings,
+// mode or clock changed), from any task (per platform)
+void jobsReschedule(void);
+// Start draining the debug log ring to the console (per platform)
+void logBegin(void);
+// Firmware upload from the web server (per platform): claim the update,
+// hand over each chunk as it arrives, none of which waits.  A chunk
+// larger than the room left fails the update (false).  Then flag the
+// end, the verdict is in Firmware.State() once the upload is done.
+bool firmwareUploadBegin(void);
+bool firmwareUploadWrite(const uint8_t *pData, size_t len);
+size_t firmwareUploadRoom(void);
+void firmwareUploadEnd(void);
+bool firmwareUploadDone(void);
+
+// Wi-Fi & web services (per platform), wifiBegin() returns true
+// when the soft AP was started, a station joins in the background
+// and rejoins when the supervisor asks (Supervisor.h)
+bool wifiBegin(void);
+bool wifiConnected(void);
+void wifiReconnect(void);
+void webServicesBegin(void);
+// Refresh the system status and push both web status feeds
+void notifyWsSystemStatus(void);
+// Browsers following the status feeds
+size_t webStatusClients(void);
+// Restart from the housekeeping task, once the settings are saved
+void requestRestart(void);
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef __Boot__
+#define __Boot__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "Config.h"
+
+// ##################################################################
+// # Fast boot
+// #
+// # What the board needs to come back quickly from a restart, kept in
+// # the platform's retained memory (RTC slow memory on the ESP32,
+// # which a software, watchdog or brownout reset leaves alone but a
+// # power cycle does not): the value each gauge output was last
+// # driven to, and the access point & channel the Wi-Fi last joined.
+// # Each block has its own check and writer (the gauge task, the
+// # Wi-Fi task), the gauge values only count under the same routes.
+// # Also keeps the time each boot phase finished, for the status tab.
+// ##################################################################
+
+#define BOOT_NEEDLE_TARGET_MS 300   // Power up to the gauges restored
+
+enum BootPhase : uint8_t { bpSettings, bpNeedles, bpReady, bpWifi, NUM_BOOT_PHASES };
+
+class BootState{
+  public:
+    // Check the retained blocks, once the settings (routes) are loaded
+    void Begin(const GaugeRouteSettings &routes);
+    // Last value written to a route's output (duty, or LED pattern)
+    bool Output(uint8_t u8Route, uint32_t &u32Value) const;
+    void SetOutput(uint8_t u8Route, uint32_t u32Value);
+    // Access point the Wi-Fi last joined, false if none
+    bool Wifi(uint8_t (&u8Bssid)[6], uint8_t &u8Channel) const;
+    void SetWifi(const uint8_t *u8Bssid, uint8_t u8Channel);
+    // Phase timings, ms from power up, UINT32_MAX until reached
+    void Mark(BootPhase phase);
+    uint32_t Millis(BootPhase phase) const { return u32PhaseMs[phase]; }
+
+  private:
+    struct GaugeBlock{
+        uint32_t Magic;
+        uint32_t Routes;            // Hash of the routes it was written under
+        uint16_t Value[GAUGE_ROUTES];
+        uint32_t Valid;             // Route bits
+        uint32_t Check;
+    };
+    struct WifiBlock{
+        uint32_t Magic;
+        uint8_t Bssid[6];
+        uint8_t Channel;
+        uint8_t Reserved;
+        uint32_t Check;
+    };
+    GaugeBlock *pGauges = NULL;
+    WifiBlock *pWifi = NULL;
+    volatile uint32_t u32PhaseMs[NUM_BOOT_PHASES] = { UINT32_MAX, UINT32_MAX, UINT32_MAX, UINT32_MAX };
+};
+
+extern BootState Boot;
+
+// Static IPv4 address as text, "<address>/<prefix> <gateway> [<dns>]",
+// empty for DHCP, e.g. "192.168.1.50/24 192.168.1.1", the prefix 1..30
+bool staticIpParse(const char *chText, WiFiSettings &wifi);
+size_t staticIpFormat(const WiFiSettings &wifi, char *chOut, size_t maxLen);
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef __Calibration__
+#define __Calibration__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "Config.h"
+#include "SeqLock.h"
+
+// ##################################################################
+// # Gauge calibration sequencer
+// #
+// # Steps the outputs from the housekeeping scheduler, one dwell per
+// # step, so the receive path and the web UI carry on throughout.
+// # Every sweep runs up the scale and back down: a meter's hysteresis
+// # shows as the needle reading differently at the same step from
+// # either side.  The test sweep (range) drives every output and
+// # repeats until stopped.  A gauge sweep drives one gauge through up
+// # to GAUGE_CAL_POINTS values, the operator nudges the duty at each
+// # step until the needle reads true (the step then dwells again from
+// # the last nudge), and the corrected duties, the mean of the two
+// # passes, are kept as that gauge's calibration points until saved.
+// #
+// # The web UI task only posts requests (latest wins, nudges add up),
+// # the housekeeping task applies them.
+// ##################################################################
+
+#define CAL_DWELL_MS 5000           // Default time on each step
+#define CAL_DWELL_MIN_MS 500
+#define CAL_DWELL_MAX_MS 120000
+
+// Corrected points of the last gauge sweep
+struct CalResult{
+    uint8_t Scale = rsLinear;       // rsWind or rsTemp
+    uint8_t Points = 0;             // 0 until a sweep finishes
+    int Hysteresis = 0;             // Largest up/down difference, PWM counts
+    GaugeCalPoint Point[GAUGE_CAL_POINTS];
+};
+
+class CalibrationSequencer{
+  public:
+    // Web UI: start a sweep (mode is a CalMode, the scale picks the
+    // gauge of a sweep) or stop, and move the current step's duty
+    void Start(uint8_t u8Mode, uint8_t u8Scale, uint32_t u32DwellMs);
+    void Nudge(int iDuty);
+    // The last finished gauge sweep, false if there is none
+    bool Result(CalResult &result) const { return Results.Read(result) && result.Points; }
+    // Housekeeping: apply the requests and step once the dwell is over
+    void Tick(uint32_t u32NowMs);
+    // ms until Tick() has something to do, UINT32_MAX when idle
+    uint32_t DueIn(uint32_t u32NowMs) const;
+    // One line for the status tab
+    size_t Status(char *chOut, size_t maxLen) const;
+
+  private:
+    struct Request{
+        uint8_t Mode = 0;
+        uint8_t Scale = rsLinear;
+        uint32_t DwellMs = CAL_DWELL_MS;
+    };
+    void begin(const Request &request, uint32_t u32NowMs);
+    void output(void);
+    void finish(void);
+    uint8_t step(void) const { return u8Visit < u8Steps ? u8Visit : 2 * (u8Steps - 1) - u8Visit; }
+    bool down(void) const { return u8Visit >= u8Steps; }
+    SeqLock<Request> Requests;
+    std::atomic<int32_t> i32Nudges{0};
+    SeqLock<CalResult> Results;
+    // Housekeeping task only
+    uint32_t u32Applied = 0;        // Requests seen
+    uint8_t u8Mode = 0;
+    uint8_t u8Scale = rsLinear;
+    uint32_t u32DwellMs = CAL_DWELL_MS;
+    uint32_t u32StepMs = 0;         // Current step started (or last nudged)
+    uint8_t u8Steps = 0;
+    uint8_t u8Visit = 0;            // 0 .. u8Steps - 1 up, then back down to 2 * (u8Steps - 1)
+    float fValue[GAUGE_CAL_POINTS];
+    uint32_t u32Base[GAUGE_CAL_POINTS];         // Duty from the gauge table
+    int32_t i32Correction[2][GAUGE_CAL_POINTS]; // Up, down
+};
+
+extern CalibrationSequencer Calibration;
+
+#endif
@@ -1,17 +1,47 @@
 #ifndef __AppConfig__
 #define __AppConfig__
 
+#include <stdint.h>
+#include <string.h>
+
+// A static IPv4 address when Ip is set (DHCP when all zero), the subnet
+// as a prefix length, no DNS server when all zero
 struct WiFiSettings{
     char ssid[32] = {0};
     char pass[32] = {0};
+    uint8_t Ip[4] = {0};
+    uint8_t Gateway[4] = {0};
+    uint8_t Dns[4] = {0};
+    uint8_t Prefix = 24;
+};
+
+// Calibration point, gauge value and the PWM duty that shows it
+#define GAUGE_CAL_POINTS 8
+struct GaugeCalPoint{
+    float value = 0;
+    int pwm = 0;
 };
 
+// What a gauge scaled output fed by the wind speed shows, the rolling
+// statistics are over the rapid_wind samples (WindStats.h)
+enum GaugeShow : uint8_t { gsInstant, gsAverage2m, gsAverage10m, gsGust2m, gsGust10m, gsLull2m,
+  gsLull10m, NUM_GAUGE_SHOW };
+
 struct GaugeSettings{
     int min = 0;
     int max = 10;
     int step = 1;
     float gain = 1;  // Gain is now the 50% PWM output integer
     int threshold = 0;
+    // Piecewise-linear calibration curve, ascending values, used in
+    // place of the gain when calPoints >= 2
+    int calPoints = 0;
+    GaugeCalPoint cal[GAUGE_CAL_POINTS];
+    // Needle slewing between samples, PWM counts per second (0 = jump
+    // straight to the new value), with critically damped easing
+    int slew = 0;
+    int damped = 1;
+    int show = gsInstant;
     GaugeSettings(int m1, int m2, int s, float g, int t){
         gain = g;
         min = m1;
@@ -38,14 +68,87 @@ struct GaugeLampSettings{
     int OffMinute = 0;
 };
 
+// Wind direction LED patterns for the 16 compass sectors, N, NNE ... NNW,
+// each is the MCP23008 output register (8 LEDs).  With Arc set the
+// compass lights every sector the direction has swung through, the 10
+// minute mean plus and minus its circular standard deviation.
+#define WIND_SECTORS 16
+struct WindLedSettings{
+    uint8_t Pattern[WIND_SECTORS] = { 0x01, 0x03, 0x02, 0x06, 0x04, 0x0C, 0x08, 0x18,
+                                      0x10, 0x30, 0x20, 0x60, 0x40, 0xC0, 0x80, 0x81 };
+    uint8_t Arc = 0;
+};
+
+// Connectivity supervisor (Supervisor.h), the gauge data goes stale
+// when no sample arrived for StaleIntervals rapid_wind intervals (3 s
+// each, 0 = never), then the needles & LED bars park at ParkPercent of
+// their scale and, with Blank set, the wind direction LEDs go dark
+struct LinkSettings{
+    uint8_t StaleIntervals = 10;
+    uint8_t ParkPercent = 0;
+    uint8_t Blank = 1;
+};
+
+// Serial numbers the gauges take packets from, space separated, each
+// the start of a station (ST-) or hub (HB-) serial, e.g. "ST-00000512"
+// or "HB-0001".  Empty takes every station on the network (Ingest.h).
+#define INGEST_ALLOW_LEN 64
+struct IngestSettings{
+    char Allow[INGEST_ALLOW_LEN] = {0};
+};
+
+// Gauge routing, any Tempest field to a PWM (LEDC) channel or an
+// MCP23008 bank (I2C address 0x20 + bank).  A PWM route drives a meter
+// through its scale, an expander route shows the wind direction as the
+// compass pattern, anything else as a bar of 0 to 8 LEDs.  The wind &
+// temp scales are the gauge settings above (range, calibration, slew
+// and, for the compass, the wind speed threshold), linear runs from
+// Min to Max.  Routes are set up at boot.
+#define GAUGE_ROUTES 8
+#define EXPANDER_BANKS 8
+enum RouteField : uint8_t { rfNone, rfWindSpeed, rfWindDirection, rfAirTemperature, rfWindAverage,
+  rfWindGust, rfPressure, rfHumidity, rfUv, rfBrightness, rfSolarRadiation, rfRainRate,
+  rfStrikeDistance, rfStrikeCount, NUM_ROUTE_FIELDS };
+enum RouteOutput : uint8_t { roPwm, roExpander, NUM_ROUTE_OUTPUTS };
+enum RouteScale : uint8_t { rsLinear, rsWind, rsTemp, NUM_ROUTE_SCALES };
+
+struct GaugeRoute{
+    uint8_t Field = rfNone;
+    uint8_t Output = roPwm;
+    uint8_t Channel = 0;    // LEDC channel, or expander bank
+    uint8_t Pin = 0;        // LEDC output pin
+    uint8_t Scale = rsLinear;
+    float Min = 0;
+    float Max = 100;
+    GaugeRoute(){};
+    GaugeRoute(uint8_t f, uint8_t o, uint8_t c, uint8_t p, uint8_t s){
+        Field = f;
+        Output = o;
+        Channel = c;
+        Pin = p;
+        Scale = s;
+    };
+};
+
+// The board's wind & temp gauges (GPIO 25 & 26) and wind LEDs
+struct GaugeRouteSettings{
+    GaugeRoute Route[GAUGE_ROUTES] = { {rfWindSpeed, roPwm, 0, 25, rsWind},
+                                       {rfAirTemperature, roPwm, 1, 26, rsTemp},
+                                       {rfWindDirection, roExpander, 0, 0, rsWind} };
+};
+
 struct AppConfig{
-    static const unsigned int Version = 4;
+    static const unsigned int Version = 12;
     WiFiSettings WiFi;
     GaugeSettings Wind = {0, 40, 10, 3900, 1};
     GaugeSettings Temp = {-10, 110, 15, 3680, 1};
     WebSettings Web = {"admin", "temp"};
     char TimeZone[32] = "EST+5EDT,M3.2.0/2,M11.1.0/2";
     GaugeLampSettings GaugeLamps;
+    WindLedSettings WindLeds;
+    GaugeRouteSettings Routes;
+    LinkSettings Link;
+    IngestSettings Ingest;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,77 @@
+#ifndef __Firmware__
+#define __Firmware__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "Sha256.h"
+
+// ##################################################################
+// # Firmware update
+// #
+// # The uploaded image goes straight to the update slot (the OTA
+// # partition not running, Hal.h) as it arrives: each flash sector is
+// # erased just ahead of the bytes that land in it, nothing is held
+// # back but the last 32 bytes.  Those are the SHA-256 an ESP32 app
+// # image carries over everything before it (esp_image_header_t
+// # hash_appended), the digest runs one chunk behind the writes and
+// # has to match before the slot is set to boot.  The first bytes are
+// # checked for the image header, so the wrong file fails at once.
+// #
+// # The web server claims the update, the writer (a low priority task
+// # on the board) does the rest.  The gauge task reports the receive
+// # to output time of each sample, the longest while an update runs
+// # and otherwise are kept for the status tab.
+// ##################################################################
+
+#define FIRMWARE_MAGIC 0xE9                 // esp_image_header_t.magic
+#define FIRMWARE_HEADER_LEN 24              // Up to and with hash_appended
+#define FIRMWARE_HASH_APPENDED 23
+
+enum FirmwareState : uint8_t { fsIdle, fsWriting, fsDone, fsFailed };
+enum FirmwareError : uint8_t { feNone, feNoSlot, feNotImage, feTooBig, feFlash, feDigest, feRejected,
+  feStalled, feOverrun, NUM_FIRMWARE_ERRORS };
+
+class FirmwareUpdate{
+  public:
+    // Web server: claim the update, false if one is running or there
+    // is no update slot
+    bool Begin(uint32_t u32NowMs);
+    // Writer: the next bytes of the image, false once it has failed
+    bool Write(const uint8_t *pData, size_t len);
+    // Writer: all in, check the digest and boot the new image at the
+    // next restart, true if it will
+    bool End(uint32_t u32NowMs);
+    // Writer, or the web server when it could not hand a chunk over:
+    // give up, the slot is left as it is (not bootable)
+    void Fail(FirmwareError error);
+    // Gauge task: receive to output time of a sample
+    void Latency(uint32_t u32Us);
+    FirmwareState State(void) const { return state.load(); }
+    FirmwareError Error(void) const { return error.load(); }
+    // Status tab: progress and throughput, and the longest gauge latency
+    // during the last update against the longest otherwise
+    size_t Status(char *chOut, size_t maxLen, uint32_t u32NowMs) const;
+    size_t LatencyStatus(char *chOut, size_t maxLen) const;
+
+  private:
+    void digest(const uint8_t *pData, size_t len);
+    // Writer only
+    Sha256 Sha;
+    size_t SlotLen = 0;
+    uint32_t u32Erased = 0;                 // Erased ahead of the writes up to here
+    uint8_t u8Header[FIRMWARE_HEADER_LEN];
+    uint8_t u8Tail[SHA256_LEN];             // Last bytes in, not yet digested
+    uint8_t u8TailLen = 0;
+    // Read by the status
+    std::atomic<FirmwareState> state{fsIdle};
+    std::atomic<FirmwareError> error{feNone};
+    std::atomic<uint32_t> u32Bytes{0};
+    std::atomic<uint32_t> u32StartMs{0};
+    std::atomic<uint32_t> u32EndMs{0};
+    std::atomic<uint32_t> u32MaxLatencyUs[2] = {};    // Otherwise, updating
+};
+
+extern FirmwareUpdate Firmware;
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef __GaugeRoutes__
+#define __GaugeRoutes__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "Config.h"
+#include "GaugeTable.h"
+#include "NeedleSlew.h"
+#include "WxSample.h"
+
+// ##################################################################
+// # Gauge routing
+// #
+// # The routes in the settings (Config.h) compiled, at boot, into one
+// # dispatch list per message type: a rapid_wind only walks the
+// # outputs fed from rapid_wind, an obs_st the ones fed from obs_st,
+// # so the cost of a sample is the outputs it drives, whatever the
+// # number of fields that could be routed.  Each output carries the
+// # field accessor, its scale (a compiled gauge table, or linear) and
+// # the channel, resolved once.
+// ##################################################################
+
+#define ROUTE_TEXT_LEN 64
+
+struct RouteFieldInfo{
+    const char *Name;
+    uint8_t Message;        // WX_VALID_* of the message carrying it
+    float (*Read)(const WxSample &sample);
+};
+extern const RouteFieldInfo RouteFields[NUM_ROUTE_FIELDS];
+extern const char *RouteOutputNames[NUM_ROUTE_OUTPUTS];
+extern const char *RouteScaleNames[NUM_ROUTE_SCALES];
+
+// Routes as text, "<field> pwm <channel>/<pin> <scale> [<min> <max>]"
+// or "<field> mcp <bank> <scale> [<min> <max>]", min & max only for a
+// linear scale, e.g. "wind_gust pwm 4/4 linear 0 60".  An empty line
+// is an unused route.  Parsing checks the route on its own,
+// routesValid() that no two routes share an output.
+bool routeParse(const char *chLine, GaugeRoute &route);
+size_t routeFormat(const GaugeRoute &route, char *chOut, size_t maxLen);
+bool routesValid(const GaugeRouteSettings &routes);
+
+class GaugeRouter{
+  public:
+    // Set up the PWM channels & expander banks, then compile the routes
+    void Begin(const GaugeRouteSettings &routes);
+    // Drive the outputs fed by the sample's message(s)
+    void Dispatch(const WxSample &sample, uint32_t u32NowMs);
+    // Advance the needle moves, returns the ms until the next step is due
+    uint32_t Service(uint32_t u32NowMs);
+    void Stop(void);
+    // Stale data (Supervisor.h): needles & bars to a percentage of their
+    // scale, the compass dark if blanked, the restart values are kept
+    void Park(uint8_t u8Percent, bool bBlank, uint32_t u32NowMs);
+    // Calibration (Calibration.h): every output at the same step of its
+    // scale (the gauge step, an eighth of a linear scale, a compass
+    // sector), or the meters of one gauge at a raw duty
+    uint8_t CalibrationSteps(void) const;
+    void CalibrateStep(uint8_t u8Step);
+    void CalibrateDuty(const GaugeSettings *pGauge, uint32_t u32Duty);
+    size_t Outputs(uint8_t u8Message) const;
+
+  private:
+    enum OutputKind : uint8_t { okPwm, okCompass, okBar };
+    struct Output{
+        uint8_t Field;
+        uint8_t Kind;
+        uint8_t Channel;
+        uint8_t Route;              // Needle state
+        const GaugeTransfer *Transfer;  // NULL for linear
+        const GaugeSettings *Gauge;     // Range, step, slew & compass threshold, NULL for none
+        float fMin;                 // Linear
+        float fMax;
+        float fDutyPerUnit;
+    };
+    // The gauge's range as it is set now (a settings change moves it),
+    // else the linear route's own
+    static float scaleMin(const Output &out){ return out.Gauge ? out.Gauge->min : out.fMin; }
+    static float scaleMax(const Output &out){ return out.Gauge ? out.Gauge->max : out.fMax; }
+    struct DispatchList{
+        Output Outputs[GAUGE_ROUTES];
+        uint8_t numOutputs = 0;
+    };
+    uint32_t duty(const Output &out, float fValue) const;
+    void write(const Output &out, const WxSample &sample, float fValue, uint32_t u32NowMs);
+    DispatchList RapidWind;
+    DispatchList Obs;
+    NeedleSlew Needles[GAUGE_ROUTES];
+};
+
+extern GaugeRouter GaugeRoutes;
+
+#endif
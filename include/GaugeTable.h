@@ -0,0 +1,51 @@
+#ifndef __GaugeTable__
+#define __GaugeTable__
+
+#include <stdint.h>
+#include "Config.h"
+
+// ##################################################################
+// # Gauge transfer function
+// #
+// # The gauge calibration curve (or the straight line through the
+// # gain when no curve is set), compiled into an integer lookup table
+// # over the gauge min..max range.  Scaling a sample is then a table
+// # lookup plus a Q16 fixed-point interpolation, in 13-bit LEDC duty.
+// # Values outside min..max hold the ends of the scale.
+// ##################################################################
+
+#define GAUGE_TABLE_SEGMENTS 64
+#define GAUGE_PWM_MAX 8191
+
+class GaugeTable{
+  public:
+    // Compile the table, only needed when the gauge settings change
+    void Build(const GaugeSettings &gauge);
+    uint32_t Lookup(float fValue) const;
+
+  private:
+    float fMin = 0;
+    float fScaleQ16 = 0;     // Table segments per gauge unit, Q16
+    uint16_t u16Table[GAUGE_TABLE_SEGMENTS + 1] = {0};
+};
+
+// Double buffered table, rebuilt off to the side so the gauge task
+// never scales through a half written table.  The sequence, as in
+// SeqLock.h, is odd while a rebuild runs; a lookup is retried when it
+// moved on by 2 or more meanwhile (a second rebuild started, into the
+// table being read).
+class GaugeTransfer{
+  public:
+    void Rebuild(const GaugeSettings &gauge);
+    uint32_t Scale(float fValue) const;
+
+  private:
+    GaugeTable Tables[2];
+    uint32_t u32Seq = 0;            // Table in use: (u32Seq >> 1) & 1
+};
+
+// The wind & temperature scales, from the gauge settings (main.cpp)
+extern GaugeTransfer WindGauge;
+extern GaugeTransfer TempGauge;
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef __Hal__
+#define __Hal__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include "WxSample.h"
+
+// ##################################################################
+// # Hardware Abstraction Layer
+// #
+// # Thin interfaces for the hardware the gauge pipeline touches, so
+// # setup()/loop() build for the TinyPICO (src/esp32) and for a Linux
+// # host against fake, recording drivers (src/native).
+// ##################################################################
+
+// LEDC style PWM outputs (gauges and gauge lamps)
+class PwmDriver{
+  public:
+    virtual void Setup(uint8_t u8Channel, uint8_t u8Pin, uint32_t u32Freq, uint8_t u8Bits) = 0;
+    virtual void Write(uint8_t u8Channel, uint32_t u32Duty) = 0;
+    // Linear ramp from the current duty to the target over u32Ms, stepped
+    // by the PWM peripheral itself.  A new Fade() or Write() on the channel
+    // cancels a running one.  Only valid when HasFade() is true.
+    virtual bool HasFade(void) = 0;
+    virtual void Fade(uint8_t u8Channel, uint32_t u32Duty, uint32_t u32Ms) = 0;
+};
+
+// MCP23008 I2C GPIO expanders (wind direction LEDs and the like), one
+// per bank at I2C address 0x20 + bank
+class GpioExpander{
+  public:
+    virtual bool Begin(uint8_t u8Bank) = 0;
+    virtual void Write(uint8_t u8Bank, uint8_t u8Value) = 0;
+};
+
+// TinyPICO DotStar status LED
+class StatusLed{
+  public:
+    virtual void SetColor(uint32_t u32Color) = 0;
+    virtual void SetBrightness(uint8_t u8Brightness) = 0;
+    virtual void SetPower(bool bOn) = 0;
+    virtual void CycleColor(uint8_t u8Wait) = 0;
+};
+
+// Wall clock (epoch) and monotonic time
+class SystemClock{
+  public:
+    virtual time_t Now(void) = 0;
+    virtual void Set(time_t tNow) = 0;
+    virtual uint32_t Millis(void) = 0;
+    virtual uint64_t Micros(void) = 0;
+    virtual void Delay(uint32_t u32Ms) = 0;
+};
+
+// WeatherFlow UDP listener, blocks for up to the timeout and returns
+// true when a new sample is available
+class WxSource{
+  public:
+    virtual bool Begin(void) = 0;
+    virtual bool Receive(WxSample &sample, uint32_t u32TimeoutMs) = 0;
+};
+
+#define FIRMWARE_SECTOR 4096    // Flash erase unit
+
+// Heap figures in bytes, 0 where the platform has no such heap
+struct HeapInfo{
+    uint32_t Free;
+    uint32_t Largest;           // Biggest block one allocation can get
+    uint32_t MinFree;           // Least free since power up
+    uint32_t ExternalSize;      // PSRAM, 0 when not fitted
+    uint32_t ExternalFree;
+};
+
+// Everything else the board provides (console, watchdog, buttons)
+class Platform{
+  public:
+    virtual void ConsoleBegin(uint32_t u32Baud) = 0;
+    virtual void ConsoleWrite(const char *chMsg) = 0;
+    virtual void PinInputPullup(uint8_t u8Pin) = 0;
+    virtual bool PinRead(uint8_t u8Pin) = 0;
+    virtual void WatchdogBegin(uint32_t u32TimeoutSec) = 0;
+    virtual void WatchdogSubscribe(void) = 0;    // Watch the calling task
+    virtual void WatchdogReset(void) = 0;
+    virtual void Restart(void) = 0;
+    // Long lived buffers from external RAM (PSRAM), NULL when not fitted
+    virtual void *AllocExternal(size_t size) = 0;
+    // A small block of memory a restart leaves as it was (not a power
+    // cycle, so check it), NULL if the board has none that big
+    virtual void *Retained(size_t size) = 0;
+    // Settings storage, two slots (A/B) of the same size, see SettingsStore.h
+    virtual bool SettingsRead(uint8_t u8Slot, void *pData, size_t len) = 0;
+    virtual bool SettingsWrite(uint8_t u8Slot, const void *pData, size_t len) = 0;
+    // Firmware update slot (the app partition not running), its size or
+    // 0 if there is none.  Each FIRMWARE_SECTOR is erased before it is
+    // written, activating checks the image and boots it next restart.
+    // See Firmware.h.
+    virtual size_t FirmwareBegin(void) = 0;
+    virtual bool FirmwareErase(uint32_t u32Offset) = 0;
+    virtual bool FirmwareWrite(uint32_t u32Offset, const void *pData, size_t len) = 0;
+    virtual bool FirmwareActivate(size_t len) = 0;
+    // Internal RAM heap and PSRAM, now (see Memory.h)
+    virtual void Heap(HeapInfo &heap) = 0;
+    // Least stack a task has had free since it started, in bytes, by
+    // task name, UINT32_MAX when no such task is running
+    virtual uint32_t StackFree(const char *chTask) = 0;
+};
+
+struct HalDrivers{
+    PwmDriver *Pwm;
+    GpioExpander *Expander;
+    StatusLed *Led;
+    SystemClock *Clock;
+    WxSource *Wx;
+    Platform *Sys;
+};
+
+// Provided by the platform implementation (src/esp32 or src/native)
+extern HalDrivers Hal;
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef __History__
+#define __History__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "WxSample.h"
+
+// ##################################################################
+// # Observation history
+// #
+// # Fixed capacity rings of the raw rapid_wind and obs_st samples,
+// # plus 1 and 10 minute min/mean/max tiers, fed from the raw rings by
+// # the housekeeping task once a minute (Downsample()).  Everything is stored struct-of-arrays in PSRAM, allocated
+// # once at startup, in fixed-point (hundredths of a MPH or degree F).
+// #
+// # One writer per ring (the gauge task for the raw samples, the
+// # housekeeping task for the tiers) and any number of readers: a record is
+// # written before the ring total is advanced, and a reader drops any
+// # record the writer lapped while it was being copied out.
+// ##################################################################
+
+#define HISTORY_WIND_RAW  28800   // 24 h of rapid_wind (3 s)
+#define HISTORY_OBS_RAW   1440    // 24 h of obs_st (60 s)
+#define HISTORY_TIER_1M   1440    // 24 h of 1 minute buckets
+#define HISTORY_TIER_10M  1008    // 7 days of 10 minute buckets
+
+// Download formats, see HistoryCursor
+enum HistorySeries : uint8_t { hsWindRaw, hsObsRaw, hsWind1m, hsWind10m, hsTemp1m, hsTemp10m,
+  NUM_HISTORY_SERIES };
+// Series names for the download request, indexed by HistorySeries
+extern const char *HistorySeriesNames[NUM_HISTORY_SERIES];
+
+#define HISTORY_HEADER_SIZE 8
+#define HISTORY_MAX_RECORD 10
+
+// Ring bookkeeping, the arrays live with the owner
+struct HistoryRing{
+    uint32_t Capacity = 0;
+    volatile uint32_t Total = 0;   // Records ever written, the sequence number of the next
+    uint32_t Slot(uint32_t u32Seq) const { return u32Seq % Capacity; }
+    // Once full, the oldest slot is the next one written, so treat it as gone
+    uint32_t Oldest(void) const { return Total >= Capacity ? Total - Capacity + 1 : 0; }
+    bool Holds(uint32_t u32Seq) const { return u32Seq + Capacity > Total; }
+};
+
+// Min/mean/max of one quantity per fixed interval, the bucket being
+// filled is published once its interval is over (or a sample lands in
+// a later one), samples for a published bucket are dropped
+class HistoryTier{
+  public:
+    bool Begin(uint32_t u32Capacity, uint32_t u32Seconds);
+    void Add(uint32_t u32Epoch, int16_t i16Value);
+    // Publish the bucket being filled if it ends at or before u32Epoch
+    void Close(uint32_t u32Epoch);
+    uint32_t Epoch(uint32_t u32Seq) const { return pStart[Ring.Slot(u32Seq)]; }
+    size_t Encode(uint32_t u32Seq, uint8_t *pOut) const;
+    HistoryRing Ring;
+
+  private:
+    void flush(void);
+    uint32_t u32Seconds = 60;
+    uint32_t *pStart = NULL;
+    int16_t *pMin = NULL;
+    int16_t *pMean = NULL;
+    int16_t *pMax = NULL;
+    uint32_t u32Bucket = 0;
+    int32_t i32Sum = 0;
+    uint32_t u32Published = 0;     // Newest published bucket + 1
+    uint16_t u16Count = 0;
+    int16_t i16Min = 0;
+    int16_t i16Max = 0;
+};
+
+class WxHistory{
+  public:
+    // Allocate the rings, false (and history disabled) without PSRAM
+    bool Begin(void);
+    void Add(const WxSample &sample);
+    // Feed the tiers the raw samples added since the last call, then
+    // publish the buckets over by u32Epoch (housekeeping task)
+    void Downsample(uint32_t u32Epoch);
+    bool Active(void) const { return bActive; }
+
+    // Series access for the download cursor
+    const HistoryRing &Ring(HistorySeries series) const;
+    uint32_t Epoch(HistorySeries series, uint32_t u32Seq) const;
+    size_t Encode(HistorySeries series, uint32_t u32Seq, uint8_t *pOut) const;
+
+  private:
+    bool bActive = false;
+    HistoryRing WindRing;
+    uint32_t *pWindEpoch = NULL;
+    uint16_t *pWindSpeed = NULL;    // 0.01 MPH
+    uint16_t *pWindDir = NULL;      // Degrees
+    HistoryRing ObsRing;
+    uint32_t *pObsEpoch = NULL;
+    int16_t *pObsTemp = NULL;       // 0.01 F
+    uint32_t u32WindFed = 0;        // Raw records fed to the tiers
+    uint32_t u32ObsFed = 0;
+    HistoryTier Wind1m;
+    HistoryTier Wind10m;
+    HistoryTier Temp1m;
+    HistoryTier Temp10m;
+};
+
+// Streams one series as the little endian binary download:
+//   "WXH" 1, series, record size, 2 reserved bytes, then records of
+//   raw wind: epoch u32, speed u16 (0.01 MPH), direction u16
+//   raw obs:  epoch u32, temperature i16 (0.01 F)
+//   tiers:    bucket start u32, min, mean, max i16 (0.01 MPH or F)
+// oldest first, from the first record at or after u32Since.  Fill()
+// hands out whole records only, 0 once the series is done.
+class HistoryCursor{
+  public:
+    HistoryCursor(const WxHistory &history, HistorySeries series, uint32_t u32Since);
+    size_t Fill(uint8_t *pBuffer, size_t maxLen);
+
+  private:
+    const WxHistory *pHistory;
+    HistorySeries Series;
+    uint32_t u32Seq;
+    uint32_t u32End;
+    bool bHeader = false;
+};
+
+extern WxHistory History;
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef __Ingest__
+#define __Ingest__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "Config.h"
+#include "SeqLock.h"
+#include "WxSample.h"
+
+// ##################################################################
+// # Datagram ingest
+// #
+// # Every hub on the LAN broadcasts on the same port, so the receive
+// # task screens each datagram before it is decoded: the serial_number
+// # and hub_sn are found by scanning, and anything not on the allow
+// # list (Config.h IngestSettings) is dropped there.  What decodes goes
+// # to a mailbox slot per message type that only keeps the newest, the
+// # gauge task takes the slots oldest first.  A burst (a hub coming
+// # back, a flood of device_status or evt_strike) never queues behind
+// # the rapid_wind that moves a needle, it can only replace an older
+// # one not yet shown.
+// #
+// # Datagrams, rejects and replaced samples are counted per sender,
+// # the first INGEST_SOURCES serial numbers seen.  The receive task is
+// # the only writer, the web and housekeeping tasks read.
+// ##################################################################
+
+#define INGEST_ALLOW_MAX 4
+#define INGEST_SERIAL_LEN 16
+#define INGEST_SOURCES 8
+
+enum IngestSlot : uint8_t { isRapidWind, isObs, NUM_INGEST_SLOTS };
+
+// Allow list, parsed
+struct IngestAllow{
+    uint8_t Count = 0;
+    uint8_t Len[INGEST_ALLOW_MAX] = {0};
+    char Prefix[INGEST_ALLOW_MAX][INGEST_SERIAL_LEN];
+};
+
+struct IngestSource{
+    char Serial[INGEST_SERIAL_LEN];
+    std::atomic<uint32_t> Datagrams{0};
+    std::atomic<uint32_t> Rejected{0};      // Not on the allow list
+    std::atomic<uint32_t> Replaced{0};      // Superseded before the gauges took it
+};
+
+class WxIngest{
+  public:
+    // Take the allow list from the settings, any task
+    void Configure(const IngestSettings &ingest);
+    // Receive task: screen and decode a datagram, false if dropped
+    bool Decode(const char *chData, size_t len, WxSample &sample);
+    // Receive task: hand a sample to the gauges, replacing any of its
+    // type they have not taken yet
+    void Post(const WxSample &sample);
+    // Gauge task: the oldest sample not yet taken, false if none
+    bool Take(WxSample &sample);
+    // Senders seen, in order, and what came from each
+    uint8_t Sources(void) const { return u8NumSources.load(std::memory_order_acquire); }
+    const IngestSource &Source(uint8_t u8Source) const { return Table[u8Source]; }
+    // "<n> sources, <n> rejected" for the status tab
+    size_t Status(char *chOut, size_t maxLen) const;
+
+  private:
+    uint8_t source(const char *chSerial, size_t len);
+    SeqLock<IngestAllow> Allow;
+    SeqLock<WxSample> Slots[NUM_INGEST_SLOTS];
+    uint32_t u32Posted[NUM_INGEST_SLOTS] = {0};     // Receive task only
+    uint8_t u8PostedSource[NUM_INGEST_SLOTS] = {0};
+    std::atomic<uint32_t> u32Taken[NUM_INGEST_SLOTS] = {};
+    IngestSource Table[INGEST_SOURCES];
+    std::atomic<uint8_t> u8NumSources{0};
+};
+
+extern WxIngest Ingest;
+
+// Allow list text to prefixes, false if an entry is too long, not a
+// serial number or there are too many
+bool ingestAllowParse(const char *chText, IngestAllow &allow);
+
+#endif
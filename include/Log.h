@@ -0,0 +1,37 @@
+#ifndef __Log__
+#define __Log__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ##################################################################
+// # Debug logging
+// #
+// # debug(level, fmt, ...) only captures the record: the format
+// # pointer plus the raw arguments (strings copied in) go into a lock
+// # free ring, and formatting & the serial port are left to a low
+// # priority task (logFlush()).  Levels above DEBUG compile away along
+// # with their arguments, and without DEBUG nothing is logged at all.
+// # The format must be a string literal, it is read again later.
+// ##################################################################
+
+#define LOG_RECORDS 64          // Power of two
+#define LOG_ARG_BYTES 52        // Raw arguments & copied strings per record
+#define LOG_LINE_LEN 256
+
+#ifdef DEBUG
+#define debug(level, fmt, ...) do{ if( (level) <= DEBUG )logWrite((level), fmt, ##__VA_ARGS__); }while(0)
+#else
+#define debug(level, fmt, ...) do{ }while(0)
+#endif
+
+void logWrite(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// Drain the ring: format each record and hand it to the console and the
+// sink (if set), returns the number of records written.  One caller only.
+size_t logFlush(void);
+void logSetSink(void (*sink)(const char *chLine, size_t len));
+// Records lost to a full ring
+uint32_t logDropped(void);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef __Memory__
+#define __Memory__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "Hal.h"
+
+// ##################################################################
+// # Memory telemetry
+// #
+// # The internal heap (free, the largest block one allocation can
+// # get, and the least ever free), PSRAM, and the stack each long
+// # running task has never touched: the gauge and receive tasks,
+// # housekeeping, the web server (async_tcp) and the log.  The
+// # Arduino loop task is deleted once the pipeline starts, the gauge
+// # task does its work.  Sampled by the housekeeping task for
+// # status_memory, the first time a stack or the largest block runs
+// # low it is logged.  /metrics reads the platform directly.
+// ##################################################################
+
+enum MemoryTask : uint8_t { mtGauges, mtRx, mtHousekeeping, mtWeb, mtLog, NUM_MEMORY_TASKS };
+extern const char *MemoryTaskNames[NUM_MEMORY_TASKS];      // FreeRTOS task names
+
+#define MEMORY_STACK_LOW 512        // Bytes of stack left
+#define MEMORY_BLOCK_LOW 8192       // Largest heap block, about a web response buffer
+
+class MemoryMonitor{
+  public:
+    void Sample(void);
+    const HeapInfo &Heap(void) const { return heap; }
+    // UINT32_MAX when the task is not running
+    uint32_t StackFree(MemoryTask task) const { return u32StackFree[task]; }
+
+  private:
+    HeapInfo heap = {};
+    uint32_t u32StackFree[NUM_MEMORY_TASKS] = {};
+    bool bStackWarned[NUM_MEMORY_TASKS] = {};
+    bool bBlockWarned = false;
+};
+
+extern MemoryMonitor Memory;
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef __Metrics__
+#define __Metrics__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#ifdef ARDUINO
+#include <xtensa/core-macros.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+// ##################################################################
+// # Hot path metrics
+// #
+// # Each stage of the receive -> gauge path (and the web work that
+// # shares the CPU) is timed with the CPU cycle counter into a fixed
+// # log-linear histogram: four buckets per power of two, from 32
+// # cycles up, so any duration lands within 25% of its bucket edge.
+// # Recording is one relaxed atomic add per bucket and two for the
+// # sum, lock free from any task, no allocation.  The stages nested in
+// # the gauge loop (scale, pwm, leds) run several times per sample and
+// # are timed one time in METRICS_NESTED_SAMPLE, their counts are of
+// # the samples taken.  Exported as Prometheus text (/metrics) and
+// # summarized in status_system.
+// ##################################################################
+
+enum MetricStage : uint8_t { msRx, msParse, msScale, msPwm, msLeds, msTemplate, msWebSocket,
+  msLoop, NUM_METRIC_STAGES };
+enum MetricCounter : uint8_t { mcDatagrams, mcRapidWind, mcObs, mcIgnored, mcQueueDrops,
+  mcWifiOutages, mcDataOutages, mcWifiReconnects, mcListenerRestarts, mcRejected, NUM_METRIC_COUNTERS };
+extern const char *MetricStageNames[NUM_METRIC_STAGES];
+
+#define METRICS_MIN_SHIFT 5     // Everything under 32 cycles in bucket 0
+#define METRICS_SUB_BITS 2      // Buckets per power of two, as a shift
+#define METRICS_BUCKETS (1 + ((32 - METRICS_MIN_SHIFT) << METRICS_SUB_BITS))
+#define METRICS_NESTED_SAMPLE 8 // Power of two
+#define METRICS_NESTED_STAGES ((1u << msScale) | (1u << msPwm) | (1u << msLeds))
+
+// Free running cycle count, wraps (any stage is far shorter)
+static inline uint32_t metricsCycles(void){
+#ifdef ARDUINO
+  return XTHAL_GET_CCOUNT();
+#elif defined(__x86_64__) || defined(__i386__)
+  return (uint32_t)__rdtsc();
+#else
+  // Nanoseconds stand in for cycles on other hosts
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec);
+#endif
+}
+
+class LatencyHistogram{
+  public:
+    void Record(uint32_t u32Cycles){
+      Buckets[bucket(u32Cycles)].fetch_add(1, std::memory_order_relaxed);
+      // 64-bit sum from two words, a reader may catch the carry in flight
+      uint32_t u32Lo = SumLo.fetch_add(u32Cycles, std::memory_order_relaxed);
+      if( (uint32_t)(u32Lo + u32Cycles) < u32Lo )SumHi.fetch_add(1, std::memory_order_relaxed);
+    }
+    uint32_t Count(void) const;
+    uint64_t Sum(void) const;
+    uint32_t Bucket(size_t idx) const { return Buckets[idx].load(std::memory_order_relaxed); }
+    // Upper edge of a bucket, in cycles
+    static uint64_t Edge(size_t idx);
+    // Upper edge of the bucket holding the quantile (0..1), 0 when empty
+    uint64_t Quantile(float fQuantile) const;
+
+  private:
+    static size_t bucket(uint32_t u32Cycles){
+      if( u32Cycles < (1u << METRICS_MIN_SHIFT) )return 0;
+      uint32_t u32Exp = 31 - __builtin_clz(u32Cycles);
+      uint32_t u32Sub = (u32Cycles >> (u32Exp - METRICS_SUB_BITS)) & ((1u << METRICS_SUB_BITS) - 1);
+      return 1 + ((u32Exp - METRICS_MIN_SHIFT) << METRICS_SUB_BITS) + u32Sub;
+    }
+    std::atomic<uint32_t> Buckets[METRICS_BUCKETS] = {};
+    std::atomic<uint32_t> SumLo{0};
+    std::atomic<uint32_t> SumHi{0};
+};
+
+class MetricsRegistry{
+  public:
+    // Measure the cycle counter and the cost of timing a stage
+    void Begin(void);
+    void Record(MetricStage stage, uint32_t u32Cycles){ Stages[stage].Record(u32Cycles); }
+    // Whether to time this run of the stage, every run but the nested
+    // stages'.  A plain load and store, a race only moves a sample.
+    bool Sample(MetricStage stage){
+      if( !((1u << stage) & METRICS_NESTED_STAGES) )return true;
+      uint32_t u32Run = Runs[stage].load(std::memory_order_relaxed);
+      Runs[stage].store(u32Run + 1, std::memory_order_relaxed);
+      return (u32Run & (METRICS_NESTED_SAMPLE - 1)) == 0;
+    }
+    void Count(MetricCounter counter, uint32_t u32Add = 1){
+      Counters[counter].fetch_add(u32Add, std::memory_order_relaxed);
+    }
+    const LatencyHistogram &Stage(MetricStage stage) const { return Stages[stage]; }
+    uint32_t Counter(MetricCounter counter) const { return Counters[counter].load(std::memory_order_relaxed); }
+    uint32_t CyclesPerMicro(void) const { return u32CyclesPerUs; }
+    // Time spent in the timers themselves, over the time elapsed since
+    // Begin()
+    float Overhead(void) const;
+    // "p50 / p99 us" of a stage, for the status page
+    size_t Summary(MetricStage stage, char *chOut, size_t maxLen) const;
+
+  private:
+    LatencyHistogram Stages[NUM_METRIC_STAGES];
+    std::atomic<uint32_t> Counters[NUM_METRIC_COUNTERS] = {};
+    std::atomic<uint32_t> Runs[NUM_METRIC_STAGES] = {};
+    uint32_t u32CyclesPerUs = 1000;
+    uint32_t u32TimerCycles = 0;
+    uint32_t u32CheckCycles = 0;    // The sampling check of a nested stage run
+    uint64_t u64BeginUs = 0;
+};
+
+extern MetricsRegistry Metrics;
+
+// Times its scope into a stage
+class StageTimer{
+  public:
+    explicit StageTimer(MetricStage stageIn)
+      : stage(stageIn), bTimed(Metrics.Sample(stageIn)), u32Start(bTimed ? metricsCycles() : 0) {}
+    ~StageTimer(){ if( bTimed )Metrics.Record(stage, metricsCycles() - u32Start); }
+
+  private:
+    MetricStage stage;
+    bool bTimed;
+    uint32_t u32Start;
+};
+
+// Prometheus text exposition, streamed a chunk at a time (the buckets
+// are read as they are written out, so one scrape may straddle a sample)
+class MetricsCursor{
+  public:
+    size_t Fill(uint8_t *pOut, size_t maxLen);
+
+  private:
+    size_t line(char *chOut, size_t maxLen);
+    uint16_t u16Line = 0;
+    uint64_t u64Cumulative = 0;
+    char chLine[192];
+    size_t lineLen = 0;
+    size_t lineSent = 0;
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef __NeedleSlew__
+#define __NeedleSlew__
+
+#include <stdint.h>
+#include "Config.h"
+
+// ##################################################################
+// # Gauge needle slewing
+// #
+// # Moves a gauge needle to each new sample over time instead of
+// # jumping, with linear or critically damped easing.  Where the PWM
+// # driver has a hardware fade engine the move is issued as a handful
+// # of linear fades (one for linear easing, SLEW_SEGMENTS along the
+// # damped curve), so the CPU only touches the channel at segment
+// # boundaries.  Otherwise the same moves are interpolated in software
+// # every SLEW_SOFT_STEP_MS.  A new sample retargets a move in progress
+// # from wherever the needle is at the time.
+// ##################################################################
+
+#define SLEW_SEGMENTS 6          // Hardware fades per critically damped move
+#define SLEW_SOFT_STEP_MS 20     // Software fallback update period
+#define SLEW_MAX_MS 2800         // Land before the next rapid_wind (3 s)
+#define SLEW_IDLE UINT32_MAX
+
+class NeedleSlew{
+  public:
+    void Begin(uint8_t u8ChannelIn, uint32_t u32Duty = 0);
+    // Start moving to the new duty at the gauge slew rate, a zero rate
+    // writes the duty straight away
+    void MoveTo(uint32_t u32Duty, const GaugeSettings &gauge, uint32_t u32NowMs);
+    // Advance the move, returns the ms until the next call is needed
+    uint32_t Service(uint32_t u32NowMs);
+    // Abandon a move, the channel keeps its current duty
+    void Stop(void){ bMoving = false; }
+    uint32_t Position(uint32_t u32NowMs) const;
+
+  private:
+    uint32_t Curve(uint32_t u32ElapsedMs) const;
+
+    uint8_t u8Channel = 0;
+    uint32_t u32From = 0;
+    uint32_t u32To = 0;
+    uint32_t u32StartMs = 0;
+    uint32_t u32DurationMs = 0;
+    uint32_t u32NextMs = 0;
+    uint8_t u8Segment = 0;
+    bool bDamped = false;
+    bool bHardware = false;
+    volatile bool bMoving = false;
+};
+
+#endif
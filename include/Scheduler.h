@@ -0,0 +1,63 @@
+#ifndef __Scheduler__
+#define __Scheduler__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include "TimerWheel.h"
+
+// ##################################################################
+// # Tickless housekeeping scheduler
+// #
+// # Each job says how long until it is next due, once, after it runs
+// # (or when rescheduled), and the deadline waits on the timer wheel.
+// # The housekeeping task sleeps until the nearest one, so a quiet
+// # station wakes for the status push and little else.  Jobs tied to
+// # the wall clock (lamps, blink) are rescheduled when the clock is
+// # set, and jobs waiting on an event report SCHED_IDLE until then.
+// ##################################################################
+
+#define SCHED_IDLE UINT32_MAX
+#define SCHED_MAX_JOBS 8
+
+struct ScheduledJob{
+    const char *Name;
+    void (*Callback)(void);
+    // ms from now until the job is next due, SCHED_IDLE for never
+    uint32_t (*Next)(void);
+};
+
+class JobScheduler{
+  public:
+    void Begin(const ScheduledJob *jobs, size_t numJobs, uint32_t u32NowMs);
+    // Run the jobs that are due, returns the ms until the next one (SCHED_IDLE if none)
+    uint32_t Run(uint32_t u32NowMs);
+    // Ask every job for its deadline again on the next Run(), any task
+    void Reschedule(void) { bReschedule = true; }
+    bool Pending(void) const { return bReschedule; }
+    uint32_t Wakeups(void) const { return u32Wakeups; }
+    uint32_t Runs(void) const { return u32Runs; }
+
+  private:
+    void arm(size_t i, uint32_t u32NowMs);
+    const ScheduledJob *pJobs = nullptr;
+    size_t numJobs = 0;
+    TimerWheel Wheel;
+    WheelTimer Timers[SCHED_MAX_JOBS];
+    volatile bool bReschedule = false;
+    uint32_t u32Wakeups = 0;
+    uint32_t u32Runs = 0;
+};
+
+extern JobScheduler Scheduler;
+
+// ms until tTarget on the wall clock
+uint32_t schedUntil(time_t tTarget);
+// The first time after tNow, and the last at or before it, that the
+// local clock reads hour:minute, through DST changes (a time spring
+// forward skips is the moment of the jump, one fall back repeats
+// happens once)
+time_t nextLocalTime(time_t tNow, int iHour, int iMinute);
+time_t lastLocalTime(time_t tNow, int iHour, int iMinute);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef __SeqLock__
+#define __SeqLock__
+
+#include <stdint.h>
+
+// ##################################################################
+// # Single writer sequence lock
+// #
+// # Hands a small struct from one task to others without blocking the
+// # writer: the sequence is odd while a write is in progress, readers
+// # retry until they copy out a stable, even sequence.
+// ##################################################################
+
+template <class T>
+class SeqLock{
+  public:
+    void Write(const T &value){
+      u32Seq = u32Seq + 1;
+      __sync_synchronize();
+      Value = value;
+      __sync_synchronize();
+      u32Seq = u32Seq + 1;
+    }
+    // Copy out the latest value, returns the write count (0 = never written)
+    uint32_t Read(T &value) const{
+      uint32_t u32Before, u32After;
+      do{
+        u32Before = u32Seq;
+        __sync_synchronize();
+        value = Value;
+        __sync_synchronize();
+        u32After = u32Seq;
+      }while( (u32Before & 1) || u32Before != u32After );
+      return u32Before / 2;
+    }
+
+  private:
+    volatile uint32_t u32Seq = 0;
+    T Value;
+};
+
+#endif
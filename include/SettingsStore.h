@@ -0,0 +1,61 @@
+#ifndef __SettingsStore__
+#define __SettingsStore__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "Config.h"
+
+// ##################################################################
+// # Settings persistence, write-behind
+// #
+// # Settings.Config stays the live copy.  Edits are bracketed with
+// # Begin()/End(section), which only mark the section dirty; the
+// # housekeeping task commits a snapshot once the edits have settled
+// # for SETTINGS_DEBOUNCE_MS, and skips the write if the dirty
+// # sections match what is already on flash.  Commits alternate
+// # between two CRC protected slots (A/B), so a power cut during a
+// # write leaves the previous commit to boot from.  The slot sequence
+// # number counts every commit made (flash wear).
+// ##################################################################
+
+#define SETTINGS_DEBOUNCE_MS 3000
+
+enum SettingsSection { csWiFi, csWind, csTemp, csWeb, csTimeZone, csGaugeLamps, csWindLeds,
+  csRoutes, csLink, csIngest, NUM_SETTINGS_SECTIONS };
+
+class SettingsStore{
+  public:
+    // Load the newest valid slot over Settings.Config (after
+    // Settings.Begin()), or queue a migration of the library's copy.
+    // Returns false when there was no valid slot.
+    bool Begin(void);
+    // Edits of Settings.Config, one writer (the web server task)
+    void BeginEdit(void);
+    void EndEdit(uint32_t u32Sections);
+    // Write the defaults now, for the reset button
+    void Reset(void);
+    // Commit if due (or bNow, skipping the debounce), housekeeping only
+    void Service(uint32_t u32NowMs, bool bNow = false);
+    bool Dirty(void) const { return u32Dirty != 0; }
+    // ms until Service() would commit, UINT32_MAX with nothing to write
+    uint32_t DueIn(uint32_t u32NowMs) const;
+    uint32_t Writes(void) const { return u32Sequence; }
+    uint32_t Skipped(void) const { return u32Skipped; }
+
+  private:
+    bool commit(const AppConfig &config);
+    volatile uint32_t u32EditSeq = 0;       // Odd while an edit is in progress
+    volatile uint32_t u32Dirty = 0;         // Section bits
+    volatile uint32_t u32LastEditMs = 0;
+    uint32_t u32Sequence = 0;               // Of the newest slot
+    uint8_t u8NextSlot = 0;
+    uint32_t u32Skipped = 0;
+    AppConfig Committed;                    // As on flash
+};
+
+#define SETTINGS_SECTION(section) (1UL << (section))
+#define SETTINGS_ALL ((1UL << NUM_SETTINGS_SECTIONS) - 1)
+
+extern SettingsStore SettingsStorage;
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef __Sha256__
+#define __Sha256__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ##################################################################
+// # SHA-256 (FIPS 180-4)
+// #
+// # Incremental, fed as the bytes arrive, 104 bytes of state and no
+// # allocation.  Plain C++ so the host build checks the same code the
+// # board runs.
+// ##################################################################
+
+#define SHA256_LEN 32
+
+class Sha256{
+  public:
+    void Begin(void);
+    void Update(const uint8_t *pData, size_t len);
+    void Final(uint8_t (&u8Digest)[SHA256_LEN]);
+
+  private:
+    void block(const uint8_t *pBlock);
+    uint32_t u32State[8];
+    uint64_t u64Bytes;
+    uint8_t u8Buffer[64];
+};
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef __StatusFeed__
+#define __StatusFeed__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ##################################################################
+// # Web status push
+// #
+// # A StatusFeed holds the current text of each field of one of the
+// # web UI status messages (status_weather, status_system and
+// # status_memory), and the frame sequence each field last changed
+// # in.  A frame is serialized once, with only the fields changed
+// # since a given sequence, and the same buffer goes to every client
+// # that is at that sequence.
+// #
+// # StatusFanout tracks where each client is.  A client whose send
+// # queue is full is skipped, and once it drains it gets one catch-up
+// # frame with the latest value of everything it missed, so a slow
+// # browser never costs more than one queued frame per feed.
+// ##################################################################
+
+#define STATUS_MAX_FIELDS 32
+#define STATUS_VALUE_LEN 32
+#define STATUS_MAX_CLIENTS 8
+
+enum WeatherStatusField { wsTime, wsTemperature, wsHumidity, wsPressure, wsWind, wsWindGust,
+  wsUv, wsBrightness, wsSolarRadiation, wsRainRate, wsPrecipitationType, wsLightningStrikes,
+  wsLightningDistance, wsWindAverage2m, wsWindAverage10m, wsWindGust10m, wsWindLull10m,
+  wsWindDirection, wsWindVariability, NUM_WEATHER_STATUS };
+
+enum SystemStatusField { ssWifiMode, ssWifiSsid, ssWifiIpAddr, ssWifiRssi, ssBatVolt,
+  ssSettingsWrites, ssCalibration, ssBootNeedles, ssBootReady, ssBootWifi, ssLink, ssLinkOutages,
+  ssLinkRecovery, ssDatagrams, ssSources, ssDrops, ssLoopRate, ssMetricsOverhead, ssStageRx,
+  ssStageParse, ssStageScale, ssStagePwm, ssStageLeds, ssStageTemplate, ssStageWebSocket,
+  ssStageLoop, ssFirmware, ssFirmwareLatency, NUM_SYSTEM_STATUS };
+
+// The stacks in MemoryTask order
+enum MemoryStatusField { mfHeapFree, mfHeapLargest, mfHeapMinFree, mfPsram, mfStackGauges,
+  mfStackRx, mfStackHousekeeping, mfStackWeb, mfStackLog, NUM_MEMORY_STATUS };
+
+class StatusFeed{
+  public:
+    // Keys are the element ids in the web UI
+    StatusFeed(const char *chTypeIn, const char *const *chKeysIn, uint8_t u8NumFieldsIn);
+    // Update a field, only a different value marks it changed
+    void Set(uint8_t u8Field, const char *chValue);
+    void Setf(uint8_t u8Field, const char *chFormat, ...);
+    // Close the frame, returns true if anything changed since the last
+    bool Commit(void);
+    uint32_t Seq(void) const { return u32Seq; }
+    const char *Value(uint8_t u8Field) const { return u8Field < u8NumFields ? chValues[u8Field] : ""; }
+    // Serialize the fields changed after u32Since as the UI message, returns
+    // the length (excluding the terminator) even if it did not fit
+    size_t Serialize(uint32_t u32Since, char *chBuffer, size_t maxLen) const;
+
+  private:
+    const char *chType;
+    const char *const *chKeys;
+    uint8_t u8NumFields;
+    bool bPending = false;
+    uint32_t u32Seq = 0;
+    uint32_t u32Changed[STATUS_MAX_FIELDS] = {0};
+    char chValues[STATUS_MAX_FIELDS][STATUS_VALUE_LEN] = {{0}};
+};
+
+// What the fan-out sends through, AsyncWebSocket on the board
+class StatusTransport{
+  public:
+    // Connected client ids, in connection order, returns the count
+    virtual size_t Clients(uint32_t *u32Ids, size_t maxClients) = 0;
+    // Clients are then named by their index in that list, no id lookup
+    // Room in the client's outbound queue for another frame
+    virtual bool CanSend(size_t client) = 0;
+    // Shared buffer for one frame of len characters (+ terminator)
+    virtual char *Begin(size_t len) = 0;
+    virtual void Send(size_t client) = 0;
+    // Done with the shared buffer, the clients hold their own references
+    virtual void End(void) = 0;
+};
+
+class StatusFanout{
+  public:
+    explicit StatusFanout(StatusFeed &feedIn) : feed(feedIn) {}
+    // Bring every client that can take a frame up to the feed, returns
+    // the number of frames serialized
+    uint32_t Push(StatusTransport &transport);
+
+  private:
+    struct Client{
+        uint32_t Id;
+        uint32_t Seq;       // Last frame sequence delivered
+    };
+    StatusFeed &feed;
+    Client Clients[STATUS_MAX_CLIENTS];
+    size_t numClients = 0;
+};
+
+extern StatusFeed WeatherStatus;
+extern StatusFeed SystemStatus;
+extern StatusFeed MemoryStatus;
+
+#endif
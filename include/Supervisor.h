@@ -0,0 +1,71 @@
+#ifndef __Supervisor__
+#define __Supervisor__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+// ##################################################################
+// # Connectivity supervisor
+// #
+// # Watches the station link once the boot join is done (that one is
+// # the Wi-Fi task's) and the samples reaching the gauges.  A lost
+// # link is rejoined from the housekeeping scheduler with exponential
+// # backoff, LINK_RETRY_MIN_MS doubling up to LINK_RETRY_MAX_MS.  With
+// # no sample for the stale limit (Config.h LinkSettings) the data is
+// # stale: the gauge task parks the outputs, and the receive task is
+// # asked to restart the WeatherFlow listener, again with backoff,
+// # starting from the stale limit.  The first sample after ends the
+// # outage, its length is the recovery time on the status tab.
+// #
+// # The gauge task reports the samples and the receive task takes the
+// # listener restarts, everything else is the housekeeping task's.
+// ##################################################################
+
+#define LINK_WIND_INTERVAL_MS 3000      // rapid_wind period
+#define LINK_RETRY_MIN_MS 2000
+#define LINK_RETRY_MAX_MS 120000
+
+class ConnectivitySupervisor{
+  public:
+    void Begin(uint32_t u32NowMs);
+    // Gauge task: a sample arrived, true if it ends a stale spell
+    bool Received(uint32_t u32NowMs);
+    // Housekeeping: follow the link and the data age, reconnect or ask
+    // for a listener restart when due
+    void Tick(uint32_t u32NowMs);
+    // ms until Tick() has something to do, UINT32_MAX when waiting on
+    // the link (the Wi-Fi events reschedule)
+    uint32_t DueIn(uint32_t u32NowMs) const;
+    // Receive task: restart the listener, once per request
+    bool ListenerRestart(void){ return bListenerRestart.exchange(false); }
+    bool Stale(void) const { return bStale.load(); }
+    // Length of the last and the longest outage ended, ms
+    uint32_t LastRecoveryMs(void) const { return u32LastRecoveryMs.load(); }
+    uint32_t MaxRecoveryMs(void) const { return u32MaxRecoveryMs.load(); }
+    // The status tab lines: state, outage counts and recovery times
+    size_t Status(char *chOut, size_t maxLen, uint32_t u32NowMs) const;
+    size_t Outages(char *chOut, size_t maxLen) const;
+    size_t Recovery(char *chOut, size_t maxLen) const;
+
+  private:
+    uint32_t staleMs(void) const;
+    std::atomic<uint32_t> u32RxMs{0};       // Last sample
+    std::atomic<bool> bStale{false};
+    std::atomic<bool> bOutage{false};       // Link lost or stale, until a sample
+    std::atomic<bool> bListenerRestart{false};
+    std::atomic<uint32_t> u32LastRecoveryMs{0};
+    std::atomic<uint32_t> u32MaxRecoveryMs{0};
+    // Housekeeping task only
+    bool bJoined = false;                   // Boot join done, supervising
+    bool bLinkUp = false;
+    uint32_t u32LinkDownMs = 0;
+    uint32_t u32LinkRetryMs = 0;            // Next rejoin
+    uint32_t u32LinkBackoffMs = LINK_RETRY_MIN_MS;
+    uint32_t u32ListenerRetryMs = 0;        // Next listener restart
+    uint32_t u32ListenerBackoffMs = 0;
+};
+
+extern ConnectivitySupervisor Supervisor;
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef __Template__
+#define __Template__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+
+// ##################################################################
+// # Compiled web templates
+// #
+// # A template (index.html) is parsed once at startup into literal
+// # text and %VAR% placeholders, each resolved to a TemplateVar id
+// # through a perfect hash of the known names.  The literal text and
+// # the values derived from the settings are rendered together into
+// # one cached buffer, rebuilt only when the settings generation moves
+// # on.  A request streams that buffer, formatting just the live
+// # values (Wi-Fi, battery, weather) into a small scratch buffer as it
+// # goes, so serving the page allocates no strings.
+// ##################################################################
+
+// Everything up to TEMPLATE_FIRST_LIVE only changes with the settings
+enum TemplateVar : uint8_t { tvWifiMode, tvWifiSsid, tvWifiStatic, tvUsername, tvMinWind, tvMaxWind,
+  tvStepWind, tvGainWind, tvThresholdWind, tvCalWind, tvSlewWind, tvDampedWind, tvMinTemp, tvMaxTemp,
+  tvStepTemp, tvGainTemp, tvCalTemp, tvSlewTemp, tvDampedTemp, tvWindLeds, tvShowWind, tvArcWind,
+  tvRoute0, tvRoute1, tvRoute2, tvRoute3, tvRoute4, tvRoute5, tvRoute6, tvRoute7, tvLinkStale,
+  tvLinkPark, tvLinkBlank, tvIngestAllow, tvWifiIpAddr, tvWifiRssi, tvBatVolt, tvSettingsWrites,
+  tvCurTime, tvCurTemperature, tvCurHumidity, tvCurPressure, tvCurWind, tvCurGust, tvCurUv,
+  tvCurBrightness, tvCurRadiation, tvCurRainRate, tvCurPrecipitationType, tvCurLightningStrikes, tvCurLightningDistance, NUM_TEMPLATE_VARS };
+#define TEMPLATE_FIRST_LIVE tvWifiIpAddr
+#define TEMPLATE_VALUE_LEN 64
+#define TEMPLATE_MAX_PARTS 64
+
+extern const char *TemplateVarNames[NUM_TEMPLATE_VARS];
+
+// Placeholder name to id, -1 if unknown
+int templateVarFind(const char *chName, size_t len);
+
+// Format a value, returns the length.  The platform provides the live
+// network and board values (src/esp32/Network.cpp, src/native).
+size_t templateValue(TemplateVar var, char *chOut, size_t maxLen);
+size_t templatePlatformValue(TemplateVar var, char *chOut, size_t maxLen);
+
+// Bumped whenever Settings.Config changes, invalidates the rendered caches
+extern volatile uint32_t u32SettingsGeneration;
+
+// Literal text with the settings values filled in, split where a live
+// value goes.  Immutable once built, so a response in flight keeps
+// streaming the render it started with.
+struct TemplateRender{
+    struct Part{
+        uint32_t Offset;    // Text to send from the cache
+        uint32_t Len;
+        uint8_t Var;        // Live value after it, NUM_TEMPLATE_VARS for none
+    };
+    char *Text = nullptr;
+    Part Parts[TEMPLATE_MAX_PARTS];
+    size_t numParts = 0;
+    uint32_t Generation = 0;
+    ~TemplateRender(){ delete[] Text; }
+};
+
+class CompiledTemplate{
+  public:
+    // Parse the template, the text is copied.  False if it has more
+    // placeholders than segments, or more live values than render parts
+    // (TEMPLATE_MAX_PARTS - 1), the template is then served uncompiled.
+    bool Compile(const char *chText, size_t len);
+    // Current render, rebuilt if the settings changed since the last
+    std::shared_ptr<const TemplateRender> Render(void);
+    size_t NumSegments(void) const { return numSegments; }
+
+  private:
+    struct Segment{
+        uint32_t Offset;
+        uint32_t Len;
+        uint8_t Var;        // NUM_TEMPLATE_VARS for literal text
+    };
+    std::unique_ptr<char[]> Source;
+    Segment SegmentList[TEMPLATE_MAX_PARTS * 2];
+    size_t numSegments = 0;
+    std::shared_ptr<const TemplateRender> Cached;
+};
+
+// Streams one response: the cached text, live values formatted in place
+class TemplateCursor{
+  public:
+    explicit TemplateCursor(std::shared_ptr<const TemplateRender> renderIn) : render(renderIn) {}
+    // Fill the next chunk, 0 once done
+    size_t Fill(uint8_t *pBuffer, size_t maxLen);
+
+  private:
+    std::shared_ptr<const TemplateRender> render;
+    size_t part = 0;
+    uint32_t u32Sent = 0;       // Of the current part's text, then its value
+    bool bValue = false;
+    char chValue[TEMPLATE_VALUE_LEN];
+    size_t valueLen = 0;
+};
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef __TimerWheel__
+#define __TimerWheel__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ##################################################################
+// # Hierarchical timer wheel
+// #
+// # Four levels of 64 slots over a 10 ms tick: level 0 holds the
+// # timers due within 64 ticks, each level above 64 times coarser, and
+// # a level's slot is spread (cascaded) into the levels below as the
+// # tick reaches it, so adding, removing and expiring are O(1).
+// # Occupancy bitmaps let Advance() step straight to the next slot
+// # with anything in it, and NextDeadline() find the earliest timer
+// # for a tickless sleep.  Deadlines are Hal.Clock->Millis() values,
+// # timers past the top level's reach (~46 h) wait there and are
+// # placed again when it comes round.
+// ##################################################################
+
+#define WHEEL_TICK_MS 10
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+
+struct WheelTimer{
+    WheelTimer *Next = nullptr;
+    WheelTimer *Prev = nullptr;
+    uint32_t Expires = 0;       // Tick
+    uint8_t Level = 0;
+    uint8_t Slot = 0;
+    bool Active = false;
+};
+
+class TimerWheel{
+  public:
+    void Begin(uint32_t u32NowMs);
+    // Due at u32DeadlineMs (one tick from now at the earliest), re-adding moves it
+    void Add(WheelTimer &timer, uint32_t u32DeadlineMs);
+    void Remove(WheelTimer &timer);
+    // Move up to u32NowMs, returns the timers that expired (removed,
+    // linked through Next), NULL if none
+    WheelTimer *Advance(uint32_t u32NowMs);
+    // Earliest deadline, false if no timer is set
+    bool NextDeadline(uint32_t &u32DeadlineMs) const;
+
+  private:
+    void place(WheelTimer &timer);
+    void unlink(WheelTimer &timer);
+    void cascade(uint8_t u8Level);
+    WheelTimer *Slots[WHEEL_LEVELS][WHEEL_SLOTS] = {};
+    uint64_t u64Occupied[WHEEL_LEVELS] = {};
+    uint32_t u32Tick = 0;       // Last tick processed
+    uint32_t u32TickMs = 0;     // Millis() of u32Tick
+    WheelTimer *pExpired = nullptr;
+};
+
+#endif
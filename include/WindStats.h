@@ -0,0 +1,75 @@
+#ifndef __WindStats__
+#define __WindStats__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ##################################################################
+// # Rolling wind statistics
+// #
+// # Kept over the rapid_wind stream for the last 2 and 10 minutes:
+// # the mean speed, gust (max) and lull (min), and the circular mean
+// # and spread of the direction.  The samples sit in one ring, each
+// # window keeps running sums from its oldest sample on, plus a
+// # monotonic deque each for the max & min, so adding a sample costs
+// # O(1) amortized however long the window.  Speeds are kept in
+// # hundredths of a MPH and directions as Q14 unit vectors, so the
+// # sums are exact integers and never drift.
+// ##################################################################
+
+#define WIND_STATS_SAMPLES 256      // 10 min of rapid_wind (3 s) with room
+#define WIND_STATS_MASK (WIND_STATS_SAMPLES - 1)
+
+enum WindWindow : uint8_t { ww2Min, ww10Min, NUM_WIND_WINDOWS };
+
+// Everything the gauges and web status show, for one window
+struct WindSummary{
+    uint16_t Samples = 0;
+    float Average = 0;          // MPH
+    float Gust = 0;
+    float Lull = 0;
+    float Direction = -1;       // Circular mean, degrees, -1 while calm
+    float Variability = 0;      // Circular standard deviation, degrees
+};
+
+class WindStatistics{
+  public:
+    void Add(uint32_t u32NowMs, float fSpeed, int iDirection);
+    void Clear(void);
+    // Readers on the gauge task only, others take the Summary() copies
+    float Average(WindWindow window) const;
+    float Gust(WindWindow window) const;
+    float Lull(WindWindow window) const;
+    WindSummary Summary(WindWindow window) const;
+
+  private:
+    struct Sample{
+        uint32_t Ms;
+        uint16_t Speed;         // Hundredths of a MPH
+        int16_t Sin;            // Q14, 0 when calm (no direction)
+        int16_t Cos;
+    };
+    // Indexes into the ring as a running sample count, the deques hold
+    // the counts of samples that may yet be the max (or min)
+    struct Window{
+        explicit Window(uint32_t u32MsIn) : u32Ms(u32MsIn) {}
+        uint32_t u32Ms;
+        uint32_t u32First = 0;
+        uint32_t u32Speed = 0;
+        int32_t i32Sin = 0;
+        int32_t i32Cos = 0;
+        uint16_t u16Directions = 0;
+        uint32_t MaxQueue[WIND_STATS_SAMPLES];
+        uint32_t u32MaxHead = 0, u32MaxTail = 0;
+        uint32_t MinQueue[WIND_STATS_SAMPLES];
+        uint32_t u32MinHead = 0, u32MinTail = 0;
+    };
+    void evict(Window &window);
+    Sample Samples[WIND_STATS_SAMPLES];
+    uint32_t u32Next = 0;
+    Window Windows[NUM_WIND_WINDOWS] = { Window(120000), Window(600000) };
+};
+
+extern WindStatistics WindStats;
+
+#endif
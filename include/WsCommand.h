@@ -0,0 +1,32 @@
+#ifndef __WsCommand__
+#define __WsCommand__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ##################################################################
+// # Web UI commands
+// #
+// # The websocket messages from the web UI, {"type": ..., "payload":
+// # {...}}, applied to Settings.Config.  Parsing uses one static JSON
+// # document and the type is switched on a compile time hash, so a
+// # command allocates nothing.  Strings are copied bounded, a value
+// # that does not fit rejects the whole command.  Changes are saved
+// # by the housekeeping task (SettingsStore.h), never from here.
+// ##################################################################
+
+#define WS_COMMAND_MAX_LEN 2048     // Largest frame accepted
+
+enum WsCommand { wcInvalid, wcUnknown, wcSettings, wcWiFi, wcUser, wcRoutes, wcCalibrate };
+
+// FNV-1a, usable in case labels
+constexpr uint32_t wsCommandHash(const char *chType, uint32_t u32Hash = 2166136261u){
+  return *chType ? wsCommandHash(chType + 1, (u32Hash ^ (uint8_t)*chType) * 16777619u) : u32Hash;
+}
+
+// Parse and apply one frame (not NUL terminated), returns the command
+// applied.  wcWiFi and wcRoutes want a restart, which is left to the
+// caller (requestRestart()).
+WsCommand wsCommandDispatch(const char *chData, size_t len);
+
+#endif
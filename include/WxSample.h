@@ -0,0 +1,51 @@
+#ifndef __WxSample__
+#define __WxSample__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ##################################################################
+// # Decoded WeatherFlow data, as handed from the UDP source to the
+// # gauge outputs.  Values are in the units the gauges are scaled
+// # for (i.e. the WeatherFlow "Imperial" units, MPH and degrees F).
+// ##################################################################
+
+// Valid flags, more than one may be set by a single receive
+#define WX_VALID_RAPID_WIND 0x01
+#define WX_VALID_OBS_ST     0x02
+
+#define WX_NO_SOURCE 0xFF
+
+struct WxSample{
+    uint8_t Valid = 0;
+    uint32_t EpochTime = 0;
+    float WindSpeed = 0;
+    int WindDirection = 0;
+    float AirTemperature = 0;
+    // Rest of obs_st, for the web status
+    float WindAverage = 0;
+    float WindGust = 0;
+    float Pressure = 0;         // inHg
+    float Humidity = 0;         // %
+    uint32_t Brightness = 0;    // lux
+    float Uv = 0;
+    uint32_t SolarRadiation = 0;    // W/m^2
+    float RainAmount = 0;       // inches, over the previous minute
+    uint8_t PrecipitationType = 0;  // 0 none, 1 rain, 2 hail, 3 rain + hail
+    float StrikeDistance = 0;   // miles
+    uint32_t StrikeCount = 0;
+    uint64_t RxMicros = 0;      // Monotonic time the datagram was received
+    uint8_t Source = WX_NO_SOURCE;  // Sender, in the ingest source table (Ingest.h)
+};
+
+// Decode a single Tempest UDP broadcast (JSON) into a sample, returns
+// false if the message is not one the gauges use.
+bool wxDecodeJson(const char *chData, size_t len, WxSample &sample);
+// The same through a whole JSON document, what the filtered decode is
+// checked and benchmarked against
+bool wxDecodeJsonFull(const char *chData, size_t len, WxSample &sample);
+// A string member of the message, found by scanning as the decode does,
+// NULL (and no length) if missing
+const char *wxStringValue(const char *chData, size_t len, const char *chKey, size_t &valueLen);
+
+#endif
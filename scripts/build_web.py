@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+"""
+Build the SPIFFS image contents (data/) from the web UI sources (web/).
+
+Every asset is minified, and everything except the templates (files with
+%VAR% placeholders, rendered by the firmware) is gzipped.  References to
+the static assets in the HTML get a ?v=<hash> query, so the firmware can
+let browsers cache them for good.  data/manifest.json lists each asset
+with its content hash (the ETag), content type and caching policy.
+
+Runs from PlatformIO (extra_scripts, before building the filesystem
+image) or by hand:  scripts/build_web.py [--src web] [--out data]
+"""
+
+import argparse
+import gzip
+import hashlib
+import json
+import os
+import re
+import shutil
+
+CONTENT_TYPES = {
+    ".html": "text/html",
+    ".css": "text/css",
+    ".js": "application/javascript",
+    ".ico": "image/x-icon",
+    ".json": "application/json",
+    ".png": "image/png",
+    ".svg": "image/svg+xml",
+}
+TEMPLATE_VAR = re.compile(rb"%[A-Z][A-Z0-9_]*%")
+ETAG_LEN = 16
+
+
+def minify_lines(data, line_comment=None):
+    """Conservative minify: indentation, blank lines and whole-line comments.
+    Newlines stay, so JavaScript semicolon insertion is unaffected."""
+    out = []
+    for line in data.decode("utf-8").splitlines():
+        line = line.strip()
+        if not line or (line_comment and line.startswith(line_comment)):
+            continue
+        out.append(line)
+    return ("\n".join(out) + "\n").encode("utf-8")
+
+
+def strip_blocks(data, start, end):
+    return re.sub(re.escape(start).encode() + rb".*?" + re.escape(end).encode(), b"", data, flags=re.S)
+
+
+def minify(name, data):
+    ext = os.path.splitext(name)[1]
+    if ext == ".js":
+        return minify_lines(strip_blocks(data, "/*", "*/"), "//")
+    if ext == ".css":
+        return minify_lines(strip_blocks(data, "/*", "*/"))
+    if ext == ".html":
+        return minify_lines(strip_blocks(data, "<!--", "-->"))
+    return data
+
+
+def content_hash(data):
+    return hashlib.sha256(data).hexdigest()[:ETAG_LEN]
+
+
+def build(src, out):
+    names = sorted(n for n in os.listdir(src) if os.path.isfile(os.path.join(src, n)))
+    assets = {}
+    for name in names:
+        with open(os.path.join(src, name), "rb") as f:
+            assets[name] = minify(name, f.read())
+
+    # Static assets first, their hashes version the references in the HTML
+    static = [n for n in names if not n.endswith(".html")]
+    hashes = {n: content_hash(assets[n]) for n in static}
+    for name in names:
+        if not name.endswith(".html"):
+            continue
+        for ref in static:
+            assets[name] = re.sub(rb'((?:src|href)=")' + re.escape(ref).encode() + rb'"',
+                                  rb'\g<1>' + ref.encode() + b"?v=" + hashes[ref].encode() + b'"',
+                                  assets[name])
+        hashes[name] = content_hash(assets[name])
+
+    if os.path.isdir(out):
+        shutil.rmtree(out)
+    os.makedirs(out)
+    manifest = []
+    for name in names:
+        data = assets[name]
+        template = bool(TEMPLATE_VAR.search(data))
+        ext = os.path.splitext(name)[1]
+        entry = {
+            "path": "/" + name,
+            "type": CONTENT_TYPES.get(ext, "text/plain"),
+            "etag": hashes[name],
+            "template": template,
+            "gzip": not template,
+            # Versioned by the ?v= query, HTML is revalidated with the ETag
+            "immutable": ext != ".html",
+        }
+        if template:
+            with open(os.path.join(out, name), "wb") as f:
+                f.write(data)
+        else:
+            # Fixed mtime and no file name, so the image is reproducible
+            with open(os.path.join(out, name + ".gz"), "wb") as f:
+                with gzip.GzipFile(filename="", mode="wb", fileobj=f, compresslevel=9, mtime=0) as gz:
+                    gz.write(data)
+        manifest.append(entry)
+        size = os.path.getsize(os.path.join(out, name if template else name + ".gz"))
+        print("web: %-18s %6d -> %6d bytes%s" % (name, len(data), size, " (template)" if template else ""))
+
+    with open(os.path.join(out, "manifest.json"), "w") as f:
+        json.dump({"assets": manifest}, f, separators=(",", ":"))
+
+
+def main():
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--src", default=os.path.join(root, "web"))
+    parser.add_argument("--out", default=os.path.join(root, "data"))
+    args = parser.parse_args()
+    build(args.src, args.out)
+
+
+try:
+    Import("env")  # noqa: F821, only defined when run by PlatformIO
+    build(os.path.join(env.subst("$PROJECT_DIR"), "web"), env.subst("$PROJECT_DATA_DIR"))  # noqa: F821
+except NameError:
+    if __name__ == "__main__":
+        main()
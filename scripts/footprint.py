@@ -0,0 +1,183 @@
+#!/usr/bin/env python3
+"""
+Flash and RAM footprint of the firmware, from the section sizes in its ELF.
+
+The sections are summed by where they end up on the ESP32: the app image
+in flash (everything loaded, code and constants, plus the initial values
+of the RAM data), instruction RAM, internal data RAM (initialized, zeroed
+and not initialized), RTC memory and PSRAM.  bench/footprint.txt holds the
+last accepted build, a region that grows by more than --threshold percent
+of it fails the check, as bench/baseline.txt does for the kernel times,
+and so does a missing baseline.
+
+Runs from PlatformIO (extra_scripts): every build of the firmware writes
+$BUILD_DIR/footprint.txt and prints it against the baseline,
+``pio run -t footprint`` fails on a regression and
+``pio run -t footprint-baseline`` accepts the build.  Or by hand:
+
+  scripts/footprint.py .pio/build/tinypico/firmware.elf
+      [--baseline bench/footprint.txt] [--threshold 1] [--write-baseline <file>]
+"""
+
+import argparse
+import os
+import struct
+import sys
+
+SHF_ALLOC = 0x2
+SHT_PROGBITS = 1
+SHT_NOBITS = 8
+
+# Region of each section, by name prefix, first match
+REGIONS = [
+    ("iram", (".iram0.",)),
+    ("dram", (".dram0.", ".noinit")),
+    ("rtc", (".rtc",)),
+    ("psram", (".ext_ram.",)),
+]
+REGION_ORDER = ["flash", "iram", "dram", "rtc", "psram"]
+SLACK_BYTES = 64        # Alignment padding moves by this much on its own
+
+
+def sections(path):
+    """(name, type, size) of each section the program loads."""
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:4] != b"\x7fELF":
+        raise ValueError("%s is not an ELF file" % path)
+    bits64 = data[4] == 2
+    endian = "<" if data[5] == 1 else ">"
+    if bits64:
+        shoff, = struct.unpack_from(endian + "Q", data, 0x28)
+        shentsize, shnum, shstrndx = struct.unpack_from(endian + "HHH", data, 0x3A)
+        header = endian + "IIQQQQIIQQ"
+    else:
+        shoff, = struct.unpack_from(endian + "I", data, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from(endian + "HHH", data, 0x2E)
+        header = endian + "IIIIIIIIII"
+    headers = [struct.unpack_from(header, data, shoff + i * shentsize) for i in range(shnum)]
+    strtab = headers[shstrndx][4]
+
+    def name(offset):
+        end = data.index(b"\0", strtab + offset)
+        return data[strtab + offset:end].decode("ascii", "replace")
+
+    out = []
+    for sh in headers:
+        sh_name, sh_type, sh_flags, sh_size = sh[0], sh[1], sh[2], sh[5]
+        if sh_flags & SHF_ALLOC and sh_size and sh_type in (SHT_PROGBITS, SHT_NOBITS):
+            out.append((name(sh_name), sh_type, sh_size))
+    return out
+
+
+def footprint(path):
+    """Bytes per region, and per section."""
+    regions = dict.fromkeys(REGION_ORDER, 0)
+    per_section = []
+    for name, sh_type, size in sections(path):
+        # Everything with contents is in the image, RAM data as its initial values
+        if sh_type == SHT_PROGBITS:
+            regions["flash"] += size
+        for region, prefixes in REGIONS:
+            if name.startswith(prefixes):
+                regions[region] += size
+                break
+        per_section.append((name, size))
+    return regions, per_section
+
+
+def load(path):
+    regions = {}
+    with open(path) as f:
+        for line in f:
+            fields = line.split()
+            if len(fields) == 2 and not line.startswith("#"):
+                regions[fields[0]] = int(fields[1])
+    return regions
+
+
+def save(path, regions, per_section, heading):
+    with open(path, "w") as f:
+        f.write("# %s\n# region bytes\n" % heading)
+        for region in REGION_ORDER:
+            f.write("%s %d\n" % (region, regions[region]))
+        f.write("# section bytes\n")
+        for name, size in per_section:
+            f.write("# %s %d\n" % (name, size))
+
+
+def compare(regions, baseline, threshold):
+    """Prints the regions against the baseline, True if one grew past it."""
+    failed = False
+    print("%-8s %10s %10s %9s" % ("region", "bytes", "base", "change"))
+    for region in REGION_ORDER:
+        size = regions[region]
+        if region not in baseline:
+            print("%-8s %10d %10s %9s" % (region, size, "-", "new" if baseline else ""))
+            continue
+        base = baseline[region]
+        change = 100.0 * (size - base) / base if base else 0.0
+        grown = size - base > SLACK_BYTES and (not base or change > threshold)
+        print("%-8s %10d %10d %+8.2f%%%s" % (region, size, base, change, "  REGRESSED" if grown else ""))
+        failed |= grown
+    return failed
+
+
+def run(elf, baseline_path, threshold, record=None, write=None, check=True):
+    """Returns the exit status, 1 when a region regressed or, checking,
+    there is no baseline to hold it to."""
+    regions, per_section = footprint(elf)
+    baseline = load(baseline_path) if baseline_path and os.path.isfile(baseline_path) else {}
+    missing = not baseline and not write
+    if missing:
+        print("no baseline in %s" % baseline_path)
+    print("footprint of %s, threshold %.1f%%\n" % (os.path.basename(elf), threshold))
+    failed = compare(regions, baseline, threshold)
+    if record:
+        save(record, regions, per_section, "scripts/footprint.py %s" % os.path.basename(elf))
+    if write:
+        save(write, regions, per_section, "scripts/footprint.py --write-baseline %s" % write)
+        print("\nbaseline written to %s" % write)
+    if failed:
+        print("\nFAILED: footprint grew past the baseline")
+    elif missing and check:
+        print("\nFAILED: no baseline to check against, write one with --write-baseline")
+        failed = True
+    return 1 if failed else 0
+
+
+def main():
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("elf")
+    parser.add_argument("--baseline", default=os.path.join(root, "bench", "footprint.txt"))
+    parser.add_argument("--threshold", type=float, default=1.0, help="percent a region may grow")
+    parser.add_argument("--write-baseline", metavar="FILE")
+    args = parser.parse_args()
+    return run(args.elf, args.baseline, args.threshold, write=args.write_baseline)
+
+
+try:
+    Import("env")  # noqa: F821, only defined when run by PlatformIO
+    ELF = "$BUILD_DIR/${PROGNAME}.elf"
+    BASELINE = os.path.join(env.subst("$PROJECT_DIR"), "bench", "footprint.txt")  # noqa: F821
+
+    # Every build records its footprint and shows it, without failing
+    def record(target, source, env):
+        run(env.subst(ELF), BASELINE, 1.0, record=env.subst("$BUILD_DIR/footprint.txt"), check=False)
+
+    def check(target, source, env):
+        return run(env.subst(ELF), BASELINE, 1.0)
+
+    # Accept this build, bench/footprint.txt is then committed with the change
+    def accept(target, source, env):
+        return run(env.subst(ELF), BASELINE, 1.0, write=BASELINE)
+
+    env.AddPostAction(ELF, record)  # noqa: F821
+    env.AddCustomTarget("footprint", ELF, check, title="Footprint",  # noqa: F821
+                        description="Flash and RAM use against bench/footprint.txt")
+    env.AddCustomTarget("footprint-baseline", ELF, accept, title="Footprint baseline",  # noqa: F821
+                        description="Write bench/footprint.txt from this build")
+except NameError:
+    if __name__ == "__main__":
+        sys.exit(main())
@@ -0,0 +1,48 @@
+#!/usr/bin/env python3
+"""
+WeatherFlow Tempest UDP capture
+
+Records the Tempest hub broadcasts on UDP port 50222 for replay by the
+native build ("program replay <file>").  Each line is the time since the
+capture started, in seconds, followed by the datagram (JSON).
+
+    scripts/wf_capture.py capture.txt [--minutes 60]
+"""
+import argparse
+import socket
+import sys
+import time
+
+WF_UDP_PORT = 50222
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Capture WeatherFlow UDP broadcasts")
+    parser.add_argument("output", help="capture file to write")
+    parser.add_argument("--minutes", type=float, default=0, help="stop after this long (0 = until Ctrl-C)")
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(("", WF_UDP_PORT))
+    sock.settimeout(1.0)
+
+    start = time.monotonic()
+    count = 0
+    with open(args.output, "w") as capture:
+        try:
+            while not args.minutes or time.monotonic() - start < args.minutes * 60:
+                try:
+                    data, _ = sock.recvfrom(2048)
+                except socket.timeout:
+                    continue
+                line = data.decode("utf-8", "replace").strip()
+                capture.write("%.3f %s\n" % (time.monotonic() - start, line))
+                count += 1
+        except KeyboardInterrupt:
+            pass
+    print("Captured %d datagrams" % count, file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
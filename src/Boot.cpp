@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <string.h>
+#include "Hal.h"
+#include "App.h"
+#include "Boot.h"
+
+BootState Boot;
+
+#define BOOT_GAUGE_MAGIC 0x57584731     // "WXG1"
+#define BOOT_WIFI_MAGIC 0x57585731      // "WXW1"
+
+// FNV-1a over the block up to its check
+static uint32_t bootCheck(const void *pBlock, size_t len, uint32_t u32Hash = 2166136261u){
+  const uint8_t *pData = (const uint8_t *)pBlock;
+  for( size_t i = 0; i < len; i++ )u32Hash = (u32Hash ^ pData[i]) * 16777619u;
+  return u32Hash;
+}
+
+// Only what decides where an output is and what drives it, not the padding
+static uint32_t routesHash(const GaugeRouteSettings &routes){
+  uint32_t u32Hash = 2166136261u;
+  for( const GaugeRoute &route : routes.Route ){
+    const uint8_t u8Route[] = { route.Field, route.Output, route.Channel, route.Pin, route.Scale };
+    u32Hash = bootCheck(u8Route, sizeof(u8Route), u32Hash);
+  }
+  return u32Hash;
+}
+
+void BootState::Begin(const GaugeRouteSettings &routes){
+  uint8_t *pRetained = (uint8_t *)Hal.Sys->Retained(sizeof(GaugeBlock) + sizeof(WifiBlock));
+  if( !pRetained )return;
+  pGauges = (GaugeBlock *)pRetained;
+  pWifi = (WifiBlock *)(pRetained + sizeof(GaugeBlock));
+
+  const uint32_t u32Routes = routesHash(routes);
+  if( pGauges->Magic != BOOT_GAUGE_MAGIC || pGauges->Routes != u32Routes ||
+      pGauges->Check != bootCheck(pGauges, offsetof(GaugeBlock, Check)) ){
+    memset(pGauges, 0, sizeof(GaugeBlock));
+    pGauges->Magic = BOOT_GAUGE_MAGIC;
+    pGauges->Routes = u32Routes;
+    pGauges->Check = bootCheck(pGauges, offsetof(GaugeBlock, Check));
+  }
+  if( pWifi->Magic != BOOT_WIFI_MAGIC || pWifi->Check != bootCheck(pWifi, offsetof(WifiBlock, Check)) ){
+    memset(pWifi, 0, sizeof(WifiBlock));
+  }
+}
+
+bool BootState::Output(uint8_t u8Route, uint32_t &u32Value) const{
+  if( !pGauges || u8Route >= GAUGE_ROUTES || !(pGauges->Valid & (1UL << u8Route)) )return false;
+  u32Value = pGauges->Value[u8Route];
+  return true;
+}
+
+void BootState::SetOutput(uint8_t u8Route, uint32_t u32Value){
+  if( !pGauges || u8Route >= GAUGE_ROUTES )return;
+  if( (pGauges->Valid & (1UL << u8Route)) && pGauges->Value[u8Route] == u32Value )return;
+  pGauges->Value[u8Route] = (uint16_t)u32Value;
+  pGauges->Valid |= 1UL << u8Route;
+  pGauges->Check = bootCheck(pGauges, offsetof(GaugeBlock, Check));
+}
+
+bool BootState::Wifi(uint8_t (&u8Bssid)[6], uint8_t &u8Channel) const{
+  if( !pWifi || pWifi->Magic != BOOT_WIFI_MAGIC || !pWifi->Channel )return false;
+  memcpy(u8Bssid, pWifi->Bssid, sizeof(u8Bssid));
+  u8Channel = pWifi->Channel;
+  return true;
+}
+
+void BootState::SetWifi(const uint8_t *u8Bssid, uint8_t u8Channel){
+  if( !pWifi )return;
+  pWifi->Magic = BOOT_WIFI_MAGIC;
+  if( u8Bssid )memcpy(pWifi->Bssid, u8Bssid, sizeof(pWifi->Bssid));
+  pWifi->Channel = u8Bssid ? u8Channel : 0;
+  pWifi->Check = bootCheck(pWifi, offsetof(WifiBlock, Check));
+}
+
+void BootState::Mark(BootPhase phase){
+  static const char *chPhases[NUM_BOOT_PHASES] = { "settings", "needles", "ready", "wifi" };
+  u32PhaseMs[phase] = (uint32_t)(Hal.Clock->Micros() / 1000);
+  debug(1, "\n\rBoot: %s at %u ms", chPhases[phase], (unsigned)u32PhaseMs[phase]);
+}
+
+// ##################################################################
+// # Static IP
+// ##################################################################
+
+static bool ipParse(const char *chText, uint8_t (&u8Ip)[4]){
+  unsigned uOctet[4];
+  char chEnd;
+  if( sscanf(chText, "%u.%u.%u.%u%c", &uOctet[0], &uOctet[1], &uOctet[2], &uOctet[3], &chEnd) != 4 )return false;
+  for( int i = 0; i < 4; i++ ){
+    if( uOctet[i] > 255 )return false;
+    u8Ip[i] = (uint8_t)uOctet[i];
+  }
+  return true;
+}
+
+bool staticIpParse(const char *chText, WiFiSettings &wifi){
+  char chAddress[20], chGateway[16], chDns[16];
+  uint8_t u8Ip[4], u8Gateway[4], u8Dns[4] = {0};
+  unsigned uPrefix = 0;
+  int iItems = sscanf(chText, "%19s %15s %15s", chAddress, chGateway, chDns);
+  if( iItems <= 0 ){
+    memset(wifi.Ip, 0, sizeof(wifi.Ip));
+    memset(wifi.Gateway, 0, sizeof(wifi.Gateway));
+    memset(wifi.Dns, 0, sizeof(wifi.Dns));
+    wifi.Prefix = 24;
+    return true;
+  }
+  char *chSlash = strchr(chAddress, '/');
+  if( iItems < 2 || !chSlash || sscanf(chSlash + 1, "%u", &uPrefix) != 1 || uPrefix < 1 || uPrefix > 30 )return false;
+  *chSlash = 0;
+  if( !ipParse(chAddress, u8Ip) || !ipParse(chGateway, u8Gateway) || (iItems > 2 && !ipParse(chDns, u8Dns)) )return false;
+  if( !(u8Ip[0] | u8Ip[1] | u8Ip[2] | u8Ip[3]) )return false;
+  memcpy(wifi.Ip, u8Ip, sizeof(wifi.Ip));
+  memcpy(wifi.Gateway, u8Gateway, sizeof(wifi.Gateway));
+  memcpy(wifi.Dns, u8Dns, sizeof(wifi.Dns));
+  wifi.Prefix = (uint8_t)uPrefix;
+  return true;
+}
+
+size_t staticIpFormat(const WiFiSettings &wifi, char *chOut, size_t maxLen){
+  int iLen = 0;
+  if( wifi.Ip[0] | wifi.Ip[1] | wifi.Ip[2] | wifi.Ip[3] ){
+    iLen = snprintf(chOut, maxLen, "%u.%u.%u.%u/%u %u.%u.%u.%u", wifi.Ip[0], wifi.Ip[1], wifi.Ip[2],
+      wifi.Ip[3], wifi.Prefix, wifi.Gateway[0], wifi.Gateway[1], wifi.Gateway[2], wifi.Gateway[3]);
+    if( iLen > 0 && (size_t)iLen < maxLen && (wifi.Dns[0] | wifi.Dns[1] | wifi.Dns[2] | wifi.Dns[3]) ){
+      iLen += snprintf(chOut + iLen, maxLen - iLen, " %u.%u.%u.%u", wifi.Dns[0], wifi.Dns[1], wifi.Dns[2],
+        wifi.Dns[3]);
+    }
+  }
+  else if( maxLen )chOut[0] = 0;
+  if( iLen < 0 )return 0;
+  return (size_t)iLen < maxLen ? (size_t)iLen : maxLen - 1;
+}
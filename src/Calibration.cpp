@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include "App.h"
+#include "Calibration.h"
+#include "GaugeRoutes.h"
+#include "GaugeTable.h"
+
+CalibrationSequencer Calibration;
+
+static const GaugeSettings &calGauge(uint8_t u8Scale){
+  return u8Scale == rsTemp ? Settings.Config.Temp : Settings.Config.Wind;
+}
+
+static uint32_t calDuty(int32_t i32Duty){
+  return i32Duty < 0 ? 0 : i32Duty > GAUGE_PWM_MAX ? GAUGE_PWM_MAX : (uint32_t)i32Duty;
+}
+
+void CalibrationSequencer::Start(uint8_t u8ModeIn, uint8_t u8ScaleIn, uint32_t u32DwellMsIn){
+  Request request;
+  request.Mode = u8ModeIn;
+  request.Scale = u8ScaleIn == rsTemp ? rsTemp : rsWind;
+  request.DwellMs = u32DwellMsIn < CAL_DWELL_MIN_MS ? CAL_DWELL_MIN_MS :
+    u32DwellMsIn > CAL_DWELL_MAX_MS ? CAL_DWELL_MAX_MS : u32DwellMsIn;
+  Requests.Write(request);
+}
+
+void CalibrationSequencer::Nudge(int iDuty){
+  i32Nudges += iDuty;
+}
+
+// Restarting the sweep already running only changes the dwell, so
+// saving the other settings mid-sweep keeps the corrections
+void CalibrationSequencer::begin(const Request &request, uint32_t u32NowMs){
+  u32DwellMs = request.DwellMs;
+  if( request.Mode == u8Mode && (request.Mode != sweep || request.Scale == u8Scale) )return;
+  u8Mode = request.Mode;
+  u8Scale = request.Scale;
+  u8Visit = 0;
+  u32StepMs = u32NowMs;
+  if( u8Mode == range )u8Steps = std::max(GaugeRoutes.CalibrationSteps(), (uint8_t)2);
+  else if( u8Mode == sweep ){
+    // The gauge steps, or GAUGE_CAL_POINTS spread evenly when there are more
+    const GaugeSettings &gauge = calGauge(u8Scale);
+    const GaugeTransfer &transfer = u8Scale == rsTemp ? TempGauge : WindGauge;
+    int iSpan = gauge.max - gauge.min;
+    int iSteps = gauge.step > 0 ? (iSpan + gauge.step - 1) / gauge.step + 1 : GAUGE_CAL_POINTS;
+    if( iSpan <= 0 ){
+      debug(1, "\n\rCalibration: %s gauge has no range", RouteScaleNames[u8Scale]);
+      u8Mode = none;
+      CalibrationMode = none;
+      return;
+    }
+    u8Steps = iSteps > GAUGE_CAL_POINTS ? GAUGE_CAL_POINTS : iSteps < 2 ? 2 : iSteps;
+    for( uint8_t i = 0; i < u8Steps; i++ ){
+      fValue[i] = iSteps > GAUGE_CAL_POINTS ? gauge.min + (float)iSpan * i / (u8Steps - 1) :
+        std::min(gauge.min + i * gauge.step, gauge.max);
+      u32Base[i] = transfer.Scale(fValue[i]);
+      i32Correction[0][i] = i32Correction[1][i] = 0;
+    }
+  }
+  CalibrationMode = (CalMode)u8Mode;
+  debug(1, "\n\rCalibration %s, %u steps, %u ms each", u8Mode == range ? "test" : u8Mode == sweep ?
+    RouteScaleNames[u8Scale] : "off", (unsigned)u8Steps, (unsigned)u32DwellMs);
+  if( u8Mode != none )output();
+}
+
+void CalibrationSequencer::output(void){
+  if( u8Mode == range ){
+    debug(1, "\n\rCalibration test step %u %s", (unsigned)step(), down() ? "down" : "up");
+    GaugeRoutes.CalibrateStep(step());
+    return;
+  }
+  const uint8_t i = step();
+  const int32_t i32Fix = i32Correction[down()][i];
+  debug(1, "\n\rCalibration %s %.2f %s: %u (%+d)", RouteScaleNames[u8Scale], fValue[i],
+    down() ? "down" : "up", (unsigned)calDuty((int32_t)u32Base[i] + i32Fix), (int)i32Fix);
+  GaugeRoutes.CalibrateDuty(&calGauge(u8Scale), calDuty((int32_t)u32Base[i] + i32Fix));
+}
+
+// End of a gauge sweep, each point the mean of the two passes (the top
+// of the scale is only passed once)
+void CalibrationSequencer::finish(void){
+  CalResult result;
+  result.Scale = u8Scale;
+  result.Points = u8Steps;
+  for( uint8_t i = 0; i < u8Steps; i++ ){
+    int32_t i32Up = i32Correction[0][i];
+    int32_t i32Down = i < u8Steps - 1 ? i32Correction[1][i] : i32Up;
+    result.Point[i].value = fValue[i];
+    result.Point[i].pwm = calDuty((int32_t)u32Base[i] + (i32Up + i32Down) / 2);
+    result.Hysteresis = std::max(result.Hysteresis, abs(i32Up - i32Down));
+    debug(1, "\n\r\t%.2f: %d (up %+d, down %+d)", fValue[i], result.Point[i].pwm, (int)i32Up, (int)i32Down);
+  }
+  Results.Write(result);
+  debug(1, "\n\rCalibration %s done, hysteresis %d", RouteScaleNames[u8Scale], result.Hysteresis);
+  u8Mode = none;
+  CalibrationMode = none;
+}
+
+void CalibrationSequencer::Tick(uint32_t u32NowMs){
+  Request request;
+  uint32_t u32Seq = Requests.Read(request);
+  if( u32Seq != u32Applied ){
+    u32Applied = u32Seq;
+    begin(request, u32NowMs);
+  }
+
+  int32_t i32Nudge = i32Nudges.exchange(0);
+  if( u8Mode == none )return;
+  if( i32Nudge && u8Mode == sweep ){
+    int32_t &i32Fix = i32Correction[down()][step()];
+    const int32_t i32Base = (int32_t)u32Base[step()];
+    i32Fix = (int32_t)calDuty(i32Base + i32Fix + i32Nudge) - i32Base;
+    u32StepMs = u32NowMs;
+    output();
+    return;
+  }
+  if( u32NowMs - u32StepMs < u32DwellMs )return;
+
+  u32StepMs = u32NowMs;
+  if( ++u8Visit > 2 * (u8Steps - 1) ){
+    if( u8Mode == sweep ){
+      finish();
+      return;
+    }
+    u8Visit = 1;
+  }
+  // The down pass starts from the correction going up
+  if( u8Mode == sweep && down() )i32Correction[1][step()] = i32Correction[0][step()];
+  output();
+}
+
+uint32_t CalibrationSequencer::DueIn(uint32_t u32NowMs) const{
+  Request request;
+  if( Requests.Read(request) != u32Applied || i32Nudges.load() )return 0;
+  if( u8Mode == none )return UINT32_MAX;
+  uint32_t u32Elapsed = u32NowMs - u32StepMs;
+  return u32Elapsed < u32DwellMs ? u32DwellMs - u32Elapsed : 0;
+}
+
+size_t CalibrationSequencer::Status(char *chOut, size_t maxLen) const{
+  if( u8Mode == range ){
+    return snprintf(chOut, maxLen, "Test %u/%u %s", (unsigned)step() + 1, (unsigned)u8Steps, down() ? "down" : "up");
+  }
+  if( u8Mode == sweep ){
+    const uint8_t i = step();
+    const int32_t i32Fix = i32Correction[down()][i];
+    return snprintf(chOut, maxLen, "%s %.1f %s %u (%+d)", RouteScaleNames[u8Scale], fValue[i],
+      down() ? "down" : "up", (unsigned)calDuty((int32_t)u32Base[i] + i32Fix), (int)i32Fix);
+  }
+  CalResult result;
+  if( Result(result) ){
+    return snprintf(chOut, maxLen, "%s swept, hysteresis %d", RouteScaleNames[result.Scale], result.Hysteresis);
+  }
+  return snprintf(chOut, maxLen, "Off");
+}
@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <string.h>
+#include "App.h"
+#include "Firmware.h"
+#include "Hal.h"
+
+FirmwareUpdate Firmware;
+
+static const char *chErrors[NUM_FIRMWARE_ERRORS] = { "", "no update slot", "not an image", "too big",
+  "flash error", "bad digest", "not bootable", "stalled", "writer overrun" };
+
+// The web server is the only caller
+bool FirmwareUpdate::Begin(uint32_t u32NowMs){
+  if( state.load() == fsWriting )return false;
+  u32Bytes.store(0, std::memory_order_relaxed);
+  SlotLen = Hal.Sys->FirmwareBegin();
+  if( !SlotLen ){
+    error = feNoSlot;
+    state = fsFailed;
+    return false;
+  }
+  Sha.Begin();
+  u32Erased = 0;
+  u8TailLen = 0;
+  error = feNone;
+  u32StartMs = u32NowMs;
+  u32MaxLatencyUs[1].store(0, std::memory_order_relaxed);
+  state = fsWriting;
+  debug(1, "\n\rFirmware update started, %u KB slot", (unsigned)(SlotLen / 1024));
+  return true;
+}
+
+// Everything but the last SHA256_LEN bytes seen so far goes into the
+// digest, those may be the image's own
+void FirmwareUpdate::digest(const uint8_t *pData, size_t len){
+  if( len >= SHA256_LEN ){
+    Sha.Update(u8Tail, u8TailLen);
+    Sha.Update(pData, len - SHA256_LEN);
+    memcpy(u8Tail, pData + len - SHA256_LEN, SHA256_LEN);
+    u8TailLen = SHA256_LEN;
+    return;
+  }
+  size_t over = u8TailLen + len > SHA256_LEN ? u8TailLen + len - SHA256_LEN : 0;
+  Sha.Update(u8Tail, over);
+  memmove(u8Tail, u8Tail + over, u8TailLen - over);
+  memcpy(u8Tail + u8TailLen - over, pData, len);
+  u8TailLen = (uint8_t)(u8TailLen - over + len);
+}
+
+bool FirmwareUpdate::Write(const uint8_t *pData, size_t len){
+  if( state.load() != fsWriting )return false;
+  const uint32_t u32Offset = u32Bytes.load(std::memory_order_relaxed);
+  if( u32Offset < FIRMWARE_HEADER_LEN ){
+    size_t take = len < FIRMWARE_HEADER_LEN - u32Offset ? len : FIRMWARE_HEADER_LEN - u32Offset;
+    memcpy(u8Header + u32Offset, pData, take);
+    if( u32Offset + take == FIRMWARE_HEADER_LEN &&
+        (u8Header[0] != FIRMWARE_MAGIC || u8Header[FIRMWARE_HASH_APPENDED] != 1) ){
+      Fail(feNotImage);
+      return false;
+    }
+  }
+  if( u32Offset + len > SlotLen ){
+    Fail(feTooBig);
+    return false;
+  }
+  // Erase just ahead of the write, a sector at a time, so no one flash
+  // operation holds the other tasks up for long
+  while( u32Erased < u32Offset + len ){
+    if( !Hal.Sys->FirmwareErase(u32Erased) ){
+      Fail(feFlash);
+      return false;
+    }
+    u32Erased += FIRMWARE_SECTOR;
+  }
+  if( !Hal.Sys->FirmwareWrite(u32Offset, pData, len) ){
+    Fail(feFlash);
+    return false;
+  }
+  digest(pData, len);
+  u32Bytes.store(u32Offset + len, std::memory_order_relaxed);
+  return true;
+}
+
+bool FirmwareUpdate::End(uint32_t u32NowMs){
+  if( state.load() != fsWriting )return false;
+  const uint32_t u32Len = u32Bytes.load(std::memory_order_relaxed);
+  if( u32Len < FIRMWARE_HEADER_LEN + SHA256_LEN ){
+    Fail(feNotImage);
+    return false;
+  }
+  uint8_t u8Digest[SHA256_LEN];
+  Sha.Final(u8Digest);
+  if( memcmp(u8Digest, u8Tail, SHA256_LEN) != 0 ){
+    Fail(feDigest);
+    return false;
+  }
+  if( !Hal.Sys->FirmwareActivate(u32Len) ){
+    Fail(feRejected);
+    return false;
+  }
+  u32EndMs = u32NowMs;
+  state = fsDone;
+  debug(1, "\n\rFirmware update verified, %u bytes in %u ms, gauge latency %u us (%u us otherwise)",
+    (unsigned)u32Len, (unsigned)(u32NowMs - u32StartMs), (unsigned)u32MaxLatencyUs[1].load(),
+    (unsigned)u32MaxLatencyUs[0].load());
+  return true;
+}
+
+void FirmwareUpdate::Fail(FirmwareError errorIn){
+  if( state.load() != fsWriting )return;
+  error = errorIn;
+  state = fsFailed;
+  debug(1, "\n\rFirmware update failed at %u bytes: %s", (unsigned)u32Bytes.load(), chErrors[errorIn]);
+}
+
+// Single writer, the gauge task
+void FirmwareUpdate::Latency(uint32_t u32Us){
+  std::atomic<uint32_t> &max = u32MaxLatencyUs[state.load(std::memory_order_relaxed) == fsWriting];
+  if( u32Us > max.load(std::memory_order_relaxed) )max.store(u32Us, std::memory_order_relaxed);
+}
+
+size_t FirmwareUpdate::Status(char *chOut, size_t maxLen, uint32_t u32NowMs) const{
+  const FirmwareState current = state.load();
+  const unsigned uKB = (unsigned)(u32Bytes.load(std::memory_order_relaxed) / 1024);
+  const uint32_t u32Ms = (current == fsWriting ? u32NowMs : u32EndMs.load()) - u32StartMs.load();
+  const unsigned uRate = u32Ms ? (unsigned)((uint64_t)u32Bytes.load(std::memory_order_relaxed) * 1000 / 1024 / u32Ms) : 0;
+  int iLen;
+  switch( current ){
+    case fsWriting: iLen = snprintf(chOut, maxLen, "%u KB, %u KB/s", uKB, uRate); break;
+    case fsDone: iLen = snprintf(chOut, maxLen, "%u KB at %u KB/s, restarting", uKB, uRate); break;
+    case fsFailed: iLen = snprintf(chOut, maxLen, "Failed at %u KB: %s", uKB, chErrors[error.load()]); break;
+    default: iLen = snprintf(chOut, maxLen, "None"); break;
+  }
+  if( iLen < 0 )return 0;
+  return (size_t)iLen < maxLen ? (size_t)iLen : maxLen - 1;
+}
+
+size_t FirmwareUpdate::LatencyStatus(char *chOut, size_t maxLen) const{
+  int iLen = snprintf(chOut, maxLen, "%.1f ms (%.1f ms otherwise)", u32MaxLatencyUs[1].load() / 1000.0,
+    u32MaxLatencyUs[0].load() / 1000.0);
+  if( iLen < 0 )return 0;
+  return (size_t)iLen < maxLen ? (size_t)iLen : maxLen - 1;
+}
@@ -0,0 +1,338 @@
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "Hal.h"
+#include "App.h"
+#include "Boot.h"
+#include "GaugeRoutes.h"
+#include "Metrics.h"
+#include "WindStats.h"
+
+GaugeRouter GaugeRoutes;
+
+// Indexed by RouteField
+const RouteFieldInfo RouteFields[NUM_ROUTE_FIELDS] = {
+  { "", 0, [](const WxSample &s){ (void)s; return 0.0f; } },
+  { "wind_speed", WX_VALID_RAPID_WIND, [](const WxSample &s){ return s.WindSpeed; } },
+  { "wind_direction", WX_VALID_RAPID_WIND, [](const WxSample &s){ return (float)s.WindDirection; } },
+  { "air_temperature", WX_VALID_OBS_ST, [](const WxSample &s){ return s.AirTemperature; } },
+  { "wind_average", WX_VALID_OBS_ST, [](const WxSample &s){ return s.WindAverage; } },
+  { "wind_gust", WX_VALID_OBS_ST, [](const WxSample &s){ return s.WindGust; } },
+  { "pressure", WX_VALID_OBS_ST, [](const WxSample &s){ return s.Pressure; } },
+  { "humidity", WX_VALID_OBS_ST, [](const WxSample &s){ return s.Humidity; } },
+  { "uv", WX_VALID_OBS_ST, [](const WxSample &s){ return s.Uv; } },
+  { "brightness", WX_VALID_OBS_ST, [](const WxSample &s){ return (float)s.Brightness; } },
+  { "solar_radiation", WX_VALID_OBS_ST, [](const WxSample &s){ return (float)s.SolarRadiation; } },
+  { "rain_rate", WX_VALID_OBS_ST, [](const WxSample &s){ return s.RainAmount * 60; } },    // in/hr
+  { "lightning_distance", WX_VALID_OBS_ST, [](const WxSample &s){ return s.StrikeDistance; } },
+  { "lightning_strikes", WX_VALID_OBS_ST, [](const WxSample &s){ return (float)s.StrikeCount; } },
+};
+const char *RouteOutputNames[NUM_ROUTE_OUTPUTS] = { "pwm", "mcp" };
+const char *RouteScaleNames[NUM_ROUTE_SCALES] = { "linear", "wind", "temp" };
+
+// LEDC channels, the gauge lamps keep theirs
+#define ROUTE_PWM_CHANNELS 16
+#define ROUTE_BAR_LEDS 8
+
+// Linear routes jump straight to each sample
+static const GaugeSettings NoSlew = {0, 0, 0, 0, 0};
+
+// The rolling statistic a gauge is set to show, in place of the sample
+static float windShown(int iShow, float fInstant){
+  switch( iShow ){
+    case gsAverage2m: return WindStats.Average(ww2Min);
+    case gsAverage10m: return WindStats.Average(ww10Min);
+    case gsGust2m: return WindStats.Gust(ww2Min);
+    case gsGust10m: return WindStats.Gust(ww10Min);
+    case gsLull2m: return WindStats.Lull(ww2Min);
+    case gsLull10m: return WindStats.Lull(ww10Min);
+    default: return fInstant;
+  }
+}
+
+
+// ##################################################################
+// # Route text
+// ##################################################################
+
+static int nameFind(const char *const *chNames, size_t numNames, const char *chName){
+  for( size_t i = 0; i < numNames; i++ ){
+    if( strcmp(chNames[i], chName) == 0 )return (int)i;
+  }
+  return -1;
+}
+
+bool routeParse(const char *chLine, GaugeRoute &route){
+  char chField[24], chOutput[8], chChannel[12], chScale[8];
+  float fMin = 0, fMax = 0;
+  route = GaugeRoute();
+  int iItems = sscanf(chLine, "%23s %7s %11s %7s %f %f", chField, chOutput, chChannel, chScale, &fMin, &fMax);
+  if( iItems <= 0 )return true;
+  if( iItems < 4 )return false;
+
+  int iField = -1;
+  for( int i = rfNone + 1; i < NUM_ROUTE_FIELDS && iField < 0; i++ ){
+    if( strcmp(RouteFields[i].Name, chField) == 0 )iField = i;
+  }
+  int iOutput = nameFind(RouteOutputNames, NUM_ROUTE_OUTPUTS, chOutput);
+  int iScale = nameFind(RouteScaleNames, NUM_ROUTE_SCALES, chScale);
+  if( iField < 0 || iOutput < 0 || iScale < 0 )return false;
+
+  unsigned uChannel = 0, uPin = 0;
+  if( iOutput == roPwm ){
+    if( sscanf(chChannel, "%u/%u", &uChannel, &uPin) != 2 || uChannel >= ROUTE_PWM_CHANNELS || uPin > 39 )return false;
+    if( uChannel == LED1CHANNEL || uChannel == LED2CHANNEL )return false;
+  }
+  else if( sscanf(chChannel, "%u", &uChannel) != 1 || uChannel >= EXPANDER_BANKS )return false;
+  if( iScale == rsLinear && (iItems < 6 || !(fMax > fMin)) )return false;
+
+  route = GaugeRoute(iField, iOutput, uChannel, uPin, iScale);
+  if( iScale == rsLinear ){
+    route.Min = fMin;
+    route.Max = fMax;
+  }
+  return true;
+}
+
+size_t routeFormat(const GaugeRoute &route, char *chOut, size_t maxLen){
+  int iLen;
+  char chChannel[12];
+  if( route.Field == rfNone || route.Field >= NUM_ROUTE_FIELDS || route.Output >= NUM_ROUTE_OUTPUTS
+      || route.Scale >= NUM_ROUTE_SCALES ){
+    chOut[0] = 0;
+    return 0;
+  }
+  if( route.Output == roPwm )snprintf(chChannel, sizeof(chChannel), "%u/%u", route.Channel, route.Pin);
+  else snprintf(chChannel, sizeof(chChannel), "%u", route.Channel);
+  if( route.Scale == rsLinear ){
+    iLen = snprintf(chOut, maxLen, "%s %s %s %s %g %g", RouteFields[route.Field].Name,
+      RouteOutputNames[route.Output], chChannel, RouteScaleNames[route.Scale], route.Min, route.Max);
+  }
+  else{
+    iLen = snprintf(chOut, maxLen, "%s %s %s %s", RouteFields[route.Field].Name,
+      RouteOutputNames[route.Output], chChannel, RouteScaleNames[route.Scale]);
+  }
+  if( iLen < 0 )return 0;
+  return (size_t)iLen < maxLen ? (size_t)iLen : maxLen - 1;
+}
+
+bool routesValid(const GaugeRouteSettings &routes){
+  uint32_t u32Pwm = 0, u32Banks = 0;
+  for( size_t i = 0; i < GAUGE_ROUTES; i++ ){
+    const GaugeRoute &route = routes.Route[i];
+    if( route.Field == rfNone )continue;
+    uint32_t &u32Used = route.Output == roPwm ? u32Pwm : u32Banks;
+    if( u32Used & (1UL << route.Channel) )return false;
+    u32Used |= 1UL << route.Channel;
+  }
+  return true;
+}
+
+
+// ##################################################################
+// # Dispatch
+// ##################################################################
+
+void GaugeRouter::Begin(const GaugeRouteSettings &routes){
+  uint32_t u32Banks = 0;
+  RapidWind.numOutputs = Obs.numOutputs = 0;
+  for( uint8_t i = 0; i < GAUGE_ROUTES; i++ ){
+    const GaugeRoute &route = routes.Route[i];
+    if( route.Field == rfNone || route.Field >= NUM_ROUTE_FIELDS )continue;
+
+    Output out;
+    out.Field = route.Field;
+    out.Channel = route.Channel;
+    out.Route = i;
+    out.Transfer = route.Scale == rsWind ? &WindGauge : route.Scale == rsTemp ? &TempGauge : NULL;
+    out.Gauge = route.Scale == rsWind ? &Settings.Config.Wind : route.Scale == rsTemp ? &Settings.Config.Temp : NULL;
+    out.fMin = route.Min;
+    out.fMax = route.Max;
+    out.fDutyPerUnit = route.Max > route.Min ? GAUGE_PWM_MAX / (route.Max - route.Min) : 0;
+
+    if( route.Output == roPwm ){
+      out.Kind = okPwm;
+      // PWM freq 5 kHz, 13-bit timer resolution
+      Hal.Pwm->Setup(route.Channel, route.Pin, 5000, 13);
+      // Straight back to where the needle was before a restart
+      uint32_t u32Duty = 0;
+      Boot.Output(i, u32Duty);
+      ledcAnalogWrite(route.Channel, u32Duty);
+      Needles[i].Begin(route.Channel, u32Duty);
+    }
+    else{
+      out.Kind = route.Field == rfWindDirection ? okCompass : okBar;
+      if( !(u32Banks & (1UL << route.Channel)) && !Hal.Expander->Begin(route.Channel) ){
+        debug(1, "\n\rFailed to startup MCP23008 bank %u!", route.Channel);
+      }
+      u32Banks |= 1UL << route.Channel;
+    }
+
+    DispatchList &list = RouteFields[route.Field].Message == WX_VALID_RAPID_WIND ? RapidWind : Obs;
+    list.Outputs[list.numOutputs++] = out;
+  }
+  invalidateExpanders();
+  for( uint8_t i = 0; i < GAUGE_ROUTES; i++ ){
+    uint32_t u32Pattern = 0;
+    if( routes.Route[i].Field == rfNone || routes.Route[i].Output != roExpander )continue;
+    Boot.Output(i, u32Pattern);
+    writeExpander(routes.Route[i].Channel, (uint8_t)u32Pattern);
+  }
+}
+
+uint32_t GaugeRouter::duty(const Output &out, float fValue) const{
+  StageTimer timer(msScale);
+  if( out.Transfer )return out.Transfer->Scale(fValue);
+  float fDuty = (fValue - out.fMin) * out.fDutyPerUnit;
+  if( !(fDuty > 0) )return 0;
+  return fDuty < GAUGE_PWM_MAX ? (uint32_t)fDuty : GAUGE_PWM_MAX;
+}
+
+// LEDs lit from the bottom, as many as the duty is of the full scale
+static uint8_t barPattern(uint32_t u32Duty){
+  uint32_t u32Lit = (u32Duty * ROUTE_BAR_LEDS + GAUGE_PWM_MAX / 2) / GAUGE_PWM_MAX;
+  return (uint8_t)((1UL << u32Lit) - 1);
+}
+
+void GaugeRouter::write(const Output &out, const WxSample &sample, float fValue, uint32_t u32NowMs){
+  switch( out.Kind ){
+    case okPwm:{
+        uint32_t u32Duty = duty(out, fValue);
+        debug(2, "\n\r\t%s PWM %u: %u", RouteFields[out.Field].Name, out.Channel, u32Duty);
+        Needles[out.Route].MoveTo(u32Duty, out.Gauge ? *out.Gauge : NoSlew, u32NowMs);
+        Boot.SetOutput(out.Route, u32Duty);
+      }
+      break;
+    case okCompass:{
+        StageTimer timer(msLeds);
+        // Dark below the wind speed threshold, only while live
+        bool bDark = out.Gauge && (sample.Valid & WX_VALID_RAPID_WIND) && sample.WindSpeed < out.Gauge->threshold;
+        uint8_t u8Pattern = 0x00;
+        if( !bDark ){
+          WindSummary stats;
+          if( Settings.Config.WindLeds.Arc && (sample.Valid & WX_VALID_RAPID_WIND) )stats = WindStats.Summary(ww10Min);
+          u8Pattern = stats.Direction >= 0 ? encodeWindArc(stats.Direction, stats.Variability) : encodeWind((int)fValue);
+        }
+        debug(2, "\n\r\tWind direction code: 0x%02X", u8Pattern);
+        writeExpander(out.Channel, u8Pattern);
+        Boot.SetOutput(out.Route, u8Pattern);
+      }
+      break;
+    default:{
+        uint32_t u32Duty = duty(out, fValue);
+        StageTimer timer(msLeds);
+        uint8_t u8Pattern = barPattern(u32Duty);
+        writeExpander(out.Channel, u8Pattern);
+        Boot.SetOutput(out.Route, u8Pattern);
+      }
+      break;
+  }
+}
+
+void GaugeRouter::Dispatch(const WxSample &sample, uint32_t u32NowMs){
+  if( sample.Valid & WX_VALID_RAPID_WIND ){
+    for( uint8_t i = 0; i < RapidWind.numOutputs; i++ ){
+      const Output &out = RapidWind.Outputs[i];
+      float fValue = RouteFields[out.Field].Read(sample);
+      if( out.Field == rfWindSpeed && out.Gauge )fValue = windShown(out.Gauge->show, fValue);
+      write(out, sample, fValue, u32NowMs);
+    }
+  }
+  if( sample.Valid & WX_VALID_OBS_ST ){
+    for( uint8_t i = 0; i < Obs.numOutputs; i++ ){
+      const Output &out = Obs.Outputs[i];
+      write(out, sample, RouteFields[out.Field].Read(sample), u32NowMs);
+    }
+  }
+}
+
+uint32_t GaugeRouter::Service(uint32_t u32NowMs){
+  const DispatchList *lists[] = { &RapidWind, &Obs };
+  uint32_t u32Next = SLEW_IDLE;
+  for( const DispatchList *list : lists ){
+    for( uint8_t i = 0; i < list->numOutputs; i++ ){
+      if( list->Outputs[i].Kind != okPwm )continue;
+      uint32_t u32Ms = Needles[list->Outputs[i].Route].Service(u32NowMs);
+      if( u32Ms < u32Next )u32Next = u32Ms;
+    }
+  }
+  return u32Next;
+}
+
+void GaugeRouter::Stop(void){
+  for( uint8_t i = 0; i < GAUGE_ROUTES; i++ )Needles[i].Stop();
+}
+
+void GaugeRouter::Park(uint8_t u8Percent, bool bBlank, uint32_t u32NowMs){
+  const DispatchList *lists[] = { &RapidWind, &Obs };
+  const float fPark = std::min(u8Percent, (uint8_t)100) / 100.0f;
+  for( const DispatchList *list : lists ){
+    for( uint8_t i = 0; i < list->numOutputs; i++ ){
+      const Output &out = list->Outputs[i];
+      const float fMin = scaleMin(out);
+      const uint32_t u32Duty = duty(out, fMin + (scaleMax(out) - fMin) * fPark);
+      if( out.Kind == okPwm )Needles[out.Route].MoveTo(u32Duty, out.Gauge ? *out.Gauge : NoSlew, u32NowMs);
+      else if( out.Kind == okBar )writeExpander(out.Channel, barPattern(u32Duty));
+      else if( bBlank )writeExpander(out.Channel, 0x00);
+    }
+  }
+}
+
+// Steps across the scale, the last one at the top, few enough that the
+// sweep up and back counts in a byte
+#define CAL_STEPS_MAX 64
+static uint8_t calSteps(float fSpan, float fStep){
+  if( !(fStep > 0) || !(fSpan > 0) )return 1;
+  float fSteps = ceilf(fSpan / fStep) + 1;
+  return fSteps < CAL_STEPS_MAX ? (uint8_t)fSteps : CAL_STEPS_MAX;
+}
+
+uint8_t GaugeRouter::CalibrationSteps(void) const{
+  const DispatchList *lists[] = { &RapidWind, &Obs };
+  uint8_t u8Steps = 1;
+  for( const DispatchList *list : lists ){
+    for( uint8_t i = 0; i < list->numOutputs; i++ ){
+      const Output &out = list->Outputs[i];
+      const float fSpan = scaleMax(out) - scaleMin(out);
+      uint8_t u8Out = out.Kind == okCompass ? WIND_SECTORS :
+        calSteps(fSpan, out.Gauge ? out.Gauge->step : fSpan / 8);
+      if( u8Out > u8Steps )u8Steps = u8Out;
+    }
+  }
+  return u8Steps;
+}
+
+// Outputs with fewer steps than the longest hold at the top of their scale
+void GaugeRouter::CalibrateStep(uint8_t u8Step){
+  static const WxSample Nothing;
+  const DispatchList *lists[] = { &RapidWind, &Obs };
+  for( const DispatchList *list : lists ){
+    for( uint8_t i = 0; i < list->numOutputs; i++ ){
+      const Output &out = list->Outputs[i];
+      float fValue;
+      if( out.Kind == okCompass )fValue = std::min(u8Step, (uint8_t)(WIND_SECTORS - 1)) * (360.0f / WIND_SECTORS);
+      else{
+        const float fMin = scaleMin(out), fMax = scaleMax(out);
+        fValue = std::min(fMin + u8Step * (out.Gauge ? out.Gauge->step : (fMax - fMin) / 8), fMax);
+      }
+      debug(1, "\n\r%s: %.2f", RouteFields[out.Field].Name, fValue);
+      if( out.Kind == okPwm )ledcAnalogWrite(out.Channel, duty(out, fValue));
+      else write(out, Nothing, fValue, 0);
+    }
+  }
+}
+
+void GaugeRouter::CalibrateDuty(const GaugeSettings *pGauge, uint32_t u32Duty){
+  const DispatchList *lists[] = { &RapidWind, &Obs };
+  for( const DispatchList *list : lists ){
+    for( uint8_t i = 0; i < list->numOutputs; i++ ){
+      const Output &out = list->Outputs[i];
+      if( out.Kind == okPwm && out.Gauge == pGauge )ledcAnalogWrite(out.Channel, u32Duty);
+    }
+  }
+}
+
+size_t GaugeRouter::Outputs(uint8_t u8Message) const{
+  return u8Message == WX_VALID_RAPID_WIND ? RapidWind.numOutputs : Obs.numOutputs;
+}
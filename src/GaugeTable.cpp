@@ -0,0 +1,81 @@
+#include "GaugeTable.h"
+
+// Evaluate the piecewise-linear curve, points ascending by value.  Values
+// outside the curve hold the end points.  Only used to build the table.
+static double evalCurve(const GaugeCalPoint *points, int numPoints, double dValue){
+  if( dValue <= points[0].value )return points[0].pwm;
+  for( int i = 1; i < numPoints; i++ ){
+    if( dValue > points[i].value )continue;
+    double dSpan = points[i].value - points[i-1].value;
+    if( dSpan <= 0 )return points[i].pwm;
+    return points[i-1].pwm + (points[i].pwm - points[i-1].pwm) * (dValue - points[i-1].value) / dSpan;
+  }
+  return points[numPoints-1].pwm;
+}
+
+void GaugeTable::Build(const GaugeSettings &gauge){
+  GaugeCalPoint points[GAUGE_CAL_POINTS];
+  int numPoints = gauge.calPoints;
+  double dRange = gauge.max - gauge.min;
+  if( dRange <= 0 )dRange = 1;
+
+  if( numPoints >= 2 && numPoints <= GAUGE_CAL_POINTS ){
+    // Insertion sort, the web UI does not promise any order
+    for( int i = 0; i < numPoints; i++ ){
+      GaugeCalPoint point = gauge.cal[i];
+      int j = i;
+      for( ; j > 0 && points[j-1].value > point.value; j-- )points[j] = points[j-1];
+      points[j] = point;
+    }
+  }
+  else{
+    // No curve, straight line with the gain as the 50% PWM point
+    numPoints = 2;
+    points[0].value = gauge.min;
+    points[0].pwm = 0;
+    points[1].value = gauge.max;
+    points[1].pwm = (int)(gauge.gain * 2);
+  }
+
+  fMin = gauge.min;
+  fScaleQ16 = (float)(GAUGE_TABLE_SEGMENTS * 65536.0 / dRange);
+  for( int i = 0; i <= GAUGE_TABLE_SEGMENTS; i++ ){
+    double dPwm = evalCurve(points, numPoints, gauge.min + dRange * i / GAUGE_TABLE_SEGMENTS);
+    if( dPwm < 0 )dPwm = 0;
+    if( dPwm > GAUGE_PWM_MAX )dPwm = GAUGE_PWM_MAX;
+    u16Table[i] = (uint16_t)dPwm;
+  }
+}
+
+uint32_t GaugeTable::Lookup(float fValue) const{
+  float fPos = (fValue - fMin) * fScaleQ16;
+  if( !(fPos > 0) )return u16Table[0];
+  if( fPos >= (float)(GAUGE_TABLE_SEGMENTS << 16) )return u16Table[GAUGE_TABLE_SEGMENTS];
+
+  uint32_t u32Pos = (uint32_t)fPos;
+  uint32_t u32Idx = u32Pos >> 16;
+  int32_t i32Frac = (int32_t)(u32Pos & 0xFFFF);
+  int32_t i32Lo = u16Table[u32Idx];
+  int32_t i32Hi = u16Table[u32Idx + 1];
+  return (uint32_t)(i32Lo + (((i32Hi - i32Lo) * i32Frac) >> 16));
+}
+
+// Single writer, the table not in use is built while the sequence is odd
+void GaugeTransfer::Rebuild(const GaugeSettings &gauge){
+  uint32_t u32Next = __atomic_load_n(&u32Seq, __ATOMIC_RELAXED) + 1;
+  __atomic_store_n(&u32Seq, u32Next, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  Tables[((u32Next >> 1) & 1) ^ 1].Build(gauge);
+  __atomic_store_n(&u32Seq, u32Next + 1, __ATOMIC_RELEASE);
+}
+
+// Acquire only on the read side, scaling is on every gauge update
+uint32_t GaugeTransfer::Scale(float fValue) const{
+  uint32_t u32Before, u32Duty;
+  do{
+    u32Before = __atomic_load_n(&u32Seq, __ATOMIC_ACQUIRE);
+    u32Duty = Tables[(u32Before >> 1) & 1].Lookup(fValue);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  }while( __atomic_load_n(&u32Seq, __ATOMIC_RELAXED) - u32Before >= 2 );
+  return u32Duty;
+}
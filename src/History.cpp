@@ -0,0 +1,268 @@
+#include <math.h>
+#include <string.h>
+#include "Hal.h"
+#include "History.h"
+
+WxHistory History;
+
+const char *HistorySeriesNames[NUM_HISTORY_SERIES] = { "wind", "obs", "wind_1m", "wind_10m",
+  "temp_1m", "temp_10m" };
+
+static void *allocArray(size_t count, size_t size){
+  return Hal.Sys->AllocExternal(count * size);
+}
+
+static int16_t toFixed(float fValue){
+  float fScaled = roundf(fValue * 100.0f);
+  if( fScaled > INT16_MAX )return INT16_MAX;
+  if( fScaled < INT16_MIN )return INT16_MIN;
+  return (int16_t)fScaled;
+}
+
+static uint8_t *putU32(uint8_t *p, uint32_t u32Value){
+  p[0] = u32Value; p[1] = u32Value >> 8; p[2] = u32Value >> 16; p[3] = u32Value >> 24;
+  return p + 4;
+}
+
+static uint8_t *putU16(uint8_t *p, uint16_t u16Value){
+  p[0] = u16Value; p[1] = u16Value >> 8;
+  return p + 2;
+}
+
+// Make the record stores visible before the new ring total
+static void publish(HistoryRing &ring){
+  __sync_synchronize();
+  ring.Total = ring.Total + 1;
+}
+
+
+// ##################################################################
+// # Downsampled tiers
+// ##################################################################
+
+bool HistoryTier::Begin(uint32_t u32Capacity, uint32_t u32SecondsIn){
+  u32Seconds = u32SecondsIn;
+  pStart = (uint32_t *)allocArray(u32Capacity, sizeof(uint32_t));
+  pMin = (int16_t *)allocArray(u32Capacity, sizeof(int16_t));
+  pMean = (int16_t *)allocArray(u32Capacity, sizeof(int16_t));
+  pMax = (int16_t *)allocArray(u32Capacity, sizeof(int16_t));
+  if( !pStart || !pMin || !pMean || !pMax )return false;
+  Ring.Capacity = u32Capacity;
+  return true;
+}
+
+void HistoryTier::Add(uint32_t u32Epoch, int16_t i16Value){
+  uint32_t u32SampleBucket = u32Epoch / u32Seconds;
+  // Late, its bucket is out already
+  if( u32SampleBucket < u32Published || (u16Count && u32SampleBucket < u32Bucket) )return;
+  // Sample is in a new interval, publish the finished one
+  if( u16Count && u32SampleBucket != u32Bucket )flush();
+  if( !u16Count ){
+    u32Bucket = u32SampleBucket;
+    i32Sum = 0;
+    i16Min = i16Max = i16Value;
+  }
+  i32Sum += i16Value;
+  u16Count++;
+  if( i16Value < i16Min )i16Min = i16Value;
+  if( i16Value > i16Max )i16Max = i16Value;
+}
+
+void HistoryTier::Close(uint32_t u32Epoch){
+  if( u16Count && (u32Bucket + 1) * u32Seconds <= u32Epoch )flush();
+}
+
+void HistoryTier::flush(void){
+  uint32_t u32Slot = Ring.Slot(Ring.Total);
+  pStart[u32Slot] = u32Bucket * u32Seconds;
+  pMin[u32Slot] = i16Min;
+  pMean[u32Slot] = (int16_t)(i32Sum / u16Count);
+  pMax[u32Slot] = i16Max;
+  publish(Ring);
+  u32Published = u32Bucket + 1;
+  u16Count = 0;
+}
+
+size_t HistoryTier::Encode(uint32_t u32Seq, uint8_t *pOut) const{
+  uint32_t u32Slot = Ring.Slot(u32Seq);
+  uint8_t *p = putU32(pOut, pStart[u32Slot]);
+  p = putU16(p, pMin[u32Slot]);
+  p = putU16(p, pMean[u32Slot]);
+  p = putU16(p, pMax[u32Slot]);
+  return p - pOut;
+}
+
+
+// ##################################################################
+// # Raw samples
+// ##################################################################
+
+bool WxHistory::Begin(void){
+  pWindEpoch = (uint32_t *)allocArray(HISTORY_WIND_RAW, sizeof(uint32_t));
+  pWindSpeed = (uint16_t *)allocArray(HISTORY_WIND_RAW, sizeof(uint16_t));
+  pWindDir = (uint16_t *)allocArray(HISTORY_WIND_RAW, sizeof(uint16_t));
+  pObsEpoch = (uint32_t *)allocArray(HISTORY_OBS_RAW, sizeof(uint32_t));
+  pObsTemp = (int16_t *)allocArray(HISTORY_OBS_RAW, sizeof(int16_t));
+  if( !pWindEpoch || !pWindSpeed || !pWindDir || !pObsEpoch || !pObsTemp )return false;
+  WindRing.Capacity = HISTORY_WIND_RAW;
+  ObsRing.Capacity = HISTORY_OBS_RAW;
+
+  bActive = Wind1m.Begin(HISTORY_TIER_1M, 60) && Wind10m.Begin(HISTORY_TIER_10M, 600)
+    && Temp1m.Begin(HISTORY_TIER_1M, 60) && Temp10m.Begin(HISTORY_TIER_10M, 600);
+  return bActive;
+}
+
+void WxHistory::Add(const WxSample &sample){
+  if( !bActive || !sample.EpochTime )return;
+
+  if( sample.Valid & WX_VALID_RAPID_WIND ){
+    int16_t i16Speed = toFixed(sample.WindSpeed);
+    if( i16Speed < 0 )i16Speed = 0;
+    uint32_t u32Slot = WindRing.Slot(WindRing.Total);
+    pWindEpoch[u32Slot] = sample.EpochTime;
+    pWindSpeed[u32Slot] = i16Speed;
+    pWindDir[u32Slot] = (uint16_t)sample.WindDirection;
+    publish(WindRing);
+  }
+  if( sample.Valid & WX_VALID_OBS_ST ){
+    int16_t i16Temp = toFixed(sample.AirTemperature);
+    uint32_t u32Slot = ObsRing.Slot(ObsRing.Total);
+    pObsEpoch[u32Slot] = sample.EpochTime;
+    pObsTemp[u32Slot] = i16Temp;
+    publish(ObsRing);
+  }
+}
+
+void WxHistory::Downsample(uint32_t u32Epoch){
+  if( !bActive )return;
+
+  // A record lapped while it was read is skipped, as for a download
+  const uint32_t u32WindEnd = WindRing.Total;
+  __sync_synchronize();
+  if( u32WindFed < WindRing.Oldest() )u32WindFed = WindRing.Oldest();
+  for( ; u32WindFed < u32WindEnd; u32WindFed++ ){
+    uint32_t u32Slot = WindRing.Slot(u32WindFed);
+    uint32_t u32SampleEpoch = pWindEpoch[u32Slot];
+    int16_t i16Speed = (int16_t)pWindSpeed[u32Slot];
+    __sync_synchronize();
+    if( !WindRing.Holds(u32WindFed) )continue;
+    Wind1m.Add(u32SampleEpoch, i16Speed);
+    Wind10m.Add(u32SampleEpoch, i16Speed);
+  }
+
+  const uint32_t u32ObsEnd = ObsRing.Total;
+  __sync_synchronize();
+  if( u32ObsFed < ObsRing.Oldest() )u32ObsFed = ObsRing.Oldest();
+  for( ; u32ObsFed < u32ObsEnd; u32ObsFed++ ){
+    uint32_t u32Slot = ObsRing.Slot(u32ObsFed);
+    uint32_t u32SampleEpoch = pObsEpoch[u32Slot];
+    int16_t i16Temp = pObsTemp[u32Slot];
+    __sync_synchronize();
+    if( !ObsRing.Holds(u32ObsFed) )continue;
+    Temp1m.Add(u32SampleEpoch, i16Temp);
+    Temp10m.Add(u32SampleEpoch, i16Temp);
+  }
+
+  Wind1m.Close(u32Epoch);
+  Wind10m.Close(u32Epoch);
+  Temp1m.Close(u32Epoch);
+  Temp10m.Close(u32Epoch);
+}
+
+const HistoryRing &WxHistory::Ring(HistorySeries series) const{
+  switch( series ){
+    case hsWindRaw: return WindRing;
+    case hsObsRaw: return ObsRing;
+    case hsWind1m: return Wind1m.Ring;
+    case hsWind10m: return Wind10m.Ring;
+    case hsTemp1m: return Temp1m.Ring;
+    default: return Temp10m.Ring;
+  }
+}
+
+uint32_t WxHistory::Epoch(HistorySeries series, uint32_t u32Seq) const{
+  switch( series ){
+    case hsWindRaw: return pWindEpoch[WindRing.Slot(u32Seq)];
+    case hsObsRaw: return pObsEpoch[ObsRing.Slot(u32Seq)];
+    case hsWind1m: return Wind1m.Epoch(u32Seq);
+    case hsWind10m: return Wind10m.Epoch(u32Seq);
+    case hsTemp1m: return Temp1m.Epoch(u32Seq);
+    default: return Temp10m.Epoch(u32Seq);
+  }
+}
+
+size_t WxHistory::Encode(HistorySeries series, uint32_t u32Seq, uint8_t *pOut) const{
+  uint8_t *p = pOut;
+  switch( series ){
+    case hsWindRaw:{
+        uint32_t u32Slot = WindRing.Slot(u32Seq);
+        p = putU32(p, pWindEpoch[u32Slot]);
+        p = putU16(p, pWindSpeed[u32Slot]);
+        p = putU16(p, pWindDir[u32Slot]);
+        return p - pOut;
+      }
+    case hsObsRaw:{
+        uint32_t u32Slot = ObsRing.Slot(u32Seq);
+        p = putU32(p, pObsEpoch[u32Slot]);
+        p = putU16(p, pObsTemp[u32Slot]);
+        return p - pOut;
+      }
+    case hsWind1m: return Wind1m.Encode(u32Seq, pOut);
+    case hsWind10m: return Wind10m.Encode(u32Seq, pOut);
+    case hsTemp1m: return Temp1m.Encode(u32Seq, pOut);
+    default: return Temp10m.Encode(u32Seq, pOut);
+  }
+}
+
+
+// ##################################################################
+// # Binary download
+// ##################################################################
+
+static const uint8_t u8RecordSize[NUM_HISTORY_SERIES] = { 8, 6, 10, 10, 10, 10 };
+
+HistoryCursor::HistoryCursor(const WxHistory &history, HistorySeries series, uint32_t u32Since)
+  : pHistory(&history), Series(series){
+  const HistoryRing &ring = history.Ring(series);
+  // Snapshot the end, records added during the download are left for the next one
+  u32End = history.Active() ? ring.Total : 0;
+  u32Seq = history.Active() ? ring.Oldest() : 0;
+
+  // Epochs ascend through the ring, binary search for the start
+  uint32_t u32High = u32End;
+  while( u32Seq < u32High ){
+    uint32_t u32Mid = u32Seq + (u32High - u32Seq) / 2;
+    if( history.Epoch(series, u32Mid) < u32Since )u32Seq = u32Mid + 1;
+    else u32High = u32Mid;
+  }
+}
+
+size_t HistoryCursor::Fill(uint8_t *pBuffer, size_t maxLen){
+  const HistoryRing &ring = pHistory->Ring(Series);
+  const size_t recordSize = u8RecordSize[Series];
+  size_t len = 0;
+
+  if( !bHeader ){
+    if( maxLen < HISTORY_HEADER_SIZE )return 0;
+    const uint8_t u8Header[HISTORY_HEADER_SIZE] = { 'W', 'X', 'H', 1, Series, (uint8_t)recordSize, 0, 0 };
+    memcpy(pBuffer, u8Header, sizeof(u8Header));
+    len = sizeof(u8Header);
+    bHeader = true;
+  }
+
+  // Skip anything the writer has lapped since the last fill
+  if( !ring.Holds(u32Seq) )u32Seq = ring.Oldest();
+  while( u32Seq < u32End && len + recordSize <= maxLen ){
+    uint8_t u8Record[HISTORY_MAX_RECORD];
+    pHistory->Encode(Series, u32Seq, u8Record);
+    // Overwritten while it was copied out, move on to the oldest still held
+    if( !ring.Holds(u32Seq) ){
+      u32Seq = ring.Oldest();
+      continue;
+    }
+    memcpy(pBuffer + len, u8Record, recordSize);
+    len += recordSize;
+    u32Seq++;
+  }
+  return len;
+}
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <string.h>
+#include "App.h"
+#include "Ingest.h"
+#include "Metrics.h"
+
+WxIngest Ingest;
+
+// Serial numbers are letters, digits and dashes, anything else (and
+// with it anything that would need escaping in a label) is no sender
+static bool serialValid(const char *chSerial, size_t len){
+  if( !chSerial || !len || len >= INGEST_SERIAL_LEN )return false;
+  for( size_t i = 0; i < len; i++ ){
+    char ch = chSerial[i];
+    if( !((ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z') || (ch >= '0' && ch <= '9') || ch == '-') )return false;
+  }
+  return true;
+}
+
+static bool allowed(const IngestAllow &allow, const char *chSerial, size_t len){
+  if( !chSerial )return false;
+  for( uint8_t i = 0; i < allow.Count; i++ ){
+    if( allow.Len[i] <= len && memcmp(chSerial, allow.Prefix[i], allow.Len[i]) == 0 )return true;
+  }
+  return false;
+}
+
+bool ingestAllowParse(const char *chText, IngestAllow &allow){
+  allow.Count = 0;
+  for( const char *p = chText; ; ){
+    p += strspn(p, " ,\t");
+    if( !*p )return true;
+    size_t len = strcspn(p, " ,\t");
+    if( allow.Count == INGEST_ALLOW_MAX || !serialValid(p, len) )return false;
+    memcpy(allow.Prefix[allow.Count], p, len);
+    allow.Prefix[allow.Count][len] = 0;
+    allow.Len[allow.Count++] = (uint8_t)len;
+    p += len;
+  }
+}
+
+void WxIngest::Configure(const IngestSettings &ingest){
+  IngestAllow allow;
+  if( !ingestAllowParse(ingest.Allow, allow) ){
+    debug(1, "\n\rBad station allow list, taking every station: %s", ingest.Allow);
+    allow.Count = 0;
+  }
+  Allow.Write(allow);
+}
+
+// Table index of a sender, added when first seen, WX_NO_SOURCE once full
+uint8_t WxIngest::source(const char *chSerial, size_t len){
+  if( !serialValid(chSerial, len) )return WX_NO_SOURCE;
+  const uint8_t u8Count = u8NumSources.load(std::memory_order_relaxed);
+  for( uint8_t i = 0; i < u8Count; i++ ){
+    if( memcmp(Table[i].Serial, chSerial, len) == 0 && Table[i].Serial[len] == 0 )return i;
+  }
+  if( u8Count == INGEST_SOURCES )return WX_NO_SOURCE;
+  memcpy(Table[u8Count].Serial, chSerial, len);
+  Table[u8Count].Serial[len] = 0;
+  u8NumSources.store(u8Count + 1, std::memory_order_release);
+  return u8Count;
+}
+
+bool WxIngest::Decode(const char *chData, size_t len, WxSample &sample){
+  size_t serialLen, hubLen;
+  const char *chSerial = wxStringValue(chData, len, "\"serial_number\"", serialLen);
+  const uint8_t u8Source = source(chSerial, serialLen);
+  if( u8Source != WX_NO_SOURCE )Table[u8Source].Datagrams.fetch_add(1, std::memory_order_relaxed);
+
+  // A station on the list, or one relayed by a hub on it
+  IngestAllow allow;
+  Allow.Read(allow);
+  if( allow.Count && !allowed(allow, chSerial, serialLen) ){
+    const char *chHub = wxStringValue(chData, len, "\"hub_sn\"", hubLen);
+    if( !allowed(allow, chHub, hubLen) ){
+      if( u8Source != WX_NO_SOURCE )Table[u8Source].Rejected.fetch_add(1, std::memory_order_relaxed);
+      Metrics.Count(mcDatagrams);
+      Metrics.Count(mcRejected);
+      return false;
+    }
+  }
+  if( !wxDecodeJson(chData, len, sample) )return false;
+  sample.Source = u8Source;
+  return true;
+}
+
+// A take racing the post may still see the older sample, and count it
+// replaced all the same
+void WxIngest::Post(const WxSample &sample){
+  const IngestSlot slot = sample.Valid & WX_VALID_RAPID_WIND ? isRapidWind : isObs;
+  if( (int32_t)(u32Posted[slot] - u32Taken[slot].load(std::memory_order_relaxed)) > 0 ){
+    Metrics.Count(mcQueueDrops);
+    if( u8PostedSource[slot] != WX_NO_SOURCE ){
+      Table[u8PostedSource[slot]].Replaced.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  Slots[slot].Write(sample);
+  u32Posted[slot]++;
+  u8PostedSource[slot] = sample.Source;
+}
+
+bool WxIngest::Take(WxSample &sample){
+  WxSample candidate;
+  int iSlot = -1;
+  uint32_t u32Write = 0;
+  for( int s = 0; s < NUM_INGEST_SLOTS; s++ ){
+    uint32_t u32Seen = Slots[s].Read(candidate);
+    if( (int32_t)(u32Seen - u32Taken[s].load(std::memory_order_relaxed)) <= 0 )continue;
+    if( iSlot < 0 || candidate.RxMicros < sample.RxMicros ){
+      sample = candidate;
+      iSlot = s;
+      u32Write = u32Seen;
+    }
+  }
+  if( iSlot < 0 )return false;
+  u32Taken[iSlot].store(u32Write, std::memory_order_relaxed);
+  return true;
+}
+
+size_t WxIngest::Status(char *chOut, size_t maxLen) const{
+  int iLen = snprintf(chOut, maxLen, "%u sources, %u rejected", (unsigned)Sources(),
+    (unsigned)Metrics.Counter(mcRejected));
+  if( iLen < 0 )return 0;
+  return (size_t)iLen < maxLen ? (size_t)iLen : maxLen - 1;
+}
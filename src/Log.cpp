@@ -0,0 +1,306 @@
+#include <atomic>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "Hal.h"
+#include "App.h"
+
+// ##################################################################
+// # Record ring
+// #
+// # Bounded MPSC queue, each slot carries a turn number saying whose
+// # it is: the producer whose claim is at that position, or the
+// # consumer once the record is published.  Producers claim a
+// # position with a CAS, a full ring drops the record.
+// ##################################################################
+
+struct LogRecord{
+    const char *Format;
+    uint8_t Level;
+    uint8_t Used;           // Bytes of Args
+    uint8_t Args[LOG_ARG_BYTES];
+};
+
+struct LogSlot{
+    // Sequence number less the slot index, so the zeroed start is
+    // every slot free for its first pass
+    std::atomic<uint32_t> Turn;
+    LogRecord Record;
+};
+
+static LogSlot logSlots[LOG_RECORDS];
+static std::atomic<uint32_t> u32LogHead(0);
+static uint32_t u32LogTail = 0;
+static std::atomic<uint32_t> u32LogDropped(0);
+static void (*logSink)(const char *chLine, size_t len) = NULL;
+
+static LogSlot *logClaim(uint32_t &u32Pos){
+  u32Pos = u32LogHead.load(std::memory_order_relaxed);
+  for(;;){
+    LogSlot &slot = logSlots[u32Pos & (LOG_RECORDS - 1)];
+    int32_t iDiff = (int32_t)(slot.Turn.load(std::memory_order_acquire) +
+      (u32Pos & (LOG_RECORDS - 1)) - u32Pos);
+    if( iDiff == 0 ){
+      if( u32LogHead.compare_exchange_weak(u32Pos, u32Pos + 1, std::memory_order_relaxed) )return &slot;
+    }
+    else if( iDiff < 0 )return NULL;
+    else u32Pos = u32LogHead.load(std::memory_order_relaxed);
+  }
+}
+
+static void logPublish(LogSlot *slot, uint32_t u32Pos){
+  slot->Turn.store(u32Pos + 1 - (u32Pos & (LOG_RECORDS - 1)), std::memory_order_release);
+}
+
+
+// ##################################################################
+// # Conversion specs
+// #
+// # Walked twice, to pull the arguments off the va_list when logging
+// # and to format them when draining.  %n and long double are not
+// # supported, the record stops there.
+// ##################################################################
+
+struct LogSpec{
+    const char *Start;      // The '%'
+    const char *End;        // Past the conversion
+    bool WidthArg;
+    bool PrecisionArg;
+    int Precision;          // -1 if none (or an argument)
+    char Length;            // 0, 'H' (hh), 'h', 'l', 'L' (ll), 'z', 'j', 't', 'D' (long double)
+    char Conv;
+};
+
+static bool logNextSpec(const char *chFmt, LogSpec &spec){
+  const char *p = strchr(chFmt, '%');
+  if( !p )return false;
+  spec = { p++, NULL, false, false, -1, 0, 0 };
+  while( *p && strchr("-+ #0", *p) )p++;
+  if( *p == '*' ){ spec.WidthArg = true; p++; }
+  else while( *p >= '0' && *p <= '9' )p++;
+  if( *p == '.' ){
+    p++;
+    if( *p == '*' ){ spec.PrecisionArg = true; p++; }
+    else{
+      spec.Precision = 0;
+      while( *p >= '0' && *p <= '9' )spec.Precision = spec.Precision * 10 + (*p++ - '0');
+    }
+  }
+  switch( *p ){
+    case 'h': spec.Length = p[1] == 'h' ? 'H' : 'h'; p += p[1] == 'h' ? 2 : 1; break;
+    case 'l': spec.Length = p[1] == 'l' ? 'L' : 'l'; p += p[1] == 'l' ? 2 : 1; break;
+    case 'z': case 'j': case 't': spec.Length = *p++; break;
+    case 'L': spec.Length = 'D'; p++; break;
+  }
+  spec.Conv = *p;
+  spec.End = *p ? p + 1 : p;
+  return true;
+}
+
+template <class T>
+static bool logPut(LogRecord &rec, T value){
+  if( rec.Used + sizeof(T) > LOG_ARG_BYTES )return false;
+  memcpy(rec.Args + rec.Used, &value, sizeof(T));
+  rec.Used += sizeof(T);
+  return true;
+}
+
+template <class T>
+static bool logGet(const LogRecord &rec, size_t &at, T &value){
+  if( at + sizeof(T) > rec.Used )return false;
+  memcpy(&value, rec.Args + at, sizeof(T));
+  at += sizeof(T);
+  return true;
+}
+
+static bool logPutString(LogRecord &rec, const char *chValue, int iPrecision){
+  if( !chValue )chValue = "(null)";
+  size_t len = iPrecision >= 0 ? strnlen(chValue, iPrecision) : strlen(chValue);
+  if( rec.Used >= LOG_ARG_BYTES )return false;
+  // Long strings are cut to what is left of the record
+  if( len > (size_t)(LOG_ARG_BYTES - rec.Used - 1) )len = LOG_ARG_BYTES - rec.Used - 1;
+  memcpy(rec.Args + rec.Used, chValue, len);
+  rec.Args[rec.Used + len] = 0;
+  rec.Used += len + 1;
+  return true;
+}
+
+// Integer conversions, by length modifier
+static bool logPutInt(LogRecord &rec, char length, va_list &args){
+  switch( length ){
+    case 'l': return logPut(rec, va_arg(args, long));
+    case 'L': return logPut(rec, va_arg(args, long long));
+    case 'z': return logPut(rec, va_arg(args, size_t));
+    case 'j': return logPut(rec, va_arg(args, intmax_t));
+    case 't': return logPut(rec, va_arg(args, ptrdiff_t));
+    default: return logPut(rec, va_arg(args, int));
+  }
+}
+
+static bool logPutArgs(LogRecord &rec, va_list &args){
+  LogSpec spec;
+  for( const char *p = rec.Format; logNextSpec(p, spec); p = spec.End ){
+    if( spec.Conv == '%' )continue;
+    int iPrecision = spec.Precision;
+    if( spec.WidthArg && !logPut(rec, va_arg(args, int)) )return false;
+    if( spec.PrecisionArg ){
+      iPrecision = va_arg(args, int);
+      if( !logPut(rec, iPrecision) )return false;
+    }
+    switch( spec.Conv ){
+      case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+        if( !logPutInt(rec, spec.Length, args) )return false;
+        break;
+      case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+        if( spec.Length == 'D' || !logPut(rec, va_arg(args, double)) )return false;
+        break;
+      case 's':
+        if( !logPutString(rec, va_arg(args, const char *), iPrecision) )return false;
+        break;
+      case 'p':
+        if( !logPut(rec, va_arg(args, void *)) )return false;
+        break;
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+// One conversion, the spec with '*' replaced by the captured values
+template <class T>
+static int logFormatValue(const char *chSpec, char *chOut, size_t maxLen, T value){
+  return snprintf(chOut, maxLen, chSpec, value);
+}
+
+static bool logFormatSpec(const LogRecord &rec, size_t &at, const LogSpec &spec, char *chOut,
+                          size_t maxLen, int &iLen){
+  char chSpec[32];
+  size_t specLen = 0;
+  for( const char *p = spec.Start; p < spec.End && specLen < sizeof(chSpec) - 12; p++ ){
+    if( *p != '*' ){
+      chSpec[specLen++] = *p;
+      continue;
+    }
+    int iArg;
+    if( !logGet(rec, at, iArg) )return false;
+    specLen += snprintf(chSpec + specLen, sizeof(chSpec) - specLen, "%d", iArg);
+  }
+  chSpec[specLen] = 0;
+
+  switch( spec.Conv ){
+    case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+      switch( spec.Length ){
+        case 'l':{ long v; if( !logGet(rec, at, v) )return false; iLen = logFormatValue(chSpec, chOut, maxLen, v); } break;
+        case 'L':{ long long v; if( !logGet(rec, at, v) )return false; iLen = logFormatValue(chSpec, chOut, maxLen, v); } break;
+        case 'z':{ size_t v; if( !logGet(rec, at, v) )return false; iLen = logFormatValue(chSpec, chOut, maxLen, v); } break;
+        case 'j':{ intmax_t v; if( !logGet(rec, at, v) )return false; iLen = logFormatValue(chSpec, chOut, maxLen, v); } break;
+        case 't':{ ptrdiff_t v; if( !logGet(rec, at, v) )return false; iLen = logFormatValue(chSpec, chOut, maxLen, v); } break;
+        default:{ int v; if( !logGet(rec, at, v) )return false; iLen = logFormatValue(chSpec, chOut, maxLen, v); } break;
+      }
+      break;
+    case 's':{
+        if( at >= rec.Used )return false;
+        const char *chValue = (const char *)rec.Args + at;
+        at += strlen(chValue) + 1;
+        iLen = logFormatValue(chSpec, chOut, maxLen, chValue);
+      }
+      break;
+    case 'p':{ void *v; if( !logGet(rec, at, v) )return false; iLen = logFormatValue(chSpec, chOut, maxLen, v); } break;
+    default:{ double v; if( !logGet(rec, at, v) )return false; iLen = logFormatValue(chSpec, chOut, maxLen, v); } break;
+  }
+  return true;
+}
+
+static size_t logFormat(const LogRecord &rec, char *chOut, size_t maxLen){
+  size_t len = 0, at = 0;
+  const char *p = rec.Format;
+  LogSpec spec;
+  auto append = [&](const char *chText, size_t textLen){
+    if( textLen > maxLen - 1 - len )textLen = maxLen - 1 - len;
+    memcpy(chOut + len, chText, textLen);
+    len += textLen;
+  };
+
+  for( ; logNextSpec(p, spec); p = spec.End ){
+    append(p, spec.Start - p);
+    if( spec.Conv == '%' ){
+      append("%", 1);
+      continue;
+    }
+    int iLen = 0;
+    if( !logFormatSpec(rec, at, spec, chOut + len, maxLen - len, iLen) ){
+      // Arguments that did not fit the record
+      append("...", 3);
+      chOut[len] = 0;
+      return len;
+    }
+    if( iLen > 0 )len += (size_t)iLen < maxLen - len ? (size_t)iLen : maxLen - 1 - len;
+  }
+  append(p, strlen(p));
+  chOut[len] = 0;
+  return len;
+}
+
+
+// ##################################################################
+// # Logging & draining
+// ##################################################################
+
+void logWrite(int level, const char *fmt, ...){
+  uint32_t u32Pos;
+  LogSlot *slot = logClaim(u32Pos);
+  if( !slot ){
+    u32LogDropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  LogRecord &rec = slot->Record;
+  rec.Format = fmt;
+  rec.Level = (uint8_t)level;
+  rec.Used = 0;
+  va_list args;
+  va_start(args, fmt);
+  logPutArgs(rec, args);
+  va_end(args);
+  logPublish(slot, u32Pos);
+}
+
+static void logEmit(const char *chLine, size_t len){
+  Hal.Sys->ConsoleWrite(chLine);
+  if( logSink )logSink(chLine, len);
+}
+
+size_t logFlush(void){
+  static uint32_t u32Reported = 0;
+  char chLine[LOG_LINE_LEN];
+  size_t count = 0;
+
+  uint32_t u32Dropped = u32LogDropped.load(std::memory_order_relaxed);
+  if( u32Dropped != u32Reported ){
+    int iLen = snprintf(chLine, sizeof(chLine), "\n\r[%u log records dropped]",
+      (unsigned)(u32Dropped - u32Reported));
+    u32Reported = u32Dropped;
+    logEmit(chLine, iLen);
+  }
+
+  for(;;){
+    const uint32_t u32Index = u32LogTail & (LOG_RECORDS - 1);
+    LogSlot &slot = logSlots[u32Index];
+    if( (int32_t)(slot.Turn.load(std::memory_order_acquire) + u32Index - (u32LogTail + 1)) < 0 )break;
+    size_t len = logFormat(slot.Record, chLine, sizeof(chLine));
+    // Hand the slot back for the producers' next pass
+    slot.Turn.store(u32LogTail + LOG_RECORDS - u32Index, std::memory_order_release);
+    u32LogTail++;
+    logEmit(chLine, len);
+    count++;
+  }
+  return count;
+}
+
+void logSetSink(void (*sink)(const char *chLine, size_t len)){
+  logSink = sink;
+}
+
+uint32_t logDropped(void){
+  return u32LogDropped.load(std::memory_order_relaxed);
+}
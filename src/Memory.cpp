@@ -0,0 +1,25 @@
+#include "App.h"
+#include "Hal.h"
+#include "Memory.h"
+
+MemoryMonitor Memory;
+
+const char *MemoryTaskNames[NUM_MEMORY_TASKS] = { "gauges", "wx_rx", "housekeeping", "async_tcp", "log" };
+
+// The housekeeping task is the only caller
+void MemoryMonitor::Sample(void){
+  Hal.Sys->Heap(heap);
+  for( int i = 0; i < NUM_MEMORY_TASKS; i++ ){
+    u32StackFree[i] = Hal.Sys->StackFree(MemoryTaskNames[i]);
+    if( u32StackFree[i] < MEMORY_STACK_LOW && !bStackWarned[i] ){
+      bStackWarned[i] = true;
+      debug(1, "\n\rTask %s stack low, %u bytes never used", MemoryTaskNames[i], (unsigned)u32StackFree[i]);
+    }
+  }
+  // Free well over the largest block means fragmented, rather than used up
+  if( heap.Largest && heap.Largest < MEMORY_BLOCK_LOW && !bBlockWarned ){
+    bBlockWarned = true;
+    debug(1, "\n\rHeap low, largest block %u bytes of %u free", (unsigned)heap.Largest,
+      (unsigned)heap.Free);
+  }
+}
@@ -0,0 +1,262 @@
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+#include <stdio.h>
+#include <string.h>
+#include "Hal.h"
+#include "App.h"
+#include "Ingest.h"
+#include "Log.h"
+#include "Memory.h"
+#include "Metrics.h"
+#include "Scheduler.h"
+#include "Supervisor.h"
+
+MetricsRegistry Metrics;
+
+const char *MetricStageNames[NUM_METRIC_STAGES] = { "rx", "parse", "scale", "pwm", "leds",
+  "template", "websocket", "loop" };
+
+
+// ##################################################################
+// # Histogram
+// ##################################################################
+
+uint32_t LatencyHistogram::Count(void) const{
+  uint32_t u32Count = 0;
+  for( size_t i = 0; i < METRICS_BUCKETS; i++ )u32Count += Bucket(i);
+  return u32Count;
+}
+
+uint64_t LatencyHistogram::Sum(void) const{
+  return ((uint64_t)SumHi.load(std::memory_order_relaxed) << 32) | SumLo.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::Edge(size_t idx){
+  if( idx == 0 )return 1u << METRICS_MIN_SHIFT;
+  uint32_t u32Exp = METRICS_MIN_SHIFT + ((idx - 1) >> METRICS_SUB_BITS);
+  uint64_t u64Sub = ((idx - 1) & ((1u << METRICS_SUB_BITS) - 1)) + 1;
+  return ((1ull << METRICS_SUB_BITS) + u64Sub) << (u32Exp - METRICS_SUB_BITS);
+}
+
+uint64_t LatencyHistogram::Quantile(float fQuantile) const{
+  uint32_t u32Counts[METRICS_BUCKETS];
+  uint64_t u64Total = 0;
+  for( size_t i = 0; i < METRICS_BUCKETS; i++ )u64Total += u32Counts[i] = Bucket(i);
+  if( !u64Total )return 0;
+  uint64_t u64Rank = (uint64_t)(fQuantile * u64Total + 0.5f);
+  if( u64Rank < 1 )u64Rank = 1;
+  uint64_t u64Seen = 0;
+  for( size_t i = 0; i < METRICS_BUCKETS; i++ ){
+    u64Seen += u32Counts[i];
+    if( u64Seen >= u64Rank )return Edge(i);
+  }
+  return Edge(METRICS_BUCKETS - 1);
+}
+
+
+// ##################################################################
+// # Registry
+// ##################################################################
+
+void MetricsRegistry::Begin(void){
+#ifdef ARDUINO
+  u32CyclesPerUs = getCpuFrequencyMhz();
+#elif defined(__x86_64__) || defined(__i386__)
+  // Host time stamp counter, against the monotonic clock
+  uint64_t u64StartUs = Hal.Clock->Micros();
+  uint32_t u32StartCycles = metricsCycles();
+  while( Hal.Clock->Micros() - u64StartUs < 20000 ){}
+  u32CyclesPerUs = (metricsCycles() - u32StartCycles) / (uint32_t)(Hal.Clock->Micros() - u64StartUs);
+#endif
+  // What a StageTimer costs, a read of the counter either side and a record
+  LatencyHistogram scratch;
+  const uint32_t u32Timers = 64;
+  uint32_t u32Start = metricsCycles();
+  for( uint32_t i = 0; i < u32Timers; i++ ){
+    uint32_t u32Begin = metricsCycles();
+    scratch.Record(metricsCycles() - u32Begin);
+  }
+  u32TimerCycles = (metricsCycles() - u32Start) / u32Timers;
+  // And the sampling check of a nested stage run
+  std::atomic<uint32_t> scratchRuns{0};
+  volatile uint32_t u32Sampled = 0;
+  u32Start = metricsCycles();
+  for( uint32_t i = 0; i < u32Timers; i++ ){
+    uint32_t u32Run = scratchRuns.load(std::memory_order_relaxed);
+    scratchRuns.store(u32Run + 1, std::memory_order_relaxed);
+    if( (u32Run & (METRICS_NESTED_SAMPLE - 1)) == 0 )u32Sampled = u32Sampled + 1;
+  }
+  u32CheckCycles = (metricsCycles() - u32Start) / u32Timers;
+  u64BeginUs = Hal.Clock->Micros();
+}
+
+float MetricsRegistry::Overhead(void) const{
+  uint64_t u64Timers = 0, u64Runs = 0;
+  for( int i = 0; i < NUM_METRIC_STAGES; i++ ){
+    u64Timers += Stages[i].Count();
+    u64Runs += Runs[i].load(std::memory_order_relaxed);
+  }
+  // Every nested run paid for the sampling check, the sampled ones for a timer too
+  const uint64_t u64Cycles = u64Timers * u32TimerCycles + u64Runs * u32CheckCycles;
+  const uint64_t u64ElapsedUs = Hal.Clock->Micros() - u64BeginUs;
+  return u64ElapsedUs ? (float)((double)u64Cycles / ((double)u64ElapsedUs * u32CyclesPerUs)) : 0;
+}
+
+size_t MetricsRegistry::Summary(MetricStage stage, char *chOut, size_t maxLen) const{
+  const LatencyHistogram &hist = Stages[stage];
+  int iLen;
+  if( !hist.Count() )iLen = snprintf(chOut, maxLen, "-");
+  else iLen = snprintf(chOut, maxLen, "%.1f / %.1f us", (double)hist.Quantile(0.5f) / u32CyclesPerUs,
+    (double)hist.Quantile(0.99f) / u32CyclesPerUs);
+  if( iLen < 0 )return 0;
+  return (size_t)iLen < maxLen ? (size_t)iLen : maxLen - 1;
+}
+
+
+// ##################################################################
+// # Prometheus text
+// #
+// # The histograms go out with a bucket per power of two, then the
+// # counters.  Line n of the page is built on its own, so the cursor
+// # only keeps its place and the running bucket total.
+// ##################################################################
+
+#define METRICS_EXPORT_BUCKETS (1 + (METRICS_BUCKETS - 1) / (1 << METRICS_SUB_BITS))
+#define METRICS_STAGE_LINES (METRICS_EXPORT_BUCKETS + 3)   // +Inf, _sum, _count
+#define METRICS_HEADER_LINES 2
+#define METRICS_FIXED_LINES 25              // Counters and gauges, after the histograms
+
+static HeapInfo heapNow(void){
+  HeapInfo heap;
+  Hal.Sys->Heap(heap);
+  return heap;
+}
+
+size_t MetricsCursor::line(char *chOut, size_t maxLen){
+  const double dCyclesPerSec = Metrics.CyclesPerMicro() * 1e6;
+  uint32_t u32Line = u16Line;
+  if( u32Line == 0 )return snprintf(chOut, maxLen, "# HELP wxgauges_stage_seconds Time spent per stage\n");
+  if( u32Line == 1 )return snprintf(chOut, maxLen, "# TYPE wxgauges_stage_seconds histogram\n");
+  u32Line -= METRICS_HEADER_LINES;
+
+  if( u32Line < NUM_METRIC_STAGES * METRICS_STAGE_LINES ){
+    const MetricStage stage = (MetricStage)(u32Line / METRICS_STAGE_LINES);
+    const LatencyHistogram &hist = Metrics.Stage(stage);
+    const char *chStage = MetricStageNames[stage];
+    uint32_t u32Row = u32Line % METRICS_STAGE_LINES;
+    if( u32Row == 0 )u64Cumulative = 0;
+    if( u32Row < METRICS_EXPORT_BUCKETS ){
+      // Bucket 0, then each power of two (1 << METRICS_SUB_BITS fine buckets)
+      size_t first = u32Row ? 1 + ((u32Row - 1) << METRICS_SUB_BITS) : 0;
+      size_t last = u32Row ? first + (1 << METRICS_SUB_BITS) - 1 : 0;
+      for( size_t i = first; i <= last; i++ )u64Cumulative += hist.Bucket(i);
+      return snprintf(chOut, maxLen, "wxgauges_stage_seconds_bucket{stage=\"%s\",le=\"%.3g\"} %llu\n", chStage,
+        LatencyHistogram::Edge(last) / dCyclesPerSec, (unsigned long long)u64Cumulative);
+    }
+    if( u32Row == METRICS_EXPORT_BUCKETS ){
+      return snprintf(chOut, maxLen, "wxgauges_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n", chStage,
+        (unsigned long long)u64Cumulative);
+    }
+    if( u32Row == METRICS_EXPORT_BUCKETS + 1 ){
+      return snprintf(chOut, maxLen, "wxgauges_stage_seconds_sum{stage=\"%s\"} %.6f\n", chStage,
+        hist.Sum() / dCyclesPerSec);
+    }
+    return snprintf(chOut, maxLen, "wxgauges_stage_seconds_count{stage=\"%s\"} %llu\n", chStage,
+      (unsigned long long)u64Cumulative);
+  }
+  u32Line -= NUM_METRIC_STAGES * METRICS_STAGE_LINES;
+
+  switch( u32Line ){
+    case 0: return snprintf(chOut, maxLen, "# TYPE wxgauges_datagrams_total counter\n"
+      "wxgauges_datagrams_total %u\n", (unsigned)Metrics.Counter(mcDatagrams));
+    case 1: return snprintf(chOut, maxLen, "# TYPE wxgauges_samples_total counter\n"
+      "wxgauges_samples_total{type=\"rapid_wind\"} %u\n", (unsigned)Metrics.Counter(mcRapidWind));
+    case 2: return snprintf(chOut, maxLen, "wxgauges_samples_total{type=\"obs_st\"} %u\n",
+      (unsigned)Metrics.Counter(mcObs));
+    case 3: return snprintf(chOut, maxLen, "# TYPE wxgauges_datagrams_ignored_total counter\n"
+      "wxgauges_datagrams_ignored_total %u\n", (unsigned)Metrics.Counter(mcIgnored));
+    case 4: return snprintf(chOut, maxLen, "# TYPE wxgauges_drops_total counter\n"
+      "wxgauges_drops_total{queue=\"samples\"} %u\n", (unsigned)Metrics.Counter(mcQueueDrops));
+    case 5: return snprintf(chOut, maxLen, "wxgauges_drops_total{queue=\"log\"} %u\n", (unsigned)logDropped());
+    case 6: return snprintf(chOut, maxLen, "# TYPE wxgauges_expander_writes_total counter\n"
+      "wxgauges_expander_writes_total %u\n", (unsigned)u32ExpanderWrites);
+    case 7: return snprintf(chOut, maxLen, "# TYPE wxgauges_expander_writes_skipped_total counter\n"
+      "wxgauges_expander_writes_skipped_total %u\n", (unsigned)u32ExpanderWritesSkipped);
+    case 8: return snprintf(chOut, maxLen, "# TYPE wxgauges_wakeups_total counter\n"
+      "wxgauges_wakeups_total{task=\"gauges\"} %u\n", (unsigned)Metrics.Stage(msLoop).Count());
+    case 9: return snprintf(chOut, maxLen, "wxgauges_wakeups_total{task=\"housekeeping\"} %u\n",
+      (unsigned)Scheduler.Wakeups());
+    case 10: return snprintf(chOut, maxLen, "# TYPE wxgauges_uptime_seconds gauge\n"
+      "wxgauges_uptime_seconds %.3f\n", Hal.Clock->Micros() / 1e6);
+    case 11: return snprintf(chOut, maxLen, "# TYPE wxgauges_metrics_overhead_ratio gauge\n"
+      "wxgauges_metrics_overhead_ratio %.6f\n", Metrics.Overhead());
+    case 12: return snprintf(chOut, maxLen, "# TYPE wxgauges_outages_total counter\n"
+      "wxgauges_outages_total{link=\"wifi\"} %u\n", (unsigned)Metrics.Counter(mcWifiOutages));
+    case 13: return snprintf(chOut, maxLen, "wxgauges_outages_total{link=\"data\"} %u\n",
+      (unsigned)Metrics.Counter(mcDataOutages));
+    case 14: return snprintf(chOut, maxLen, "# TYPE wxgauges_restarts_total counter\n"
+      "wxgauges_restarts_total{link=\"wifi\"} %u\n", (unsigned)Metrics.Counter(mcWifiReconnects));
+    case 15: return snprintf(chOut, maxLen, "wxgauges_restarts_total{link=\"listener\"} %u\n",
+      (unsigned)Metrics.Counter(mcListenerRestarts));
+    case 16: return snprintf(chOut, maxLen, "# TYPE wxgauges_data_stale gauge\n"
+      "wxgauges_data_stale %d\n", Supervisor.Stale() ? 1 : 0);
+    case 17: return snprintf(chOut, maxLen, "# TYPE wxgauges_recovery_seconds gauge\n"
+      "wxgauges_recovery_seconds{outage=\"last\"} %.3f\n", Supervisor.LastRecoveryMs() / 1000.0);
+    case 18: return snprintf(chOut, maxLen, "wxgauges_recovery_seconds{outage=\"max\"} %.3f\n",
+      Supervisor.MaxRecoveryMs() / 1000.0);
+    case 19: return snprintf(chOut, maxLen, "# TYPE wxgauges_datagrams_rejected_total counter\n"
+      "wxgauges_datagrams_rejected_total %u\n", (unsigned)Metrics.Counter(mcRejected));
+    case 20: return snprintf(chOut, maxLen, "# TYPE wxgauges_heap_bytes gauge\n"
+      "wxgauges_heap_bytes{kind=\"free\"} %u\n", (unsigned)heapNow().Free);
+    case 21: return snprintf(chOut, maxLen, "wxgauges_heap_bytes{kind=\"largest_block\"} %u\n",
+      (unsigned)heapNow().Largest);
+    case 22: return snprintf(chOut, maxLen, "wxgauges_heap_bytes{kind=\"min_free\"} %u\n",
+      (unsigned)heapNow().MinFree);
+    case 23: return snprintf(chOut, maxLen, "# TYPE wxgauges_psram_bytes gauge\n"
+      "wxgauges_psram_bytes{kind=\"free\"} %u\n", (unsigned)heapNow().ExternalFree);
+    case 24: return snprintf(chOut, maxLen, "wxgauges_psram_bytes{kind=\"size\"} %u\n",
+      (unsigned)heapNow().ExternalSize);
+    default: break;
+  }
+  u32Line -= METRICS_FIXED_LINES;
+
+  // Stack never used, a task not running has no sample
+  if( u32Line < NUM_MEMORY_TASKS ){
+    const char *chTask = MemoryTaskNames[u32Line];
+    uint32_t u32Free = Hal.Sys->StackFree(chTask);
+    char chFree[12] = "NaN";
+    if( u32Free != UINT32_MAX )snprintf(chFree, sizeof(chFree), "%u", (unsigned)u32Free);
+    return snprintf(chOut, maxLen, "%swxgauges_stack_free_bytes{task=\"%s\"} %s\n",
+      u32Line ? "" : "# TYPE wxgauges_stack_free_bytes gauge\n", chTask, chFree);
+  }
+  u32Line -= NUM_MEMORY_TASKS;
+
+  // Per sender, received then rejected and replaced, the page ends after the last
+  static const char *chResults[] = { "received", "rejected", "replaced" };
+  const uint32_t u32Source = u32Line / 3, u32Result = u32Line % 3;
+  if( u32Source >= Ingest.Sources() )return 0;
+  const IngestSource &source = Ingest.Source(u32Source);
+  const std::atomic<uint32_t> *pCounts[] = { &source.Datagrams, &source.Rejected, &source.Replaced };
+  return snprintf(chOut, maxLen, "%swxgauges_source_datagrams_total{serial=\"%s\",result=\"%s\"} %u\n",
+    u32Line ? "" : "# TYPE wxgauges_source_datagrams_total counter\n", source.Serial, chResults[u32Result],
+    (unsigned)pCounts[u32Result]->load(std::memory_order_relaxed));
+}
+
+size_t MetricsCursor::Fill(uint8_t *pOut, size_t maxLen){
+  size_t len = 0;
+  while( len < maxLen ){
+    if( lineSent == lineLen ){
+      int iLen = (int)line(chLine, sizeof(chLine));
+      if( iLen <= 0 )break;
+      lineLen = (size_t)iLen < sizeof(chLine) ? (size_t)iLen : sizeof(chLine) - 1;
+      lineSent = 0;
+      u16Line++;
+    }
+    size_t copy = lineLen - lineSent < maxLen - len ? lineLen - lineSent : maxLen - len;
+    memcpy(pOut + len, chLine + lineSent, copy);
+    lineSent += copy;
+    len += copy;
+  }
+  return len;
+}
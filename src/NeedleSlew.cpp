@@ -0,0 +1,89 @@
+#include <math.h>
+#include "Hal.h"
+#include "Metrics.h"
+#include "NeedleSlew.h"
+
+// Critically damped step response from rest, 1 - (1 + kt)e^-kt, scaled so
+// t = 1 lands exactly on the target
+#define SLEW_DAMPING 6.0f
+
+void NeedleSlew::Begin(uint8_t u8ChannelIn, uint32_t u32Duty){
+  u8Channel = u8ChannelIn;
+  u32From = u32To = u32Duty;
+  bMoving = false;
+  bHardware = Hal.Pwm->HasFade();
+}
+
+uint32_t NeedleSlew::Curve(uint32_t u32ElapsedMs) const{
+  if( u32ElapsedMs >= u32DurationMs )return u32To;
+  float fT = (float)u32ElapsedMs / u32DurationMs;
+  float fX = fT;
+  if( bDamped ){
+    static const float fEnd = 1.0f - (1.0f + SLEW_DAMPING) * expf(-SLEW_DAMPING);
+    fX = (1.0f - (1.0f + SLEW_DAMPING * fT) * expf(-SLEW_DAMPING * fT)) / fEnd;
+  }
+  return (uint32_t)lroundf((float)u32From + ((float)u32To - (float)u32From) * fX);
+}
+
+uint32_t NeedleSlew::Position(uint32_t u32NowMs) const{
+  if( !bMoving )return u32To;
+  return Curve(u32NowMs - u32StartMs);
+}
+
+void NeedleSlew::MoveTo(uint32_t u32Duty, const GaugeSettings &gauge, uint32_t u32NowMs){
+  u32From = Position(u32NowMs);
+  u32To = u32Duty;
+  uint32_t u32Delta = u32To > u32From ? u32To - u32From : u32From - u32To;
+  uint32_t u32Ms = gauge.slew > 0 ? (uint32_t)((uint64_t)u32Delta * 1000 / gauge.slew) : 0;
+  if( u32Ms > SLEW_MAX_MS )u32Ms = SLEW_MAX_MS;
+
+  if( u32Ms < SLEW_SOFT_STEP_MS ){
+    // Nothing worth slewing, this also cancels a running hardware fade
+    bMoving = false;
+    StageTimer timer(msPwm);
+    Hal.Pwm->Write(u8Channel, u32To);
+    return;
+  }
+  bDamped = gauge.damped;
+  u32StartMs = u32NowMs;
+  u32DurationMs = u32Ms;
+  // The software path has nothing to write until the first step
+  u32NextMs = bHardware ? u32NowMs : u32NowMs + SLEW_SOFT_STEP_MS;
+  u8Segment = 0;
+  bMoving = true;
+  Service(u32NowMs);
+}
+
+uint32_t NeedleSlew::Service(uint32_t u32NowMs){
+  if( !bMoving )return SLEW_IDLE;
+  if( (int32_t)(u32NowMs - u32NextMs) < 0 )return u32NextMs - u32NowMs;
+  uint32_t u32Elapsed = u32NowMs - u32StartMs;
+
+  if( bHardware ){
+    // Hand the next segment to the fade engine, the last one lands on the target
+    uint8_t u8Segments = bDamped ? SLEW_SEGMENTS : 1;
+    if( u8Segment >= u8Segments ){ bMoving = false; return SLEW_IDLE; }
+    u8Segment++;
+    uint32_t u32SegEnd = (uint32_t)((uint64_t)u32DurationMs * u8Segment / u8Segments);
+    uint32_t u32SegMs = u32SegEnd > u32Elapsed ? u32SegEnd - u32Elapsed : 1;
+    uint32_t u32Duty = Curve(u32SegEnd);
+    StageTimer timer(msPwm);
+    Hal.Pwm->Fade(u8Channel, u32Duty, u32SegMs);
+    u32NextMs = u32NowMs + u32SegMs;
+    return u32SegMs;
+  }
+
+  if( u32Elapsed >= u32DurationMs ){
+    StageTimer timer(msPwm);
+    Hal.Pwm->Write(u8Channel, u32To);
+    bMoving = false;
+    return SLEW_IDLE;
+  }
+  uint32_t u32Duty = Curve(u32Elapsed);
+  {
+    StageTimer timer(msPwm);
+    Hal.Pwm->Write(u8Channel, u32Duty);
+  }
+  u32NextMs = u32NowMs + SLEW_SOFT_STEP_MS;
+  return SLEW_SOFT_STEP_MS;
+}
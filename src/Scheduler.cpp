@@ -0,0 +1,97 @@
+#include "Hal.h"
+#include "Scheduler.h"
+
+JobScheduler Scheduler;
+
+void JobScheduler::Begin(const ScheduledJob *jobs, size_t numJobsIn, uint32_t u32NowMs){
+  pJobs = jobs;
+  numJobs = numJobsIn < SCHED_MAX_JOBS ? numJobsIn : SCHED_MAX_JOBS;
+  Wheel.Begin(u32NowMs);
+  for( size_t i = 0; i < numJobs; i++ )arm(i, u32NowMs);
+}
+
+void JobScheduler::arm(size_t i, uint32_t u32NowMs){
+  uint32_t u32Delay = pJobs[i].Next();
+  if( u32Delay == SCHED_IDLE )Wheel.Remove(Timers[i]);
+  else Wheel.Add(Timers[i], u32NowMs + u32Delay);
+}
+
+uint32_t JobScheduler::Run(uint32_t u32NowMs){
+  u32Wakeups++;
+  WheelTimer *pTimer = Wheel.Advance(u32NowMs);
+  while( pTimer ){
+    WheelTimer *pNext = pTimer->Next;
+    size_t i = pTimer - Timers;
+    pJobs[i].Callback();
+    u32Runs++;
+    arm(i, Hal.Clock->Millis());
+    pTimer = pNext;
+  }
+  // Events (a clock set, a settings change) since the last pass
+  if( bReschedule ){
+    bReschedule = false;
+    for( size_t i = 0; i < numJobs; i++ )arm(i, Hal.Clock->Millis());
+  }
+
+  uint32_t u32Deadline;
+  if( !Wheel.NextDeadline(u32Deadline) )return SCHED_IDLE;
+  int32_t i32Wait = (int32_t)(u32Deadline - Hal.Clock->Millis());
+  return i32Wait > 0 ? (uint32_t)i32Wait : 0;
+}
+
+
+// ##################################################################
+// # Wall clock deadlines
+// ##################################################################
+
+uint32_t schedUntil(time_t tTarget){
+  time_t tNow = Hal.Clock->Now();
+  if( tTarget <= tNow )return 0;
+  // Now() is whole seconds, so this lands up to a second late, never early
+  long long llMs = ((long long)tTarget - (long long)tNow) * 1000;
+  return llMs > INT32_MAX ? INT32_MAX : (uint32_t)llMs;
+}
+
+// hour:minute local, iDay days from tNow's date.  A time skipped by
+// spring forward is the moment of the jump (the first local time past
+// it), a time repeated by fall back is whichever mktime() picks.
+static time_t localTimeOn(time_t tNow, int iDay, int iHour, int iMinute){
+  tm tmTarget;
+  localtime_r(&tNow, &tmTarget);
+  tmTarget.tm_mday += iDay;
+  tmTarget.tm_hour = iHour;
+  tmTarget.tm_min = iMinute;
+  tmTarget.tm_sec = 0;
+  tmTarget.tm_isdst = -1;
+  time_t tTarget = mktime(&tmTarget);
+  if( tmTarget.tm_hour == iHour && tmTarget.tm_min == iMinute )return tTarget;
+
+  // Skipped, find where the offset changed (within the two hours before)
+  tm tmAt;
+  localtime_r(&tTarget, &tmAt);
+  const int iDst = tmAt.tm_isdst;
+  time_t tLow = tTarget - 7200, tHigh = tTarget;
+  while( tHigh - tLow > 1 ){
+    time_t tMid = tLow + (tHigh - tLow) / 2;
+    localtime_r(&tMid, &tmAt);
+    if( tmAt.tm_isdst == iDst )tHigh = tMid;
+    else tLow = tMid;
+  }
+  return tHigh;
+}
+
+time_t nextLocalTime(time_t tNow, int iHour, int iMinute){
+  for( int iDay = 0; iDay < 3; iDay++ ){
+    time_t tTarget = localTimeOn(tNow, iDay, iHour, iMinute);
+    if( tTarget > tNow )return tTarget;
+  }
+  return tNow + 86400;
+}
+
+time_t lastLocalTime(time_t tNow, int iHour, int iMinute){
+  for( int iDay = 0; iDay > -3; iDay-- ){
+    time_t tTarget = localTimeOn(tNow, iDay, iHour, iMinute);
+    if( tTarget <= tNow )return tTarget;
+  }
+  return tNow - 86400;
+}
@@ -0,0 +1,201 @@
+#include <string.h>
+#include "Hal.h"
+#include "App.h"
+#include "SettingsStore.h"
+
+SettingsStore SettingsStorage;
+
+#define SETTINGS_MAGIC 0x57584753      // "SGXW"
+
+// Slot layout, the CRC covers everything after it
+struct SettingsSlotHeader{
+    uint32_t Crc;
+    uint32_t Magic;
+    uint16_t Version;
+    uint16_t Size;
+    uint32_t Sequence;
+};
+#define SETTINGS_SLOT_LEN (sizeof(SettingsSlotHeader) + sizeof(AppConfig))
+
+// A section compared value by value, to tell a real change from the
+// same values sent again (never the bytes: the padding in the structs
+// and whatever follows a string's terminator are not settings)
+template<size_t N>
+static bool sameText(const char (&chA)[N], const char (&chB)[N]){
+  return strncmp(chA, chB, N) == 0;
+}
+
+static bool sameGauge(const GaugeSettings &a, const GaugeSettings &b){
+  if( a.min != b.min || a.max != b.max || a.step != b.step || a.gain != b.gain ||
+      a.threshold != b.threshold || a.calPoints != b.calPoints || a.slew != b.slew ||
+      a.damped != b.damped || a.show != b.show )return false;
+  for( int i = 0; i < a.calPoints && i < GAUGE_CAL_POINTS; i++ ){
+    if( a.cal[i].value != b.cal[i].value || a.cal[i].pwm != b.cal[i].pwm )return false;
+  }
+  return true;
+}
+
+static bool sameRoute(const GaugeRoute &a, const GaugeRoute &b){
+  return a.Field == b.Field && a.Output == b.Output && a.Channel == b.Channel && a.Pin == b.Pin &&
+    a.Scale == b.Scale && a.Min == b.Min && a.Max == b.Max;
+}
+
+static bool sameSection(SettingsSection section, const AppConfig &a, const AppConfig &b){
+  switch( section ){
+    case csWiFi:
+      return sameText(a.WiFi.ssid, b.WiFi.ssid) && sameText(a.WiFi.pass, b.WiFi.pass) &&
+        memcmp(a.WiFi.Ip, b.WiFi.Ip, sizeof(a.WiFi.Ip)) == 0 &&
+        memcmp(a.WiFi.Gateway, b.WiFi.Gateway, sizeof(a.WiFi.Gateway)) == 0 &&
+        memcmp(a.WiFi.Dns, b.WiFi.Dns, sizeof(a.WiFi.Dns)) == 0 && a.WiFi.Prefix == b.WiFi.Prefix;
+    case csWind: return sameGauge(a.Wind, b.Wind);
+    case csTemp: return sameGauge(a.Temp, b.Temp);
+    case csWeb: return sameText(a.Web.user, b.Web.user) && sameText(a.Web.pass, b.Web.pass);
+    case csTimeZone: return sameText(a.TimeZone, b.TimeZone);
+    case csGaugeLamps:
+      return a.GaugeLamps.LampBrightness == b.GaugeLamps.LampBrightness &&
+        a.GaugeLamps.OnHour == b.GaugeLamps.OnHour && a.GaugeLamps.OnMinute == b.GaugeLamps.OnMinute &&
+        a.GaugeLamps.OffHour == b.GaugeLamps.OffHour && a.GaugeLamps.OffMinute == b.GaugeLamps.OffMinute;
+    case csWindLeds:
+      return memcmp(a.WindLeds.Pattern, b.WindLeds.Pattern, sizeof(a.WindLeds.Pattern)) == 0 &&
+        a.WindLeds.Arc == b.WindLeds.Arc;
+    case csRoutes:
+      for( size_t i = 0; i < GAUGE_ROUTES; i++ ){
+        if( !sameRoute(a.Routes.Route[i], b.Routes.Route[i]) )return false;
+      }
+      return true;
+    case csLink:
+      return a.Link.StaleIntervals == b.Link.StaleIntervals && a.Link.ParkPercent == b.Link.ParkPercent &&
+        a.Link.Blank == b.Link.Blank;
+    case csIngest: return sameText(a.Ingest.Allow, b.Ingest.Allow);
+    default: return false;
+  }
+}
+
+// Slot image, built and read by one task at a time (setup, then housekeeping)
+static uint8_t u8SlotImage[SETTINGS_SLOT_LEN];
+static AppConfig Snapshot;
+
+// CRC-32 (IEEE), bitwise, a slot is only checked at boot and per commit
+static uint32_t crc32(const uint8_t *pData, size_t len){
+  uint32_t u32Crc = 0xFFFFFFFF;
+  for( size_t i = 0; i < len; i++ ){
+    u32Crc ^= pData[i];
+    for( int b = 0; b < 8; b++ )u32Crc = (u32Crc >> 1) ^ (0xEDB88320 & (0 - (u32Crc & 1)));
+  }
+  return ~u32Crc;
+}
+
+// Read a slot into u8SlotImage, true if it is intact (bCurrent: and
+// written by this firmware's AppConfig)
+static bool readSlot(uint8_t u8Slot, SettingsSlotHeader &header, bool &bCurrent){
+  if( !Hal.Sys->SettingsRead(u8Slot, u8SlotImage, sizeof(u8SlotImage)) )return false;
+  memcpy(&header, u8SlotImage, sizeof(header));
+  if( header.Magic != SETTINGS_MAGIC )return false;
+  if( header.Crc != crc32(u8SlotImage + sizeof(header.Crc), sizeof(u8SlotImage) - sizeof(header.Crc)) )return false;
+  bCurrent = header.Version == AppConfig::Version && header.Size == sizeof(AppConfig);
+  return true;
+}
+
+bool SettingsStore::Begin(void){
+  SettingsSlotHeader header[2];
+  bool bIntact[2], bCurrent[2] = { false, false };
+  for( uint8_t s = 0; s < 2; s++ )bIntact[s] = readSlot(s, header[s], bCurrent[s]);
+
+  // The write count carries on across layout changes
+  int iNewest = -1;
+  for( uint8_t s = 0; s < 2; s++ ){
+    if( !bIntact[s] )continue;
+    if( iNewest < 0 || (int32_t)(header[s].Sequence - header[iNewest].Sequence) > 0 )iNewest = s;
+  }
+  if( iNewest >= 0 ){
+    u32Sequence = header[iNewest].Sequence;
+    u8NextSlot = iNewest ^ 1;
+  }
+
+  // Newest slot this firmware can read, else keep what Settings.Begin()
+  // loaded and save it at the first commit
+  int iLoad = -1;
+  for( uint8_t s = 0; s < 2; s++ ){
+    if( !bIntact[s] || !bCurrent[s] )continue;
+    if( iLoad < 0 || (int32_t)(header[s].Sequence - header[iLoad].Sequence) > 0 )iLoad = s;
+  }
+  if( iLoad < 0 ){
+    debug(1, "\n\rNo settings slot, using the stored defaults");
+    u32Dirty = SETTINGS_ALL;
+    return false;
+  }
+  readSlot(iLoad, header[iLoad], bCurrent[iLoad]);
+  memcpy(&Settings.Config, u8SlotImage + sizeof(SettingsSlotHeader), sizeof(AppConfig));
+  Committed = Settings.Config;
+  debug(1, "\n\rSettings loaded from slot %c, %u writes", 'A' + iLoad, (unsigned)u32Sequence);
+  return true;
+}
+
+void SettingsStore::BeginEdit(void){
+  u32EditSeq = u32EditSeq + 1;
+  __sync_synchronize();
+}
+
+void SettingsStore::EndEdit(uint32_t u32Sections){
+  __sync_fetch_and_or(&u32Dirty, u32Sections);
+  u32LastEditMs = Hal.Clock->Millis();
+  __sync_synchronize();
+  u32EditSeq = u32EditSeq + 1;
+}
+
+void SettingsStore::Reset(void){
+  Settings.ResetToDefault();
+  commit(Settings.Config);
+  u32Dirty = 0;
+}
+
+void SettingsStore::Service(uint32_t u32NowMs, bool bNow){
+  if( !u32Dirty )return;
+  if( !bNow && u32NowMs - u32LastEditMs < SETTINGS_DEBOUNCE_MS )return;
+
+  // Snapshot between edits, else try again next time
+  const uint32_t u32Seq = u32EditSeq;
+  if( u32Seq & 1 )return;
+  __sync_synchronize();
+  Snapshot = Settings.Config;
+  const uint32_t u32Sections = u32Dirty;
+  __sync_synchronize();
+  if( u32EditSeq != u32Seq )return;
+  // An edit from here on marks its section dirty again
+  __sync_fetch_and_and(&u32Dirty, ~u32Sections);
+
+  bool bChanged = false;
+  for( size_t i = 0; i < NUM_SETTINGS_SECTIONS && !bChanged; i++ ){
+    if( !(u32Sections & SETTINGS_SECTION(i)) )continue;
+    bChanged = !sameSection((SettingsSection)i, Snapshot, Committed);
+  }
+  if( !bChanged ){
+    u32Skipped++;
+    return;
+  }
+  if( !commit(Snapshot) )__sync_fetch_and_or(&u32Dirty, u32Sections);
+}
+
+uint32_t SettingsStore::DueIn(uint32_t u32NowMs) const{
+  if( !u32Dirty )return UINT32_MAX;
+  uint32_t u32Settled = u32NowMs - u32LastEditMs;
+  return u32Settled < SETTINGS_DEBOUNCE_MS ? SETTINGS_DEBOUNCE_MS - u32Settled : 0;
+}
+
+bool SettingsStore::commit(const AppConfig &config){
+  SettingsSlotHeader header = { 0, SETTINGS_MAGIC, AppConfig::Version, sizeof(AppConfig), u32Sequence + 1 };
+  memcpy(u8SlotImage, &header, sizeof(header));
+  memcpy(u8SlotImage + sizeof(header), &config, sizeof(AppConfig));
+  header.Crc = crc32(u8SlotImage + sizeof(header.Crc), sizeof(u8SlotImage) - sizeof(header.Crc));
+  memcpy(u8SlotImage, &header.Crc, sizeof(header.Crc));
+
+  if( !Hal.Sys->SettingsWrite(u8NextSlot, u8SlotImage, sizeof(u8SlotImage)) ){
+    debug(1, "\n\rSettings write to slot %c failed", 'A' + u8NextSlot);
+    return false;
+  }
+  debug(2, "\n\rSettings written to slot %c, %u writes", 'A' + u8NextSlot, (unsigned)header.Sequence);
+  u32Sequence = header.Sequence;
+  u8NextSlot ^= 1;
+  Committed = config;
+  return true;
+}
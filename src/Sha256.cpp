@@ -0,0 +1,83 @@
+#include <string.h>
+#include "Sha256.h"
+
+static const uint32_t u32K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t ror(uint32_t u32Value, int iBits){
+  return (u32Value >> iBits) | (u32Value << (32 - iBits));
+}
+
+void Sha256::Begin(void){
+  static const uint32_t u32Init[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+  memcpy(u32State, u32Init, sizeof(u32State));
+  u64Bytes = 0;
+}
+
+void Sha256::block(const uint8_t *pBlock){
+  uint32_t w[64];
+  for( int i = 0; i < 16; i++ ){
+    w[i] = (uint32_t)pBlock[4 * i] << 24 | (uint32_t)pBlock[4 * i + 1] << 16 |
+      (uint32_t)pBlock[4 * i + 2] << 8 | pBlock[4 * i + 3];
+  }
+  for( int i = 16; i < 64; i++ ){
+    uint32_t s0 = ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+  uint32_t a = u32State[0], b = u32State[1], c = u32State[2], d = u32State[3];
+  uint32_t e = u32State[4], f = u32State[5], g = u32State[6], h = u32State[7];
+  for( int i = 0; i < 64; i++ ){
+    uint32_t t1 = h + (ror(e, 6) ^ ror(e, 11) ^ ror(e, 25)) + ((e & f) ^ (~e & g)) + u32K[i] + w[i];
+    uint32_t t2 = (ror(a, 2) ^ ror(a, 13) ^ ror(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    h = g; g = f; f = e; e = d + t1;
+    d = c; c = b; b = a; a = t1 + t2;
+  }
+  u32State[0] += a; u32State[1] += b; u32State[2] += c; u32State[3] += d;
+  u32State[4] += e; u32State[5] += f; u32State[6] += g; u32State[7] += h;
+}
+
+void Sha256::Update(const uint8_t *pData, size_t len){
+  size_t used = u64Bytes & 63;
+  u64Bytes += len;
+  if( used ){
+    size_t take = 64 - used < len ? 64 - used : len;
+    memcpy(u8Buffer + used, pData, take);
+    pData += take;
+    len -= take;
+    if( used + take < 64 )return;
+    block(u8Buffer);
+  }
+  // Whole blocks straight from the caller's buffer
+  for( ; len >= 64; pData += 64, len -= 64 )block(pData);
+  memcpy(u8Buffer, pData, len);
+}
+
+void Sha256::Final(uint8_t (&u8Digest)[SHA256_LEN]){
+  const uint64_t u64Bits = u64Bytes * 8;
+  size_t used = u64Bytes & 63;
+  u8Buffer[used++] = 0x80;
+  if( used > 56 ){
+    memset(u8Buffer + used, 0, 64 - used);
+    block(u8Buffer);
+    used = 0;
+  }
+  memset(u8Buffer + used, 0, 56 - used);
+  for( int i = 0; i < 8; i++ )u8Buffer[56 + i] = (uint8_t)(u64Bits >> (56 - 8 * i));
+  block(u8Buffer);
+  for( int i = 0; i < 8; i++ ){
+    u8Digest[4 * i] = (uint8_t)(u32State[i] >> 24);
+    u8Digest[4 * i + 1] = (uint8_t)(u32State[i] >> 16);
+    u8Digest[4 * i + 2] = (uint8_t)(u32State[i] >> 8);
+    u8Digest[4 * i + 3] = (uint8_t)u32State[i];
+  }
+}
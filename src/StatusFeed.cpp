@@ -0,0 +1,146 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "Metrics.h"
+#include "StatusFeed.h"
+
+static const char *chWeatherKeys[NUM_WEATHER_STATUS] = { "time", "temperature", "humidity",
+  "pressure", "wind", "wind_gust", "uv", "brightness", "solar_radiation", "rain_rate",
+  "precipitation_type", "lightning_strikes", "lightning_distance", "wind_avg_2m", "wind_avg_10m",
+  "wind_gust_10m", "wind_lull_10m", "wind_dir_10m", "wind_var_10m" };
+static const char *chSystemKeys[NUM_SYSTEM_STATUS] = { "wifi_mode", "wifi_ssid", "wifi_ip_addr",
+  "wifi_rssi", "bat_volt", "settings_writes", "calibration", "boot_needles", "boot_ready",
+  "boot_wifi", "link", "link_outages", "link_recovery", "rx_datagrams", "rx_sources", "rx_drops",
+  "loop_rate", "metrics_overhead", "stage_rx", "stage_parse", "stage_scale", "stage_pwm",
+  "stage_leds", "stage_template", "stage_websocket", "stage_loop", "fw_update", "fw_latency" };
+static const char *chMemoryKeys[NUM_MEMORY_STATUS] = { "heap_free", "heap_largest", "heap_min",
+  "psram", "stack_gauges", "stack_wx_rx", "stack_housekeeping", "stack_async_tcp", "stack_log" };
+
+StatusFeed WeatherStatus("status_weather", chWeatherKeys, NUM_WEATHER_STATUS);
+StatusFeed SystemStatus("status_system", chSystemKeys, NUM_SYSTEM_STATUS);
+StatusFeed MemoryStatus("status_memory", chMemoryKeys, NUM_MEMORY_STATUS);
+
+
+// ##################################################################
+// # Status feed
+// ##################################################################
+
+StatusFeed::StatusFeed(const char *chTypeIn, const char *const *chKeysIn, uint8_t u8NumFieldsIn)
+  : chType(chTypeIn), chKeys(chKeysIn),
+    u8NumFields(u8NumFieldsIn < STATUS_MAX_FIELDS ? u8NumFieldsIn : STATUS_MAX_FIELDS) {}
+
+void StatusFeed::Set(uint8_t u8Field, const char *chValue){
+  if( u8Field >= u8NumFields )return;
+  if( u32Changed[u8Field] && strncmp(chValues[u8Field], chValue, STATUS_VALUE_LEN - 1) == 0 )return;
+  snprintf(chValues[u8Field], STATUS_VALUE_LEN, "%s", chValue);
+  // Lands in the frame the next Commit() closes
+  u32Changed[u8Field] = u32Seq + 1;
+  bPending = true;
+}
+
+void StatusFeed::Setf(uint8_t u8Field, const char *chFormat, ...){
+  char chValue[STATUS_VALUE_LEN];
+  va_list args;
+  va_start(args, chFormat);
+  vsnprintf(chValue, sizeof(chValue), chFormat, args);
+  va_end(args);
+  Set(u8Field, chValue);
+}
+
+bool StatusFeed::Commit(void){
+  if( !bPending )return false;
+  u32Seq++;
+  bPending = false;
+  return true;
+}
+
+// Bounded append, keeps counting past the end so the caller learns the size
+static size_t append(char *chBuffer, size_t maxLen, size_t len, const char *chText){
+  for( ; *chText; chText++, len++ ){
+    if( len + 1 < maxLen )chBuffer[len] = *chText;
+  }
+  return len;
+}
+
+static size_t appendEscaped(char *chBuffer, size_t maxLen, size_t len, const char *chText){
+  char chEscape[3] = { '\\', 0, 0 };
+  for( ; *chText; chText++ ){
+    if( *chText == '"' || *chText == '\\' ){
+      chEscape[1] = *chText;
+      len = append(chBuffer, maxLen, len, chEscape);
+    }
+    else if( (uint8_t)*chText >= 0x20 ){
+      if( len + 1 < maxLen )chBuffer[len] = *chText;
+      len++;
+    }
+  }
+  return len;
+}
+
+size_t StatusFeed::Serialize(uint32_t u32Since, char *chBuffer, size_t maxLen) const{
+  size_t len = 0;
+  bool bFirst = true;
+  len = append(chBuffer, maxLen, len, "{\"type\":\"");
+  len = append(chBuffer, maxLen, len, chType);
+  len = append(chBuffer, maxLen, len, "\",\"status\":{");
+  for( uint8_t i = 0; i < u8NumFields; i++ ){
+    // Changed after the client's frame, and not waiting on the next Commit()
+    if( u32Changed[i] <= u32Since || u32Changed[i] > u32Seq )continue;
+    len = append(chBuffer, maxLen, len, bFirst ? "\"" : ",\"");
+    len = append(chBuffer, maxLen, len, chKeys[i]);
+    len = append(chBuffer, maxLen, len, "\":\"");
+    len = appendEscaped(chBuffer, maxLen, len, chValues[i]);
+    len = append(chBuffer, maxLen, len, "\"");
+    bFirst = false;
+  }
+  len = append(chBuffer, maxLen, len, "}}");
+  if( maxLen )chBuffer[len < maxLen ? len : maxLen - 1] = 0;
+  return len;
+}
+
+
+// ##################################################################
+// # Fan-out
+// ##################################################################
+
+uint32_t StatusFanout::Push(StatusTransport &transport){
+  StageTimer timer(msWebSocket);
+  uint32_t u32Ids[STATUS_MAX_CLIENTS];
+  size_t numIds = transport.Clients(u32Ids, STATUS_MAX_CLIENTS);
+  uint32_t u32Frames = 0;
+
+  // Follow the connected clients, a new one starts from nothing.  Both
+  // lists are in connection order, so one pass merges them.
+  Client keep[STATUS_MAX_CLIENTS];
+  size_t numKeep = 0, known = 0;
+  for( size_t i = 0; i < numIds; i++ ){
+    while( known < numClients && Clients[known].Id != u32Ids[i] )known++;
+    keep[numKeep++] = { u32Ids[i], known < numClients ? Clients[known].Seq : 0 };
+    if( known == numClients )known = 0;
+  }
+  memcpy(Clients, keep, sizeof(Client) * numKeep);
+  numClients = numKeep;
+
+  // One frame per distinct client position, normally just the one delta
+  const uint32_t u32Seq = feed.Seq();
+  bool bBlocked[STATUS_MAX_CLIENTS] = {false};
+  for( size_t i = 0; i < numClients; i++ ){
+    if( Clients[i].Seq >= u32Seq || bBlocked[i] )continue;
+    if( !transport.CanSend(i) ){ bBlocked[i] = true; continue; }
+
+    const uint32_t u32Since = Clients[i].Seq;
+    size_t len = feed.Serialize(u32Since, NULL, 0);
+    char *chBuffer = transport.Begin(len);
+    if( !chBuffer )break;
+    feed.Serialize(u32Since, chBuffer, len + 1);
+    u32Frames++;
+    for( size_t j = i; j < numClients; j++ ){
+      if( Clients[j].Seq != u32Since || bBlocked[j] )continue;
+      if( j != i && !transport.CanSend(j) ){ bBlocked[j] = true; continue; }
+      transport.Send(j);
+      Clients[j].Seq = u32Seq;
+    }
+    transport.End();
+  }
+  return u32Frames;
+}
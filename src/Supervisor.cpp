@@ -0,0 +1,132 @@
+#include <algorithm>
+#include <stdio.h>
+#include "App.h"
+#include "Metrics.h"
+#include "Supervisor.h"
+
+ConnectivitySupervisor Supervisor;
+
+static uint32_t untilMs(uint32_t u32DueMs, uint32_t u32NowMs){
+  return (int32_t)(u32DueMs - u32NowMs) > 0 ? u32DueMs - u32NowMs : 0;
+}
+
+uint32_t ConnectivitySupervisor::staleMs(void) const{
+  return Settings.Config.Link.StaleIntervals * (uint32_t)LINK_WIND_INTERVAL_MS;
+}
+
+void ConnectivitySupervisor::Begin(uint32_t u32NowMs){
+  u32RxMs = u32NowMs;
+  bStale = false;
+  bOutage = false;
+  bListenerRestart = false;
+  bJoined = false;
+  bLinkUp = false;
+}
+
+bool ConnectivitySupervisor::Received(uint32_t u32NowMs){
+  const uint32_t u32Gap = u32NowMs - u32RxMs.exchange(u32NowMs);
+  const bool bWasStale = bStale.exchange(false);
+  if( bOutage.exchange(false) ){
+    u32LastRecoveryMs = u32Gap;
+    if( u32Gap > u32MaxRecoveryMs.load() )u32MaxRecoveryMs = u32Gap;
+    debug(1, "\n\rData back after %u ms", (unsigned)u32Gap);
+    // The data deadline starts over
+    jobsReschedule();
+  }
+  return bWasStale;
+}
+
+void ConnectivitySupervisor::Tick(uint32_t u32NowMs){
+  // The link, once the boot join is done
+  const bool bUp = wifiConnected();
+  if( !bJoined ){
+    bJoined = bUp;
+    bLinkUp = bUp;
+  }
+  else if( bUp != bLinkUp ){
+    bLinkUp = bUp;
+    if( !bUp ){
+      bOutage = true;
+      u32LinkDownMs = u32NowMs;
+      u32LinkBackoffMs = LINK_RETRY_MIN_MS;
+      u32LinkRetryMs = u32NowMs + u32LinkBackoffMs;
+      Metrics.Count(mcWifiOutages);
+      debug(1, "\n\rWi-Fi lost, rejoining in %u ms", (unsigned)u32LinkBackoffMs);
+    }
+    else{
+      debug(1, "\n\rWi-Fi back after %u ms", (unsigned)(u32NowMs - u32LinkDownMs));
+      // The socket may not have lived through the address going away
+      bListenerRestart = true;
+      Metrics.Count(mcListenerRestarts);
+      u32ListenerRetryMs = u32NowMs + std::max(staleMs(), (uint32_t)LINK_RETRY_MIN_MS);
+    }
+  }
+  if( bJoined && !bLinkUp && (int32_t)(u32NowMs - u32LinkRetryMs) >= 0 ){
+    u32LinkBackoffMs = std::min(u32LinkBackoffMs * 2, (uint32_t)LINK_RETRY_MAX_MS);
+    u32LinkRetryMs = u32NowMs + u32LinkBackoffMs;
+    Metrics.Count(mcWifiReconnects);
+    debug(1, "\n\rRejoining Wi-Fi, next try in %u ms", (unsigned)u32LinkBackoffMs);
+    wifiReconnect();
+  }
+
+  // The data, a sample arriving meanwhile takes the stale mark back
+  const uint32_t u32Limit = staleMs();
+  const uint32_t u32Rx = u32RxMs.load();
+  if( !bStale && u32Limit && u32NowMs - u32Rx >= u32Limit ){
+    bStale = true;
+    if( u32RxMs.load() != u32Rx )bStale = false;
+    else{
+      bOutage = true;
+      u32ListenerRetryMs = u32NowMs;
+      u32ListenerBackoffMs = u32Limit;
+      Metrics.Count(mcDataOutages);
+      debug(1, "\n\rNo data for %u s, gauges parked", (unsigned)((u32NowMs - u32Rx) / 1000));
+    }
+  }
+  if( bStale && bLinkUp && (int32_t)(u32NowMs - u32ListenerRetryMs) >= 0 ){
+    bListenerRestart = true;
+    Metrics.Count(mcListenerRestarts);
+    u32ListenerRetryMs = u32NowMs + u32ListenerBackoffMs;
+    u32ListenerBackoffMs = std::min(u32ListenerBackoffMs * 2, (uint32_t)LINK_RETRY_MAX_MS);
+    debug(1, "\n\rRestarting the WeatherFlow listener, next in %u ms", (unsigned)(u32ListenerRetryMs - u32NowMs));
+  }
+}
+
+uint32_t ConnectivitySupervisor::DueIn(uint32_t u32NowMs) const{
+  if( wifiConnected() != bLinkUp )return 0;
+  uint32_t u32Due = UINT32_MAX;
+  if( bJoined && !bLinkUp )u32Due = untilMs(u32LinkRetryMs, u32NowMs);
+  const uint32_t u32Limit = staleMs();
+  if( !bStale && u32Limit )u32Due = std::min(u32Due, untilMs(u32RxMs.load() + u32Limit, u32NowMs));
+  if( bStale && bLinkUp )u32Due = std::min(u32Due, untilMs(u32ListenerRetryMs, u32NowMs));
+  return u32Due;
+}
+
+size_t ConnectivitySupervisor::Status(char *chOut, size_t maxLen, uint32_t u32NowMs) const{
+  int iLen;
+  if( !bJoined )iLen = snprintf(chOut, maxLen, "Joining");
+  else if( !bLinkUp ){
+    iLen = snprintf(chOut, maxLen, "Wi-Fi down %u s, retry %u s", (unsigned)((u32NowMs - u32LinkDownMs) / 1000),
+      (unsigned)(untilMs(u32LinkRetryMs, u32NowMs) / 1000));
+  }
+  else if( bStale )iLen = snprintf(chOut, maxLen, "No data %u s", (unsigned)((u32NowMs - u32RxMs.load()) / 1000));
+  else iLen = snprintf(chOut, maxLen, "Live");
+  if( iLen < 0 )return 0;
+  return (size_t)iLen < maxLen ? (size_t)iLen : maxLen - 1;
+}
+
+size_t ConnectivitySupervisor::Outages(char *chOut, size_t maxLen) const{
+  int iLen = snprintf(chOut, maxLen, "Wi-Fi %u (%u tries), data %u", (unsigned)Metrics.Counter(mcWifiOutages),
+    (unsigned)Metrics.Counter(mcWifiReconnects), (unsigned)Metrics.Counter(mcDataOutages));
+  if( iLen < 0 )return 0;
+  return (size_t)iLen < maxLen ? (size_t)iLen : maxLen - 1;
+}
+
+size_t ConnectivitySupervisor::Recovery(char *chOut, size_t maxLen) const{
+  int iLen;
+  if( !u32MaxRecoveryMs.load() )iLen = snprintf(chOut, maxLen, "-");
+  else iLen = snprintf(chOut, maxLen, "last %.1f s, max %.1f s", u32LastRecoveryMs.load() / 1000.0,
+    u32MaxRecoveryMs.load() / 1000.0);
+  if( iLen < 0 )return 0;
+  return (size_t)iLen < maxLen ? (size_t)iLen : maxLen - 1;
+}
@@ -0,0 +1,244 @@
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "App.h"
+#include "Boot.h"
+#include "Metrics.h"
+#include "GaugeRoutes.h"
+#include "SettingsStore.h"
+#include "StatusFeed.h"
+#include "Template.h"
+
+volatile uint32_t u32SettingsGeneration = 1;
+
+const char *TemplateVarNames[NUM_TEMPLATE_VARS] = { "WIFI_MODE", "WIFI_SSID", "WIFI_STATIC",
+  "USERNAME", "MIN_WIND", "MAX_WIND", "STEP_WIND", "GAIN_WIND", "THRESHOLD_WIND", "CAL_WIND", "SLEW_WIND",
+  "DAMPED_WIND", "MIN_TEMP", "MAX_TEMP", "STEP_TEMP", "GAIN_TEMP", "CAL_TEMP", "SLEW_TEMP",
+  "DAMPED_TEMP", "WIND_LEDS", "SHOW_WIND", "ARC_WIND", "ROUTE_0", "ROUTE_1", "ROUTE_2", "ROUTE_3",
+  "ROUTE_4", "ROUTE_5", "ROUTE_6", "ROUTE_7", "LINK_STALE", "LINK_PARK", "LINK_BLANK", "INGEST_ALLOW",
+  "WIFI_IP_ADDR", "WIFI_RSSI", "BAT_VOLT", "SETTINGS_WRITES", "CUR_TIME", "CUR_TEMPERATURE",
+  "CUR_HUMIDITY", "CUR_PRESSURE", "CUR_WIND", "CUR_GUST", "CUR_UV", "CUR_BRIGHTNESS", "CUR_RADIATION", "CUR_RAIN_RATE",
+  "CUR_PRECIPITATION_TYPE", "CUR_LIGHTNING_STRIKES", "CUR_LIGHTNING_DISTANCE" };
+
+
+// ##################################################################
+// # Placeholder names, perfect hash
+// #
+// # FNV-1a with a seed searched at startup so every known name lands
+// # in its own slot, a lookup is one hash and one compare.
+// ##################################################################
+
+#define TEMPLATE_HASH_SLOTS 128
+#define TEMPLATE_HASH_EMPTY 0xFF
+
+static uint32_t u32HashSeed = 0;
+static uint8_t u8HashSlots[TEMPLATE_HASH_SLOTS];
+static bool bHashBuilt = false;
+
+static uint32_t varHash(const char *chName, size_t len, uint32_t u32Seed){
+  uint32_t u32Hash = 2166136261u ^ u32Seed;
+  for( size_t i = 0; i < len; i++ ){
+    u32Hash ^= (uint8_t)chName[i];
+    u32Hash *= 16777619u;
+  }
+  // The low bits of an FNV product only depend on the low bits going
+  // in, fold the top down so the seed moves every slot
+  return (u32Hash ^ (u32Hash >> 15)) % TEMPLATE_HASH_SLOTS;
+}
+
+static void buildVarHash(void){
+  for( u32HashSeed = 0; ; u32HashSeed++ ){
+    memset(u8HashSlots, TEMPLATE_HASH_EMPTY, sizeof(u8HashSlots));
+    bool bCollision = false;
+    for( uint8_t i = 0; i < NUM_TEMPLATE_VARS && !bCollision; i++ ){
+      uint32_t u32Slot = varHash(TemplateVarNames[i], strlen(TemplateVarNames[i]), u32HashSeed);
+      if( u8HashSlots[u32Slot] != TEMPLATE_HASH_EMPTY )bCollision = true;
+      else u8HashSlots[u32Slot] = i;
+    }
+    if( !bCollision )break;
+  }
+  bHashBuilt = true;
+}
+
+int templateVarFind(const char *chName, size_t len){
+  if( !bHashBuilt )buildVarHash();
+  uint8_t u8Var = u8HashSlots[varHash(chName, len, u32HashSeed)];
+  if( u8Var == TEMPLATE_HASH_EMPTY )return -1;
+  const char *chKnown = TemplateVarNames[u8Var];
+  if( strlen(chKnown) != len || memcmp(chKnown, chName, len) != 0 )return -1;
+  return u8Var;
+}
+
+
+// ##################################################################
+// # Values
+// ##################################################################
+
+static size_t calPointsValue(const GaugeSettings &gauge, char *chOut, size_t maxLen){
+  size_t len = 0;
+  chOut[0] = 0;
+  for( int i = 0; i < gauge.calPoints && len < maxLen; i++ ){
+    len += snprintf(chOut + len, maxLen - len, "%s%.2f:%d", i ? ", " : "", gauge.cal[i].value,
+      gauge.cal[i].pwm);
+  }
+  return len < maxLen ? len : maxLen - 1;
+}
+
+static size_t windLedsValue(char *chOut, size_t maxLen){
+  size_t len = 0;
+  chOut[0] = 0;
+  for( int i = 0; i < WIND_SECTORS && len < maxLen; i++ ){
+    len += snprintf(chOut + len, maxLen - len, i ? " %02X" : "%02X", Settings.Config.WindLeds.Pattern[i]);
+  }
+  return len < maxLen ? len : maxLen - 1;
+}
+
+size_t templateValue(TemplateVar var, char *chOut, size_t maxLen){
+  static const uint8_t u8Weather[] = { wsTime, wsTemperature, wsHumidity, wsPressure, wsWind,
+    wsWindGust, wsUv, wsBrightness, wsSolarRadiation, wsRainRate, wsPrecipitationType,
+    wsLightningStrikes, wsLightningDistance };
+  const AppConfig &config = Settings.Config;
+  int iLen;
+
+  switch( var ){
+    case tvWifiMode: iLen = snprintf(chOut, maxLen, "%s", bSoftApActive ? "AP Mode" : "Station Mode"); break;
+    case tvWifiSsid: iLen = snprintf(chOut, maxLen, "%s", bSoftApActive ? AP_MODE_SSID : config.WiFi.ssid); break;
+    case tvWifiStatic: return staticIpFormat(config.WiFi, chOut, maxLen);
+    case tvUsername: iLen = snprintf(chOut, maxLen, "%s", config.Web.user); break;
+    case tvMinWind: iLen = snprintf(chOut, maxLen, "%d", config.Wind.min); break;
+    case tvMaxWind: iLen = snprintf(chOut, maxLen, "%d", config.Wind.max); break;
+    case tvStepWind: iLen = snprintf(chOut, maxLen, "%d", config.Wind.step); break;
+    case tvGainWind: iLen = snprintf(chOut, maxLen, "%.2f", config.Wind.gain); break;
+    case tvThresholdWind: iLen = snprintf(chOut, maxLen, "%d", config.Wind.threshold); break;
+    case tvCalWind: return calPointsValue(config.Wind, chOut, maxLen);
+    case tvSlewWind: iLen = snprintf(chOut, maxLen, "%d", config.Wind.slew); break;
+    case tvDampedWind: iLen = snprintf(chOut, maxLen, "%s", config.Wind.damped ? "checked" : ""); break;
+    case tvMinTemp: iLen = snprintf(chOut, maxLen, "%d", config.Temp.min); break;
+    case tvMaxTemp: iLen = snprintf(chOut, maxLen, "%d", config.Temp.max); break;
+    case tvStepTemp: iLen = snprintf(chOut, maxLen, "%d", config.Temp.step); break;
+    case tvGainTemp: iLen = snprintf(chOut, maxLen, "%.2f", config.Temp.gain); break;
+    case tvCalTemp: return calPointsValue(config.Temp, chOut, maxLen);
+    case tvSlewTemp: iLen = snprintf(chOut, maxLen, "%d", config.Temp.slew); break;
+    case tvDampedTemp: iLen = snprintf(chOut, maxLen, "%s", config.Temp.damped ? "checked" : ""); break;
+    case tvWindLeds: return windLedsValue(chOut, maxLen);
+    case tvShowWind: iLen = snprintf(chOut, maxLen, "%d", config.Wind.show); break;
+    case tvArcWind: iLen = snprintf(chOut, maxLen, "%s", config.WindLeds.Arc ? "checked" : ""); break;
+    case tvRoute0: case tvRoute1: case tvRoute2: case tvRoute3:
+    case tvRoute4: case tvRoute5: case tvRoute6: case tvRoute7:
+      return routeFormat(config.Routes.Route[var - tvRoute0], chOut, maxLen);
+    case tvLinkStale: iLen = snprintf(chOut, maxLen, "%u", (unsigned)config.Link.StaleIntervals); break;
+    case tvLinkPark: iLen = snprintf(chOut, maxLen, "%u", (unsigned)config.Link.ParkPercent); break;
+    case tvLinkBlank: iLen = snprintf(chOut, maxLen, "%s", config.Link.Blank ? "checked" : ""); break;
+    case tvIngestAllow: iLen = snprintf(chOut, maxLen, "%s", config.Ingest.Allow); break;
+    case tvWifiIpAddr:
+    case tvWifiRssi:
+    case tvBatVolt:
+      return templatePlatformValue(var, chOut, maxLen);
+    case tvSettingsWrites: iLen = snprintf(chOut, maxLen, "%u", (unsigned)SettingsStorage.Writes()); break;
+    default:
+      // Weather, as last pushed to the websocket clients
+      if( var >= tvCurTime && var < NUM_TEMPLATE_VARS ){
+        const char *chValue = WeatherStatus.Value(u8Weather[var - tvCurTime]);
+        iLen = snprintf(chOut, maxLen, "%s", chValue[0] ? chValue : "N/A");
+      }
+      else iLen = snprintf(chOut, maxLen, "N/A");
+      break;
+  }
+  if( iLen < 0 )return 0;
+  return (size_t)iLen < maxLen ? (size_t)iLen : maxLen - 1;
+}
+
+
+// ##################################################################
+// # Compile & render
+// ##################################################################
+
+bool CompiledTemplate::Compile(const char *chText, size_t len){
+  Source.reset(new char[len]);
+  memcpy(Source.get(), chText, len);
+  Cached.reset();
+  numSegments = 0;
+
+  const size_t maxSegments = sizeof(SegmentList) / sizeof(SegmentList[0]);
+  size_t literal = 0, live = 0;
+  for( size_t i = 0; i < len; i++ ){
+    if( chText[i] != '%' )continue;
+    const char *chEnd = (const char *)memchr(chText + i + 1, '%', len - i - 1);
+    if( !chEnd )break;
+    int iVar = templateVarFind(chText + i + 1, chEnd - chText - i - 1);
+    // Not a placeholder (e.g. "100%"), keep it as text
+    if( iVar < 0 )continue;
+    if( numSegments + 2 > maxSegments )return false;
+    // Each live value ends a part of the render, the text after the
+    // last one is a part of its own
+    if( iVar >= TEMPLATE_FIRST_LIVE && ++live + 1 > TEMPLATE_MAX_PARTS )return false;
+    if( i > literal )SegmentList[numSegments++] = { (uint32_t)literal, (uint32_t)(i - literal), NUM_TEMPLATE_VARS };
+    SegmentList[numSegments++] = { 0, 0, (uint8_t)iVar };
+    i = chEnd - chText;
+    literal = i + 1;
+  }
+  if( len > literal ){
+    if( numSegments + 1 > maxSegments )return false;
+    SegmentList[numSegments++] = { (uint32_t)literal, (uint32_t)(len - literal), NUM_TEMPLATE_VARS };
+  }
+  return true;
+}
+
+std::shared_ptr<const TemplateRender> CompiledTemplate::Render(void){
+  const uint32_t u32Generation = u32SettingsGeneration;
+  std::shared_ptr<const TemplateRender> cached = Cached;
+  if( cached && cached->Generation == u32Generation )return cached;
+
+  // Settings changed, render the text and settings values again
+  std::shared_ptr<TemplateRender> render = std::make_shared<TemplateRender>();
+  std::string strText;
+  char chValue[TEMPLATE_VALUE_LEN];
+  TemplateRender::Part part = { 0, 0, NUM_TEMPLATE_VARS };
+  for( size_t i = 0; i < numSegments; i++ ){
+    const Segment &seg = SegmentList[i];
+    if( seg.Var == NUM_TEMPLATE_VARS )strText.append(Source.get() + seg.Offset, seg.Len);
+    else if( seg.Var < TEMPLATE_FIRST_LIVE )strText.append(chValue, templateValue((TemplateVar)seg.Var, chValue, sizeof(chValue)));
+    else{
+      // Room for every part, Compile() counted them
+      part.Len = strText.size() - part.Offset;
+      part.Var = seg.Var;
+      render->Parts[render->numParts++] = part;
+      part = { (uint32_t)strText.size(), 0, NUM_TEMPLATE_VARS };
+    }
+  }
+  part.Len = strText.size() - part.Offset;
+  render->Parts[render->numParts++] = part;
+  render->Text = new char[strText.size() + 1];
+  memcpy(render->Text, strText.c_str(), strText.size() + 1);
+  render->Generation = u32Generation;
+  Cached = render;
+  return render;
+}
+
+size_t TemplateCursor::Fill(uint8_t *pBuffer, size_t maxLen){
+  StageTimer timer(msTemplate);
+  size_t len = 0;
+  while( len < maxLen && part < render->numParts ){
+    const TemplateRender::Part &current = render->Parts[part];
+    const char *chFrom = bValue ? chValue : render->Text + current.Offset;
+    const size_t total = bValue ? valueLen : current.Len;
+    size_t chunk = total - u32Sent;
+    if( chunk > maxLen - len )chunk = maxLen - len;
+    memcpy(pBuffer + len, chFrom + u32Sent, chunk);
+    len += chunk;
+    u32Sent += chunk;
+    if( u32Sent < total )break;
+
+    // Text done, format the live value that follows (or move on)
+    u32Sent = 0;
+    if( !bValue && current.Var != NUM_TEMPLATE_VARS ){
+      valueLen = templateValue((TemplateVar)current.Var, chValue, sizeof(chValue));
+      bValue = true;
+    }
+    else{
+      bValue = false;
+      part++;
+    }
+  }
+  return len;
+}
@@ -0,0 +1,134 @@
+#include "TimerWheel.h"
+
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_REACH (1UL << (WHEEL_BITS * WHEEL_LEVELS))
+
+// Slot index at a level for a tick
+static inline uint8_t wheelIndex(uint32_t u32Tick, uint8_t u8Level){
+  return (u32Tick >> (WHEEL_BITS * u8Level)) & WHEEL_MASK;
+}
+
+// First occupied slot at or after u8From (wrapping), -1 if none
+static inline int firstOccupied(uint64_t u64Occupied, uint8_t u8From){
+  if( !u64Occupied )return -1;
+  uint64_t u64Rotated = u8From ? (u64Occupied >> u8From) | (u64Occupied << (WHEEL_SLOTS - u8From)) : u64Occupied;
+  return (u8From + __builtin_ctzll(u64Rotated)) & WHEEL_MASK;
+}
+
+void TimerWheel::Begin(uint32_t u32NowMs){
+  u32TickMs = u32NowMs;
+}
+
+void TimerWheel::place(WheelTimer &timer){
+  const uint32_t u32Delta = timer.Expires - u32Tick;
+  uint8_t u8Level = 0;
+  while( u8Level < WHEEL_LEVELS - 1 && u32Delta >= (1UL << (WHEEL_BITS * (u8Level + 1))) )u8Level++;
+  // Beyond the top level, park in its last slot and place it again from there
+  timer.Slot = u32Delta >= WHEEL_REACH ? (wheelIndex(u32Tick, u8Level) + WHEEL_MASK) & WHEEL_MASK
+    : wheelIndex(timer.Expires, u8Level);
+  timer.Level = u8Level;
+  timer.Prev = nullptr;
+  timer.Next = Slots[u8Level][timer.Slot];
+  if( timer.Next )timer.Next->Prev = &timer;
+  Slots[u8Level][timer.Slot] = &timer;
+  u64Occupied[u8Level] |= 1ULL << timer.Slot;
+  timer.Active = true;
+}
+
+void TimerWheel::unlink(WheelTimer &timer){
+  if( timer.Prev )timer.Prev->Next = timer.Next;
+  else Slots[timer.Level][timer.Slot] = timer.Next;
+  if( timer.Next )timer.Next->Prev = timer.Prev;
+  if( !Slots[timer.Level][timer.Slot] )u64Occupied[timer.Level] &= ~(1ULL << timer.Slot);
+  timer.Next = timer.Prev = nullptr;
+  timer.Active = false;
+}
+
+void TimerWheel::Add(WheelTimer &timer, uint32_t u32DeadlineMs){
+  if( timer.Active )unlink(timer);
+  int32_t i32Ms = (int32_t)(u32DeadlineMs - u32TickMs);
+  uint32_t u32Ticks = i32Ms > 0 ? ((uint32_t)i32Ms + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS : 0;
+  timer.Expires = u32Tick + (u32Ticks ? u32Ticks : 1);
+  place(timer);
+}
+
+void TimerWheel::Remove(WheelTimer &timer){
+  if( timer.Active )unlink(timer);
+}
+
+// The tick reached this level's slot, spread its timers below
+void TimerWheel::cascade(uint8_t u8Level){
+  const uint8_t u8Slot = wheelIndex(u32Tick, u8Level);
+  WheelTimer *pTimer = Slots[u8Level][u8Slot];
+  Slots[u8Level][u8Slot] = nullptr;
+  u64Occupied[u8Level] &= ~(1ULL << u8Slot);
+  while( pTimer ){
+    WheelTimer *pNext = pTimer->Next;
+    place(*pTimer);
+    pTimer = pNext;
+  }
+}
+
+WheelTimer *TimerWheel::Advance(uint32_t u32NowMs){
+  WheelTimer *pHead = nullptr, **ppTail = &pHead;
+  if( (int32_t)(u32NowMs - u32TickMs) < WHEEL_TICK_MS )return nullptr;
+  uint32_t u32Ticks = (u32NowMs - u32TickMs) / WHEEL_TICK_MS;
+  u32TickMs += u32Ticks * WHEEL_TICK_MS;
+  const uint32_t u32Target = u32Tick + u32Ticks;
+
+  while( u32Tick != u32Target ){
+    // Step straight to the next tick anything happens on: a level 0
+    // slot expiring, or a higher slot coming round to be cascaded
+    uint32_t u32Step = u32Target;
+    for( uint8_t l = 0; l < WHEEL_LEVELS; l++ ){
+      int iSlot = firstOccupied(u64Occupied[l], (wheelIndex(u32Tick, l) + 1) & WHEEL_MASK);
+      if( iSlot < 0 )continue;
+      const uint8_t u8Shift = WHEEL_BITS * l;
+      uint32_t u32Lap = u32Tick >> u8Shift;
+      uint32_t u32Event = (u32Lap & ~(uint32_t)WHEEL_MASK) | (uint32_t)iSlot;
+      if( u32Event <= u32Lap )u32Event += WHEEL_SLOTS;
+      u32Event <<= u8Shift;
+      if( u32Event - u32Tick < u32Step - u32Tick )u32Step = u32Event;
+    }
+    u32Tick = u32Step;
+
+    if( !(u32Tick & WHEEL_MASK) ){
+      for( uint8_t l = 1; l < WHEEL_LEVELS; l++ ){
+        cascade(l);
+        if( wheelIndex(u32Tick, l) != 0 )break;
+      }
+    }
+    const uint8_t u8Slot = wheelIndex(u32Tick, 0);
+    while( WheelTimer *pTimer = Slots[0][u8Slot] ){
+      unlink(*pTimer);
+      *ppTail = pTimer;
+      ppTail = &pTimer->Next;
+    }
+  }
+  return pHead;
+}
+
+bool TimerWheel::NextDeadline(uint32_t &u32DeadlineMs) const{
+  bool bFound = false;
+  uint32_t u32Best = 0;
+  for( uint8_t l = 0; l < WHEEL_LEVELS; l++ ){
+    // The earliest timers of a level are in its first slot after the
+    // current one (which is a whole lap away, so comes last).  Not so
+    // at the top level, where the timers beyond its reach are parked.
+    uint64_t u64Slots = u64Occupied[l];
+    while( u64Slots ){
+      int iSlot = firstOccupied(u64Slots, (wheelIndex(u32Tick, l) + 1) & WHEEL_MASK);
+      for( const WheelTimer *pTimer = Slots[l][iSlot]; pTimer; pTimer = pTimer->Next ){
+        uint32_t u32Ahead = pTimer->Expires - u32Tick;
+        if( !bFound || u32Ahead < u32Best ){
+          u32Best = u32Ahead;
+          bFound = true;
+        }
+      }
+      if( l < WHEEL_LEVELS - 1 )break;
+      u64Slots &= ~(1ULL << iSlot);
+    }
+  }
+  if( bFound )u32DeadlineMs = u32TickMs + u32Best * WHEEL_TICK_MS;
+  return bFound;
+}
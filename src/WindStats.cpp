@@ -0,0 +1,109 @@
+#include <math.h>
+#include <string.h>
+#include "WindStats.h"
+
+WindStatistics WindStats;
+
+#define WIND_Q14 16384
+#define RAD_TO_DEG 57.29578f
+
+void WindStatistics::Add(uint32_t u32NowMs, float fSpeed, int iDirection){
+  const uint32_t u32Seq = u32Next++;
+  Sample &sample = Samples[u32Seq & WIND_STATS_MASK];
+  sample.Ms = u32NowMs;
+  float fHundredths = fSpeed * 100 + 0.5f;
+  sample.Speed = !(fHundredths > 0) ? 0 : fHundredths < 65535 ? (uint16_t)fHundredths : 65535;
+  // A calm sample has no direction worth averaging
+  if( sample.Speed ){
+    float fRadians = iDirection / RAD_TO_DEG;
+    sample.Sin = (int16_t)lroundf(sinf(fRadians) * WIND_Q14);
+    sample.Cos = (int16_t)lroundf(cosf(fRadians) * WIND_Q14);
+  }
+  else sample.Sin = sample.Cos = 0;
+
+  for( Window &window : Windows ){
+    window.u32Speed += sample.Speed;
+    if( sample.Speed ){
+      window.i32Sin += sample.Sin;
+      window.i32Cos += sample.Cos;
+      window.u16Directions++;
+    }
+    // Anything not above (below) the new sample can never be the max (min) again
+    while( window.u32MaxTail != window.u32MaxHead &&
+        Samples[window.MaxQueue[(window.u32MaxTail - 1) & WIND_STATS_MASK] & WIND_STATS_MASK].Speed <= sample.Speed ){
+      window.u32MaxTail--;
+    }
+    window.MaxQueue[window.u32MaxTail++ & WIND_STATS_MASK] = u32Seq;
+    while( window.u32MinTail != window.u32MinHead &&
+        Samples[window.MinQueue[(window.u32MinTail - 1) & WIND_STATS_MASK] & WIND_STATS_MASK].Speed >= sample.Speed ){
+      window.u32MinTail--;
+    }
+    window.MinQueue[window.u32MinTail++ & WIND_STATS_MASK] = u32Seq;
+    evict(window);
+  }
+}
+
+// Drop the samples older than the window, or about to be overwritten in the ring
+void WindStatistics::evict(Window &window){
+  const Sample &newest = Samples[(u32Next - 1) & WIND_STATS_MASK];
+  while( window.u32First != u32Next && (newest.Ms - Samples[window.u32First & WIND_STATS_MASK].Ms > window.u32Ms
+      || u32Next - window.u32First >= WIND_STATS_SAMPLES) ){
+    const Sample &oldest = Samples[window.u32First & WIND_STATS_MASK];
+    window.u32Speed -= oldest.Speed;
+    if( oldest.Speed ){
+      window.i32Sin -= oldest.Sin;
+      window.i32Cos -= oldest.Cos;
+      window.u16Directions--;
+    }
+    if( window.MaxQueue[window.u32MaxHead & WIND_STATS_MASK] == window.u32First )window.u32MaxHead++;
+    if( window.MinQueue[window.u32MinHead & WIND_STATS_MASK] == window.u32First )window.u32MinHead++;
+    window.u32First++;
+  }
+}
+
+void WindStatistics::Clear(void){
+  for( Window &window : Windows ){
+    const uint32_t u32Ms = window.u32Ms;
+    window = Window(u32Ms);
+  }
+  u32Next = 0;
+}
+
+float WindStatistics::Average(WindWindow window) const{
+  const Window &w = Windows[window];
+  uint32_t u32Count = u32Next - w.u32First;
+  return u32Count ? w.u32Speed / (100.0f * u32Count) : 0;
+}
+
+float WindStatistics::Gust(WindWindow window) const{
+  const Window &w = Windows[window];
+  if( w.u32MaxHead == w.u32MaxTail )return 0;
+  return Samples[w.MaxQueue[w.u32MaxHead & WIND_STATS_MASK] & WIND_STATS_MASK].Speed / 100.0f;
+}
+
+float WindStatistics::Lull(WindWindow window) const{
+  const Window &w = Windows[window];
+  if( w.u32MinHead == w.u32MinTail )return 0;
+  return Samples[w.MinQueue[w.u32MinHead & WIND_STATS_MASK] & WIND_STATS_MASK].Speed / 100.0f;
+}
+
+WindSummary WindStatistics::Summary(WindWindow window) const{
+  const Window &w = Windows[window];
+  WindSummary summary;
+  summary.Samples = (uint16_t)(u32Next - w.u32First);
+  summary.Average = Average(window);
+  summary.Gust = Gust(window);
+  summary.Lull = Lull(window);
+  if( w.u16Directions ){
+    // Mean resultant length R of the unit vectors, the circular standard
+    // deviation is sqrt(-2 ln R), 180 when they cancel out
+    float fSin = (float)w.i32Sin / WIND_Q14, fCos = (float)w.i32Cos / WIND_Q14;
+    float fLength = sqrtf(fSin * fSin + fCos * fCos) / w.u16Directions;
+    float fDirection = atan2f(fSin, fCos) * RAD_TO_DEG;
+    summary.Direction = fDirection < 0 ? fDirection + 360 : fDirection;
+    if( fLength >= 1 )summary.Variability = 0;
+    else if( fLength > 0.0001f )summary.Variability = fminf(180, sqrtf(-2 * logf(fLength)) * RAD_TO_DEG);
+    else summary.Variability = 180;
+  }
+  return summary;
+}
@@ -0,0 +1,220 @@
+#include <string.h>
+#include <ArduinoJson.h>
+#include "App.h"
+#include "Boot.h"
+#include "Calibration.h"
+#include "GaugeRoutes.h"
+#include "Ingest.h"
+#include "Metrics.h"
+#include "SettingsStore.h"
+#include "Template.h"
+#include "WsCommand.h"
+
+// Parsed in place of a per frame document, only the async server task
+// dispatches commands
+static StaticJsonDocument<WS_COMMAND_MAX_LEN> jsonWsMsg;
+
+// Bounded string copy, false (and the field untouched) if it is
+// missing or does not fit
+template <size_t N>
+static bool copyField(char (&chDst)[N], const char *chSrc){
+  if( !chSrc )return false;
+  size_t len = strlen(chSrc);
+  if( len >= N )return false;
+  memcpy(chDst, chSrc, len + 1);
+  return true;
+}
+
+// Calibration curve from the web UI, [[value, pwm], ...]
+static void readCalPoints(JsonArray jsonCal, GaugeSettings &gauge){
+  gauge.calPoints = 0;
+  for( size_t i = 0; i < jsonCal.size() && i < GAUGE_CAL_POINTS; i++ ){
+    gauge.cal[i].value = jsonCal[i][0];
+    gauge.cal[i].pwm = jsonCal[i][1];
+    gauge.calPoints++;
+  }
+}
+
+// Wind LED patterns from the web UI, one register value per sector
+static void readWindLeds(JsonArray jsonLeds){
+  if( jsonLeds.size() != WIND_SECTORS )return;
+  for( size_t i = 0; i < WIND_SECTORS; i++ ){
+    Settings.Config.WindLeds.Pattern[i] = jsonLeds[i].as<uint8_t>();
+  }
+}
+
+// Gauge routes from the web UI, one line of text per route (GaugeRoutes.h),
+// false if any of them does not parse or two share an output
+static bool readRoutes(JsonArray jsonRoutes, GaugeRouteSettings &routes){
+  if( jsonRoutes.size() > GAUGE_ROUTES )return false;
+  for( size_t i = 0; i < GAUGE_ROUTES; i++ ){
+    const char *chRoute = i < jsonRoutes.size() ? jsonRoutes[i].as<const char *>() : "";
+    if( !chRoute || !routeParse(chRoute, routes.Route[i]) )return false;
+  }
+  return routesValid(routes);
+}
+
+// Stale data handling from the web UI, kept as it was when not sent
+static void readLink(JsonObject jsonLink, LinkSettings &link){
+  if( jsonLink.isNull() )return;
+  int iStale = jsonLink["stale"] | (int)link.StaleIntervals;
+  int iPark = jsonLink["park"] | (int)link.ParkPercent;
+  link.StaleIntervals = iStale < 0 ? 0 : iStale > UINT8_MAX ? UINT8_MAX : iStale;
+  link.ParkPercent = iPark < 0 ? 0 : iPark > 100 ? 100 : iPark;
+  link.Blank = (jsonLink["blank"] | (int)link.Blank) ? 1 : 0;
+}
+
+// Station allow list from the web UI, kept as it was when not sent or
+// not a list of serial numbers
+static void readIngest(JsonObject jsonIngest, IngestSettings &ingest){
+  const char *chAllow = jsonIngest["allow"];
+  IngestAllow allow;
+  if( chAllow && (!ingestAllowParse(chAllow, allow) || !copyField(ingest.Allow, chAllow)) ){
+    debug(1, "\n\rRejected station allow list: %s", chAllow);
+  }
+}
+
+// Gauge scaling from the web UI, each value kept as it was when not sent
+static void readGauge(JsonObject jsonGauge, GaugeSettings &gauge){
+  gauge.min = jsonGauge["min"] | gauge.min;
+  gauge.max = jsonGauge["max"] | gauge.max;
+  gauge.step = jsonGauge["step"] | gauge.step;
+  gauge.gain = jsonGauge["gain"] | gauge.gain;
+  gauge.threshold = jsonGauge["threshold"] | gauge.threshold;
+  if( !jsonGauge["cal"].isNull() )readCalPoints(jsonGauge["cal"], gauge);
+  gauge.slew = jsonGauge["slew"] | gauge.slew;
+  gauge.damped = jsonGauge["damped"] | gauge.damped;
+  int iShow = jsonGauge["show"] | gauge.show;
+  gauge.show = iShow >= 0 && iShow < NUM_GAUGE_SHOW ? iShow : gauge.show;
+}
+
+WsCommand wsCommandDispatch(const char *chData, size_t len){
+  StageTimer timer(msWebSocket);
+  if( len > WS_COMMAND_MAX_LEN || deserializeJson(jsonWsMsg, chData, len) != DeserializationError::Ok ){
+    return wcInvalid;
+  }
+  const char *chMsgtype = jsonWsMsg["type"];
+  if( !chMsgtype )return wcInvalid;
+  JsonObject jsonPayload = jsonWsMsg["payload"];
+
+  switch( wsCommandHash(chMsgtype) ){
+    // Update System Settings
+    case wsCommandHash("updateSettings"):{
+        if( strcmp(chMsgtype, "updateSettings") != 0 )break;
+        SettingsStorage.BeginEdit();
+        readGauge(jsonPayload["wind"], Settings.Config.Wind);
+        readGauge(jsonPayload["temp"], Settings.Config.Temp);
+        readWindLeds(jsonPayload["wind"]["leds"]);
+        Settings.Config.WindLeds.Arc = (jsonPayload["wind"]["arc"] | (int)Settings.Config.WindLeds.Arc) ? 1 : 0;
+        readLink(jsonPayload["link"], Settings.Config.Link);
+        readIngest(jsonPayload["ingest"], Settings.Config.Ingest);
+        SettingsStorage.EndEdit(SETTINGS_SECTION(csWind) | SETTINGS_SECTION(csTemp) |
+          SETTINGS_SECTION(csWindLeds) | SETTINGS_SECTION(csLink) | SETTINGS_SECTION(csIngest));
+        gaugeTablesBuild();
+        Ingest.Configure(Settings.Config.Ingest);
+        u32SettingsGeneration++;
+
+        // Calibration mode, the housekeeping task runs it
+        const char *chMode = jsonPayload["cal"]["mode"] | "";
+        float fDwell = jsonPayload["cal"]["dwell"] | 0.0f;
+        uint32_t u32DwellMs = fDwell > 0 && fDwell <= CAL_DWELL_MAX_MS / 1000 ? (uint32_t)(fDwell * 1000) : CAL_DWELL_MS;
+        if( strcmp("range", chMode) == 0 ){
+          Calibration.Start(range, rsLinear, u32DwellMs);
+        }
+        if( strcmp("wind", chMode) == 0 ){
+          Calibration.Start(sweep, rsWind, u32DwellMs);
+        }
+        if( strcmp("temp", chMode) == 0 ){
+          Calibration.Start(sweep, rsTemp, u32DwellMs);
+        }
+        if( strcmp("none", chMode) == 0 ){
+          Calibration.Start(none, rsLinear, u32DwellMs);
+        }
+      }
+      return wcSettings;
+
+    // Calibration, nudge the current step or save the last gauge sweep
+    case wsCommandHash("calibrate"):{
+        if( strcmp(chMsgtype, "calibrate") != 0 )break;
+        const char *chAction = jsonPayload["action"] | "";
+        if( strcmp("nudge", chAction) == 0 ){
+          Calibration.Nudge(jsonPayload["duty"] | 0);
+          return wcCalibrate;
+        }
+        CalResult result;
+        if( strcmp("save", chAction) != 0 || !Calibration.Result(result) ){
+          debug(1, "\n\rRejected calibration %s, nothing to do", chAction);
+          return wcInvalid;
+        }
+        SettingsStorage.BeginEdit();
+        GaugeSettings &gauge = result.Scale == rsTemp ? Settings.Config.Temp : Settings.Config.Wind;
+        gauge.calPoints = result.Points;
+        for( uint8_t i = 0; i < result.Points; i++ )gauge.cal[i] = result.Point[i];
+        SettingsStorage.EndEdit(SETTINGS_SECTION(result.Scale == rsTemp ? csTemp : csWind));
+        gaugeTablesBuild();
+        u32SettingsGeneration++;
+        debug(1, "\n\rSaved %u %s calibration points", (unsigned)result.Points, RouteScaleNames[result.Scale]);
+      }
+      return wcCalibrate;
+
+    // updateWiFi
+    case wsCommandHash("updateWiFi"):{
+        if( strcmp(chMsgtype, "updateWiFi") != 0 )break;
+        WiFiSettings wifi = Settings.Config.WiFi;
+        if( !copyField(wifi.ssid, jsonPayload["wifi"]["ssid"]) ||
+            !copyField(wifi.pass, jsonPayload["wifi"]["pw"]) ){
+          debug(1, "\n\rRejected Wi-Fi parameters, missing or too long");
+          return wcInvalid;
+        }
+        // Static address, kept as it was when not sent
+        const char *chStatic = jsonPayload["wifi"]["static"];
+        if( chStatic && !staticIpParse(chStatic, wifi) ){
+          debug(1, "\n\rRejected static IP: %s", chStatic);
+          return wcInvalid;
+        }
+        SettingsStorage.BeginEdit();
+        Settings.Config.WiFi = wifi;
+        SettingsStorage.EndEdit(SETTINGS_SECTION(csWiFi));
+        // Never the password, the log goes out to the /log viewers
+        debug(1, "\n\rGot Wi-Fi parameters, SSID: %s, and a new password", Settings.Config.WiFi.ssid);
+      }
+      return wcWiFi;
+
+    //updateUser
+    case wsCommandHash("updateUser"):{
+        if( strcmp(chMsgtype, "updateUser") != 0 )break;
+        WebSettings web = Settings.Config.Web;
+        if( !copyField(web.user, jsonPayload["auth"]["user"]) ||
+            !copyField(web.pass, jsonPayload["auth"]["pass"]) ){
+          debug(1, "\n\rRejected Auth parameters, missing or too long");
+          return wcInvalid;
+        }
+        SettingsStorage.BeginEdit();
+        Settings.Config.Web = web;
+        SettingsStorage.EndEdit(SETTINGS_SECTION(csWeb));
+        u32SettingsGeneration++;
+        debug(1, "\n\rGot Auth parameters, user: %s, and a new password", Settings.Config.Web.user);
+      }
+      return wcUser;
+
+    // updateRoutes, applied from the next boot
+    case wsCommandHash("updateRoutes"):{
+        if( strcmp(chMsgtype, "updateRoutes") != 0 )break;
+        GaugeRouteSettings routes;
+        if( !readRoutes(jsonPayload["routes"], routes) ){
+          debug(1, "\n\rRejected gauge routes, invalid or outputs used twice");
+          return wcInvalid;
+        }
+        SettingsStorage.BeginEdit();
+        Settings.Config.Routes = routes;
+        SettingsStorage.EndEdit(SETTINGS_SECTION(csRoutes));
+        u32SettingsGeneration++;
+      }
+      return wcRoutes;
+
+    default:
+      break;
+  }
+  debug(1, "\r\nUnknown websocket message type: %s", chMsgtype);
+  return wcUnknown;
+}
@@ -0,0 +1,293 @@
+#include <ArduinoJson.h>
+#include <string.h>
+#include "Metrics.h"
+#include "WxSample.h"
+
+// ##################################################################
+// # WeatherFlow Tempest UDP decoding
+// #
+// # Converts a single broadcast to the WeatherFlow "Imperial" units
+// # the gauges are scaled for.  The message type is found with a scan
+// # for the "type" key and anything but rapid_wind and obs_st dropped
+// # there, then only the array elements a field below reads are
+// # converted, in place from the receive buffer.  Building with
+// # -D WX_DECODE_FULL deserializes the whole message instead.
+// ##################################################################
+
+#define MPS_TO_MPH 2.2369363f
+#define MB_TO_INHG 0.02953f
+#define MM_TO_IN 0.0393701f
+#define KM_TO_MI 0.621371f
+
+#define WX_MAX_VALUES 32    // Array elements past this are never read
+
+static float celsiusToFahrenheit(float fCelsius){
+  return fCelsius * 9.0f / 5.0f + 32.0f;
+}
+
+
+// ##################################################################
+// # Fields in use
+// #
+// # The values the gauges, routes and web status read, by their
+// # position in the message array.  Optional fields are only taken
+// # from a full length obs_st.
+// ##################################################################
+
+struct WxField{
+    uint8_t Index;
+    bool Optional;
+    void (*Apply)(WxSample &sample, double dValue);
+};
+
+// ob: [epoch, wind speed (m/s), wind direction (degrees)]
+static const WxField RapidWindFields[] = {
+  { 0, false, [](WxSample &s, double d){ s.EpochTime = (uint32_t)d; } },
+  { 1, false, [](WxSample &s, double d){ s.WindSpeed = (float)d * MPS_TO_MPH; } },
+  { 2, false, [](WxSample &s, double d){ s.WindDirection = (int)d; } },
+};
+
+// obs: [[epoch, lull, avg, gust, direction, interval, pressure (mb), air temperature (C),
+//        humidity, lux, uv, solar radiation, rain (mm), precipitation type,
+//        strike distance (km), strike count, ...]]
+static const WxField ObsStFields[] = {
+  { 0, false, [](WxSample &s, double d){ s.EpochTime = (uint32_t)d; } },
+  { 2, false, [](WxSample &s, double d){ s.WindAverage = (float)d * MPS_TO_MPH; } },
+  { 3, false, [](WxSample &s, double d){ s.WindGust = (float)d * MPS_TO_MPH; } },
+  { 6, false, [](WxSample &s, double d){ s.Pressure = (float)d * MB_TO_INHG; } },
+  { 7, false, [](WxSample &s, double d){ s.AirTemperature = celsiusToFahrenheit((float)d); } },
+  { 8, true, [](WxSample &s, double d){ s.Humidity = (float)d; } },
+  { 9, true, [](WxSample &s, double d){ s.Brightness = (uint32_t)d; } },
+  { 10, true, [](WxSample &s, double d){ s.Uv = (float)d; } },
+  { 11, true, [](WxSample &s, double d){ s.SolarRadiation = (uint32_t)d; } },
+  { 12, true, [](WxSample &s, double d){ s.RainAmount = (float)d * MM_TO_IN; } },
+  { 13, true, [](WxSample &s, double d){ s.PrecipitationType = (uint8_t)d; } },
+  { 14, true, [](WxSample &s, double d){ s.StrikeDistance = (float)d * KM_TO_MI; } },
+  { 15, true, [](WxSample &s, double d){ s.StrikeCount = (uint32_t)d; } },
+};
+
+struct WxMessage{
+    const char *Type;
+    const char *Key;        // Array holding the values, with its quotes
+    uint8_t Nesting;        // [ before the first value
+    uint8_t Valid;
+    uint8_t MinValues;      // Fewer and the message is dropped
+    uint8_t FullValues;     // Fewer and the optional fields are left alone
+    const WxField *Fields;
+    size_t numFields;
+    uint32_t Filter;        // Bit per array element a field reads
+};
+
+static uint32_t wxFilter(const WxField *pFields, size_t numFields){
+  uint32_t u32Filter = 0;
+  for( size_t f = 0; f < numFields; f++ )u32Filter |= 1u << pFields[f].Index;
+  return u32Filter;
+}
+
+#define WX_FIELDS(list) list, sizeof(list) / sizeof(list[0]), wxFilter(list, sizeof(list) / sizeof(list[0]))
+
+static const WxMessage Messages[] = {
+  { "rapid_wind", "\"ob\"", 1, WX_VALID_RAPID_WIND, 3, 3, WX_FIELDS(RapidWindFields) },
+  { "obs_st", "\"obs\"", 2, WX_VALID_OBS_ST, 8, 16, WX_FIELDS(ObsStFields) },
+};
+#define NUM_MESSAGES (sizeof(Messages) / sizeof(Messages[0]))
+
+
+// ##################################################################
+// # In place scanning, never past the end of the datagram
+// ##################################################################
+
+static const char *skipSpace(const char *p, const char *end){
+  while( p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') )p++;
+  return p;
+}
+
+// Just past the first ':' that follows the key, NULL if there is none
+static const char *findKey(const char *p, const char *end, const char *chKey){
+  const size_t keyLen = strlen(chKey);
+  while( (p = (const char *)memchr(p, '"', end - p)) != NULL ){
+    if( (size_t)(end - p) < keyLen )return NULL;
+    if( memcmp(p, chKey, keyLen) == 0 ){
+      const char *q = skipSpace(p + keyLen, end);
+      if( q < end && *q == ':' )return skipSpace(q + 1, end);
+    }
+    p++;
+  }
+  return NULL;
+}
+
+// A JSON number (null reads as 0, as the document decode did), returns
+// the first character after it or NULL
+static const char *parseNumber(const char *p, const char *end, double &dValue){
+  static const double Pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18 };
+  if( end - p >= 4 && memcmp(p, "null", 4) == 0 ){
+    dValue = 0;
+    return p + 4;
+  }
+  bool bNegative = p < end && *p == '-';
+  if( bNegative )p++;
+  const char *start = p;
+  // Up to 18 significant digits in the mantissa, the rest only scale it
+  uint64_t u64Mantissa = 0;
+  int iScale = 0, iDigits = 0;
+  for( ; p < end && *p >= '0' && *p <= '9'; p++ ){
+    if( iDigits < 18 )u64Mantissa = u64Mantissa * 10 + (*p - '0');
+    else iScale++;
+    if( u64Mantissa )iDigits++;
+  }
+  if( p < end && *p == '.' ){
+    for( p++; p < end && *p >= '0' && *p <= '9'; p++ ){
+      if( iDigits >= 18 )continue;
+      u64Mantissa = u64Mantissa * 10 + (*p - '0');
+      if( u64Mantissa )iDigits++;
+      iScale--;
+    }
+  }
+  if( p == start )return NULL;
+  if( p < end && (*p == 'e' || *p == 'E') ){
+    p++;
+    bool bExpNegative = p < end && *p == '-';
+    if( p < end && (*p == '-' || *p == '+') )p++;
+    int iExp = 0;
+    for( ; p < end && *p >= '0' && *p <= '9'; p++ )if( iExp < 400 )iExp = iExp * 10 + (*p - '0');
+    iScale += bExpNegative ? -iExp : iExp;
+  }
+  double dResult = (double)u64Mantissa;
+  for( ; iScale > 18; iScale -= 18 )dResult *= Pow10[18];
+  for( ; iScale < -18; iScale += 18 )dResult /= Pow10[18];
+  dResult = iScale < 0 ? dResult / Pow10[-iScale] : dResult * Pow10[iScale];
+  dValue = bNegative ? -dResult : dResult;
+  return p;
+}
+
+// Past a value the filter does not want, array elements are numbers or null
+static const char *skipValue(const char *p, const char *end){
+  while( p < end && *p != ',' && *p != ']' && *p != ' ' && *p != '[' && *p != '{' && *p != '"' )p++;
+  return p;
+}
+
+const char *wxStringValue(const char *chData, size_t len, const char *chKey, size_t &valueLen){
+  const char *end = chData + len;
+  const char *p = findKey(chData, end, chKey);
+  valueLen = 0;
+  if( !p || p >= end || *p != '"' )return NULL;
+  p++;
+  const char *chValueEnd = (const char *)memchr(p, '"', end - p);
+  if( !chValueEnd )return NULL;
+  valueLen = chValueEnd - p;
+  return p;
+}
+
+static bool decodeFiltered(const char *chData, size_t len, WxSample &sample){
+  const char *end = chData + len;
+
+  // "type" first, the rest of the datagram is only looked at for ours
+  size_t typeLen;
+  const char *chType = wxStringValue(chData, len, "\"type\"", typeLen);
+  if( !chType )return false;
+  const WxMessage *pMessage = NULL;
+  for( size_t m = 0; m < NUM_MESSAGES; m++ ){
+    if( strlen(Messages[m].Type) == typeLen && memcmp(chType, Messages[m].Type, typeLen) == 0 ){
+      pMessage = &Messages[m];
+      break;
+    }
+  }
+  if( !pMessage )return false;
+
+  // The values array may come before or after the type
+  const char *p;
+  if( !(p = findKey(chData, end, pMessage->Key)) )return false;
+  for( uint8_t n = 0; n < pMessage->Nesting; n++ ){
+    if( p >= end || *p != '[' )return false;
+    p = skipSpace(p + 1, end);
+  }
+
+  double dValues[WX_MAX_VALUES];
+  size_t numValues = 0;
+  p = skipSpace(p, end);
+  if( p < end && *p == ']' )return false;
+  for( ;; ){
+    const char *next;
+    if( numValues < WX_MAX_VALUES && (pMessage->Filter & (1u << numValues)) ){
+      next = parseNumber(p, end, dValues[numValues]);
+    }
+    else next = skipValue(p, end);
+    if( !next || next == p )return false;
+    numValues++;
+    p = skipSpace(next, end);
+    if( p >= end )return false;
+    if( *p == ']' )break;
+    if( *p != ',' )return false;
+    p = skipSpace(p + 1, end);
+  }
+  if( numValues < pMessage->MinValues )return false;
+
+  const bool bFull = numValues >= pMessage->FullValues;
+  for( size_t f = 0; f < pMessage->numFields; f++ ){
+    const WxField &field = pMessage->Fields[f];
+    if( !field.Optional || bFull )field.Apply(sample, dValues[field.Index]);
+  }
+  sample.Valid = pMessage->Valid;
+  return true;
+}
+
+
+// ##################################################################
+// # Whole document decode, the reference for the filtered one
+// ##################################################################
+
+bool wxDecodeJsonFull(const char *chData, size_t len, WxSample &sample){
+  StaticJsonDocument<1024> jsonWxMsg;
+  if( deserializeJson(jsonWxMsg, chData, len) != DeserializationError::Ok )return false;
+
+  const char *chType = jsonWxMsg["type"];
+  if( !chType )return false;
+
+  sample.Valid = 0;
+  if( strcmp(chType, "rapid_wind") == 0 ){
+    JsonArray ob = jsonWxMsg["ob"];
+    if( ob.size() < 3 )return false;
+    sample.EpochTime = ob[0];
+    sample.WindSpeed = ob[1].as<float>() * MPS_TO_MPH;
+    sample.WindDirection = ob[2];
+    sample.Valid = WX_VALID_RAPID_WIND;
+  }
+  else if( strcmp(chType, "obs_st") == 0 ){
+    JsonArray obs = jsonWxMsg["obs"][0];
+    if( obs.size() < 8 )return false;
+    sample.EpochTime = obs[0];
+    sample.WindAverage = obs[2].as<float>() * MPS_TO_MPH;
+    sample.WindGust = obs[3].as<float>() * MPS_TO_MPH;
+    sample.Pressure = obs[6].as<float>() * MB_TO_INHG;
+    sample.AirTemperature = celsiusToFahrenheit(obs[7].as<float>());
+    if( obs.size() >= 16 ){
+      sample.Humidity = obs[8];
+      sample.Brightness = obs[9];
+      sample.Uv = obs[10];
+      sample.SolarRadiation = obs[11];
+      sample.RainAmount = obs[12].as<float>() * MM_TO_IN;
+      sample.PrecipitationType = obs[13].as<uint8_t>();
+      sample.StrikeDistance = obs[14].as<float>() * KM_TO_MI;
+      sample.StrikeCount = obs[15];
+    }
+    sample.Valid = WX_VALID_OBS_ST;
+  }
+  return sample.Valid != 0;
+}
+
+bool wxDecodeJson(const char *chData, size_t len, WxSample &sample){
+  bool bDecoded;
+  {
+    StageTimer timer(msParse);
+#ifdef WX_DECODE_FULL
+    bDecoded = wxDecodeJsonFull(chData, len, sample);
+#else
+    bDecoded = decodeFiltered(chData, len, sample);
+#endif
+  }
+  Metrics.Count(mcDatagrams);
+  if( !bDecoded )Metrics.Count(mcIgnored);
+  else Metrics.Count(sample.Valid & WX_VALID_RAPID_WIND ? mcRapidWind : mcObs);
+  return bDecoded;
+}
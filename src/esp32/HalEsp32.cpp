@@ -0,0 +1,269 @@
+#include <Arduino.h>
+#include <TinyPICO.h>
+#include <Adafruit_MCP23X08.h>
+#include <esp_task_wdt.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <driver/ledc.h>
+#include <Preferences.h>
+#include <sys/time.h>
+#include <lwip/sockets.h>
+#include "Hal.h"
+#include "Ingest.h"
+#include "Metrics.h"
+#ifdef WX_SOURCE_WFLIB
+#include <wf.h>
+#endif
+
+// WeatherFlow broadcast port
+#define WF_UDP_PORT 50222
+
+// ##################################################################
+// # TinyPICO implementation of the hardware abstraction layer
+// ##################################################################
+
+// Hardware board
+TinyPICO TP = TinyPICO();
+
+// Hardware I2C GPIO extenders, one per bank
+#define MCP23008_BASE_ADDR 0x20
+#define MCP23008_BANKS 8
+Adafruit_MCP23X08 mcp[MCP23008_BANKS];
+
+#ifdef WX_SOURCE_WFLIB
+// WeatherFlow Handler
+WeatherFlow WF(Imperial);
+#endif
+
+// Arduino LEDC channels 0-7 are the high speed group, 8-15 low speed
+#define LEDC_MAX_CHANNELS 16
+#define LEDC_FADE_FIELD_MAX 1023
+
+class LedcPwm : public PwmDriver{
+  public:
+    void Setup(uint8_t u8Channel, uint8_t u8Pin, uint32_t u32Freq, uint8_t u8Bits) override {
+      ledcSetup(u8Channel, u32Freq, u8Bits);
+      ledcAttachPin(u8Pin, u8Channel);
+      if( u8Channel < LEDC_MAX_CHANNELS )u32ChannelFreq[u8Channel] = u32Freq;
+    }
+    void Write(uint8_t u8Channel, uint32_t u32Duty) override {
+      // Also stops a running fade, the duty update clears the step count
+      ledcWrite(u8Channel, u32Duty);
+    }
+    bool HasFade(void) override { return true; }
+    // Program the LEDC fade registers directly (no fade ISR installed, so
+    // there is no fade semaphore to wait on), starting from the duty the
+    // hardware is at right now, which makes retargeting mid-fade seamless
+    void Fade(uint8_t u8Channel, uint32_t u32Duty, uint32_t u32Ms) override {
+      if( u8Channel >= LEDC_MAX_CHANNELS ){
+        ledcWrite(u8Channel, u32Duty);
+        return;
+      }
+      ledc_mode_t mode = (ledc_mode_t)(u8Channel / 8);
+      ledc_channel_t channel = (ledc_channel_t)(u8Channel % 8);
+      uint32_t u32From = ledc_get_duty(mode, channel);
+      uint32_t u32Delta = u32Duty > u32From ? u32Duty - u32From : u32From - u32Duty;
+      if( u32Delta == 0 || u32Ms == 0 ){
+        ledcWrite(u8Channel, u32Duty);
+        return;
+      }
+      // At most 1023 steps of up to 1023 counts, each held for 1..1023 PWM
+      // periods.  Large moves land within one step (<0.1% of 13-bit scale).
+      uint32_t u32Scale = (u32Delta + LEDC_FADE_FIELD_MAX - 1) / LEDC_FADE_FIELD_MAX;
+      uint32_t u32Steps = u32Delta / u32Scale;
+      uint32_t u32Periods = (uint32_t)((uint64_t)u32Ms * u32ChannelFreq[u8Channel] / 1000);
+      uint32_t u32Cycles = constrain(u32Periods / u32Steps, 1, LEDC_FADE_FIELD_MAX);
+      ledc_set_fade(mode, channel, u32From,
+        u32Duty > u32From ? LEDC_DUTY_DIR_INCREASE : LEDC_DUTY_DIR_DECREASE,
+        u32Steps, u32Cycles, u32Scale);
+      ledc_update_duty(mode, channel);
+    }
+  private:
+    uint32_t u32ChannelFreq[LEDC_MAX_CHANNELS] = {0};
+};
+
+class Mcp23008Expander : public GpioExpander{
+  public:
+    bool Begin(uint8_t u8Bank) override {
+      if( u8Bank >= MCP23008_BANKS || !mcp[u8Bank].begin_I2C(MCP23008_BASE_ADDR + u8Bank) )return false;
+      for(int i=0; i<8; i++)mcp[u8Bank].pinMode(i, OUTPUT);
+      return true;
+    }
+    void Write(uint8_t u8Bank, uint8_t u8Value) override {
+      if( u8Bank < MCP23008_BANKS )mcp[u8Bank].writeGPIO(u8Value, 0);
+    }
+};
+
+class DotStarLed : public StatusLed{
+  public:
+    void SetColor(uint32_t u32Color) override { TP.DotStar_SetPixelColor(u32Color); }
+    void SetBrightness(uint8_t u8Brightness) override { TP.DotStar_SetBrightness(u8Brightness); }
+    void SetPower(bool bOn) override { TP.DotStar_SetPower(bOn); }
+    void CycleColor(uint8_t u8Wait) override { TP.DotStar_CycleColor(u8Wait); }
+};
+
+class Esp32Clock : public SystemClock{
+  public:
+    time_t Now(void) override { return time(NULL); }
+    void Set(time_t tNow) override {
+      timeval tvNow;
+      tvNow.tv_sec = tNow;
+      tvNow.tv_usec = 0;
+      settimeofday(&tvNow, NULL);
+    }
+    uint32_t Millis(void) override { return millis(); }
+    uint64_t Micros(void) override { return (uint64_t)esp_timer_get_time(); }
+    void Delay(uint32_t u32Ms) override { delay(u32Ms); }
+};
+
+#ifdef WX_SOURCE_WFLIB
+// WeatherFlowLocalUdp library, polled since it has no blocking receive.
+// It decodes for itself, so there is no allow list and no sender.
+class WeatherFlowUdp : public WxSource{
+  public:
+    bool Begin(void) override { return WF.Begin(); }
+    bool Receive(WxSample &sample, uint32_t u32TimeoutMs) override {
+      uint32_t u32Start = millis();
+      while( !WF.ReceiveLoop() ){
+        if( millis() - u32Start >= u32TimeoutMs )return false;
+        vTaskDelay(pdMS_TO_TICKS(10));
+      }
+      sample.RxMicros = (uint64_t)esp_timer_get_time();
+      sample.Valid = 0;
+      if( WF.RapidWind().Valid() ){
+        sample.Valid |= WX_VALID_RAPID_WIND;
+        sample.EpochTime = WF.RapidWind().EpochTime();
+        sample.WindSpeed = WF.RapidWind().WindSpeed();
+        sample.WindDirection = WF.RapidWind().WindDirection();
+      }
+      if( WF.ObservationTempest().Valid() ){
+        sample.Valid |= WX_VALID_OBS_ST;
+        sample.AirTemperature = WF.ObservationTempest().AirTemperature();
+      }
+      return true;
+    }
+};
+#else
+// lwIP socket on the WeatherFlow broadcast port, the receive task sleeps
+// in select() until a datagram (or the timeout) arrives, so the recv()
+// that follows only copies it out (the rx stage of the metrics), then
+// the ingest screens and decodes it
+class WeatherFlowSocket : public WxSource{
+  public:
+    bool Begin(void) override {
+      sockaddr_in addr = {};
+      int iReuse = 1;
+      if( iSock >= 0 )close(iSock);
+      iSock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+      if( iSock < 0 )return false;
+      setsockopt(iSock, SOL_SOCKET, SO_REUSEADDR, &iReuse, sizeof(iReuse));
+      addr.sin_family = AF_INET;
+      addr.sin_port = htons(WF_UDP_PORT);
+      addr.sin_addr.s_addr = htonl(INADDR_ANY);
+      return bind(iSock, (sockaddr *)&addr, sizeof(addr)) == 0;
+    }
+    bool Receive(WxSample &sample, uint32_t u32TimeoutMs) override {
+      if( iSock < 0 ){ vTaskDelay(pdMS_TO_TICKS(u32TimeoutMs)); return false; }
+      timeval tvTimeout = { (time_t)(u32TimeoutMs / 1000), (suseconds_t)((u32TimeoutMs % 1000) * 1000) };
+      fd_set fdsRead;
+      FD_ZERO(&fdsRead);
+      FD_SET(iSock, &fdsRead);
+      if( select(iSock + 1, &fdsRead, NULL, NULL, &tvTimeout) <= 0 )return false;
+      int iLen;
+      {
+        StageTimer timer(msRx);
+        iLen = recv(iSock, chBuffer, sizeof(chBuffer), MSG_DONTWAIT);
+      }
+      if( iLen <= 0 )return false;
+      sample.RxMicros = (uint64_t)esp_timer_get_time();
+      return Ingest.Decode(chBuffer, iLen, sample);
+    }
+  private:
+    int iSock = -1;
+    char chBuffer[1024];
+};
+#endif
+
+// RTC slow memory, not cleared by a software, watchdog or brownout reset
+#define RETAINED_WORDS 16
+RTC_NOINIT_ATTR static uint32_t u32Retained[RETAINED_WORDS];
+
+class Esp32Platform : public Platform{
+  public:
+    // The UART is ready as soon as it is begun, nothing to wait for
+    void ConsoleBegin(uint32_t u32Baud) override { Serial.begin(u32Baud); }
+    void ConsoleWrite(const char *chMsg) override { Serial.print(chMsg); }
+    void PinInputPullup(uint8_t u8Pin) override { pinMode(u8Pin, INPUT_PULLUP); }
+    bool PinRead(uint8_t u8Pin) override { return digitalRead(u8Pin); }
+    void WatchdogBegin(uint32_t u32TimeoutSec) override { esp_task_wdt_init(u32TimeoutSec, false); }
+    void WatchdogSubscribe(void) override { esp_task_wdt_add(NULL); }
+    void WatchdogReset(void) override { esp_task_wdt_reset(); }
+    void Restart(void) override { ESP.restart(); }
+    void *AllocExternal(size_t size) override {
+      #ifdef BOARD_HAS_PSRAM
+      if( psramFound() )return ps_malloc(size);
+      #endif
+      return NULL;
+    }
+    void *Retained(size_t size) override { return size <= sizeof(u32Retained) ? u32Retained : NULL; }
+    bool SettingsRead(uint8_t u8Slot, void *pData, size_t len) override {
+      return prefsBegin() && prefs.getBytes(u8Slot ? "cfg_b" : "cfg_a", pData, len) == len;
+    }
+    bool SettingsWrite(uint8_t u8Slot, const void *pData, size_t len) override {
+      return prefsBegin() && prefs.putBytes(u8Slot ? "cfg_b" : "cfg_a", pData, len) == len;
+    }
+    // The other OTA app partition, written raw, the boot loader's own
+    // check runs on activating (segments and the appended digest)
+    size_t FirmwareBegin(void) override {
+      otaSlot = esp_ota_get_next_update_partition(NULL);
+      return otaSlot ? otaSlot->size : 0;
+    }
+    bool FirmwareErase(uint32_t u32Offset) override {
+      return otaSlot && esp_partition_erase_range(otaSlot, u32Offset, FIRMWARE_SECTOR) == ESP_OK;
+    }
+    bool FirmwareWrite(uint32_t u32Offset, const void *pData, size_t len) override {
+      return otaSlot && esp_partition_write(otaSlot, u32Offset, pData, len) == ESP_OK;
+    }
+    bool FirmwareActivate(size_t len) override {
+      (void)len;
+      return otaSlot && esp_ota_set_boot_partition(otaSlot) == ESP_OK;
+    }
+    // Internal is what the stacks, lwIP and the web server allocate from
+    void Heap(HeapInfo &heap) override {
+      heap.Free = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+      heap.Largest = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL);
+      heap.MinFree = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+      heap.ExternalSize = heap_caps_get_total_size(MALLOC_CAP_SPIRAM);
+      heap.ExternalFree = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    }
+    // The ESP-IDF FreeRTOS counts stacks in bytes, not words
+    uint32_t StackFree(const char *chTask) override {
+      TaskHandle_t hTask = xTaskGetHandle(chTask);
+      return hTask ? (uint32_t)uxTaskGetStackHighWaterMark(hTask) : UINT32_MAX;
+    }
+
+  private:
+    // NVS namespace holding the settings slots, opened on first use
+    bool prefsBegin(void){
+      if( !bPrefs )bPrefs = prefs.begin("wxsettings", false);
+      return bPrefs;
+    }
+    Preferences prefs;
+    bool bPrefs = false;
+    const esp_partition_t *otaSlot = NULL;
+};
+
+static LedcPwm halPwm;
+static Mcp23008Expander halExpander;
+static DotStarLed halLed;
+static Esp32Clock halClock;
+#ifdef WX_SOURCE_WFLIB
+static WeatherFlowUdp halWx;
+#else
+static WeatherFlowSocket halWx;
+#endif
+static Esp32Platform halSys;
+
+HalDrivers Hal = { &halPwm, &halExpander, &halLed, &halClock, &halWx, &halSys };
@@ -0,0 +1,663 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include <AsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+#include <ESPmDNS.h>
+#include <ArduinoJson.h>
+#include <TinyPICO.h>
+#include <SPIFFS.h>
+#include <new>
+#include "Hal.h"
+#include "App.h"
+#include "Boot.h"
+#include "Firmware.h"
+#include "History.h"
+#include "Metrics.h"
+#include "StatusFeed.h"
+#include "Template.h"
+#include "WsCommand.h"
+
+// Hardware board (battery voltage)
+extern TinyPICO TP;
+
+// Webserver and Websockets
+AsyncWebServer objWebServer(80);
+AsyncWebSocket objWebSocket("/ws");
+// The status push clients, see the status push below
+static SemaphoreHandle_t hWsClients = NULL;
+// Debug log viewer, the drained log lines (network and station
+// details, so the upgrade needs the web login; passwords are never
+// logged)
+AsyncWebSocket objLogSocket("/log");
+// Binary history download, /history?series=wind_1m&since=<epoch>, streamed
+// straight out of the rings a TCP window at a time
+void webServerHistoryHandler(AsyncWebServerRequest *request){
+  if( !History.Active() ){
+    request->send(503, "text/plain", "History not available");
+    return;
+  }
+  int iSeries = -1;
+  if( request->hasParam("series") ){
+    const String &strSeries = request->getParam("series")->value();
+    for( int i = 0; i < NUM_HISTORY_SERIES; i++ ){
+      if( strSeries == HistorySeriesNames[i] )iSeries = i;
+    }
+  }
+  if( iSeries < 0 ){
+    request->send(400, "text/plain", "Unknown series");
+    return;
+  }
+  uint32_t u32Since = request->hasParam("since") ? strtoul(request->getParam("since")->value().c_str(), NULL, 10) : 0;
+  HistoryCursor cursor(History, (HistorySeries)iSeries, u32Since);
+  request->send(request->beginChunkedResponse("application/octet-stream",
+    [cursor](uint8_t *buffer, size_t maxLen, size_t index) mutable -> size_t {
+      (void)index;
+      return cursor.Fill(buffer, maxLen);
+    }));
+}
+
+// Prometheus scrape, the stage histograms and counters (Metrics.h)
+void webServerMetricsHandler(AsyncWebServerRequest *request){
+  MetricsCursor cursor;
+  AsyncWebServerResponse *response = request->beginChunkedResponse("text/plain; version=0.0.4",
+    [cursor](uint8_t *buffer, size_t maxLen, size_t index) mutable -> size_t {
+      (void)index;
+      return cursor.Fill(buffer, maxLen);
+    });
+  response->addHeader("Cache-Control", "no-store");
+  request->send(response);
+}
+
+// Firmware upload, multipart with the image as its one file, streamed
+// to the update slot as it arrives (Firmware.h).  The request that
+// claimed the update is the only one whose chunks are taken, the board
+// restarts into the new image once the answer is out.
+//
+// Nothing here waits on the firmware task, async_tcp serves everyone.
+// While the writer's buffer could not take another TCP window the
+// segments are not acked (ackLater), so the sender runs out of window
+// instead of overrunning it; they are acked together once there is
+// room again, on a later chunk or the client's poll.  The answer is
+// held the same way until the image has been checked.
+#ifndef TCP_WND
+#define TCP_WND 5744
+#endif
+// A window, and a chunk the multipart parser may have taken in and
+// acked but not handed over yet
+#define UPDATE_ROOM_MIN (TCP_WND + 1460)
+
+static AsyncWebServerRequest *updateRequest = NULL;
+static AsyncWebServerResponse *updateResponse = NULL;
+
+// Ack what was held back once the buffer can take a whole window again,
+// or at once when the chunks are no longer taken
+static void updateAck(AsyncClient *client){
+  if( Firmware.State() == fsWriting && firmwareUploadRoom() < UPDATE_ROOM_MIN )return;
+  client->ack(SIZE_MAX);
+}
+
+// The /update answer, built once the firmware task is done with the
+// image, the code depends on how it went
+class FirmwareResponse : public AsyncWebServerResponse{
+  public:
+    ~FirmwareResponse(){ delete response; }
+    bool _sourceValid(void) const override { return true; }
+    bool _started(void) const override { return response && response->_started(); }
+    bool _finished(void) const override { return response && response->_finished(); }
+    bool _failed(void) const override { return response && response->_failed(); }
+    void _respond(AsyncWebServerRequest *request) override { _ack(request, 0, 0); }
+    size_t _ack(AsyncWebServerRequest *request, size_t len, uint32_t time) override {
+      if( response )return response->_ack(request, len, time);
+      if( !firmwareUploadDone() )return 0;
+      const bool bVerified = Firmware.State() == fsDone;
+      char chStatus[STATUS_VALUE_LEN];
+      Firmware.Status(chStatus, sizeof(chStatus), Hal.Clock->Millis());
+      response = new (std::nothrow) AsyncBasicResponse(bVerified ? 200 : 400, "text/plain", chStatus);
+      if( !response ){
+        request->client()->close(true);
+        return 0;
+      }
+      response->addHeader("Connection", "close");
+      if( bVerified ){
+        request->onDisconnect([](){
+          updateRequest = NULL;
+          updateResponse = NULL;
+          requestRestart();
+        });
+      }
+      response->_respond(request);
+      return 0;
+    }
+  private:
+    AsyncWebServerResponse *response = NULL;
+};
+
+void webServerUpdateUpload(AsyncWebServerRequest *request, const String &filename, size_t index,
+    uint8_t *data, size_t len, bool final){
+  (void)filename;
+  (void)final;
+  if( index == 0 && !updateRequest && request->authenticate(Settings.Config.Web.user, Settings.Config.Web.pass) &&
+      firmwareUploadBegin() ){
+    updateRequest = request;
+    request->onDisconnect([](){
+      updateRequest = NULL;
+      updateResponse = NULL;
+    });
+    // Stands in for the request's own poll, which only moves a response on
+    request->client()->onPoll([](void *arg, AsyncClient *client){
+      AsyncWebServerRequest *request = (AsyncWebServerRequest *)arg;
+      if( request != updateRequest )return;
+      updateAck(client);
+      if( updateResponse && client->canSend() && !updateResponse->_finished() )updateResponse->_ack(request, 0, 0);
+    }, request);
+  }
+  if( request != updateRequest || !len )return;
+  AsyncClient *client = request->client();
+  updateAck(client);
+  // A chunk not taken has failed the update, the rest is only acked
+  if( !firmwareUploadWrite(data, len) )return;
+  // The sender may have a window in flight, this segment is not acked
+  // unless the buffer has room for one more
+  if( firmwareUploadRoom() < UPDATE_ROOM_MIN )client->ackLater();
+}
+
+void webServerUpdateHandler(AsyncWebServerRequest *request){
+  if( !request->authenticate(Settings.Config.Web.user, Settings.Config.Web.pass) )
+    return request->requestAuthentication();
+  if( request != updateRequest ){
+    request->send(Firmware.State() == fsWriting ? 409 : 400, "text/plain",
+      Firmware.State() == fsWriting ? "Update already running" : "No firmware image");
+    return;
+  }
+  // The body is all in, nothing more to hold back
+  request->client()->ack(SIZE_MAX);
+  firmwareUploadEnd();
+  updateResponse = new (std::nothrow) FirmwareResponse();
+  request->send(updateResponse);
+}
+
+void onWebSocketEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type,
+  void *arg, uint8_t *data, size_t len);
+void handleWebSocketMessage(AwsFrameInfo *info, uint8_t *data, size_t len);
+String webTemplateProcessor(const String& var);
+void webServerSpiffsHandler(AsyncWebServerRequest *request);
+static void webAssetsLoad(void);
+void webServerHistoryHandler(AsyncWebServerRequest *request);
+void webServerMetricsHandler(AsyncWebServerRequest *request);
+void webServerUpdateUpload(AsyncWebServerRequest *request, const String &filename, size_t index,
+  uint8_t *data, size_t len, bool final);
+void webServerUpdateHandler(AsyncWebServerRequest *request);
+static void wifiConnectTask(void *pvParameters);
+
+
+// ##################################################################
+// # Wi-Fi Startup
+// ##################################################################
+bool wifiBegin(void){
+  if( !Settings.Config.WiFi.ssid[0] || !Settings.Config.WiFi.pass[0] ){
+    // ------------------------------------
+    // Soft AP mode
+    // ------------------------------------
+    debug(1, "\n\rWi-Fi parameters not set, starting AP mode.");
+    
+    // Start the AP mode
+    debug(1, "\n\rStarting Wi-Fi AP for SSID: WeatherFlow");
+    if( !WiFi.softAP(AP_MODE_SSID) ){
+      debug(1, "\n\rFailed to start AP mode!");
+      while(1);
+    }
+
+    Hal.Led->SetBrightness(150); 
+    Boot.Mark(bpWifi);
+    return true;
+  }
+
+  // ------------------------------------
+  // STA mode, joined by the Wi-Fi task, then rejoined by the
+  // supervisor with backoff (Supervisor.h), which any link event
+  // wakes
+  // ------------------------------------
+  WiFi.persistent(false);
+  WiFi.mode(WIFI_STA);
+  WiFi.setAutoReconnect(false);
+  WiFi.onEvent([](WiFiEvent_t event){
+    (void)event;
+    jobsReschedule();
+  });
+  const WiFiSettings &wifi = Settings.Config.WiFi;
+  if( wifi.Ip[0] | wifi.Ip[1] | wifi.Ip[2] | wifi.Ip[3] ){
+    // staticIpParse keeps the prefix to 1..30, a stored one outside it
+    // (the shift is undefined for 0) falls back to DHCP
+    if( wifi.Prefix < 1 || wifi.Prefix > 30 ){
+      debug(1, "\n\rStatic IP prefix /%u not valid, using DHCP", wifi.Prefix);
+    }
+    else{
+      uint32_t u32Mask = htonl(0xFFFFFFFFUL << (32 - wifi.Prefix));
+      WiFi.config(IPAddress(wifi.Ip), IPAddress(wifi.Gateway), IPAddress(u32Mask), IPAddress(wifi.Dns));
+    }
+  }
+  Hal.Led->SetColor(0x0000FF);
+  xTaskCreatePinnedToCore(wifiConnectTask, "wifi", 4096, NULL, 1, NULL, 0);
+  return false;
+}
+
+bool wifiConnected(void){
+  return bSoftApActive || WiFi.status() == WL_CONNECTED;
+}
+
+// Full scan, the access point may have moved channel (or be another
+// one of the same network) since the last join
+void wifiReconnect(void){
+  const WiFiSettings &wifi = Settings.Config.WiFi;
+  WiFi.disconnect();
+  WiFi.begin(wifi.ssid, wifi.pass);
+}
+
+// Joins the configured network off the boot path: straight to the
+// access point & channel of the last boot when known (no scan), with a
+// full scan after WIFI_FAST_TIMEOUT_MS, then leaves rejoining to the
+// supervisor
+#define WIFI_FAST_TIMEOUT_MS 3000
+#define WIFI_SCAN_TIMEOUT_MS 15000
+#define WIFI_POLL_MS 250
+static void wifiConnectTask(void *pvParameters){
+  const WiFiSettings &wifi = Settings.Config.WiFi;
+  uint8_t u8Bssid[6], u8Channel;
+  bool bFast = Boot.Wifi(u8Bssid, u8Channel);
+  debug(1, "\n\rConecting to Wi-Fi: %s%s ...", wifi.ssid, bFast ? " (last access point)" : "");
+  for( int iTry = 0; WiFi.status() != WL_CONNECTED; iTry++ ){
+    const bool bDirect = bFast && iTry == 0;
+    if( bDirect )WiFi.begin(wifi.ssid, wifi.pass, u8Channel, u8Bssid);
+    else{
+      WiFi.disconnect();
+      WiFi.begin(wifi.ssid, wifi.pass);
+    }
+    const uint32_t u32Timeout = bDirect ? WIFI_FAST_TIMEOUT_MS : WIFI_SCAN_TIMEOUT_MS;
+    for( uint32_t u32Ms = 0; u32Ms < u32Timeout && WiFi.status() != WL_CONNECTED; u32Ms += WIFI_POLL_MS ){
+      // Some feedback via the DotStar
+      Hal.Led->SetBrightness((u32Ms / WIFI_POLL_MS) % 2 ? 150 : 25);
+      vTaskDelay(pdMS_TO_TICKS(WIFI_POLL_MS));
+    }
+    if( WiFi.status() != WL_CONNECTED )debug(1, "\n\rWi-Fi not connected, trying again%s", bDirect ? " with a scan" : "");
+  }
+
+  Boot.SetWifi(WiFi.BSSID(), (uint8_t)WiFi.channel());
+  Boot.Mark(bpWifi);
+  if( !MDNS.begin("wxgauges") ){debug(1, "Failed to start mDNS responder!");}
+  debug(1, "\n\rWi-Fi connected!");
+  Hal.Led->SetColor(0x00FF00);
+  Hal.Led->SetBrightness(25);
+  #ifdef DEBUG
+  char  chIP[81];
+  WiFi.localIP().toString().toCharArray(chIP, sizeof(chIP) - 1);
+  debug(1, "\n\rIP Address: %s", chIP);
+  #endif
+  // Timers waiting on the network (time sync) look again
+  jobsReschedule();
+  vTaskDelete(NULL);
+}
+
+// Log task sink, lines are dropped while a viewer is behind
+static void webLogSink(const char *chLine, size_t len){
+  if( objLogSocket.count() == 0 || !objLogSocket.availableForWriteAll() )return;
+  objLogSocket.textAll(chLine, len);
+}
+
+// ##################################################################
+// # IP Services
+// ##################################################################
+void webServicesBegin(void){
+  SPIFFS.begin();
+  webAssetsLoad();
+
+  // Setup mDNS, a station once it has joined the network
+  if( bSoftApActive && !MDNS.begin("wxgauges") ){debug(1, "Failed to start mDNS responder!");}
+
+  // Setup the webserver and websocket handling
+  objWebServer.on("/update", HTTP_POST, webServerUpdateHandler, webServerUpdateUpload);
+  objWebServer.on("/logout", HTTP_GET, [](AsyncWebServerRequest *request){request->send(401);});
+  objWebServer.on("/logged-out.html", HTTP_GET, webServerSpiffsHandler);
+  objWebServer.on("/history", HTTP_GET, [](AsyncWebServerRequest *request){
+    if( !request->authenticate(Settings.Config.Web.user, Settings.Config.Web.pass) )
+      return request->requestAuthentication();
+    webServerHistoryHandler(request);
+  });
+  objWebServer.on("/metrics", HTTP_GET, [](AsyncWebServerRequest *request){
+    if( !request->authenticate(Settings.Config.Web.user, Settings.Config.Web.pass) )
+      return request->requestAuthentication();
+    webServerMetricsHandler(request);
+  });
+  objWebServer.onNotFound([](AsyncWebServerRequest *request){
+    if( !request->authenticate(Settings.Config.Web.user, Settings.Config.Web.pass) )
+      return request->requestAuthentication();
+    webServerSpiffsHandler(request);
+  });
+  hWsClients = xSemaphoreCreateMutex();
+  objWebSocket.onEvent(onWebSocketEvent);
+  objWebServer.addHandler(&objWebSocket);
+  objLogSocket.setFilter([](AsyncWebServerRequest *request){
+    return request->authenticate(Settings.Config.Web.user, Settings.Config.Web.pass);
+  });
+  objWebServer.addHandler(&objLogSocket);
+  logSetSink(webLogSink);
+  objWebServer.begin();
+}
+
+// ##################################################################
+// # Web Services (http server and websockets)
+// ##################################################################
+
+void notFound(AsyncWebServerRequest *request){
+    request->send(404, "text/plain", "Not found");
+}
+
+// ==================================================
+// Static assets, as built by scripts/build_web.py:
+// data/manifest.json lists each file with its content
+// hash (the ETag), type, and whether it is a template,
+// the rest are stored gzipped
+// ==================================================
+#define WEB_MAX_ASSETS 16
+#define WEB_ASSET_PATH_LEN 32
+#define WEB_ETAG_LEN 20
+
+struct WebAsset{
+    char Path[WEB_ASSET_PATH_LEN];
+    char Type[32];
+    char ETag[WEB_ETAG_LEN];    // Quoted, as sent and compared
+    bool Template;
+    bool Immutable;
+    int8_t Compiled;            // Index into webTemplates, -1 if not compiled
+};
+static WebAsset webAssets[WEB_MAX_ASSETS];
+static size_t numWebAssets = 0;
+
+#define WEB_MAX_TEMPLATES 2
+static CompiledTemplate webTemplates[WEB_MAX_TEMPLATES];
+static size_t numWebTemplates = 0;
+
+// Parse a template once, it is rendered from the compiled form from then on
+static int8_t webTemplateCompile(const char *chPath){
+  if( numWebTemplates >= WEB_MAX_TEMPLATES )return -1;
+  File fTemplate = SPIFFS.open(chPath, "r");
+  if( !fTemplate )return -1;
+  size_t len = fTemplate.size();
+  std::unique_ptr<char[]> chText(new char[len]);
+  bool bRead = fTemplate.read((uint8_t *)chText.get(), len) == len;
+  fTemplate.close();
+  if( !bRead ){
+    debug(1, "\n\rUnable to read template %s", chPath);
+    return -1;
+  }
+  if( !webTemplates[numWebTemplates].Compile(chText.get(), len) ){
+    debug(1, "\n\rTemplate %s has too many placeholders to compile, served uncompiled", chPath);
+    return -1;
+  }
+  debug(2, "\n\rCompiled template %s, %u segments", chPath,
+    (unsigned)webTemplates[numWebTemplates].NumSegments());
+  return numWebTemplates++;
+}
+
+// Read the manifest once at startup
+static void webAssetsLoad(void){
+  File fManifest = SPIFFS.open("/manifest.json", "r");
+  if( !fManifest ){
+    debug(1, "\n\rNo web asset manifest, serving data/ as is");
+    return;
+  }
+  DynamicJsonDocument jsonManifest(2048);
+  DeserializationError err = deserializeJson(jsonManifest, fManifest);
+  fManifest.close();
+  if( err ){
+    debug(1, "\n\rBad web asset manifest: %s", err.c_str());
+    return;
+  }
+  numWebAssets = 0;
+  for( JsonObject jsonAsset : jsonManifest["assets"].as<JsonArray>() ){
+    if( numWebAssets >= WEB_MAX_ASSETS )break;
+    WebAsset &asset = webAssets[numWebAssets++];
+    strlcpy(asset.Path, jsonAsset["path"] | "", sizeof(asset.Path));
+    strlcpy(asset.Type, jsonAsset["type"] | "text/plain", sizeof(asset.Type));
+    snprintf(asset.ETag, sizeof(asset.ETag), "\"%s\"", (const char *)(jsonAsset["etag"] | ""));
+    asset.Template = jsonAsset["template"];
+    asset.Immutable = jsonAsset["immutable"];
+    asset.Compiled = asset.Template ? webTemplateCompile(asset.Path) : -1;
+  }
+  debug(1, "\n\rLoaded %u web assets", (unsigned)numWebAssets);
+}
+
+static const WebAsset *webAssetFind(const String &path){
+  for( size_t i = 0; i < numWebAssets; i++ ){
+    if( path == webAssets[i].Path )return &webAssets[i];
+  }
+  return NULL;
+}
+
+void webServerSpiffsHandler(AsyncWebServerRequest *request){
+  String path = request->url();
+  debug(2, "handleFileRead: %s", path.c_str());
+  if (path.endsWith("/")) path += "index.html"; // Deal with the roots
+
+  const WebAsset *asset = webAssetFind(path);
+  if( !asset && !numWebAssets && SPIFFS.exists(path) ){
+    // Image built without the manifest, every file may be a template
+    String contentType = "text/plain";
+    if (path.endsWith(".html")) contentType = "text/html";
+    else if (path.endsWith(".css")) contentType = "text/css";
+    else if (path.endsWith(".js")) contentType = "application/javascript";
+    else if (path.endsWith(".ico")) contentType = "image/x-icon";
+    request->send(SPIFFS, path, contentType, false, webTemplateProcessor);
+    return;
+  }
+  if( !asset ){
+    request->send(404, "text/plain", "Not Found");
+    return;
+  }
+
+  // Templates carry live values, never cached.  The compiled ones stream
+  // the cached settings render with the live values filled in as it goes.
+  if( asset->Template && asset->Compiled >= 0 ){
+    TemplateCursor cursor(webTemplates[asset->Compiled].Render());
+    AsyncWebServerResponse *response = request->beginChunkedResponse(asset->Type,
+      [cursor](uint8_t *buffer, size_t maxLen, size_t index) mutable -> size_t {
+        (void)index;
+        return cursor.Fill(buffer, maxLen);
+      });
+    response->addHeader("Cache-Control", "no-store");
+    request->send(response);
+    return;
+  }
+  if( asset->Template ){
+    AsyncWebServerResponse *response = request->beginResponse(SPIFFS, path, asset->Type, false,
+      webTemplateProcessor);
+    response->addHeader("Cache-Control", "no-store");
+    request->send(response);
+    return;
+  }
+
+  // Static, the browser's copy is still good if the hash matches
+  const char *chCacheControl = asset->Immutable ? "public, max-age=31536000, immutable" : "no-cache";
+  if( request->hasHeader("If-None-Match") && request->header("If-None-Match") == asset->ETag ){
+    AsyncWebServerResponse *response = request->beginResponse(304);
+    response->addHeader("ETag", asset->ETag);
+    response->addHeader("Cache-Control", chCacheControl);
+    request->send(response);
+    return;
+  }
+  // Only the .gz is on SPIFFS, the file response serves it with
+  // Content-Encoding: gzip
+  AsyncWebServerResponse *response = request->beginResponse(SPIFFS, path, asset->Type);
+  response->addHeader("ETag", asset->ETag);
+  response->addHeader("Cache-Control", chCacheControl);
+  request->send(response);
+}
+
+// ##################################################################
+// # Status push
+// #
+// # The connected clients are tracked from the websocket events, on
+// # the async_tcp task, so the library's own client list (which that
+// # task adds to and removes from) is never walked from here.  A push
+// # holds hWsClients throughout, and a client's disconnect event (the
+// # library sends it just before freeing the client) waits on it, so
+// # no client goes away under a push.  The status feeds are
+// # serialized once per frame into a message buffer shared by the
+// # clients, freed here once the last of them has sent it.
+// ##################################################################
+
+// At most this many frames waiting to go out to a client, one per feed
+#define WS_STATUS_MAX_QUEUED 3
+// Frames still queued to some client, at most one per client per feed
+#define WS_STATUS_BUFFERS (STATUS_MAX_CLIENTS * WS_STATUS_MAX_QUEUED)
+
+static AsyncWebSocketClient *wsClients[STATUS_MAX_CLIENTS];
+static size_t numWsClients = 0;
+
+static void wsClientTrack(AsyncWebSocketClient *client, bool bConnected){
+  xSemaphoreTake(hWsClients, portMAX_DELAY);
+  for( size_t i = 0; i < numWsClients; i++ ){
+    // Kept in connection order, which the fan-out relies on
+    if( wsClients[i] == client ){
+      memmove(wsClients + i, wsClients + i + 1, (--numWsClients - i) * sizeof(wsClients[0]));
+      break;
+    }
+  }
+  if( bConnected && numWsClients < STATUS_MAX_CLIENTS )wsClients[numWsClients++] = client;
+  xSemaphoreGive(hWsClients);
+  // The status push rate follows whether anyone is watching
+  jobsReschedule();
+}
+
+size_t webStatusClients(void){
+  return numWsClients;
+}
+
+// Every call is made holding hWsClients
+class WsStatusTransport : public StatusTransport{
+  public:
+    size_t Clients(uint32_t *u32Ids, size_t maxClients) override {
+      size_t count = numWsClients < maxClients ? numWsClients : maxClients;
+      for( size_t i = 0; i < count; i++ )u32Ids[i] = wsClients[i]->id();
+      return count;
+    }
+    bool CanSend(size_t index) override {
+      if( index >= numWsClients )return false;
+      AsyncWebSocketClient *client = wsClients[index];
+      return client->status() == WS_CONNECTED && client->queueLen() < WS_STATUS_MAX_QUEUED;
+    }
+    char *Begin(size_t len) override {
+      // Buffers the clients are done with first, one slot is then free
+      // unless every client still holds a frame of every feed
+      size_t slot = WS_STATUS_BUFFERS;
+      for( size_t i = 0; i < WS_STATUS_BUFFERS; i++ ){
+        if( wsBuffers[i] && wsBuffers[i]->canDelete() ){
+          delete wsBuffers[i];
+          wsBuffers[i] = NULL;
+        }
+        if( !wsBuffers[i] )slot = i;
+      }
+      if( slot == WS_STATUS_BUFFERS )return NULL;
+      wsBuffer = new (std::nothrow) AsyncWebSocketMessageBuffer(len);
+      if( !wsBuffer )return NULL;
+      if( !wsBuffer->get() ){
+        delete wsBuffer;
+        wsBuffer = NULL;
+        return NULL;
+      }
+      wsBuffers[slot] = wsBuffer;
+      // Held until End(), each queued message then holds its own lock
+      wsBuffer->lock();
+      return (char *)wsBuffer->get();
+    }
+    void Send(size_t index) override {
+      if( index < numWsClients )wsClients[index]->text(wsBuffer);
+    }
+    void End(void) override {
+      wsBuffer->unlock();
+      wsBuffer = NULL;
+    }
+  private:
+    AsyncWebSocketMessageBuffer *wsBuffer = NULL;
+    AsyncWebSocketMessageBuffer *wsBuffers[WS_STATUS_BUFFERS] = {};
+};
+
+static WsStatusTransport wsStatusTransport;
+static StatusFanout WeatherFanout(WeatherStatus);
+static StatusFanout SystemFanout(SystemStatus);
+static StatusFanout MemoryFanout(MemoryStatus);
+
+void notifyWsSystemStatus(void){
+  SystemStatus.Set(ssWifiMode, bSoftApActive ? "AP Mode" : "Station Mode");
+  SystemStatus.Set(ssWifiSsid, bSoftApActive ? AP_MODE_SSID : Settings.Config.WiFi.ssid);
+  SystemStatus.Set(ssWifiIpAddr, (bSoftApActive ? WiFi.softAPIP() : WiFi.localIP()).toString().c_str());
+  SystemStatus.Setf(ssWifiRssi, "%d", bSoftApActive ? 0 : WiFi.RSSI());
+  SystemStatus.Setf(ssBatVolt, "%.2f", TP.GetBatteryVoltage());
+
+  WeatherStatus.Commit();
+  SystemStatus.Commit();
+  MemoryStatus.Commit();
+  xSemaphoreTake(hWsClients, portMAX_DELAY);
+  WeatherFanout.Push(wsStatusTransport);
+  SystemFanout.Push(wsStatusTransport);
+  MemoryFanout.Push(wsStatusTransport);
+  xSemaphoreGive(hWsClients);
+}
+
+void onWebSocketEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type,
+    void *arg, uint8_t *data, size_t len){
+  switch (type) {
+    case WS_EVT_CONNECT:
+      wsClientTrack(client, true);
+      debug(1, "\r\nWebsocket connected (ClientID: %u, ClientIP:  %s)", client->id(), client->remoteIP().toString().c_str());
+      break;
+    case WS_EVT_DISCONNECT:
+      wsClientTrack(client, false);
+      debug(1, "\r\nWebscoked disconnected (ClientID: %u", client->id());
+      break;
+  #ifdef DEBUG
+    case WS_EVT_PONG:
+    case WS_EVT_ERROR:
+      break;
+  #endif
+    case WS_EVT_DATA:
+      handleWebSocketMessage( (AwsFrameInfo*) arg, data, len);
+      break;
+  }    
+  return;
+  }
+
+// Frames from the web UI, complete text messages only
+void handleWebSocketMessage(AwsFrameInfo *info, uint8_t *data, size_t len){
+  if( !(info->final && info->index == 0 && info->len == len && info->opcode == WS_TEXT) )return;
+  debug(2, "\r\nRaw websocket payload: %.*s", (int)len, (const char *)data);
+  WsCommand command = wsCommandDispatch((const char *)data, len);
+  if( command == wcWiFi || command == wcRoutes )requestRestart();
+  // Settings write-behind, calibration and the lamp times follow the edit
+  else if( command >= wcSettings )jobsReschedule();
+}
+
+// Only used for templates that were not compiled (no manifest, or too big)
+String webTemplateProcessor(const String& var){
+  int iVar = templateVarFind(var.c_str(), var.length());
+  if( iVar < 0 )return "N/A";
+  char chValue[TEMPLATE_VALUE_LEN];
+  templateValue((TemplateVar)iVar, chValue, sizeof(chValue));
+  return String(chValue);
+}
+
+// Live network & board values for the templates, formatted in place
+size_t templatePlatformValue(TemplateVar var, char *chOut, size_t maxLen){
+  int iLen = 0;
+  switch( var ){
+    case tvWifiIpAddr:{
+        IPAddress ip = bSoftApActive ? WiFi.softAPIP() : WiFi.localIP();
+        iLen = snprintf(chOut, maxLen, "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+      }
+      break;
+    case tvWifiRssi: iLen = snprintf(chOut, maxLen, "%d", WiFi.RSSI()); break;
+    case tvBatVolt: iLen = snprintf(chOut, maxLen, "%.2f", TP.GetBatteryVoltage()); break;
+    default: iLen = snprintf(chOut, maxLen, "N/A"); break;
+  }
+  if( iLen < 0 )return 0;
+  return (size_t)iLen < maxLen ? (size_t)iLen : maxLen - 1;
+}
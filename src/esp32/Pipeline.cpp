@@ -0,0 +1,195 @@
+#include <Arduino.h>
+#include <algorithm>
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/stream_buffer.h>
+#include "Hal.h"
+#include "App.h"
+#include "Firmware.h"
+#include "Ingest.h"
+#include "Metrics.h"
+#include "Scheduler.h"
+#include "Supervisor.h"
+
+// ##################################################################
+// # Event driven gauge pipeline (FreeRTOS)
+// #
+// # wx_rx (core 0, with the Wi-Fi stack) blocks on the UDP socket,
+// # posts the samples that pass the ingest to its mailbox (Ingest.h)
+// # and notifies gauges (core 1), which takes the newest of each
+// # message type and drives the outputs.  wx_rx also restarts the
+// # listener when the supervisor asks.  The housekeeping task sleeps
+// # until the next job deadline (Scheduler.h), or a notify asking it
+// # to reschedule, so an idle station has nothing waking it in
+// # between.  The log task drains the debug records to the serial
+// # port at low priority, the firmware task writes an upload to flash
+// # at the same (Firmware.h).
+// ##################################################################
+
+#define WX_RX_TIMEOUT_MS 1000
+#define LOG_FLUSH_MS 20
+
+static TaskHandle_t hGauges;
+static TaskHandle_t hHousekeeping;
+
+static void wxReceiveTask(void *pvParameters){
+  WxSample sample;
+  Hal.Sys->WatchdogSubscribe();
+  for(;;){
+    Hal.Sys->WatchdogReset();
+    if( Supervisor.ListenerRestart() && !Hal.Wx->Begin() )debug(1, "\n\rFailed to restart WeatherFlow listener!");
+    if( !Hal.Wx->Receive(sample, WX_RX_TIMEOUT_MS) )continue;
+    Ingest.Post(sample);
+    xTaskNotifyGive(hGauges);
+  }
+}
+
+// Between samples the task wakes only for needle slew steps, the notify
+// timeout is the time until the next one is due.  Each wakeup's work is
+// the loop stage of the metrics.
+static void gaugeOutputTask(void *pvParameters){
+  WxSample sample;
+  uint32_t u32WaitMs = WX_RX_TIMEOUT_MS;
+  Hal.Sys->WatchdogSubscribe();
+  for(;;){
+    Hal.Sys->WatchdogReset();
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(u32WaitMs));
+    StageTimer timer(msLoop);
+    while( Ingest.Take(sample) )gaugeOutput(sample);
+    u32WaitMs = std::min(gaugeService(), (uint32_t)WX_RX_TIMEOUT_MS);
+  }
+}
+
+// Runs the jobs due, then sleeps until a tick past the next deadline (so
+// the wait never ends just short of it) or a reschedule notify
+static void housekeepingTask(void *pvParameters){
+  uint32_t u32WaitMs = Scheduler.Run(Hal.Clock->Millis());
+  for(;;){
+    xTaskNotifyWait(0, UINT32_MAX, NULL, u32WaitMs == SCHED_IDLE ? portMAX_DELAY : pdMS_TO_TICKS(u32WaitMs) + 1);
+    u32WaitMs = Scheduler.Run(Hal.Clock->Millis());
+  }
+}
+
+static void logTask(void *pvParameters){
+  for(;;){
+    logFlush();
+    vTaskDelay(pdMS_TO_TICKS(LOG_FLUSH_MS));
+  }
+}
+
+void pipelineBegin(const ScheduledJob *jobs, size_t numJobs){
+  Scheduler.Begin(jobs, numJobs, Hal.Clock->Millis());
+  xTaskCreatePinnedToCore(gaugeOutputTask, "gauges", 4096, NULL, 3, &hGauges, 1);
+  xTaskCreatePinnedToCore(wxReceiveTask, "wx_rx", 6144, NULL, 2, NULL, 0);
+  xTaskCreatePinnedToCore(housekeepingTask, "housekeeping", 4096, NULL, 1, &hHousekeeping, 1);
+}
+
+void jobsReschedule(void){
+  Scheduler.Reschedule();
+  if( hHousekeeping )xTaskNotify(hHousekeeping, 0, eNoAction);
+}
+
+void logBegin(void){
+  xTaskCreatePinnedToCore(logTask, "log", 3072, NULL, 1, NULL, 1);
+}
+
+void pipelineLoop(void){
+  // Everything runs from the pipeline tasks, the Arduino loop task is done
+  vTaskDelete(NULL);
+}
+
+// ##################################################################
+// # Firmware upload
+// #
+// # The web server task only copies each chunk into a stream buffer,
+// # and never waits on it: it holds back the TCP acks while the buffer
+// # could not take another window (Network.cpp), so a chunk that does
+// # not fit is the sender overrunning the window and fails the update.
+// # The firmware task, created for the upload at the lowest priority
+// # on core 0, writes it to flash, so the gauge and receive tasks keep
+// # their priorities and only wait out a flash operation in progress
+// # (the cache is off while one runs).  Once the end is flagged it
+// # checks the image, the web server polls for that to answer.
+// ##################################################################
+#define FIRMWARE_BUFFER_LEN 12288   // Two TCP windows (5744 on the Arduino core)
+#define FIRMWARE_CHUNK_LEN 1024
+#define FIRMWARE_POLL_MS 100
+#define FIRMWARE_STALL_MS 10000     // Upload quiet this long is given up
+
+static StreamBufferHandle_t hFirmwareStream;
+static SemaphoreHandle_t hFirmwareIdle;
+static std::atomic<bool> bFirmwareEnd{false};
+static std::atomic<bool> bFirmwareDone{false};
+
+static void firmwareTask(void *pvParameters){
+  uint8_t u8Chunk[FIRMWARE_CHUNK_LEN];
+  uint32_t u32QuietMs = 0;
+  for(;;){
+    size_t len = xStreamBufferReceive(hFirmwareStream, u8Chunk, sizeof(u8Chunk), pdMS_TO_TICKS(FIRMWARE_POLL_MS));
+    if( len ){
+      // Still drained after a failure, the upload runs to its end
+      Firmware.Write(u8Chunk, len);
+      u32QuietMs = 0;
+      continue;
+    }
+    // The end is flagged after the last chunk is in
+    if( bFirmwareEnd && !xStreamBufferBytesAvailable(hFirmwareStream) )break;
+    if( (u32QuietMs += FIRMWARE_POLL_MS) >= FIRMWARE_STALL_MS ){
+      Firmware.Fail(feStalled);
+      break;
+    }
+  }
+  if( bFirmwareEnd )Firmware.End(Hal.Clock->Millis());
+  bFirmwareDone = true;
+  xSemaphoreGive(hFirmwareIdle);
+  vTaskDelete(NULL);
+}
+
+bool firmwareUploadBegin(void){
+  if( !hFirmwareIdle ){
+    hFirmwareStream = xStreamBufferCreate(FIRMWARE_BUFFER_LEN, 1);
+    hFirmwareIdle = xSemaphoreCreateBinary();
+    if( !hFirmwareStream || !hFirmwareIdle )return false;
+    xSemaphoreGive(hFirmwareIdle);
+  }
+  if( !xSemaphoreTake(hFirmwareIdle, 0) )return false;
+  xStreamBufferReset(hFirmwareStream);
+  bFirmwareEnd = false;
+  bFirmwareDone = false;
+  if( !Firmware.Begin(Hal.Clock->Millis()) ){
+    xSemaphoreGive(hFirmwareIdle);
+    return false;
+  }
+  if( xTaskCreatePinnedToCore(firmwareTask, "firmware", 4096, NULL, 1, NULL, 0) != pdPASS ){
+    Firmware.Fail(feStalled);
+    bFirmwareDone = true;
+    xSemaphoreGive(hFirmwareIdle);
+    return false;
+  }
+  return true;
+}
+
+// Whole chunks only, the web server is the one sender so the room
+// checked is there for the send
+bool firmwareUploadWrite(const uint8_t *pData, size_t len){
+  if( Firmware.State() != fsWriting )return false;
+  if( xStreamBufferSpacesAvailable(hFirmwareStream) < len ||
+      xStreamBufferSend(hFirmwareStream, pData, len, 0) != len ){
+    Firmware.Fail(feOverrun);
+    return false;
+  }
+  return true;
+}
+
+size_t firmwareUploadRoom(void){
+  return hFirmwareStream ? xStreamBufferSpacesAvailable(hFirmwareStream) : 0;
+}
+
+void firmwareUploadEnd(void){
+  bFirmwareEnd = true;
+}
+
+bool firmwareUploadDone(void){
+  return bFirmwareDone;
+}
@@ -1,80 +1,53 @@
+#ifdef ARDUINO
 #include <Arduino.h>
-#include <WiFi.h>
-#include <AsyncTCP.h>
-#include <ESPAsyncWebServer.h>
-#include <ESPmDNS.h>
-#include <ArduinoJson.h>
-#include <TinyPICO.h>
-#include <Adafruit_MCP23X08.h>
-#include <SPIFFS.h>
-#include <esp_task_wdt.h>
-#include <wf.h>
+#endif
 #include <PersistSettings.h>
 #include "Config.h"
-#include <map>
+#include "Hal.h"
+#include "App.h"
+#include "Boot.h"
+#include "Calibration.h"
+#include "Firmware.h"
+#include "GaugeTable.h"
+#include "GaugeRoutes.h"
+#include "History.h"
+#include "Ingest.h"
+#include "Memory.h"
+#include "Metrics.h"
+#include "SeqLock.h"
+#include "Scheduler.h"
+#include "SettingsStore.h"
+#include "StatusFeed.h"
+#include "Supervisor.h"
+#include "WindStats.h"
+#include <algorithm>
 #include <ctime>
 #include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 // Note, these are required because of https://community.platformio.org/t/identifier-is-undefined-setenv-tzset/16162/2
 //_VOID  _EXFUN(tzset,	(_VOID));
 //int	_EXFUN(setenv,(const char *__string, const char *__value, int __overwrite));
 
-// Version info
-#define MAJOR 1
-#define MINOR 3
-#define PATCH 0
-
-// Debug Info
-#define DEBUG 2
-void debug(int level, const char *fmt, ...);
-
-// Hardware board
-TinyPICO TP = TinyPICO();
-// Output Guages
-#define WINDGAUGEPIN 25
-#define WINDCHANNEL 0
-#define TEMPGAUGEPIN 26
-#define TEMPCHANNEL 1
-// Input/Output Settings
-#define BTNPIN1 33
-#define BTNPIN2 32
-#define LED1 27
-#define LED1CHANNEL 2
-#define LED2 15
-#define LED2CHANNEL 3
-
-// WeatherFlow Handler
-WeatherFlow WF(Imperial);
-
 // Persistent Settings Handler
 PersistSettings<AppConfig> Settings(AppConfig::Version);
 
-// Hardware I2C GPIO extender
-Adafruit_MCP23X08 mcp;
-
-// Function Prototypes
-void ledcAnalogWrite(uint8_t channel, uint32_t value, uint32_t valueMax = 8191);
-uint32_t scalePwmOutput(double dataVal, double minScale, double maxScale, double halfScalePWM = 3600);
-uint8_t encodeWind(int windDir);
-void RunCalibration(void);
-
-
 // WiFi Parameters
 bool bSoftApActive = false;
-#define AP_MODE_SSID "WeatherFlowGauges"
-
-// Webserver and Websockets
-AsyncWebServer objWebServer(80);
-AsyncWebSocket objWebSocket("/ws");
-void onWebSocketEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type,
-  void *arg, uint8_t *data, size_t len);
-void handleWebSocketMessage(AwsFrameInfo *info, uint8_t *data, size_t len);
-String webTemplateProcessor(const String& var);
-void webServerSpiffsHandler(AsyncWebServerRequest *request);
-
-enum CalMode { none, range };
+
 CalMode CalibrationMode = none;
 
+// Compiled gauge transfer functions
+GaugeTransfer WindGauge;
+GaugeTransfer TempGauge;
+
+// Latest samples, handed from the gauge task to the web status
+SeqLock<WxSample> LatestWind;
+SeqLock<WxSample> LatestObs;
+SeqLock<WindSummary> LatestWindStats[NUM_WIND_WINDOWS];
+
 
 // ##################################################################
 // # Setup
@@ -82,45 +55,66 @@ CalMode CalibrationMode = none;
 
 void setup() {
 
-  // ==================================================
-  // Hardware Init Stuff
-  // ==================================================
-  SPIFFS.begin();
-
   // ==================================================
   // Setup the serial port for logging, if debugging
   // ==================================================
   #ifdef DEBUG
-  Serial.begin(9600);
-  while(!Serial)
-  {
-    Serial.print('.');
-  }
+  Hal.Sys->ConsoleBegin(9600);
+  logBegin();
   #endif
-  
+
   // ==================================================
   // Settings (non-volitale)
   // ==================================================
+  Metrics.Begin();
   Settings.Begin();
+  SettingsStorage.Begin();
+  gaugeTablesBuild();
+  Ingest.Configure(Settings.Config.Ingest);
+  Boot.Begin(Settings.Config.Routes);
+  Boot.Mark(bpSettings);
+
+  // ==================================================
+  // Gauge outputs, PWM channels & MCP23008 I2C GPIO
+  // expanders as routed in the settings, first so the
+  // needles are back where they were before a restart
+  // while the rest starts up
+  // ==================================================
+  GaugeRoutes.Begin(Settings.Config.Routes);
+
+  // LED PWM Setup, 5 kHz, 13-bit timer
+  Hal.Pwm->Setup(LED1CHANNEL, LED1, 5000, 13);
+  ledcAnalogWrite(LED1CHANNEL, 0);
+  Hal.Pwm->Setup(LED2CHANNEL, LED2, 5000, 13);
+  ledcAnalogWrite(LED2CHANNEL, 0);
+  Boot.Mark(bpNeedles);
+  if( Boot.Millis(bpNeedles) > BOOT_NEEDLE_TARGET_MS ){
+    debug(1, "\n\rGauges restored late, %u ms", (unsigned)Boot.Millis(bpNeedles));
+  }
+
+  // ==================================================
+  // Observation history (PSRAM)
+  // ==================================================
+  if( !History.Begin() ){debug(1, "\n\rNo PSRAM, history disabled");}
 
   // ==================================================
   // Button Setup & Reset Default Settings
   // ==================================================
-  pinMode(BTNPIN1, INPUT_PULLUP);
+  Hal.Sys->PinInputPullup(BTNPIN1);
   int iSwitchDebounce = 0;
-  while( !digitalRead(BTNPIN1) ){
+  while( !Hal.Sys->PinRead(BTNPIN1) ){
     // Stage 0 reset, debouncing for 5 seconds
-    TP.DotStar_SetPixelColor(0xFF9A00);
-    TP.DotStar_SetBrightness(150);
-    TP.DotStar_SetPower(true);
+    Hal.Led->SetColor(0xFF9A00);
+    Hal.Led->SetBrightness(150);
+    Hal.Led->SetPower(true);
     // Stage 1 reset
     if( iSwitchDebounce++ > 10 ){
-      TP.DotStar_SetPixelColor(0xFF0000);
-      Settings.ResetToDefault();
-      delay(5000);
-      ESP.restart();
+      Hal.Led->SetColor(0xFF0000);
+      SettingsStorage.Reset();
+      Hal.Clock->Delay(5000);
+      Hal.Sys->Restart();
     }
-    delay(500);
+    Hal.Clock->Delay(500);
   }
 
   // ==================================================
@@ -130,478 +124,518 @@ void setup() {
   tzset();
 
   // ==================================================
-  // Wi-Fi Startup
+  // Wi-Fi Startup, a station connects in the background
   // ==================================================
-  if( !Settings.Config.WiFi.ssid[0] || !Settings.Config.WiFi.pass[0] ){
-    // ------------------------------------
-    // Soft AP mode
-    // ------------------------------------
-    debug(1, "\n\rWi-Fi parameters not set, starting AP mode.");
-    
-    // Start the AP mode
-    debug(1, "\n\rStarting Wi-Fi AP for SSID: WeatherFlow");
-    if( !WiFi.softAP(AP_MODE_SSID) ){
-      debug(1, "\n\rFailed to start AP mode!");
-      while(1);
-    }
-
-    bSoftApActive = true;
-    TP.DotStar_SetBrightness(150); 
-  }
-  else{
-    // ------------------------------------
-    // STA mode
-    // ------------------------------------
-    debug(1, "\n\rConecting to Wi-Fi: %s ...", Settings.Config.WiFi.ssid);
-    WiFi.begin(Settings.Config.WiFi.ssid, Settings.Config.WiFi.pass);
-    int iWiFiFailCount = 0;
-    TP.DotStar_SetPixelColor(0x0000FF);
-    while(WiFi.status() != WL_CONNECTED)
-    {
-      debug(1, ".");
-      delay(500);
-      // Five some feedback via the DotStar
-      if( iWiFiFailCount++ % 2 ){TP.DotStar_SetBrightness(150);}
-      else{TP.DotStar_SetBrightness(25);}
-      
-    }
-
-    debug(1, "\n\rWi-Fi connected!");
-    TP.DotStar_SetPixelColor(0x00FF00);
-    TP.DotStar_SetBrightness(25);
-    #ifdef DEBUG
-    char  chIP[81];
-    WiFi.localIP().toString().toCharArray(chIP, sizeof(chIP) - 1);
-    debug(1, "\n\rIP Address: %s", chIP);
-    #endif
-  }
+  bSoftApActive = wifiBegin();
 
   // ==================================================
   // IP Services
   // ==================================================
-
-  // Setup mDNS
-  if ( !MDNS.begin("wxgauges") ){debug(1, "Failed to start mDNS responder!");}
-
-  // Setup the webserver and websocket handling
-  // FIXME: Handle firmware update
-  //objWebServer.on("/update", HTTP_POST, NULL);
-  objWebServer.on("/logout", HTTP_GET, [](AsyncWebServerRequest *request){request->send(401);});
-  objWebServer.on("/logged-out.html", HTTP_GET, webServerSpiffsHandler);
-  objWebServer.onNotFound([](AsyncWebServerRequest *request){
-    if( !request->authenticate(Settings.Config.Web.user, Settings.Config.Web.pass) )
-      return request->requestAuthentication();
-    webServerSpiffsHandler(request);
-  });
-  objWebSocket.onEvent(onWebSocketEvent);
-  objWebServer.addHandler(&objWebSocket);
-  objWebServer.begin();
-
+  webServicesBegin();
 
   // ==================================================
-  // PWM controls for gauge outputs
-  // ==================================================
-  
-  // Wind PWM freq 5 kHz, 13-bit timer resolution
-  ledcSetup(WINDCHANNEL, 5000, 13);
-  ledcAttachPin(WINDGAUGEPIN, WINDCHANNEL);
-
-  // Temp PWM freq 5 kHz, 13-bit timer resolution
-  ledcSetup(TEMPCHANNEL, 5000, 13);
-  ledcAttachPin(TEMPGAUGEPIN, TEMPCHANNEL);
-
-  // LED PWM Setup, 5 kHz, 13-bit timer
-  ledcSetup(LED1CHANNEL, 5000, 13);
-  ledcAttachPin(LED1, LED1CHANNEL);
-  ledcAnalogWrite(LED1CHANNEL, 0);
-  ledcSetup(LED2CHANNEL, 5000, 13);
-  ledcAttachPin(LED2, LED2CHANNEL);
-  ledcAnalogWrite(LED2CHANNEL, 0);
-
-  // ==================================================
-  // Setup MCP23008 I2C GPIO Expander
+  // Start listening for UDP messages
   // ==================================================
-  if (!mcp.begin_I2C()) {debug(1, "\n\rFailed to startup MCP23008!");}
-  for(int i=0; i<8; i++)mcp.pinMode(i, OUTPUT);
+  if( !Hal.Wx->Begin() )debug(1, "\n\rFailed to start WeatherFlow listener!");
 
   // ==================================================
-  // Start listening for UDP messages
+  // Enable the watchdog timer, the pipeline tasks subscribe
   // ==================================================
-  if( !WF.Begin() )debug(1, "\n\rFailed to start WeatherFlow listener!");
+  Hal.Sys->WatchdogBegin(10);
 
   // ==================================================
-  // Enable the watchdog timer
+  // Start the receive -> gauge output pipeline & housekeeping,
+  // a station is supervised from here on
   // ==================================================
-  esp_task_wdt_init(10, false);
-  esp_task_wdt_add(NULL);
+  Supervisor.Begin(Hal.Clock->Millis());
+  if( bSoftApActive ){
+    pipelineBegin(SoftApJobs, NumSoftApJobs);
+  }
+  else{
+    pipelineBegin(StationJobs, NumStationJobs);
+  }
+  Boot.Mark(bpReady);
 }
 
 // ##################################################################
 // # Main Loop
+// #
+// # Nothing is polled here anymore, the UDP receive task pushes
+// # samples to the gauge output task and the housekeeping jobs run
+// # as they fall due (see Scheduler.h).
 // ##################################################################
 
 void loop() {
-  static uint32_t u32WindPwm;
-  static uint32_t u32TempPwm;
-  static uint8_t u8WindDir;
-  time_t ul32CurTime;
-  static time_t ul32LastBlink;
-  static bool bOneShot = false;
-  static bool bGaugeLamp = false;
-
-
-  // ================================================================
-  // Watchdog timer reset & current time
-  // ================================================================   
-  time(&ul32CurTime);
-  esp_task_wdt_reset();
-
-
-  // ================================================================
-  // Calibration modes
-  // ================================================================
-  if( CalibrationMode == range){
-    debug(1, "\n\rRunning in calibration mode, current epoch time: %d", ul32CurTime);
-    RunCalibration();
-    delay(5000);
+  pipelineLoop();
+}
+
+// ##################################################################
+// # Housekeeping jobs
+// #
+// # Each job pairs with a Next function giving the time until it is
+// # due again, asked after it runs and on jobsReschedule().
+// ##################################################################
+
+// Status via DotStar LED, on for a second every 15 seconds, logging the time
+static bool bBlinkOn = false;
+static time_t tBlinkOn = 0;
+void blinkTick(void){
+  if( bBlinkOn ){
+    bBlinkOn = false;
+    Hal.Led->SetColor(0x0);
     return;
   }
-  
-  if( bSoftApActive ){
-    // ================================================================
-    // Wi-Fi in AP mode, allowing for user setup...
-    // ================================================================
-    // Cycle the DotStar color, just to give the user some feedback
-    TP.DotStar_CycleColor(25);
+  bBlinkOn = true;
+  tBlinkOn = Hal.Clock->Now();
+  // Blue while the station is off the network, amber with no data
+  Hal.Led->SetColor(!wifiConnected() ? 0x0000FF : Supervisor.Stale() ? 0xFF9A00 : 0x00FF00);
+  char buf[128];
+  tm tmNow;
+  strftime(buf, 128, "%c", localtime_r(&tBlinkOn, &tmNow));
+  debug(1, "\n\rCurrent System Time: %s", buf);
+  debug(1, "\r\nFirmware Version: %d.%d.%d", MAJOR, MINOR, PATCH);
+}
+
+uint32_t blinkNext(void){
+  // At most a second on, even if the clock was set back meanwhile
+  if( bBlinkOn )return std::min(schedUntil(tBlinkOn + 1), (uint32_t)1000);
+  if( CalibrationMode != none )return SCHED_IDLE;
+  return schedUntil((Hal.Clock->Now() / 15 + 1) * 15);
+}
+
+// Gauge lamps, on from the on time to the off time (local, so through
+// DST).  The state comes from whichever of the two passed last rather
+// than from seeing the transition, so it is right at boot and after
+// the clock is set.
+static uint32_t u32LampPwm = UINT32_MAX;
+static uint32_t lampPwm(time_t tNow){
+  const GaugeLampSettings &lamps = Settings.Config.GaugeLamps;
+  if( lamps.OnHour == lamps.OffHour && lamps.OnMinute == lamps.OffMinute )return 0;
+  bool bOn = lastLocalTime(tNow, lamps.OnHour, lamps.OnMinute) > lastLocalTime(tNow, lamps.OffHour, lamps.OffMinute);
+  return bOn ? scalePwmOutput(lamps.LampBrightness, 0, 100, 4096) : 0;
+}
+
+void lampsTick(void){
+  uint32_t u32Pwm = lampPwm(Hal.Clock->Now());
+  if( u32Pwm == u32LampPwm )return;
+  u32LampPwm = u32Pwm;
+  ledcAnalogWrite(LED1CHANNEL, u32Pwm);
+  debug(1, "\n\rGauge lamps %s", u32Pwm ? "on" : "off");
+}
+
+uint32_t lampsNext(void){
+  if( CalibrationMode != none )return SCHED_IDLE;
+  time_t tNow = Hal.Clock->Now();
+  if( lampPwm(tNow) != u32LampPwm )return 0;
+  const GaugeLampSettings &lamps = Settings.Config.GaugeLamps;
+  return std::min(schedUntil(nextLocalTime(tNow, lamps.OnHour, lamps.OnMinute)),
+    schedUntil(nextLocalTime(tNow, lamps.OffHour, lamps.OffMinute)));
+}
+
+// Keep the system time in sync with the station, from the newest
+// rapid_wind (aged by how long ago it arrived, none if that is too long)
+#define TIME_SYNC_MS 60000
+#define TIME_SYNC_DRIFT 10
+static volatile bool bClockSynced = false;
+static volatile uint32_t u32WindRxMs = 0;
+void timeSyncTick(void){
+  WxSample wind;
+  uint32_t u32RxMs = u32WindRxMs;
+  if( !LatestWind.Read(wind) || !wind.EpochTime )return;
+  uint32_t u32AgeMs = Hal.Clock->Millis() - u32RxMs;
+  if( u32AgeMs > TIME_SYNC_MS )return;
+  long long llStation = (long long)wind.EpochTime + u32AgeMs / 1000;
+  bClockSynced = true;
+  if( llabs((long long)Hal.Clock->Now() - llStation) <= TIME_SYNC_DRIFT )return;
+  debug(1, "\n\r\tUpdating the system time...");
+  Hal.Clock->Set((time_t)llStation);
+  debug(2, "\n\r\t\tWF Epoch Time: %d", (int)wind.EpochTime);
+  debug(2, "\n\r\t\tSystem Time:   %d", (int)Hal.Clock->Now());
+  // Wall clock deadlines moved
+  Scheduler.Reschedule();
+}
+
+// Until the first sync the gauge task kicks this off with the first sample
+uint32_t timeSyncNext(void){
+  if( bClockSynced )return TIME_SYNC_MS;
+  WxSample wind;
+  return LatestWind.Read(wind) ? 0 : SCHED_IDLE;
+}
+
+// Close the history buckets once their interval is over, a little
+// after each minute so the last samples of it are in
+#define HISTORY_GRACE_SEC 5
+void historyTick(void){
+  History.Downsample((uint32_t)Hal.Clock->Now() - HISTORY_GRACE_SEC);
+}
+
+uint32_t historyNext(void){
+  if( !History.Active() )return SCHED_IDLE;
+  return schedUntil((Hal.Clock->Now() - HISTORY_GRACE_SEC) / 60 * 60 + 60 + HISTORY_GRACE_SEC);
+}
+
+// Steps the gauges while in calibration mode, and picks up the requests
+// from the web UI
+void calibrationTick(void){
+  Calibration.Tick(Hal.Clock->Millis());
+}
+
+uint32_t calibrationNext(void){
+  uint32_t u32Due = Calibration.DueIn(Hal.Clock->Millis());
+  return u32Due == UINT32_MAX ? SCHED_IDLE : u32Due;
+}
+
+// Rejoins a lost network and restarts a silent listener (Supervisor.h)
+void supervisorTick(void){
+  Supervisor.Tick(Hal.Clock->Millis());
+}
+
+uint32_t supervisorNext(void){
+  uint32_t u32Due = Supervisor.DueIn(Hal.Clock->Millis());
+  return u32Due == UINT32_MAX ? SCHED_IDLE : u32Due;
+}
+
+// Wi-Fi in AP mode, cycle the DotStar color to give the user some feedback
+void softApTick(void){
+  Hal.Led->CycleColor(0);
+}
+
+uint32_t softApNext(void){
+  return 25;
+}
+
+// Settings write-behind, then the restart a Wi-Fi change or firmware
+// update asked for, once the new settings are on flash (or the write
+// keeps failing)
+static volatile bool bRestartRequested = false;
+void requestRestart(void){
+  bRestartRequested = true;
+  jobsReschedule();
+}
+
+#define SETTINGS_RESTART_TRIES 10
+void settingsTick(void){
+  static int iRestartTries = 0;
+  SettingsStorage.Service(Hal.Clock->Millis(), bRestartRequested);
+  if( bRestartRequested && (!SettingsStorage.Dirty() || ++iRestartTries > SETTINGS_RESTART_TRIES) ){
+    debug(1, "\n\rRestarting for the new Wi-Fi settings or firmware");
+    Hal.Sys->Restart();
   }
-  else{
-    // ================================================================
-    // Wi-Fi in client mode, listening for WeatherFlow messages
-    // ================================================================
-
-    // Status via DotStar LED
-    if( ul32CurTime%15 == 0 && !bOneShot ){
-      bOneShot = true;
-      TP.DotStar_SetPixelColor(0x00FF00);
-      ul32LastBlink = ul32CurTime;
-      // Log the current time
-      char buf[128];
-      strftime(buf, 128, "%c", localtime(&ul32CurTime));
-      debug(1, "\n\rCurrent System Time: %s", buf); 
-      debug(1, "\r\nFirmware Version: %d.%d.%d", MAJOR, MINOR, PATCH);
-    }
-    if( ul32CurTime - ul32LastBlink >= 1 ){
-      bOneShot = false;
-      TP.DotStar_SetPixelColor(0x0);
-    }
+}
 
-    // ================================================================
-    // WeatherFlow receiver loop function call, return indicates
-    // new data is available
-    // ================================================================
-    if( WF.ReceiveLoop() ){
-      debug(1, "\n\rReceived updated weather info...");
-      
-      // Check for Wind data
-      if( WF.RapidWind().Valid() ){
-        debug(1, "\n\rValid Rapid Wind data:");
-        debug(1, "\n\r\tWind Speed: %f", WF.RapidWind().WindSpeed());
-        debug(1, "\n\r\tWind Direction: %d", WF.RapidWind().WindDirection());
-
-        u32WindPwm = scalePwmOutput(WF.RapidWind().WindSpeed(), Settings.Config.Wind.min,
-          Settings.Config.Wind.max, Settings.Config.Wind.gain);
-        debug(2, "\n\r\tWind PWM: %i", u32WindPwm);
-        ledcAnalogWrite(WINDCHANNEL, u32WindPwm);
-
-        if( WF.RapidWind().WindSpeed() >= Settings.Config.Wind.threshold ){ 
-          u8WindDir = encodeWind(WF.RapidWind().WindDirection()); 
-        }
-        else{ 
-          u8WindDir = 0x00;
-        }
-        debug(2, "\n\r\tWind direction code: 0x%02X", u8WindDir);
-        mcp.writeGPIO(u8WindDir, 0);
-
-        // Check if we need to update our system time
-        if( abs(time(NULL) - WF.RapidWind().EpochTime()) > 10 ){
-          debug(1, "\n\r\tUpdating the system time...");
-          timeval WFtime;
-          WFtime.tv_sec = WF.RapidWind().EpochTime();
-          WFtime.tv_usec = 0;
-          settimeofday(&WFtime, NULL);
-          debug(2, "\n\r\t\tWF Epoch Time: %d", WF.RapidWind().EpochTime());
-          debug(2, "\n\r\t\tSystem Time:   %d", time(NULL));
-        }
-      }
-
-      // Check for valid Station data
-      if( WF.ObservationTempest().Valid() ){
-        debug(1, "\n\rValid Station Observation data:");
-        debug(1, "\n\r\tAir Temperature: %f", WF.ObservationTempest().AirTemperature());
-        u32TempPwm = scalePwmOutput(WF.ObservationTempest().AirTemperature(), Settings.Config.Temp.min,
-          Settings.Config.Temp.max, Settings.Config.Temp.gain);
-        debug(2, "\n\r\tTemp PWM: %i", u32TempPwm);
-        ledcAnalogWrite(TEMPCHANNEL, u32TempPwm);
-      }
-    }
-  
-    // ================================================================
-    // Check our current time, turn on the gauge lamps if needed
-    // ================================================================
-    tm *tmCurrentTime;
-    tmCurrentTime = localtime(&ul32CurTime);
-    if( !bGaugeLamp && tmCurrentTime->tm_hour == Settings.Config.GaugeLamps.OnHour 
-        && tmCurrentTime->tm_min == Settings.Config.GaugeLamps.OnMinute ){
-      bGaugeLamp = true;
-      ledcAnalogWrite(LED1CHANNEL, scalePwmOutput(Settings.Config.GaugeLamps.LampBrightness, 0, 100, 4096));
+#define SETTINGS_RETRY_MS 500
+uint32_t settingsNext(void){
+  if( bRestartRequested )return SETTINGS_RETRY_MS;
+  uint32_t u32Due = SettingsStorage.DueIn(Hal.Clock->Millis());
+  return u32Due == UINT32_MAX ? SCHED_IDLE : std::max(u32Due, (uint32_t)SETTINGS_RETRY_MS);
+}
+
+// Stage latencies and counters for the System Status tab, the loop rate
+// is the gauge task wakeups per minute since the last refresh
+static void metricsStatus(void){
+  static uint32_t u32LastWakeups = 0, u32LastMs = 0;
+  const uint32_t u32Wakeups = Metrics.Stage(msLoop).Count();
+  const uint32_t u32Now = Hal.Clock->Millis();
+  char chValue[STATUS_VALUE_LEN];
+
+  if( u32Now != u32LastMs ){
+    SystemStatus.Setf(ssLoopRate, "%.1f /min", (u32Wakeups - u32LastWakeups) * 60000.0 / (u32Now - u32LastMs));
+  }
+  u32LastWakeups = u32Wakeups;
+  u32LastMs = u32Now;
+  SystemStatus.Setf(ssDatagrams, "%u", (unsigned)Metrics.Counter(mcDatagrams));
+  Ingest.Status(chValue, sizeof(chValue));
+  SystemStatus.Set(ssSources, chValue);
+  SystemStatus.Setf(ssDrops, "%u", (unsigned)(Metrics.Counter(mcQueueDrops) + logDropped()));
+  SystemStatus.Setf(ssMetricsOverhead, "%.3f %%", Metrics.Overhead() * 100);
+  for( int i = 0; i < NUM_METRIC_STAGES; i++ ){
+    Metrics.Summary((MetricStage)i, chValue, sizeof(chValue));
+    SystemStatus.Set(ssStageRx + i, chValue);
+  }
+  Firmware.Status(chValue, sizeof(chValue), u32Now);
+  SystemStatus.Set(ssFirmware, chValue);
+  Firmware.LatencyStatus(chValue, sizeof(chValue));
+  SystemStatus.Set(ssFirmwareLatency, chValue);
+}
+
+static void memoryKB(uint8_t u8Field, uint32_t u32Bytes){
+  if( u32Bytes )MemoryStatus.Setf(u8Field, "%.1f KB", u32Bytes / 1024.0);
+  else MemoryStatus.Set(u8Field, "-");
+}
+
+// Heap, PSRAM and the stack never used by each task, for the System
+// Status tab
+static void memoryStatus(void){
+  Memory.Sample();
+  const HeapInfo &heap = Memory.Heap();
+  memoryKB(mfHeapFree, heap.Free);
+  memoryKB(mfHeapLargest, heap.Largest);
+  memoryKB(mfHeapMinFree, heap.MinFree);
+  if( heap.ExternalSize ){
+    MemoryStatus.Setf(mfPsram, "%.2f of %.2f MB free", heap.ExternalFree / 1048576.0,
+      heap.ExternalSize / 1048576.0);
+  }
+  else MemoryStatus.Set(mfPsram, "None");
+  for( int i = 0; i < NUM_MEMORY_TASKS; i++ ){
+    uint32_t u32Free = Memory.StackFree((MemoryTask)i);
+    if( u32Free == UINT32_MAX )MemoryStatus.Set(mfStackGauges + i, "-");
+    else MemoryStatus.Setf(mfStackGauges + i, "%u bytes", (unsigned)u32Free);
+  }
+}
+
+// Refresh the web status from the latest samples, then push the changes
+void statusTick(void){
+  static const char *chPrecipitation[] = { "None", "Rain", "Hail", "Rain & Hail" };
+  WxSample wind, obs;
+  bool bWind = LatestWind.Read(wind) != 0;
+  bool bObs = LatestObs.Read(obs) != 0;
+
+  if( bWind || bObs ){
+    time_t tStation = (time_t)std::max(bWind ? wind.EpochTime : 0, bObs ? obs.EpochTime : 0);
+    char chTime[STATUS_VALUE_LEN];
+    tm tmStation;
+    strftime(chTime, sizeof(chTime), "%Y-%m-%d %H:%M:%S", localtime_r(&tStation, &tmStation));
+    WeatherStatus.Set(wsTime, chTime);
+  }
+  if( bWind ){
+    WindSummary stats2m, stats10m;
+    LatestWindStats[ww2Min].Read(stats2m);
+    LatestWindStats[ww10Min].Read(stats10m);
+    WeatherStatus.Setf(wsWindAverage2m, "%.1f MPH", stats2m.Average);
+    WeatherStatus.Setf(wsWindAverage10m, "%.1f MPH", stats10m.Average);
+    WeatherStatus.Setf(wsWindGust10m, "%.1f MPH", stats10m.Gust);
+    WeatherStatus.Setf(wsWindLull10m, "%.1f MPH", stats10m.Lull);
+    if( stats10m.Direction < 0 ){
+      WeatherStatus.Set(wsWindDirection, "Calm");
+      WeatherStatus.Set(wsWindVariability, "-");
     }
-    if( bGaugeLamp && tmCurrentTime->tm_hour == Settings.Config.GaugeLamps.OffHour && 
-        tmCurrentTime->tm_min == Settings.Config.GaugeLamps.OffMinute ){
-      bGaugeLamp = false;
-      ledcAnalogWrite(LED1CHANNEL, 0);
+    else{
+      WeatherStatus.Setf(wsWindDirection, "%.0f deg", stats10m.Direction);
+      WeatherStatus.Setf(wsWindVariability, "+/- %.0f deg", stats10m.Variability);
     }
   }
+  if( bObs ){
+    WeatherStatus.Setf(wsTemperature, "%.1f F", obs.AirTemperature);
+    WeatherStatus.Setf(wsHumidity, "%.0f %%", obs.Humidity);
+    WeatherStatus.Setf(wsPressure, "%.2f inHg", obs.Pressure);
+    WeatherStatus.Setf(wsWind, "%.1f MPH", obs.WindAverage);
+    WeatherStatus.Setf(wsWindGust, "%.1f MPH", obs.WindGust);
+    WeatherStatus.Setf(wsUv, "%.1f", obs.Uv);
+    WeatherStatus.Setf(wsBrightness, "%u lux", (unsigned)obs.Brightness);
+    WeatherStatus.Setf(wsSolarRadiation, "%u W/m2", (unsigned)obs.SolarRadiation);
+    WeatherStatus.Setf(wsRainRate, "%.2f in/hr", obs.RainAmount * 60);
+    WeatherStatus.Set(wsPrecipitationType, chPrecipitation[obs.PrecipitationType & 3]);
+    WeatherStatus.Setf(wsLightningStrikes, "%u", (unsigned)obs.StrikeCount);
+    WeatherStatus.Setf(wsLightningDistance, "%.1f mi", obs.StrikeDistance);
+  }
+  SystemStatus.Setf(ssSettingsWrites, "%u", (unsigned)SettingsStorage.Writes());
+  // Boot phases from power up, the Wi-Fi joins in the background
+  for( int i = bpNeedles; i < NUM_BOOT_PHASES; i++ ){
+    uint32_t u32Ms = Boot.Millis((BootPhase)i);
+    if( u32Ms != UINT32_MAX )SystemStatus.Setf(ssBootNeedles + i - bpNeedles, "%u ms", (unsigned)u32Ms);
+  }
+  char chValue[STATUS_VALUE_LEN];
+  Calibration.Status(chValue, sizeof(chValue));
+  SystemStatus.Set(ssCalibration, chValue);
+  Supervisor.Status(chValue, sizeof(chValue), Hal.Clock->Millis());
+  SystemStatus.Set(ssLink, chValue);
+  Supervisor.Outages(chValue, sizeof(chValue));
+  SystemStatus.Set(ssLinkOutages, chValue);
+  Supervisor.Recovery(chValue, sizeof(chValue));
+  SystemStatus.Set(ssLinkRecovery, chValue);
+  metricsStatus();
+  memoryStatus();
+  notifyWsSystemStatus();
+}
 
+// Once a second for the browsers, else just keep the values the
+// pages are rendered with fresh
+#define STATUS_PUSH_MS 1000
+#define STATUS_IDLE_MS 60000
+uint32_t statusNext(void){
+  return webStatusClients() ? STATUS_PUSH_MS : STATUS_IDLE_MS;
 }
 
+const ScheduledJob StationJobs[] = {
+  { "blink", blinkTick, blinkNext },
+  { "lamps", lampsTick, lampsNext },
+  { "timesync", timeSyncTick, timeSyncNext },
+  { "history", historyTick, historyNext },
+  { "calibration", calibrationTick, calibrationNext },
+  { "supervisor", supervisorTick, supervisorNext },
+  { "status", statusTick, statusNext },
+  { "settings", settingsTick, settingsNext },
+};
+const ScheduledJob SoftApJobs[] = {
+  { "softap", softApTick, softApNext },
+  { "status", statusTick, statusNext },
+  { "settings", settingsTick, settingsNext },
+};
+const size_t NumStationJobs = sizeof(StationJobs) / sizeof(StationJobs[0]);
+const size_t NumSoftApJobs = sizeof(SoftApJobs) / sizeof(SoftApJobs[0]);
+
 // ##################################################################
-// # Debug printer
-// #
-// # Debug logging to the serial port, message is only printed if 
-// # the level is >= to DEBUG (i.e. debugging level).  If DEBUG is
-// # undefined, code is deactivated.
+// # Gauge output stage, the live data is still recorded while
+// # calibrating, and the newest sample of each message type held back
+// # is put on the gauges as soon as calibration ends.  Stale data
+// # parks the gauges until a sample comes in, then the newest of each
+// # message type goes back on.
 // ##################################################################
-void debug(int level, const char *fmt, ...){
-  #ifdef DEBUG
-  if( level <= DEBUG ){
-    char chBuffer[256];
-    va_list args;
-    va_start(args,fmt);
-    vsprintf(chBuffer, fmt, args);
-    va_end(args);
-    Serial.print(chBuffer);
+#define CAL_RELEASE_POLL_MS 100
+static uint8_t u8HeldMessages = 0;      // WX_VALID_* bits, gauge task only
+static bool bParked = false;            // Gauge task only
+
+static void releaseHeld(uint8_t u8Skip){
+  uint8_t u8Held = u8HeldMessages & ~u8Skip;
+  u8HeldMessages = 0;
+  WxSample held;
+  if( (u8Held & WX_VALID_RAPID_WIND) && LatestWind.Read(held) )processWeather(held);
+  if( (u8Held & WX_VALID_OBS_ST) && LatestObs.Read(held) )processWeather(held);
+}
+
+void gaugeOutput(const WxSample &sample){
+  Supervisor.Received(Hal.Clock->Millis());
+  if( bParked && !Supervisor.Stale() ){
+    bParked = false;
+    u8HeldMessages |= WX_VALID_RAPID_WIND | WX_VALID_OBS_ST;
   }
-  #endif
+  History.Add(sample);
+  if( sample.Valid & WX_VALID_RAPID_WIND ){
+    u32WindRxMs = Hal.Clock->Millis();
+    LatestWind.Write(sample);
+    WindStats.Add(u32WindRxMs, sample.WindSpeed, sample.WindDirection);
+    for( int w = 0; w < NUM_WIND_WINDOWS; w++ )LatestWindStats[w].Write(WindStats.Summary((WindWindow)w));
+  }
+  if( sample.Valid & WX_VALID_OBS_ST )LatestObs.Write(sample);
+  if( !bClockSynced && (sample.Valid & WX_VALID_RAPID_WIND) )jobsReschedule();
+  if( CalibrationMode != none ){
+    u8HeldMessages |= sample.Valid & (WX_VALID_RAPID_WIND | WX_VALID_OBS_ST);
+    return;
+  }
+  if( u8HeldMessages )releaseHeld(sample.Valid);
+  processWeather(sample);
+  if( sample.RxMicros )Firmware.Latency((uint32_t)(Hal.Clock->Micros() - sample.RxMicros));
 }
 
-// ####################################################################
-// # Run Calibration
+// Advance the needle moves, returns the ms until the next step is due
+// (soon while calibrating, to catch the end of it)
+uint32_t gaugeService(void){
+  if( CalibrationMode != none ){
+    GaugeRoutes.Stop();
+    return CAL_RELEASE_POLL_MS;
+  }
+  if( Supervisor.Stale() != bParked ){
+    bParked = !bParked;
+    if( bParked ){
+      const LinkSettings &link = Settings.Config.Link;
+      GaugeRoutes.Park(link.ParkPercent, link.Blank, Hal.Clock->Millis());
+    }
+    else u8HeldMessages |= WX_VALID_RAPID_WIND | WX_VALID_OBS_ST;
+  }
+  if( u8HeldMessages )releaseHeld(0);
+  return GaugeRoutes.Service(Hal.Clock->Millis());
+}
+
+// ##################################################################
+// # Weather Processing
 // #
-// # Runs a simple calibration, steping through the gauge "steps",
-// # on each call (i.e. once per loop).  This allows the gain values
-// # to easily be "tuned."
-// ####################################################################
-void RunCalibration(void){
-  static float fWindSpeed = 0;
-  static float fAirTemp = 0;
-  static int iWindDirectionDegrees = 0;
-  uint32_t u32WindPwm;
-  uint32_t u32TempPwm;
-  uint8_t u8WindDir;
-
-  u32WindPwm = scalePwmOutput((double)fWindSpeed, Settings.Config.Wind.min, 
-    Settings.Config.Wind.max, (double)Settings.Config.Wind.gain);
-  debug(1, "\n\rWind PWM: %i", u32WindPwm);
-  ledcAnalogWrite(WINDCHANNEL, u32WindPwm);
-
-  fWindSpeed += Settings.Config.Wind.step;
-  if( fWindSpeed > Settings.Config.Wind.max )fWindSpeed = Settings.Config.Wind.min;
-
-  u32TempPwm = scalePwmOutput((double)fAirTemp, Settings.Config.Temp.min, 
-    Settings.Config.Temp.max, (double)Settings.Config.Temp.gain);
-  debug(1, "\n\rTemp PWM: %i", u32TempPwm);
-  ledcAnalogWrite(TEMPCHANNEL, u32TempPwm);
-  
-  fAirTemp += Settings.Config.Temp.step;
-  if( fAirTemp > Settings.Config.Temp.max )fAirTemp = Settings.Config.Temp.min;
-
-  iWindDirectionDegrees+= 15;
-  if( iWindDirectionDegrees > 360 )iWindDirectionDegrees = 0;
-  u8WindDir = encodeWind(iWindDirectionDegrees);
-  debug(1, "\n\rWind direction code: 0x%02X", u8WindDir);
-  mcp.writeGPIO(u8WindDir, 0);
+// # Drives the gauge outputs from a newly received WeatherFlow
+// # sample, and keeps the system time in sync with the station.
+// ##################################################################
+void processWeather(const WxSample &sample){
+  debug(1, "\n\rReceived updated weather info...");
+
+  // Check for Wind data
+  if( sample.Valid & WX_VALID_RAPID_WIND ){
+    debug(1, "\n\rValid Rapid Wind data:");
+    debug(1, "\n\r\tWind Speed: %f", sample.WindSpeed);
+    debug(1, "\n\r\tWind Direction: %d", sample.WindDirection);
+  }
+
+  // Check for valid Station data
+  if( sample.Valid & WX_VALID_OBS_ST ){
+    debug(1, "\n\rValid Station Observation data:");
+    debug(1, "\n\r\tAir Temperature: %f", sample.AirTemperature);
+  }
+
+  GaugeRoutes.Dispatch(sample, Hal.Clock->Millis());
 }
 
 
 // ##################################################################
-// # PWM and Wind LED outputs
+// # PWM and expander outputs
 // ##################################################################
 
 // Analog PMW control, similar to Arduino analogWrite
 void ledcAnalogWrite(uint8_t channel, uint32_t value, uint32_t valueMax) {
   // Write duty to LEDC, preventing writing above the max value
-  ledcWrite(channel, min(value, valueMax));
+  StageTimer timer(msPwm);
+  Hal.Pwm->Write(channel, std::min(value, valueMax));
 }
 
-// Scale our guage values, as needed
+// Compile the gauge transfer functions, call when the gauge settings change
+void gaugeTablesBuild(void){
+  WindGauge.Rebuild(Settings.Config.Wind);
+  TempGauge.Rebuild(Settings.Config.Temp);
+}
+
+// Scale our guage values, as needed (the gauges use the compiled tables)
 uint32_t scalePwmOutput(double dataVal, double minScale, double maxScale, double halfScalePWM){
   //double dRange = maxScale - minScale;
   //double dScaler = 1 / dRange;
   uint32_t u32Output = (uint32_t)floor(((dataVal - minScale) * halfScalePWM * (double)2) / (maxScale - minScale));
-  return min(u32Output, (uint32_t)8192);
+  return std::min(u32Output, (uint32_t)8192);
 }
 
-// Encode wind direction to the output for the LED driver.
-// Assumes 8 LEDs, connected to 8-bit register
-uint8_t encodeWind(int windDir){
-  uint8_t u8WindDir;
-
-  if( windDir >= (int)348.75 || windDir < (int)11.25 ){ u8WindDir = 0x01; debug(3,"\n\rWind Dir: N"); }         // N
-  else if( windDir >= (int)11.25 && windDir < (int)33.75 ){ u8WindDir = 0x03; debug(3,"\n\rWind Dir: NNE"); }   // NNE
-  else if( windDir >= (int)33.75 && windDir < (int)56.25 ){ u8WindDir = 0x02; debug(3,"\n\rWind Dir: NE"); }    // NE
-  else if( windDir >= (int)56.25 && windDir < (int)78.75 ){ u8WindDir = 0x06; debug(3,"\n\rWind Dir: ENE"); }   // ENE
-  else if( windDir >= (int)78.75 && windDir < (int)101.25 ){ u8WindDir = 0x04; debug(3,"\n\rWind Dir: E"); }    // E
-  else if( windDir >= (int)101.25 && windDir < (int)123.75 ){ u8WindDir = 0x0C; debug(3,"\n\rWind Dir: ESE"); } // ESE
-  else if( windDir >= (int)123.75 && windDir < (int)146.25 ){ u8WindDir = 0x08; debug(3,"\n\rWind Dir: SE"); }  // SE
-  else if( windDir >= (int)146.25 && windDir < (int)168.75 ){ u8WindDir = 0x18; debug(3,"\n\rWind Dir: SSE"); } // SSE
-  else if( windDir >= (int)168.75 && windDir < (int)191.25 ){ u8WindDir = 0x10; debug(3,"\n\rWind Dir: S"); }   // S
-  else if( windDir >= (int)191.25 && windDir < (int)213.75 ){ u8WindDir = 0x30; debug(3,"\n\rWind Dir: SSW"); } // SSW
-  else if( windDir >= (int)213.75 && windDir < (int)236.25 ){ u8WindDir = 0x20; debug(3,"\n\rWind Dir: SW"); }  // SW
-  else if( windDir >= (int)236.25 && windDir < (int)258.75 ){ u8WindDir = 0x60; debug(3,"\n\rWind Dir: WSW"); } // WSW
-  else if( windDir >= (int)258.75 && windDir < (int)281.25 ){ u8WindDir = 0x40; debug(3,"\n\rWind Dir: W"); }   // W
-  else if( windDir >= (int)281.25 && windDir < (int)303.75 ){ u8WindDir = 0xC0; debug(3,"\n\rWind Dir: WNW"); } // WNW
-  else if( windDir >= (int)303.75 && windDir < (int)326.25 ){ u8WindDir = 0x80; debug(3,"\n\rWind Dir: NW"); }  // NW
-  else{ u8WindDir = 0x81; debug(3,"\n\rWind Dir: NNW"); }                                                       // NNW
-
-  return u8WindDir;
+// Compass sector (0 = N ... 15 = NNW) for a direction in degrees, sectors
+// are 22.5 degrees wide and centered on the compass points
+static inline uint8_t windSector(int windDir){
+  windDir %= 360;
+  if( windDir < 0 )windDir += 360;
+  return (uint8_t)(((windDir + 12) * 2 / 45) & (WIND_SECTORS - 1));
 }
 
-// ##################################################################
-// # Web Services (http server and websockets)
-// ##################################################################
+// Encode wind direction to the output for the LED driver, through the
+// configured pattern for each sector (8 LEDs, connected to 8-bit register)
+uint8_t encodeWind(int windDir){
+  return Settings.Config.WindLeds.Pattern[windSector(windDir)];
+}
 
-void notFound(AsyncWebServerRequest *request){
-    request->send(404, "text/plain", "Not found");
-}
-
-void webServerSpiffsHandler(AsyncWebServerRequest *request){
-  String path = request->url();
-  String contentType;
-  debug(2, "handleFileRead: %s", path);
-  if (path.endsWith("/")) path += "index.html"; // Deal with the roots
-  if (path.endsWith(".html")) contentType = "text/html";
-  else if (path.endsWith(".css")) contentType = "text/css";
-  else if (path.endsWith(".js")) contentType = "application/javascript";
-  else if (path.endsWith(".ico")) contentType = "image/x-icon";
-  else contentType = "text/plain";
-  if( SPIFFS.exists(path) ){ 
-    request->send(SPIFFS, path, contentType, false, webTemplateProcessor); 
+// Every sector from the mean direction less the spread round to the mean
+// plus the spread, the whole compass once the arc would meet itself
+uint8_t encodeWindArc(float fDirection, float fSpread){
+  uint8_t u8First = 0, u8Sectors = WIND_SECTORS;
+  if( fSpread < 180 - 180.0f / WIND_SECTORS ){
+    u8First = windSector((int)lroundf(fDirection - fSpread));
+    u8Sectors = ((windSector((int)lroundf(fDirection + fSpread)) - u8First) & (WIND_SECTORS - 1)) + 1;
   }
-  else{ 
-    request->send(404, "text/plain", "Not Found");
+  uint8_t u8Pattern = 0;
+  for( uint8_t i = 0; i < u8Sectors; i++ ){
+    u8Pattern |= Settings.Config.WindLeds.Pattern[(u8First + i) & (WIND_SECTORS - 1)];
   }
+  return u8Pattern;
 }
 
-void onWebSocketEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type,
-    void *arg, uint8_t *data, size_t len){
-  switch (type) {
-  #ifdef DEBUG
-    case WS_EVT_CONNECT:
-      debug(1, "\r\nWebsocket connected (ClientID: %u, ClientIP:  %s)", client->id(), client->remoteIP().toString());
-      break;
-    case WS_EVT_DISCONNECT:
-      debug(1, "\r\nWebscoked disconnected (ClientID: %u", client->id());
-      break;
-    case WS_EVT_PONG:
-    case WS_EVT_ERROR:
-      break;
-  #endif
-    case WS_EVT_DATA:
-      handleWebSocketMessage( (AwsFrameInfo*) arg, data, len);
-      break;
-  }    
-  return;
-  }
-
-void handleWebSocketMessage(AwsFrameInfo *info, uint8_t *data, size_t len){
-  // Make sure this is a complete message and the is "text".
-  if (info->final && info->index == 0 && info->len == len && info->opcode == WS_TEXT) {
-    data[len] = 0;  // C-STR terminator
-    debug(2, "\r\nRaw websocket payload: %s", (char*)data);
-    DynamicJsonDocument jsonWsMsg(1000);
-    if( deserializeJson(jsonWsMsg, (char*)data) == DeserializationError::Ok){
-      // We've got a valid message folks
-      const char *chMsgtype = jsonWsMsg["type"];
-      const std::map<std::string,int> mapWsMsgTypes { {"updateSettings", 1}, {"updateWiFi", 2}, {"updateUser", 3} };
-      switch( mapWsMsgTypes.find(std::string(chMsgtype))->second ){
-        // Update System Settings
-        case 1:{
-            
-            Settings.Config.Wind.min = jsonWsMsg["payload"]["wind"]["min"];
-            Settings.Config.Wind.max = jsonWsMsg["payload"]["wind"]["max"];
-            Settings.Config.Wind.step = jsonWsMsg["payload"]["wind"]["step"];
-            Settings.Config.Wind.gain = jsonWsMsg["payload"]["wind"]["gain"];
-            Settings.Config.Wind.threshold = jsonWsMsg["payload"]["wind"]["threshold"];
-
-            Settings.Config.Temp.min = jsonWsMsg["payload"]["temp"]["min"];
-            Settings.Config.Temp.max = jsonWsMsg["payload"]["temp"]["max"];
-            Settings.Config.Temp.step = jsonWsMsg["payload"]["temp"]["step"];
-            Settings.Config.Temp.gain = jsonWsMsg["payload"]["temp"]["gain"];
-
-            if( strcmp("range", jsonWsMsg["payload"]["cal"]["mode"]) == 0 ){
-              CalibrationMode = range;
-            }
-            if( strcmp("none", jsonWsMsg["payload"]["cal"]["mode"]) == 0 ){
-              CalibrationMode = none;
-            }
-          }
-          break;
-
-        // updateWiFi
-        case 2:{
-            strcpy(Settings.Config.WiFi.ssid, jsonWsMsg["payload"]["wifi"]["ssid"]);
-            strcpy(Settings.Config.WiFi.pass, jsonWsMsg["payload"]["wifi"]["pw"]);
-            Settings.Write();
-            debug(1, "\n\rGot Wi-Fi parameters, SSID: %s, and password: %s", 
-              Settings.Config.WiFi.ssid, Settings.Config.WiFi.pass);
-            delay(2000);
-            ESP.restart();
-          }
-          break;
-
-        //updateUser
-        case 3:{
-            strcpy(Settings.Config.Web.user, jsonWsMsg["payload"]["auth"]["user"]);
-            strcpy(Settings.Config.Web.pass, jsonWsMsg["payload"]["auth"]["pass"]);
-            Settings.Write();
-            debug(1, "\n\rGot Auth parameters, user: %s, and password: %s", 
-              Settings.Config.Web.user, Settings.Config.Web.pass);
-          }
-          break;
-
-        default:{
-            debug(1, "\r\nUnknown websocket message type: %s", chMsgtype);
-          }
-          break;  
-      }
-    }
+// Expander output through a shadow register per bank, the I2C
+// transaction is skipped when the pattern has not changed
+uint32_t u32ExpanderWrites = 0;
+uint32_t u32ExpanderWritesSkipped = 0;
+static uint8_t u8ExpanderShadowValid = 0;
+static uint8_t u8ExpanderShadow[EXPANDER_BANKS];
+
+void writeExpander(uint8_t u8Bank, uint8_t u8Pattern){
+  if( u8Bank >= EXPANDER_BANKS )return;
+  if( (u8ExpanderShadowValid & (1 << u8Bank)) && u8Pattern == u8ExpanderShadow[u8Bank] ){
+    u32ExpanderWritesSkipped++;
+    return;
   }
+  Hal.Expander->Write(u8Bank, u8Pattern);
+  u8ExpanderShadow[u8Bank] = u8Pattern;
+  u8ExpanderShadowValid |= 1 << u8Bank;
+  u32ExpanderWrites++;
 }
 
-String webTemplateProcessor(const String& var){
-  if( var == "WIFI_MODE"){
-    if( bSoftApActive ){ return "AP Mode"; }
-    else{ return "Station Mode"; }
-  }
-  else if( var == "WIFI_SSID" ){
-    if( bSoftApActive){ return AP_MODE_SSID; }
-    else{ return String(Settings.Config.WiFi.ssid); }
-  }
-  else if( var == "WIFI_IP_ADDR")return WiFi.localIP().toString();
-  else if( var == "WIFI_RSSI" )return String(WiFi.RSSI());
-  else if( var == "BAT_VOLT" )return String(TP.GetBatteryVoltage());
-  else if( var == "MIN_WIND" )return String(Settings.Config.Wind.min);
-  else if( var == "MAX_WIND" )return String(Settings.Config.Wind.max);
-  else if( var == "STEP_WIND" )return String(Settings.Config.Wind.step);
-  else if( var == "GAIN_WIND" )return String(Settings.Config.Wind.gain);
-  else if( var == "THRESHOLD_WIND" )return String(Settings.Config.Wind.threshold);
-  else if( var == "MIN_TEMP" )return String(Settings.Config.Temp.min);
-  else if( var == "MAX_TEMP" )return String(Settings.Config.Temp.max);
-  else if( var == "STEP_TEMP" )return String(Settings.Config.Temp.step);
-  else if( var == "GAIN_TEMP" )return String(Settings.Config.Temp.gain);
-  else return "N/A";
-}
-
-void notifyWsSystemStatus(void){
-
-}
\ No newline at end of file
+// Force the next writes out, e.g. after the expanders were reset
+void invalidateExpanders(void){
+  u8ExpanderShadowValid = 0;
+}
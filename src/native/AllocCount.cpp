@@ -0,0 +1,36 @@
+#include <new>
+#include <stdlib.h>
+#include "HalNative.h"
+
+// ##################################################################
+// # Heap accounting for the native benchmarks, every operator new
+// # in the program is counted
+// ##################################################################
+
+static size_t numAllocs = 0;
+static size_t allocBytes = 0;
+
+void *operator new(size_t size){
+  numAllocs++;
+  allocBytes += size;
+  void *p = malloc(size ? size : 1);
+  if( !p )throw std::bad_alloc();
+  return p;
+}
+
+void *operator new[](size_t size){
+  return operator new(size);
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t size) noexcept { (void)size; free(p); }
+void operator delete[](void *p, size_t size) noexcept { (void)size; free(p); }
+
+size_t nativeAllocs(void){
+  return numAllocs;
+}
+
+size_t nativeAllocBytes(void){
+  return allocBytes;
+}
@@ -0,0 +1,149 @@
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "App.h"
+#include "GaugeRoutes.h"
+#include "HalNative.h"
+#include "Ingest.h"
+#include "WsCommand.h"
+#include "CommandBench.h"
+
+// ##################################################################
+// # Web UI command benchmark & fuzzer
+// #
+// # Dispatches the three web UI commands as the browser sends them
+// # and reports messages per second and heap per message.  The fuzz
+// # pass then feeds mutated copies (flipped, dropped and inserted
+// # bytes, truncation, oversized strings) and checks after every
+// # frame that the settings are still in bounds.
+// ##################################################################
+
+static const char *chBenchMessages[] = {
+  "{\"type\":\"updateSettings\",\"payload\":{\"wind\":{\"min\":0,\"max\":40,\"step\":10,\"gain\":3900,"
+    "\"threshold\":1,\"cal\":[[0,0],[10,1900],[20,3900],[40,7800]],\"slew\":4000,\"damped\":1,"
+    "\"leds\":[1,3,2,6,4,12,8,24,16,48,32,96,64,192,128,129]},\"temp\":{\"min\":-10,\"max\":110,"
+    "\"step\":15,\"gain\":3680,\"cal\":[[-10,0],[50,3680],[110,7360]],\"slew\":0,\"damped\":1},"
+    "\"link\":{\"stale\":10,\"park\":0,\"blank\":1},\"ingest\":{\"allow\":\"ST-00000512 HB-0001\"},"
+    "\"cal\":{\"mode\":\"none\"}}}",
+  "{\"type\":\"updateWiFi\",\"payload\":{\"wifi\":{\"ssid\":\"backyard-2.4\",\"pw\":\"hunter2hunter2\"}}}",
+  "{\"type\":\"updateUser\",\"payload\":{\"auth\":{\"user\":\"admin\",\"pass\":\"correct horse\"}}}",
+  "{\"type\":\"updateRoutes\",\"payload\":{\"routes\":[\"wind_speed pwm 0/25 wind\",\"air_temperature pwm 1/26 temp\","
+    "\"wind_direction mcp 0 wind\",\"wind_gust pwm 4/4 linear 0 60\",\"humidity mcp 1 linear 0 100\"]}}"
+};
+static const char *chBenchNames[] = { "updateSettings", "updateWiFi", "updateUser", "updateRoutes" };
+static const WsCommand BenchExpected[] = { wcSettings, wcWiFi, wcUser, wcRoutes };
+#define NUM_BENCH_MESSAGES (sizeof(chBenchMessages) / sizeof(chBenchMessages[0]))
+
+static uint64_t benchNanos(void){
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint32_t u32Rng = 0x2545F491;
+static uint32_t benchRandom(void){
+  u32Rng ^= u32Rng << 13;
+  u32Rng ^= u32Rng >> 17;
+  u32Rng ^= u32Rng << 5;
+  return u32Rng;
+}
+
+template <size_t N>
+static bool fieldOk(const char (&chField)[N]){
+  return memchr(chField, 0, N) != NULL;
+}
+
+static bool gaugeOk(const GaugeSettings &gauge){
+  return gauge.calPoints >= 0 && gauge.calPoints <= GAUGE_CAL_POINTS;
+}
+
+static bool settingsOk(void){
+  const AppConfig &config = Settings.Config;
+  IngestAllow allow;
+  return fieldOk(config.WiFi.ssid) && fieldOk(config.WiFi.pass) && fieldOk(config.Web.user) &&
+    fieldOk(config.Web.pass) && gaugeOk(config.Wind) && gaugeOk(config.Temp) && routesValid(config.Routes) &&
+    config.Link.ParkPercent <= 100 && config.Link.Blank <= 1 && fieldOk(config.Ingest.Allow) &&
+    ingestAllowParse(config.Ingest.Allow, allow);
+}
+
+// One mutated copy of a message, written to chOut, returns its length
+static size_t mutate(const char *chMsg, char *chOut, size_t maxLen){
+  size_t len = strlen(chMsg);
+  memcpy(chOut, chMsg, len);
+  const uint32_t u32Edits = 1 + benchRandom() % 4;
+  for( uint32_t e = 0; e < u32Edits && len > 0; e++ ){
+    size_t at = benchRandom() % len;
+    switch( benchRandom() % 5 ){
+      case 0: chOut[at] ^= (char)(1 << (benchRandom() % 8)); break;
+      case 1: memmove(chOut + at, chOut + at + 1, len - at - 1); len--; break;
+      case 2:
+        if( len + 1 < maxLen ){
+          memmove(chOut + at + 1, chOut + at, len - at);
+          chOut[at] = "{}[]\":,0aZ\\"[benchRandom() % 11];
+          len++;
+        }
+        break;
+      case 3: len = at; break;
+      default:{
+          // Stretch a string value well past any settings field
+          const char *chQuote = (const char *)memchr(chOut + at, '"', len - at);
+          size_t pad = 16 + benchRandom() % 64;
+          if( !chQuote || len + pad >= maxLen )break;
+          size_t q = chQuote - chOut + 1;
+          memmove(chOut + q + pad, chOut + q, len - q);
+          memset(chOut + q, 'x', pad);
+          len += pad;
+        }
+        break;
+    }
+  }
+  return len;
+}
+
+int commandBenchMain(int argc, char **argv){
+  uint32_t u32Messages = 100000, u32Fuzz = 200000;
+  for( int i = 1; i < argc; i++ ){
+    if( strcmp(argv[i], "--messages") == 0 && i + 1 < argc )u32Messages = strtoul(argv[++i], NULL, 10);
+    else if( strcmp(argv[i], "--fuzz") == 0 && i + 1 < argc )u32Fuzz = strtoul(argv[++i], NULL, 10);
+    else{
+      fprintf(stderr, "usage: program cmdbench [--messages <count>] [--fuzz <count>]\n");
+      return 2;
+    }
+  }
+
+  printf("%u messages per command\n\n", (unsigned)u32Messages);
+  printf("%-16s %12s %12s %12s %12s\n", "command", "msgs/s", "ns/msg", "allocs/msg", "heap/msg");
+  for( size_t m = 0; m < NUM_BENCH_MESSAGES; m++ ){
+    const char *chMsg = chBenchMessages[m];
+    const size_t len = strlen(chMsg);
+    if( wsCommandDispatch(chMsg, len) != BenchExpected[m] ){
+      fprintf(stderr, "%s was not dispatched\n", chMsg);
+      return 1;
+    }
+    const size_t allocsStart = nativeAllocs(), bytesStart = nativeAllocBytes();
+    uint64_t u64Start = benchNanos();
+    for( uint32_t i = 0; i < u32Messages; i++ )wsCommandDispatch(chMsg, len);
+    uint64_t u64Nanos = benchNanos() - u64Start;
+    printf("%-16s %12.0f %12.0f %12.2f %12.1f\n", chBenchNames[m],
+      u64Nanos ? 1e9 * u32Messages / u64Nanos : 0.0, (double)u64Nanos / u32Messages,
+      (double)(nativeAllocs() - allocsStart) / u32Messages,
+      (double)(nativeAllocBytes() - bytesStart) / u32Messages);
+  }
+
+  if( u32Fuzz == 0 )return 0;
+  char chFrame[WS_COMMAND_MAX_LEN + 256];
+  uint32_t u32Counts[wcCalibrate + 1] = {0};
+  for( uint32_t i = 0; i < u32Fuzz; i++ ){
+    size_t len = mutate(chBenchMessages[benchRandom() % NUM_BENCH_MESSAGES], chFrame, sizeof(chFrame));
+    u32Counts[wsCommandDispatch(chFrame, len)]++;
+    if( !settingsOk() ){
+      fprintf(stderr, "Settings out of bounds after frame %u: %.*s\n", (unsigned)i, (int)len, chFrame);
+      return 1;
+    }
+  }
+  printf("\n%u fuzzed frames: %u invalid, %u unknown type, %u settings, %u wifi, %u user, %u routes, settings in bounds\n",
+    (unsigned)u32Fuzz, (unsigned)u32Counts[wcInvalid], (unsigned)u32Counts[wcUnknown],
+    (unsigned)u32Counts[wcSettings], (unsigned)u32Counts[wcWiFi], (unsigned)u32Counts[wcUser],
+    (unsigned)u32Counts[wcRoutes]);
+  return 0;
+}
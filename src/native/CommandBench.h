@@ -0,0 +1,7 @@
+#ifndef __CommandBench__
+#define __CommandBench__
+
+// Web UI command dispatch throughput & fuzzing, "program cmdbench ..."
+int commandBenchMain(int argc, char **argv);
+
+#endif
@@ -0,0 +1,245 @@
+#include <chrono>
+#include <deque>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "HalNative.h"
+#include "Ingest.h"
+#include "Metrics.h"
+
+// ##################################################################
+// # Native implementation of the hardware abstraction layer
+// ##################################################################
+
+std::vector<HalEvent> HalEvents;
+
+static bool bConsoleEnabled = false;
+static bool bPwmFade = false;
+static uint32_t u32ConsoleBaud = 0;
+static time_t tWallClock = 0;
+static uint32_t u32WallClockMs = 0;
+static uint32_t u32VirtualMillis = 0;
+
+struct PendingDatagram{
+    std::string Data;
+    uint64_t RxMicros;
+};
+static std::deque<PendingDatagram> dqDatagrams;
+static std::vector<uint8_t> vecSettingsSlots[2];
+static std::vector<uint8_t> vecFirmwareSlot;
+static bool bFirmwareActive = false;
+static uint32_t u32FlashEraseUs = 0;
+static uint32_t u32FlashPageUs = 0;
+static uint32_t u32Retained[16];
+
+static uint64_t nativeMicros(void){
+  static const std::chrono::steady_clock::time_point tpStart = std::chrono::steady_clock::now();
+  return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - tpStart).count();
+}
+
+// Emulated flash operation, the board's cache is off (and the other
+// tasks held) for as long
+static void flashStall(uint32_t u32Us){
+  uint64_t u64Until = nativeMicros() + u32Us;
+  while( nativeMicros() < u64Until );
+}
+
+static void record(HalEventType type, uint8_t u8Channel, uint32_t u32Value){
+  HalEvents.push_back({nativeMicros(), type, u8Channel, u32Value});
+}
+
+class FakePwm : public PwmDriver{
+  public:
+    void Setup(uint8_t u8Channel, uint8_t u8Pin, uint32_t u32Freq, uint8_t u8Bits) override {
+      (void)u32Freq; (void)u8Bits;
+      record(evPwmSetup, u8Channel, u8Pin);
+    }
+    void Write(uint8_t u8Channel, uint32_t u32Duty) override { record(evPwmWrite, u8Channel, u32Duty); }
+    bool HasFade(void) override { return bPwmFade; }
+    void Fade(uint8_t u8Channel, uint32_t u32Duty, uint32_t u32Ms) override {
+      (void)u32Ms;
+      record(evPwmFade, u8Channel, u32Duty);
+    }
+};
+
+class FakeExpander : public GpioExpander{
+  public:
+    bool Begin(uint8_t u8Bank) override { (void)u8Bank; return true; }
+    void Write(uint8_t u8Bank, uint8_t u8Value) override { record(evExpanderWrite, u8Bank, u8Value); }
+};
+
+class FakeLed : public StatusLed{
+  public:
+    void SetColor(uint32_t u32Color) override { record(evLedColor, 0, u32Color); }
+    void SetBrightness(uint8_t u8Brightness) override { record(evLedBrightness, 0, u8Brightness); }
+    void SetPower(bool bOn) override { record(evLedPower, 0, bOn); }
+    void CycleColor(uint8_t u8Wait) override { (void)u8Wait; }
+};
+
+class FakeClock : public SystemClock{
+  public:
+    time_t Now(void) override { return tWallClock; }
+    void Set(time_t tNow) override {
+      record(evClockSet, 0, (uint32_t)tNow);
+      nativeSetWallClock(tNow);
+    }
+    // Millis() follows the virtual clock (timers & scheduling), Micros()
+    // is the host clock, used for latency measurements
+    uint32_t Millis(void) override { return u32VirtualMillis; }
+    uint64_t Micros(void) override { return nativeMicros(); }
+    // Delays only move the virtual clock, so runs are deterministic
+    void Delay(uint32_t u32Ms) override { nativeAdvanceWallClock(u32Ms); }
+};
+
+class FakeWxSource : public WxSource{
+  public:
+    bool Begin(void) override { return true; }
+    bool Receive(WxSample &sample, uint32_t u32TimeoutMs) override {
+      (void)u32TimeoutMs;
+      while( !dqDatagrams.empty() ){
+        PendingDatagram dgram;
+        {
+          StageTimer timer(msRx);
+          dgram = dqDatagrams.front();
+          dqDatagrams.pop_front();
+        }
+        if( Ingest.Decode(dgram.Data.c_str(), dgram.Data.size(), sample) ){
+          sample.RxMicros = dgram.RxMicros;
+          return true;
+        }
+      }
+      return false;
+    }
+};
+
+class FakePlatform : public Platform{
+  public:
+    void ConsoleBegin(uint32_t u32Baud) override { (void)u32Baud; }
+    void ConsoleWrite(const char *chMsg) override {
+      if( bConsoleEnabled )fputs(chMsg, stderr);
+      // Emulate a blocking UART, 10 bit times per character
+      if( u32ConsoleBaud ){
+        uint64_t u64Until = nativeMicros() + (uint64_t)strlen(chMsg) * 10000000 / u32ConsoleBaud;
+        while( nativeMicros() < u64Until );
+      }
+    }
+    void PinInputPullup(uint8_t u8Pin) override { (void)u8Pin; }
+    bool PinRead(uint8_t u8Pin) override { (void)u8Pin; return true; }
+    void WatchdogBegin(uint32_t u32TimeoutSec) override { (void)u32TimeoutSec; }
+    void WatchdogSubscribe(void) override {}
+    void WatchdogReset(void) override {}
+    void Restart(void) override { record(evRestart, 0, 0); }
+    void *AllocExternal(size_t size) override { return calloc(1, size); }
+    // Kept over a (recorded) restart, as RTC memory
+    void *Retained(size_t size) override { return size <= sizeof(u32Retained) ? u32Retained : NULL; }
+    // Slots in RAM, as flash after a power cycle only within one run
+    bool SettingsRead(uint8_t u8Slot, void *pData, size_t len) override {
+      if( u8Slot > 1 || vecSettingsSlots[u8Slot].size() != len )return false;
+      memcpy(pData, vecSettingsSlots[u8Slot].data(), len);
+      return true;
+    }
+    bool SettingsWrite(uint8_t u8Slot, const void *pData, size_t len) override {
+      if( u8Slot > 1 )return false;
+      vecSettingsSlots[u8Slot].assign((const uint8_t *)pData, (const uint8_t *)pData + len);
+      record(evSettingsWrite, u8Slot, len);
+      return true;
+    }
+    // The board's update slot in RAM, with the flash rules: a sector
+    // erases to 0xFF, a write can only clear bits
+    size_t FirmwareBegin(void) override {
+      vecFirmwareSlot.assign(NATIVE_FIRMWARE_SLOT, 0);
+      bFirmwareActive = false;
+      return vecFirmwareSlot.size();
+    }
+    bool FirmwareErase(uint32_t u32Offset) override {
+      if( u32Offset % FIRMWARE_SECTOR || u32Offset + FIRMWARE_SECTOR > vecFirmwareSlot.size() )return false;
+      flashStall(u32FlashEraseUs);
+      memset(vecFirmwareSlot.data() + u32Offset, 0xFF, FIRMWARE_SECTOR);
+      return true;
+    }
+    bool FirmwareWrite(uint32_t u32Offset, const void *pData, size_t len) override {
+      if( u32Offset + len > vecFirmwareSlot.size() )return false;
+      const uint8_t *u8Data = (const uint8_t *)pData;
+      for( size_t i = 0; i < len; i++ ){
+        if( (vecFirmwareSlot[u32Offset + i] & u8Data[i]) != u8Data[i] )return false;
+        vecFirmwareSlot[u32Offset + i] = u8Data[i];
+      }
+      flashStall((uint32_t)((len + 255) / 256) * u32FlashPageUs);
+      return true;
+    }
+    bool FirmwareActivate(size_t len) override {
+      bFirmwareActive = len <= vecFirmwareSlot.size();
+      record(evFirmwareActivate, 0, len);
+      return bFirmwareActive;
+    }
+    // No fixed heap or task stacks on the host
+    void Heap(HeapInfo &heap) override { heap = HeapInfo{}; }
+    uint32_t StackFree(const char *chTask) override { (void)chTask; return UINT32_MAX; }
+};
+
+static FakePwm halPwm;
+static FakeExpander halExpander;
+static FakeLed halLed;
+static FakeClock halClock;
+static FakeWxSource halWx;
+static FakePlatform halSys;
+
+HalDrivers Hal = { &halPwm, &halExpander, &halLed, &halClock, &halWx, &halSys };
+
+
+// ##################################################################
+// # Harness controls
+// ##################################################################
+
+void nativeInjectDatagram(const char *chData, size_t len, uint64_t u64RxMicros){
+  dqDatagrams.push_back({std::string(chData, len), u64RxMicros});
+}
+
+size_t nativePendingDatagrams(void){
+  return dqDatagrams.size();
+}
+
+void nativeSetWallClock(time_t tNow){
+  tWallClock = tNow;
+  u32WallClockMs = 0;
+}
+
+void nativeAdvanceWallClock(uint32_t u32Ms){
+  u32VirtualMillis += u32Ms;
+  u32WallClockMs += u32Ms;
+  tWallClock += u32WallClockMs / 1000;
+  u32WallClockMs %= 1000;
+}
+
+void nativeSetFlashTiming(uint32_t u32EraseUs, uint32_t u32PageUs){
+  u32FlashEraseUs = u32EraseUs;
+  u32FlashPageUs = u32PageUs;
+}
+
+const uint8_t *nativeFirmwareSlot(size_t &len, bool &bActive){
+  len = vecFirmwareSlot.size();
+  bActive = bFirmwareActive;
+  return vecFirmwareSlot.data();
+}
+
+void nativeSetPwmFade(bool bEnabled){
+  bPwmFade = bEnabled;
+}
+
+void nativeSetConsole(bool bEnabled){
+  bConsoleEnabled = bEnabled;
+}
+
+void nativeSetConsoleBaud(uint32_t u32Baud){
+  u32ConsoleBaud = u32Baud;
+}
+
+void nativeDumpEvents(FILE *fOut){
+  static const char *chNames[] = { "pwm_setup", "pwm", "expander", "led_color", "led_brightness",
+    "led_power", "clock_set", "restart", "pwm_fade", "settings_write", "firmware_activate" };
+  for( const HalEvent &ev : HalEvents ){
+    fprintf(fOut, "%llu %s %u %u\n", (unsigned long long)ev.Micros, chNames[ev.Type],
+      (unsigned)ev.Channel, (unsigned)ev.Value);
+  }
+}
@@ -0,0 +1,71 @@
+#ifndef __HalNative__
+#define __HalNative__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+#include <vector>
+#include "Hal.h"
+
+// ##################################################################
+// # Native (Linux host) fake drivers
+// #
+// # Every output the firmware makes is recorded, with the host
+// # monotonic time, so a harness can replay WeatherFlow datagrams and
+// # time the path from receive to gauge output.
+// ##################################################################
+
+enum HalEventType { evPwmSetup, evPwmWrite, evExpanderWrite, evLedColor, evLedBrightness,
+  evLedPower, evClockSet, evRestart, evPwmFade, evSettingsWrite,
+  evFirmwareActivate };
+
+struct HalEvent{
+    uint64_t Micros;
+    HalEventType Type;
+    uint8_t Channel;
+    uint32_t Value;
+};
+
+// Firmware entry points (src/main.cpp)
+void setup();
+void loop();
+
+// Recorded outputs, in order
+extern std::vector<HalEvent> HalEvents;
+void nativeDumpEvents(FILE *fOut);
+
+// The fake PWM has no fade engine (needles slew in software) unless
+// enabled, then each hardware fade is recorded as one evPwmFade
+void nativeSetPwmFade(bool bEnabled);
+
+// Fake UDP source, datagrams are decoded on Receive()
+void nativeInjectDatagram(const char *chData, size_t len, uint64_t u64RxMicros);
+size_t nativePendingDatagrams(void);
+
+// Virtual clock, advanced by the harness (and Delay()), setting the wall
+// clock leaves the monotonic Millis() alone
+void nativeSetWallClock(time_t tNow);
+void nativeAdvanceWallClock(uint32_t u32Ms);
+
+// Access point in reach, taking it away drops the station off the
+// network until it is back and the supervisor rejoins
+void nativeSetLink(bool bUp);
+
+// Firmware update slot, the size of the board's (default partition
+// table), flash operations take as long as set (busy, as the board's
+// cache is off for them): a sector erase, and each 256 byte page written
+#define NATIVE_FIRMWARE_SLOT 0x140000
+void nativeSetFlashTiming(uint32_t u32EraseUs, uint32_t u32PageUs);
+const uint8_t *nativeFirmwareSlot(size_t &len, bool &bActive);
+
+// Heap use, counted over every operator new
+size_t nativeAllocs(void);
+size_t nativeAllocBytes(void);
+
+// Console output is dropped unless enabled, a non-zero baud rate makes
+// writes block for as long as the serial port would
+void nativeSetConsole(bool bEnabled);
+void nativeSetConsoleBaud(uint32_t u32Baud);
+
+#endif
@@ -0,0 +1,419 @@
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "App.h"
+#include "GaugeTable.h"
+#include "HalNative.h"
+#include "Ingest.h"
+#include "Sha256.h"
+#include "Template.h"
+#include "WindStats.h"
+#include "WxSample.h"
+#include "KernelBench.h"
+
+// ##################################################################
+// # Firmware kernel benchmarks
+// #
+// # Times the small functions the gauge and web paths are made of,
+// # on the inputs they see from a station and a browser, and reports
+// # ns/op and allocs/op.  Each kernel is run in batches of about 10 ms
+// # and the fastest batch kept.  A fixed integer loop is timed between
+// # the batches, the baseline is scaled by how much faster or slower
+// # that ran, so a baseline written on one machine is usable on
+// # another (and a busy machine slows both alike).
+// #
+// # Only kernels that are the firmware's own code are here.  The
+// # websocket commands and the whole document parse are ArduinoJson's
+// # time and allocations, which depend on the library the native build
+// # links; cmdbench times the commands without gating them.
+// #
+// # With --baseline the run fails (exit 1) when a kernel is slower
+// # than its scaled baseline by more than --threshold percent, or
+// # allocates more per op.  --write-baseline saves the run.
+// ##################################################################
+
+#define BENCH_BATCH_NANOS 10000000ull
+#define BENCH_BATCHES 7
+#define BENCH_NOISE_NANOS 1.0       // Differences below this are timer noise
+#define BENCH_ALLOC_SLACK 0.1       // Occasional allocations (a settings save) per op
+#define BENCH_MAX_KERNELS 24
+
+static uint64_t benchNanos(void){
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Results land here so the compiler cannot drop the work
+static volatile uint32_t u32Sink;
+
+
+// ##################################################################
+// # Inputs
+// ##################################################################
+
+static const char chRapidWind[] = "{\"serial_number\":\"ST-00000512\",\"type\":\"rapid_wind\","
+  "\"hub_sn\":\"HB-00013030\",\"ob\":[1588948614,2.38,128]}";
+static const char chObsSt[] = "{\"serial_number\":\"ST-00000512\",\"type\":\"obs_st\","
+  "\"hub_sn\":\"HB-00013030\",\"obs\":[[1588948614,0.18,0.22,0.27,144,6,1017.57,22.37,50.26,328,0.03,3,"
+  "0.000000,0,0,0,2.410,1]],\"firmware_revision\":129}";
+// The same from a station on another hub, that the allow list turns away
+static const char chForeignWind[] = "{\"serial_number\":\"ST-00020771\",\"type\":\"rapid_wind\","
+  "\"hub_sn\":\"HB-00020400\",\"ob\":[1588948614,2.38,128]}";
+static const char chHubStatus[] = "{\"serial_number\":\"HB-00013030\",\"type\":\"hub_status\","
+  "\"firmware_revision\":\"171\",\"uptime\":1670133,\"rssi\":-62,\"timestamp\":1588948614,"
+  "\"reset_flags\":\"BOR,PIN,POR\",\"seq\":48,\"radio_stats\":[25,1,0,3,16841],\"mqtt_stats\":[1,0]}";
+
+// A page with every placeholder once, in a line of markup each
+static char chPage[NUM_TEMPLATE_VARS * 64];
+static CompiledTemplate PageTemplate;
+
+// Wind speeds (MPH) and directions a gusty afternoon goes through
+static float fSpeeds[64];
+static int iDirections[64];
+
+
+// ##################################################################
+// # Kernels, each given the op number to pick its input
+// ##################################################################
+
+static void kernelReference(uint32_t i){
+  uint32_t u32Hash = i;
+  for( int n = 0; n < 64; n++ )u32Hash = (u32Hash ^ (u32Hash >> 15)) * 0x2c1b3c6d + n;
+  u32Sink = u32Hash;
+}
+
+static void kernelScalePwm(uint32_t i){
+  u32Sink = scalePwmOutput(fSpeeds[i & 63], 0, 40, 3900);
+}
+
+static void kernelGaugeScale(uint32_t i){
+  u32Sink = WindGauge.Scale(fSpeeds[i & 63]);
+}
+
+static void kernelEncodeWind(uint32_t i){
+  u32Sink = encodeWind(iDirections[i & 63]);
+}
+
+static void kernelDecodeRapidWind(uint32_t i){
+  (void)i;
+  WxSample sample;
+  u32Sink = wxDecodeJson(chRapidWind, sizeof(chRapidWind) - 1, sample);
+}
+
+static void kernelDecodeObs(uint32_t i){
+  (void)i;
+  WxSample sample;
+  u32Sink = wxDecodeJson(chObsSt, sizeof(chObsSt) - 1, sample);
+}
+
+static void kernelDecodeIgnored(uint32_t i){
+  (void)i;
+  WxSample sample;
+  u32Sink = wxDecodeJson(chHubStatus, sizeof(chHubStatus) - 1, sample);
+}
+
+static void kernelIngestRejected(uint32_t i){
+  (void)i;
+  WxSample sample;
+  u32Sink = Ingest.Decode(chForeignWind, sizeof(chForeignWind) - 1, sample);
+}
+
+static void kernelDispatch(uint32_t i){
+  WxSample sample;
+  sample.Valid = WX_VALID_RAPID_WIND;
+  sample.WindSpeed = fSpeeds[i & 63];
+  sample.WindDirection = iDirections[i & 63];
+  processWeather(sample);
+  // Keep the fake driver's record from growing, its capacity stays
+  if( HalEvents.size() > 4096 )HalEvents.clear();
+}
+
+// One rapid_wind into the rolling statistics and both windows summarized,
+// as the gauge task does, 3 s apart
+static void kernelWindStats(uint32_t i){
+  WindStats.Add(i * 3000, fSpeeds[i & 63], iDirections[i & 63]);
+  WindSummary summary;
+  for( int w = 0; w < NUM_WIND_WINDOWS; w++ )summary = WindStats.Summary((WindWindow)w);
+  u32Sink = summary.Samples;
+}
+
+// The per placeholder processor, for templates served uncompiled
+static void kernelTemplateVar(uint32_t i){
+  const char *chName = TemplateVarNames[i % NUM_TEMPLATE_VARS];
+  char chValue[TEMPLATE_VALUE_LEN];
+  int iVar = templateVarFind(chName, strlen(chName));
+  u32Sink = iVar < 0 ? 0 : templateValue((TemplateVar)iVar, chValue, sizeof(chValue));
+}
+
+// One request for the compiled page
+static void kernelTemplatePage(uint32_t i){
+  (void)i;
+  uint8_t u8Chunk[1436];
+  TemplateCursor cursor(PageTemplate.Render());
+  size_t total = 0, len;
+  while( (len = cursor.Fill(u8Chunk, sizeof(u8Chunk))) > 0 )total += len;
+  u32Sink = total;
+}
+
+// The firmware update digest over one upload chunk
+static void kernelFirmwareDigest(uint32_t i){
+  static Sha256 sha;
+  static uint8_t u8Chunk[1436];
+  u8Chunk[i % sizeof(u8Chunk)] = (uint8_t)i;
+  if( (i & 1023) == 0 )sha.Begin();
+  sha.Update(u8Chunk, sizeof(u8Chunk));
+  u32Sink = u8Chunk[0];
+}
+
+struct BenchKernel{
+    const char *Name;
+    void (*Run)(uint32_t i);
+};
+
+static const BenchKernel Kernels[] = {
+  { "reference", kernelReference },
+  { "scale_pwm_output", kernelScalePwm },
+  { "gauge_scale", kernelGaugeScale },
+  { "encode_wind", kernelEncodeWind },
+  { "wx_decode_rapid_wind", kernelDecodeRapidWind },
+  { "wx_decode_obs_st", kernelDecodeObs },
+  { "wx_decode_ignored", kernelDecodeIgnored },
+  { "wx_ingest_rejected", kernelIngestRejected },
+  { "gauge_dispatch", kernelDispatch },
+  { "wind_stats", kernelWindStats },
+  { "template_var", kernelTemplateVar },
+  { "template_page", kernelTemplatePage },
+  { "fw_digest_chunk", kernelFirmwareDigest }
+};
+#define NUM_KERNELS (sizeof(Kernels) / sizeof(Kernels[0]))
+
+
+// Broadcasts the decoders must agree on, the odd ones included
+static const char *chDecodeChecks[] = {
+  chRapidWind, chObsSt, chHubStatus,
+  "{\"type\":\"rapid_wind\",\"ob\":[1588948614,0,0]}",
+  "{\"serial_number\":\"ST-00000512\",\"ob\":[1588948614,12.5,359],\"type\":\"rapid_wind\"}",
+  "{ \"type\" : \"rapid_wind\", \"ob\" : [ 1588948614 , 3.14 , 90 ] }",
+  "{\"type\":\"rapid_wind\",\"ob\":[1588948614,null,null]}",
+  "{\"type\":\"rapid_wind\",\"ob\":[1588948614,2.5]}",
+  "{\"type\":\"obs_st\",\"obs\":[[1588948614,0.18,0.22,0.27,144,6,1017.57,-12.5]]}",
+  "{\"type\":\"obs_st\",\"obs\":[[1588948614,null,1.2e1,2.5E+0,144,6,1017.57,22.37,null,0,null,0,"
+    "0.000000,0,0,0,2.410,1]]}",
+  "{\"serial_number\":\"ST-00000512\",\"type\":\"evt_strike\",\"evt\":[1493322445,27,3848]}",
+  "{\"serial_number\":\"ST-00000512\",\"type\":\"device_status\",\"timestamp\":1588948614}",
+};
+#define NUM_DECODE_CHECKS (sizeof(chDecodeChecks) / sizeof(chDecodeChecks[0]))
+
+static bool close(float fA, float fB){
+  return fabsf(fA - fB) <= 1e-5f * fmaxf(1, fabsf(fB));
+}
+
+// The filtered decode gives what the document decode does, or both drop it
+static bool benchDecodeCheck(void){
+  bool bOk = true;
+  for( size_t c = 0; c < NUM_DECODE_CHECKS; c++ ){
+    WxSample filtered, full;
+    const size_t len = strlen(chDecodeChecks[c]);
+    bool bFiltered = wxDecodeJson(chDecodeChecks[c], len, filtered);
+    bool bFull = wxDecodeJsonFull(chDecodeChecks[c], len, full);
+    if( bFiltered == bFull && (!bFull || (filtered.Valid == full.Valid && filtered.EpochTime == full.EpochTime &&
+        close(filtered.WindSpeed, full.WindSpeed) && filtered.WindDirection == full.WindDirection &&
+        close(filtered.AirTemperature, full.AirTemperature) && close(filtered.WindAverage, full.WindAverage) &&
+        close(filtered.WindGust, full.WindGust) && close(filtered.Pressure, full.Pressure) &&
+        close(filtered.Humidity, full.Humidity) && filtered.Brightness == full.Brightness &&
+        close(filtered.Uv, full.Uv) && filtered.SolarRadiation == full.SolarRadiation &&
+        close(filtered.RainAmount, full.RainAmount) && filtered.PrecipitationType == full.PrecipitationType &&
+        close(filtered.StrikeDistance, full.StrikeDistance) && filtered.StrikeCount == full.StrikeCount)) )continue;
+    fprintf(stderr, "decoders disagree on %s\n", chDecodeChecks[c]);
+    bOk = false;
+  }
+  return bOk;
+}
+
+
+// ##################################################################
+// # Measurement & baseline
+// ##################################################################
+
+struct BenchResult{
+    char Name[32];
+    double Nanos;
+    double Allocs;
+    double Reference;       // Reference ns/op alongside, not saved
+};
+
+static void benchInputs(void){
+  uint32_t u32Rand = 12345;
+  float fWind = 8;
+  int iDir = 200;
+  for( int i = 0; i < 64; i++ ){
+    u32Rand = u32Rand * 1103515245 + 12345;
+    fWind += ((int)((u32Rand >> 16) % 41) - 20) / 10.0f;
+    if( fWind < 0 )fWind = 0;
+    iDir = (iDir + (int)((u32Rand >> 8) % 61) - 30 + 360) % 360;
+    fSpeeds[i] = fWind;
+    iDirections[i] = iDir;
+  }
+
+  size_t len = 0;
+  for( int v = 0; v < NUM_TEMPLATE_VARS; v++ ){
+    len += snprintf(chPage + len, sizeof(chPage) - len, "<tr><td>%s</td><td>%%%s%%</td></tr>\n",
+      TemplateVarNames[v], TemplateVarNames[v]);
+  }
+  PageTemplate.Compile(chPage, len);
+
+  // Only the station the broadcasts above come from, as the settings frame sends
+  IngestSettings ingest;
+  strcpy(ingest.Allow, "ST-00000512");
+  Ingest.Configure(ingest);
+}
+
+// Ops for a batch of about BENCH_BATCH_NANOS
+static uint32_t benchOps(const BenchKernel &kernel){
+  uint32_t u32Ops = 1;
+  for( ;; ){
+    uint64_t u64Start = benchNanos();
+    for( uint32_t i = 0; i < u32Ops; i++ )kernel.Run(i);
+    uint64_t u64Nanos = benchNanos() - u64Start;
+    if( u64Nanos >= BENCH_BATCH_NANOS / 4 || u32Ops >= (1u << 28) ){
+      return u64Nanos ? (uint32_t)(u32Ops * (double)BENCH_BATCH_NANOS / u64Nanos) + 1 : u32Ops;
+    }
+    u32Ops *= 2;
+  }
+}
+
+static double benchBatch(const BenchKernel &kernel, uint32_t u32Ops){
+  uint64_t u64Start = benchNanos();
+  for( uint32_t i = 0; i < u32Ops; i++ )kernel.Run(i);
+  return (double)(benchNanos() - u64Start) / u32Ops;
+}
+
+// Kernel batches alternate with reference ones, so the machine speed
+// is taken over the same stretch of time as the kernel
+static BenchResult benchRun(const BenchKernel &kernel, uint32_t u32ReferenceOps){
+  BenchResult result;
+  snprintf(result.Name, sizeof(result.Name), "%s", kernel.Name);
+  const uint32_t u32Ops = benchOps(kernel);
+  const size_t allocsStart = nativeAllocs();
+  for( int b = 0; b < BENCH_BATCHES; b++ ){
+    double dNanos = benchBatch(kernel, u32Ops);
+    if( b == 0 || dNanos < result.Nanos )result.Nanos = dNanos;
+    dNanos = benchBatch(Kernels[0], u32ReferenceOps);
+    if( b == 0 || dNanos < result.Reference )result.Reference = dNanos;
+  }
+  // The reference never allocates
+  result.Allocs = (double)(nativeAllocs() - allocsStart) / ((double)u32Ops * BENCH_BATCHES);
+  return result;
+}
+
+// "<name> <ns/op> <allocs/op>" per line, # comments
+static size_t benchLoad(const char *chFile, BenchResult *pResults, size_t maxResults){
+  FILE *fIn = fopen(chFile, "r");
+  if( !fIn )return 0;
+  char chLine[128];
+  size_t num = 0;
+  while( num < maxResults && fgets(chLine, sizeof(chLine), fIn) ){
+    BenchResult &result = pResults[num];
+    if( chLine[0] == '#' )continue;
+    if( sscanf(chLine, "%31s %lf %lf", result.Name, &result.Nanos, &result.Allocs) == 3 )num++;
+  }
+  fclose(fIn);
+  return num;
+}
+
+static bool benchSave(const char *chFile, const BenchResult *pResults, size_t numResults){
+  FILE *fOut = fopen(chFile, "w");
+  if( !fOut )return false;
+  fprintf(fOut, "# program bench --write-baseline %s\n# kernel ns/op allocs/op\n", chFile);
+  for( size_t k = 0; k < numResults; k++ ){
+    fprintf(fOut, "%s %.2f %.3f\n", pResults[k].Name, pResults[k].Nanos, pResults[k].Allocs);
+  }
+  fclose(fOut);
+  return true;
+}
+
+static const BenchResult *benchFind(const BenchResult *pResults, size_t numResults, const char *chName){
+  for( size_t k = 0; k < numResults; k++ ){
+    if( strcmp(pResults[k].Name, chName) == 0 )return &pResults[k];
+  }
+  return NULL;
+}
+
+int kernelBenchMain(int argc, char **argv){
+  const char *chBaseline = NULL, *chWrite = NULL, *chFilter = NULL;
+  double dThreshold = 25;
+  for( int i = 1; i < argc; i++ ){
+    if( strcmp(argv[i], "--baseline") == 0 && i + 1 < argc )chBaseline = argv[++i];
+    else if( strcmp(argv[i], "--write-baseline") == 0 && i + 1 < argc )chWrite = argv[++i];
+    else if( strcmp(argv[i], "--threshold") == 0 && i + 1 < argc )dThreshold = atof(argv[++i]);
+    else if( strcmp(argv[i], "--filter") == 0 && i + 1 < argc )chFilter = argv[++i];
+    else{
+      fprintf(stderr, "usage: program bench [--baseline <file>] [--threshold <percent>]"
+        " [--write-baseline <file>] [--filter <name>]\n");
+      return 2;
+    }
+  }
+
+  BenchResult Baseline[BENCH_MAX_KERNELS];
+  size_t numBaseline = 0;
+  if( chBaseline ){
+    numBaseline = benchLoad(chBaseline, Baseline, BENCH_MAX_KERNELS);
+    if( !numBaseline ){
+      fprintf(stderr, "no baseline in %s\n", chBaseline);
+      return 2;
+    }
+  }
+
+  nativeSetWallClock(time(NULL));
+  setup();
+  benchInputs();
+  if( !benchDecodeCheck() )return 1;
+
+  BenchResult Results[BENCH_MAX_KERNELS];
+  size_t numResults = 0;
+  const uint32_t u32ReferenceOps = benchOps(Kernels[0]);
+  for( size_t k = 0; k < NUM_KERNELS; k++ ){
+    // The reference row always runs, it is what the baseline is written with
+    if( k && chFilter && !strstr(Kernels[k].Name, chFilter) )continue;
+    Results[numResults++] = benchRun(Kernels[k], u32ReferenceOps);
+  }
+
+  // This machine against the one the baseline was written on
+  const BenchResult *pReference = benchFind(Baseline, numBaseline, "reference");
+  const double dReference = pReference && pReference->Nanos > 0 ? pReference->Nanos : 0;
+
+  bool bFailed = false;
+  if( dReference ){
+    printf("machine speed vs baseline: x%.2f, threshold %.0f%%\n\n", dReference / Results[0].Reference, dThreshold);
+  }
+  printf("%-22s %10s %11s %10s %9s\n", "kernel", "ns/op", "allocs/op", "base ns", "change");
+  for( size_t k = 0; k < numResults; k++ ){
+    const BenchResult &result = Results[k];
+    const BenchResult *pBase = benchFind(Baseline, numBaseline, result.Name);
+    printf("%-22s %10.1f %11.3f", result.Name, result.Nanos, result.Allocs);
+    if( !pBase ){
+      printf(numBaseline ? " %10s %9s\n" : "\n", "-", "new");
+      continue;
+    }
+    const double dExpected = dReference ? pBase->Nanos * result.Reference / dReference : pBase->Nanos;
+    const double dChange = dExpected > 0 ? 100 * (result.Nanos - dExpected) / dExpected : 0;
+    const bool bSlower = k && result.Nanos - dExpected > BENCH_NOISE_NANOS && dChange > dThreshold;
+    const bool bAllocs = result.Allocs > pBase->Allocs + BENCH_ALLOC_SLACK;
+    printf(" %10.1f %+8.1f%%%s%s\n", dExpected, dChange, bSlower ? "  REGRESSED" : "",
+      bAllocs ? "  MORE ALLOCS" : "");
+    bFailed |= bSlower || bAllocs;
+  }
+
+  if( chWrite ){
+    if( !benchSave(chWrite, Results, numResults) ){
+      fprintf(stderr, "cannot write %s\n", chWrite);
+      return 2;
+    }
+    printf("\nbaseline written to %s\n", chWrite);
+  }
+  if( bFailed )printf("\nFAILED: kernels regressed past the baseline\n");
+  return bFailed ? 1 : 0;
+}
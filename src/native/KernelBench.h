@@ -0,0 +1,7 @@
+#ifndef __KernelBench__
+#define __KernelBench__
+
+// Firmware kernel ns/op & allocs/op against the stored baseline, "program bench ..."
+int kernelBenchMain(int argc, char **argv);
+
+#endif
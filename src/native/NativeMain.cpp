@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "App.h"
+#include "HalNative.h"
+#include "Replay.h"
+#include "CommandBench.h"
+#include "KernelBench.h"
+#include "OtaBench.h"
+#include "SchedCheck.h"
+#include "StatusBench.h"
+#include "StressBench.h"
+#include "TemplateBench.h"
+
+// ##################################################################
+// # Native (host) entry point
+// #
+// # Runs setup(), then feeds WeatherFlow UDP datagrams (one JSON
+// # message per line on stdin) through loop() and prints every
+// # recorded output as "<micros> <output> <channel> <value>".
+// #
+// # "program replay ..." runs the recorded packet replay instead,
+// # "program wsbench ..." the web status fan-out benchmark,
+// # "program tplbench ..." the web template render benchmark,
+// # "program cmdbench ..." the web UI command benchmark & fuzzer,
+// # "program schedcheck ..." the housekeeping scheduler checks,
+// # "program stress ..." the receive path under a flood of broadcasts,
+// # "program ota ..." the firmware update path with the gauges running
+// # and "program bench ..." the firmware kernel benchmarks.
+// ##################################################################
+
+int main(int argc, char **argv){
+  char chLine[2048];
+
+  if( argc > 1 && strcmp(argv[1], "replay") == 0 )return replayMain(argc - 1, argv + 1);
+  if( argc > 1 && strcmp(argv[1], "wsbench") == 0 )return statusBenchMain(argc - 1, argv + 1);
+  if( argc > 1 && strcmp(argv[1], "tplbench") == 0 )return templateBenchMain(argc - 1, argv + 1);
+  if( argc > 1 && strcmp(argv[1], "cmdbench") == 0 )return commandBenchMain(argc - 1, argv + 1);
+  if( argc > 1 && strcmp(argv[1], "schedcheck") == 0 )return schedCheckMain(argc - 1, argv + 1);
+  if( argc > 1 && strcmp(argv[1], "stress") == 0 )return stressBenchMain(argc - 1, argv + 1);
+  if( argc > 1 && strcmp(argv[1], "ota") == 0 )return otaBenchMain(argc - 1, argv + 1);
+  if( argc > 1 && strcmp(argv[1], "bench") == 0 )return kernelBenchMain(argc - 1, argv + 1);
+
+  nativeSetConsole(argc > 1 && strcmp(argv[1], "-v") == 0);
+  nativeSetWallClock(time(NULL));
+  setup();
+
+  while( fgets(chLine, sizeof(chLine), stdin) ){
+    size_t len = strlen(chLine);
+    if( len < 2 )continue;
+    nativeInjectDatagram(chLine, len, Hal.Clock->Micros());
+    while( nativePendingDatagrams() )loop();
+  }
+
+  nativeDumpEvents(stdout);
+  return 0;
+}
@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include "App.h"
+#include "Boot.h"
+#include "HalNative.h"
+#include "StatusFeed.h"
+#include "Template.h"
+
+// ##################################################################
+// # Native stand-ins for the Wi-Fi & web services, the host build
+// # runs as a station with no web UI, joined unless a harness takes
+// # the access point away (nativeSetLink()), then it only joins again
+// # once the access point is back and the supervisor asks.
+// ##################################################################
+
+static bool bLinkAvailable = true;
+static bool bLinkJoined = true;
+
+void nativeSetLink(bool bUp){
+  bLinkAvailable = bUp;
+  if( !bUp && bLinkJoined ){
+    bLinkJoined = false;
+    jobsReschedule();
+  }
+}
+
+bool wifiBegin(void){
+  debug(1, "\n\rNative build, Wi-Fi assumed connected.");
+  bLinkAvailable = bLinkJoined = true;
+  Boot.Mark(bpWifi);
+  return false;
+}
+
+bool wifiConnected(void){
+  return bLinkJoined;
+}
+
+void wifiReconnect(void){
+  if( !bLinkAvailable || bLinkJoined )return;
+  bLinkJoined = true;
+  jobsReschedule();
+}
+
+void webServicesBegin(void){
+}
+
+size_t webStatusClients(void){
+  return 0;
+}
+
+// No websocket clients, the frames are only closed (see "program wsbench")
+void notifyWsSystemStatus(void){
+  SystemStatus.Set(ssWifiMode, "Station Mode");
+  SystemStatus.Set(ssWifiSsid, "native");
+  SystemStatus.Set(ssWifiIpAddr, "127.0.0.1");
+  SystemStatus.Set(ssWifiRssi, "0");
+  SystemStatus.Set(ssBatVolt, "0.00");
+  WeatherStatus.Commit();
+  SystemStatus.Commit();
+  MemoryStatus.Commit();
+}
+
+size_t templatePlatformValue(TemplateVar var, char *chOut, size_t maxLen){
+  const char *chValue = "N/A";
+  switch( var ){
+    case tvWifiIpAddr: chValue = "127.0.0.1"; break;
+    case tvWifiRssi: chValue = "0"; break;
+    case tvBatVolt: chValue = "0.00"; break;
+    default: break;
+  }
+  int iLen = snprintf(chOut, maxLen, "%s", chValue);
+  if( iLen < 0 )return 0;
+  return (size_t)iLen < maxLen ? (size_t)iLen : maxLen - 1;
+}
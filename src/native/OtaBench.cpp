@@ -0,0 +1,248 @@
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "App.h"
+#include "Firmware.h"
+#include "GaugeTable.h"
+#include "HalNative.h"
+#include "OtaBench.h"
+#include "Sha256.h"
+#include "StatusFeed.h"
+#include "WxSample.h"
+
+// ##################################################################
+// # Firmware update bench
+// #
+// # Uploads a synthetic app image (--size KB, with the header bytes
+// # and the appended SHA-256 of a real one) through the update path
+// # in TCP sized chunks (--chunk bytes), a rapid_wind arriving ahead
+// # of every --wind chunks.  The flash operations take as long as set
+// # (--erase-us per sector, --page-us per 256 byte page, the data
+// # sheet typicals by default), busy as the board's cache is off for
+// # them.  Reports the update throughput and the receive to needle
+// # latency while updating against without, then checks the slot
+// # holds the image and is set to boot.  The image corrupted, cut
+// # short, too big and not an image at all go through the same
+// # (with the flash timing off) and none may be set to boot.  Exits 1
+// # if any check fails.
+// ##################################################################
+
+#define OTA_EPOCH 1700000000L
+#define OTA_IDLE_WINDS 200
+
+static int iNeedleChannel = -1;
+static uint32_t u32WindSeq = 0;
+static uint32_t u32Behind = 0;
+
+// Random body under a real header's magic & hash_appended, the last
+// SHA256_LEN bytes the digest of all before
+static std::vector<uint8_t> otaImage(size_t len){
+  std::vector<uint8_t> vecImage(len);
+  uint32_t u32Rand = 0x2545F491;
+  for( uint8_t &u8 : vecImage ){
+    u32Rand = u32Rand * 1103515245 + 12345;
+    u8 = (uint8_t)(u32Rand >> 24);
+  }
+  vecImage[0] = FIRMWARE_MAGIC;
+  vecImage[FIRMWARE_HASH_APPENDED] = 1;
+  Sha256 sha;
+  uint8_t u8Digest[SHA256_LEN];
+  sha.Begin();
+  sha.Update(vecImage.data(), len - SHA256_LEN);
+  sha.Final(u8Digest);
+  memcpy(vecImage.data() + len - SHA256_LEN, u8Digest, SHA256_LEN);
+  return vecImage;
+}
+
+static bool shaKnownAnswer(void){
+  static const uint8_t u8Abc[SHA256_LEN] = { 0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40,
+    0xde, 0x5d, 0xae, 0x22, 0x23, 0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61,
+    0xf2, 0x00, 0x15, 0xad };
+  static const uint8_t u8Million[SHA256_LEN] = { 0xcd, 0xc7, 0x6e, 0x5c, 0x99, 0x14, 0xfb, 0x92, 0x81, 0xa1,
+    0xc7, 0xe2, 0x84, 0xd7, 0x3e, 0x67, 0xf1, 0x80, 0x9a, 0x48, 0xa4, 0x97, 0x20, 0x0e, 0x04, 0x6d, 0x39,
+    0xcc, 0xc7, 0x11, 0x2c, 0xd0 };
+  Sha256 sha;
+  uint8_t u8Digest[SHA256_LEN];
+  sha.Begin();
+  sha.Update((const uint8_t *)"abc", 3);
+  sha.Final(u8Digest);
+  if( memcmp(u8Digest, u8Abc, SHA256_LEN) != 0 )return false;
+  // A million 'a' in uneven pieces, across the block edges
+  std::vector<uint8_t> vecA(1000, 'a');
+  sha.Begin();
+  for( size_t done = 0, step = 1; done < 1000000; done += step, step = step % 997 + 1 ){
+    sha.Update(vecA.data(), std::min(step, (size_t)1000000 - done));
+  }
+  sha.Final(u8Digest);
+  return memcmp(u8Digest, u8Million, SHA256_LEN) == 0;
+}
+
+// A rapid_wind in, the gauges run, and the needle has to show it
+static uint32_t otaWind(std::vector<uint32_t> &vecLatency, const uint8_t *pChunk, size_t len){
+  char chPacket[256];
+  const float fSpeed = (u32WindSeq % 80) * 0.25f;
+  int iLen = snprintf(chPacket, sizeof(chPacket), "{\"serial_number\":\"ST-00000512\",\"type\":\"rapid_wind\","
+    "\"hub_sn\":\"HB-00013030\",\"ob\":[%ld,%.2f,%u]}", OTA_EPOCH + u32WindSeq / 4, fSpeed,
+    (unsigned)(u32WindSeq * 37 % 360));
+  u32WindSeq++;
+  WxSample expected;
+  wxDecodeJsonFull(chPacket, (size_t)iLen, expected);
+  const uint64_t u64Rx = Hal.Clock->Micros();
+  nativeInjectDatagram(chPacket, (size_t)iLen, u64Rx);
+  uint64_t u64WriteUs = 0;
+  if( pChunk ){
+    firmwareUploadWrite(pChunk, len);
+    u64WriteUs = Hal.Clock->Micros() - u64Rx;
+  }
+  while( nativePendingDatagrams() )loop();
+  const HalEvent *pLast = NULL;
+  for( const HalEvent &ev : HalEvents ){
+    if( ev.Type == evPwmWrite && ev.Channel == iNeedleChannel )pLast = &ev;
+  }
+  if( !pLast || pLast->Value != WindGauge.Scale(expected.WindSpeed) )u32Behind++;
+  else vecLatency.push_back((uint32_t)(pLast->Micros - u64Rx));
+  HalEvents.clear();
+  return (uint32_t)u64WriteUs;
+}
+
+// The whole upload, returns the seconds it took
+static double otaUpload(const uint8_t *pImage, size_t len, uint32_t u32Chunk, uint32_t u32WindEvery,
+    std::vector<uint32_t> &vecLatency, uint64_t &u64WriteUs){
+  const uint64_t u64Start = Hal.Clock->Micros();
+  uint64_t u64Last = u64Start;
+  u64WriteUs = 0;
+  for( size_t done = 0, c = 0; done < len; done += u32Chunk, c++ ){
+    const size_t take = std::min((size_t)u32Chunk, len - done);
+    if( u32WindEvery && c % u32WindEvery == 0 )u64WriteUs += otaWind(vecLatency, pImage + done, take);
+    else{
+      const uint64_t u64Before = Hal.Clock->Micros();
+      firmwareUploadWrite(pImage + done, take);
+      u64WriteUs += Hal.Clock->Micros() - u64Before;
+    }
+    // The virtual clock keeps up with the host
+    const uint64_t u64Now = Hal.Clock->Micros();
+    if( u64Now - u64Last >= 1000 ){
+      nativeAdvanceWallClock((uint32_t)((u64Now - u64Last) / 1000));
+      u64Last += (u64Now - u64Last) / 1000 * 1000;
+    }
+  }
+  firmwareUploadEnd();
+  return (Hal.Clock->Micros() - u64Start) / 1e6;
+}
+
+static uint32_t percentile(std::vector<uint32_t> &vecSamples, double dPct){
+  if( vecSamples.empty() )return 0;
+  size_t idx = (size_t)ceil(dPct * vecSamples.size());
+  return vecSamples[idx ? idx - 1 : 0];
+}
+
+// An upload that has to fail for the reason given, and not be set to boot
+static bool otaReject(const char *chName, const uint8_t *pImage, size_t len, uint32_t u32Chunk,
+    FirmwareError expected){
+  std::vector<uint32_t> vecLatency;
+  uint64_t u64WriteUs;
+  bool bBegun = firmwareUploadBegin();
+  if( bBegun )otaUpload(pImage, len, u32Chunk, 0, vecLatency, u64WriteUs);
+  size_t slotLen;
+  bool bActive;
+  nativeFirmwareSlot(slotLen, bActive);
+  char chStatus[STATUS_VALUE_LEN];
+  Firmware.Status(chStatus, sizeof(chStatus), Hal.Clock->Millis());
+  const bool bOk = bBegun && !bActive && Firmware.State() == fsFailed && Firmware.Error() == expected;
+  printf("%-14s %-36s %s\n", chName, chStatus, bOk ? "ok" : "FAILED");
+  return bOk;
+}
+
+int otaBenchMain(int argc, char **argv){
+  uint32_t u32SizeKB = 512, u32Chunk = 1436, u32WindEvery = 4, u32EraseUs = 45000, u32PageUs = 700;
+  for( int i = 1; i < argc; i++ ){
+    if( strcmp(argv[i], "--size") == 0 && i + 1 < argc )u32SizeKB = atoi(argv[++i]);
+    else if( strcmp(argv[i], "--chunk") == 0 && i + 1 < argc )u32Chunk = atoi(argv[++i]);
+    else if( strcmp(argv[i], "--wind") == 0 && i + 1 < argc )u32WindEvery = atoi(argv[++i]);
+    else if( strcmp(argv[i], "--erase-us") == 0 && i + 1 < argc )u32EraseUs = atoi(argv[++i]);
+    else if( strcmp(argv[i], "--page-us") == 0 && i + 1 < argc )u32PageUs = atoi(argv[++i]);
+    else if( strcmp(argv[i], "-v") == 0 )nativeSetConsole(true);
+    else u32SizeKB = 0;
+  }
+  const size_t imageLen = (size_t)u32SizeKB * 1024;
+  if( !u32SizeKB || imageLen > NATIVE_FIRMWARE_SLOT || !u32Chunk || !u32WindEvery ){
+    fprintf(stderr, "usage: program ota [--size <KB>] [--chunk <bytes>] [--wind <chunks>] [--erase-us <us>]"
+      " [--page-us <us>] [-v]\n");
+    return 2;
+  }
+
+  nativeSetWallClock(OTA_EPOCH);
+  setup();
+  for( const GaugeRoute &route : Settings.Config.Routes.Route ){
+    if( iNeedleChannel < 0 && route.Field == rfWindSpeed && route.Output == roPwm )iNeedleChannel = route.Channel;
+  }
+  HalEvents.clear();
+
+  const bool bShaOk = shaKnownAnswer();
+  printf("SHA-256 known answers: %s\n", bShaOk ? "ok" : "FAILED");
+
+  // The gauges on their own, then with the update running
+  std::vector<uint32_t> vecIdle, vecUpdating;
+  for( int w = 0; w < OTA_IDLE_WINDS; w++ )otaWind(vecIdle, NULL, 0);
+  const std::vector<uint8_t> vecImage = otaImage(imageLen);
+  nativeSetFlashTiming(u32EraseUs, u32PageUs);
+  uint64_t u64WriteUs;
+  const bool bBegun = firmwareUploadBegin();
+  const bool bBusy = bBegun && !firmwareUploadBegin();
+  const double dSeconds = otaUpload(vecImage.data(), imageLen, u32Chunk, u32WindEvery, vecUpdating, u64WriteUs);
+  nativeSetFlashTiming(0, 0);
+  size_t slotLen;
+  bool bActive;
+  const uint8_t *pSlot = nativeFirmwareSlot(slotLen, bActive);
+  const bool bVerified = bBegun && Firmware.State() == fsDone && bActive &&
+    memcmp(pSlot, vecImage.data(), imageLen) == 0;
+
+  // Time the flash itself took, the rest is the update path's own
+  const uint64_t u64Sectors = (imageLen + FIRMWARE_SECTOR - 1) / FIRMWARE_SECTOR;
+  uint64_t u64Pages = 0;
+  for( size_t done = 0; done < imageLen; done += u32Chunk )u64Pages += (std::min((size_t)u32Chunk, imageLen - done) + 255) / 256;
+  const uint64_t u64FlashUs = u64Sectors * u32EraseUs + u64Pages * u32PageUs;
+  const double dPathNs = u64WriteUs > u64FlashUs ? (u64WriteUs - u64FlashUs) * 1000.0 / imageLen : 0;
+
+  char chStatus[STATUS_VALUE_LEN], chLatency[STATUS_VALUE_LEN];
+  Firmware.Status(chStatus, sizeof(chStatus), Hal.Clock->Millis());
+  Firmware.LatencyStatus(chLatency, sizeof(chLatency));
+  printf("\n%u KB image in %u byte chunks, flash erase %u us per sector, write %u us per page\n",
+    (unsigned)u32SizeKB, (unsigned)u32Chunk, (unsigned)u32EraseUs, (unsigned)u32PageUs);
+  printf("uploaded in %.2f s, %.1f KB/s, update path %.2f ns per byte besides the flash\n", dSeconds,
+    u32SizeKB / dSeconds, dPathNs);
+  printf("status: %s, gauge latency %s\n", chStatus, chLatency);
+  printf("%-14s %-36s %s\n", "image", bVerified ? "written, verified, set to boot" : "not set to boot",
+    bVerified ? "ok" : "FAILED");
+  printf("%-14s %-36s %s\n", "second upload", bBusy ? "refused while one runs" : "taken while one runs",
+    bBusy ? "ok" : "FAILED");
+
+  std::sort(vecIdle.begin(), vecIdle.end());
+  std::sort(vecUpdating.begin(), vecUpdating.end());
+  printf("\nrapid_wind to needle     %10s %10s %10s %8s\n", "p50 us", "p99 us", "max us", "samples");
+  printf("  without update         %10u %10u %10u %8u\n", percentile(vecIdle, 0.50), percentile(vecIdle, 0.99),
+    vecIdle.empty() ? 0 : vecIdle.back(), (unsigned)vecIdle.size());
+  printf("  updating               %10u %10u %10u %8u\n", percentile(vecUpdating, 0.50),
+    percentile(vecUpdating, 0.99), vecUpdating.empty() ? 0 : vecUpdating.back(), (unsigned)vecUpdating.size());
+  const uint32_t u32IdleMax = vecIdle.empty() ? 0 : vecIdle.back();
+  const uint32_t u32UpdatingMax = vecUpdating.empty() ? 0 : vecUpdating.back();
+  printf("  added by the update    %32u us max, %u behind\n\n",
+    u32UpdatingMax > u32IdleMax ? u32UpdatingMax - u32IdleMax : 0, (unsigned)u32Behind);
+
+  // What may not boot
+  std::vector<uint8_t> vecBad(vecImage);
+  vecBad[imageLen / 2] ^= 0x10;
+  bool bRejects = otaReject("corrupted", vecBad.data(), imageLen, u32Chunk, feDigest);
+  bRejects &= otaReject("cut short", vecImage.data(), imageLen / 2, u32Chunk, feDigest);
+  const std::vector<uint8_t> vecBig = otaImage(NATIVE_FIRMWARE_SLOT + FIRMWARE_SECTOR);
+  bRejects &= otaReject("too big", vecBig.data(), vecBig.size(), u32Chunk, feTooBig);
+  static const char chText[] = "This is not a firmware image, only some text uploaded by mistake.";
+  bRejects &= otaReject("not an image", (const uint8_t *)chText, sizeof(chText), u32Chunk, feNotImage);
+
+  const bool bFailed = !bShaOk || !bVerified || !bBusy || !bRejects || u32Behind;
+  printf("%s\n", bFailed ? "FAILED" : "update path ok");
+  return bFailed ? 1 : 0;
+}
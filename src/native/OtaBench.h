@@ -0,0 +1,7 @@
+#ifndef __OtaBench__
+#define __OtaBench__
+
+// Firmware update path and the gauges while it runs, "program ota ..."
+int otaBenchMain(int argc, char **argv);
+
+#endif
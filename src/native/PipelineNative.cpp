@@ -0,0 +1,79 @@
+#include "Hal.h"
+#include "App.h"
+#include "Firmware.h"
+#include "Ingest.h"
+#include "Metrics.h"
+#include "Scheduler.h"
+#include "Supervisor.h"
+
+// ##################################################################
+// # Native gauge pipeline
+// #
+// # Runs the same stages as the FreeRTOS pipeline, inline and single
+// # threaded from loop(): every queued datagram goes through the
+// # ingest to its mailbox, what is left there (the newest of each
+// # message type) goes to the gauge output stage, needle moves are
+// # stepped, then the scheduler runs if a job is due on the virtual
+// # clock (or a reschedule is pending).  The debug log is drained
+// # last, once the outputs are written.  Only the samples count as
+// # loop work for the metrics, the host polls loop() far more often
+// # than the board would wake.
+// ##################################################################
+
+static uint32_t u32JobsDueMs;
+static bool bJobsIdle = true;
+
+void pipelineBegin(const ScheduledJob *jobs, size_t numJobs){
+  Scheduler.Begin(jobs, numJobs, Hal.Clock->Millis());
+  jobsReschedule();
+}
+
+void jobsReschedule(void){
+  Scheduler.Reschedule();
+}
+
+void pipelineLoop(void){
+  WxSample sample;
+
+  if( Supervisor.ListenerRestart() )Hal.Wx->Begin();
+  while( Hal.Wx->Receive(sample, 0) )Ingest.Post(sample);
+  while( Ingest.Take(sample) ){
+    StageTimer timer(msLoop);
+    gaugeOutput(sample);
+  }
+  gaugeService();
+
+  uint32_t u32Now = Hal.Clock->Millis();
+  if( Scheduler.Pending() || (!bJobsIdle && (int32_t)(u32Now - u32JobsDueMs) >= 0) ){
+    uint32_t u32WaitMs = Scheduler.Run(u32Now);
+    bJobsIdle = u32WaitMs == SCHED_IDLE;
+    u32JobsDueMs = Hal.Clock->Millis() + u32WaitMs;
+  }
+  logFlush();
+}
+
+void logBegin(void){
+}
+
+// The upload is written inline as the harness hands it over, a sample
+// waits behind the chunk being written as the board's gauge task waits
+// out a flash operation
+bool firmwareUploadBegin(void){
+  return Firmware.Begin(Hal.Clock->Millis());
+}
+
+bool firmwareUploadWrite(const uint8_t *pData, size_t len){
+  return Firmware.Write(pData, len);
+}
+
+size_t firmwareUploadRoom(void){
+  return SIZE_MAX;
+}
+
+void firmwareUploadEnd(void){
+  Firmware.End(Hal.Clock->Millis());
+}
+
+bool firmwareUploadDone(void){
+  return true;
+}
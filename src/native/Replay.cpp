@@ -0,0 +1,452 @@
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "App.h"
+#include "GaugeRoutes.h"
+#include "History.h"
+#include "Metrics.h"
+#include "HalNative.h"
+#include "Replay.h"
+#include "Supervisor.h"
+#include "WindStats.h"
+
+// ##################################################################
+// # Recorded packet replay
+// #
+// # Feeds captured Tempest UDP broadcasts through the firmware
+// # receive path, in real time (1x) or time compressed (up to 1000x),
+// # and reports the latency from datagram arrival to the writes of
+// # each routed output, PWM channel or MCP23008 bank.
+// #
+// # Capture format, one datagram per line:
+// #   <seconds since capture start> <json>
+// # as written by scripts/wf_capture.py.
+// #
+// # Outages can be laid over the capture, the access point gone (the
+// # station drops off and has to rejoin) or the station silent, to see
+// # how long after each the gauges are live again.
+// ##################################################################
+
+struct ReplayPacket{
+    double Offset;
+    std::string Data;
+};
+
+// Latency samples for one output, in microseconds
+struct LatencyStats{
+    const char *Name;
+    std::vector<uint32_t> Samples;
+
+    void Report(FILE *fOut){
+      if( Samples.empty() ){
+        fprintf(fOut, "%-32s %8u %10s %10s %10s\n", Name, 0u, "-", "-", "-");
+        return;
+      }
+      std::sort(Samples.begin(), Samples.end());
+      fprintf(fOut, "%-32s %8u %10u %10u %10u\n", Name, (unsigned)Samples.size(),
+        percentile(0.50), percentile(0.99), Samples.back());
+    }
+
+    uint32_t percentile(double dPct){
+      size_t idx = (size_t)ceil(dPct * Samples.size());
+      return Samples[idx ? idx - 1 : 0];
+    }
+};
+
+// Simulated outage, capture seconds, with what the firmware did
+struct ReplayOutage{
+    bool Link;                  // Access point gone, else station silent
+    double Start;
+    double Length;
+    bool Parked = false;
+    double WifiBack = -1;       // Seconds after the end, -1 until then
+    double DataBack = -1;
+
+    bool Active(double dNow) const { return dNow >= Start && dNow < Start + Length; }
+    void Report(FILE *fOut) const {
+      char chWifi[16] = "-", chData[16] = "-";
+      if( Link && WifiBack >= 0 )snprintf(chWifi, sizeof(chWifi), "+%.1f", WifiBack);
+      if( DataBack >= 0 )snprintf(chData, sizeof(chData), "+%.1f", DataBack);
+      fprintf(fOut, "%-16s %10.1f %10.1f %8s %12s %12s\n", Link ? "wifi drop" : "station silent", Start, Length,
+        Parked ? "yes" : "no", chWifi, chData);
+    }
+};
+
+static const char *chMsgTypes[] = { "rapid_wind", "obs_st", "hub_status", "device_status",
+  "evt_strike", "evt_precip" };
+#define NUM_MSG_TYPES (sizeof(chMsgTypes) / sizeof(chMsgTypes[0]))
+
+static int messageType(const std::string &strData){
+  for( size_t i = 0; i < NUM_MSG_TYPES; i++ ){
+    std::string strKey = std::string("\"type\":\"") + chMsgTypes[i] + "\"";
+    if( strData.find(strKey) != std::string::npos )return (int)i;
+  }
+  return -1;
+}
+
+// First epoch in the message (rapid_wind "ob", obs_st "obs", or "timestamp")
+static long messageEpoch(const std::string &strData){
+  static const char *chKeys[] = { "\"ob\":[", "\"obs\":[[", "\"timestamp\":" };
+  for( const char *chKey : chKeys ){
+    size_t pos = strData.find(chKey);
+    if( pos != std::string::npos )return strtol(strData.c_str() + pos + strlen(chKey), NULL, 10);
+  }
+  return 0;
+}
+
+static bool loadCapture(const char *chPath, std::vector<ReplayPacket> &packets){
+  FILE *fIn = fopen(chPath, "r");
+  char chLine[2048];
+  if( !fIn )return false;
+  while( fgets(chLine, sizeof(chLine), fIn) ){
+    char *chJson;
+    double dOffset = strtod(chLine, &chJson);
+    while( *chJson == ' ' || *chJson == '\t' )chJson++;
+    if( *chJson != '{' )continue;
+    packets.push_back({dOffset, std::string(chJson, strcspn(chJson, "\r\n"))});
+  }
+  fclose(fIn);
+  return true;
+}
+
+// Synthetic station: rapid_wind every 3 s, obs_st and device_status every
+// minute, hub_status every 10 s and an occasional lightning strike.
+static void synthesizeCapture(double dHours, std::vector<ReplayPacket> &packets){
+  const long lStart = 1700000000;
+  uint32_t u32Rand = 12345;
+  double dWind = 3.0;
+  int iDir = 180;
+  char chMsg[512];
+
+  auto rnd = [&u32Rand](int iRange){ u32Rand = u32Rand * 1103515245 + 12345; return (int)((u32Rand >> 16) % iRange); };
+
+  for( long t = 0; t < (long)(dHours * 3600); t++ ){
+    if( t % 3 == 0 ){
+      dWind = std::max(0.0, dWind + (rnd(21) - 10) / 20.0);
+      iDir = (iDir + rnd(31) - 15 + 360) % 360;
+      snprintf(chMsg, sizeof(chMsg), "{\"serial_number\":\"ST-00000512\",\"type\":\"rapid_wind\","
+        "\"hub_sn\":\"HB-00013030\",\"ob\":[%ld,%.2f,%d]}", lStart + t, dWind, iDir);
+      packets.push_back({(double)t, chMsg});
+    }
+    if( t % 10 == 0 ){
+      snprintf(chMsg, sizeof(chMsg), "{\"serial_number\":\"HB-00013030\",\"type\":\"hub_status\","
+        "\"firmware_revision\":\"171\",\"uptime\":%ld,\"rssi\":-62,\"timestamp\":%ld,"
+        "\"reset_flags\":\"BOR,PIN,POR\",\"seq\":%ld,\"radio_stats\":[25,1,0,3,16841],"
+        "\"mqtt_stats\":[1,0]}", 1000 + t, lStart + t, t / 10);
+      packets.push_back({t + 0.2, chMsg});
+    }
+    if( t % 60 == 30 ){
+      snprintf(chMsg, sizeof(chMsg), "{\"serial_number\":\"ST-00000512\",\"type\":\"obs_st\","
+        "\"hub_sn\":\"HB-00013030\",\"obs\":[[%ld,%.2f,%.2f,%.2f,%d,3,1017.57,%.2f,50.26,328,0.03,3,"
+        "0.000000,0,0,0,2.410,1]],\"firmware_revision\":129}", lStart + t, dWind * 0.7, dWind,
+        dWind * 1.4, iDir, 15.0 + 5.0 * sin(t / 7200.0));
+      packets.push_back({t + 0.4, chMsg});
+      snprintf(chMsg, sizeof(chMsg), "{\"serial_number\":\"ST-00000512\",\"type\":\"device_status\","
+        "\"hub_sn\":\"HB-00013030\",\"timestamp\":%ld,\"uptime\":%ld,\"voltage\":2.41,"
+        "\"firmware_revision\":129,\"rssi\":-48,\"hub_rssi\":-45,\"sensor_status\":0,\"debug\":0}",
+        lStart + t, 2000 + t);
+      packets.push_back({t + 0.5, chMsg});
+    }
+    if( rnd(900) == 0 ){
+      snprintf(chMsg, sizeof(chMsg), "{\"serial_number\":\"ST-00000512\",\"type\":\"evt_strike\","
+        "\"hub_sn\":\"HB-00013030\",\"evt\":[%ld,%d,3848]}", lStart + t, 5 + rnd(30));
+      packets.push_back({t + 0.7, chMsg});
+    }
+  }
+}
+
+static void usage(void){
+  fprintf(stderr, "usage: program replay (<capture file> | --synthesize <hours>) [--speed <1..1000>]\n"
+    "       [--baud <serial baud to emulate>] [--slew <pwm/s> [--linear] [--hwfade]]\n"
+    "       [--history <series> <file>] [--route \"<gauge route>\" ...] [--metrics <file>]\n"
+    "       [--drop <start s> <length s> ...] [--silence <start s> <length s> ...] [-v]\n");
+}
+
+// Stream a history series to a file, as the /history endpoint would
+static bool writeHistory(const char *chSeries, const char *chFile){
+  int iSeries = -1;
+  for( int i = 0; i < NUM_HISTORY_SERIES; i++ ){
+    if( strcmp(chSeries, HistorySeriesNames[i]) == 0 )iSeries = i;
+  }
+  FILE *fOut = iSeries < 0 ? NULL : fopen(chFile, "wb");
+  if( !fOut ){
+    fprintf(stderr, "Unable to write history %s to %s\n", chSeries, chFile);
+    return false;
+  }
+  HistoryCursor cursor(History, (HistorySeries)iSeries, 0);
+  uint8_t u8Chunk[1436];     // One TCP segment
+  size_t len, total = 0;
+  while( (len = cursor.Fill(u8Chunk, sizeof(u8Chunk))) > 0 ){
+    fwrite(u8Chunk, 1, len, fOut);
+    total += len;
+  }
+  fclose(fOut);
+  printf("history %s: %u bytes to %s\n", chSeries, (unsigned)total, chFile);
+  return true;
+}
+
+// The /metrics page, as a scrape would get it
+static bool writeMetrics(const char *chFile){
+  FILE *fOut = fopen(chFile, "w");
+  if( !fOut ){
+    fprintf(stderr, "Unable to write metrics to %s\n", chFile);
+    return false;
+  }
+  MetricsCursor cursor;
+  uint8_t u8Chunk[1436];
+  size_t len;
+  while( (len = cursor.Fill(u8Chunk, sizeof(u8Chunk))) > 0 )fwrite(u8Chunk, 1, len, fOut);
+  fclose(fOut);
+  return true;
+}
+
+int replayMain(int argc, char **argv){
+  std::vector<ReplayPacket> packets;
+  const char *chCapture = NULL;
+  double dSynthHours = 0;
+  double dSpeed = 1;
+  unsigned uTypeCounts[NUM_MSG_TYPES + 1] = {0};
+  std::vector<const char *> extraRoutes;
+  int iSlew = 0;
+  const char *chHistorySeries = NULL;
+  const char *chHistoryFile = NULL;
+  const char *chMetricsFile = NULL;
+  bool bLinear = false;
+  uint32_t u32NeedleWrites = 0, u32NeedleFades = 0, u32WindSamples = 0, u32Lost = 0;
+  std::vector<ReplayOutage> outages;
+
+  for( int i = 1; i < argc; i++ ){
+    if( strcmp(argv[i], "--speed") == 0 && i + 1 < argc )dSpeed = atof(argv[++i]);
+    else if( strcmp(argv[i], "--synthesize") == 0 && i + 1 < argc )dSynthHours = atof(argv[++i]);
+    else if( strcmp(argv[i], "--baud") == 0 && i + 1 < argc )nativeSetConsoleBaud(atoi(argv[++i]));
+    else if( strcmp(argv[i], "--slew") == 0 && i + 1 < argc )iSlew = atoi(argv[++i]);
+    else if( strcmp(argv[i], "--linear") == 0 )bLinear = true;
+    else if( strcmp(argv[i], "--history") == 0 && i + 2 < argc ){
+      chHistorySeries = argv[++i];
+      chHistoryFile = argv[++i];
+    }
+    else if( strcmp(argv[i], "--hwfade") == 0 )nativeSetPwmFade(true);
+    else if( strcmp(argv[i], "--metrics") == 0 && i + 1 < argc )chMetricsFile = argv[++i];
+    else if( strcmp(argv[i], "--route") == 0 && i + 1 < argc )extraRoutes.push_back(argv[++i]);
+    else if( (strcmp(argv[i], "--drop") == 0 || strcmp(argv[i], "--silence") == 0) && i + 2 < argc ){
+      ReplayOutage outage;
+      outage.Link = strcmp(argv[i], "--drop") == 0;
+      outage.Start = atof(argv[++i]);
+      outage.Length = atof(argv[++i]);
+      outages.push_back(outage);
+    }
+    else if( strcmp(argv[i], "-v") == 0 )nativeSetConsole(true);
+    else chCapture = argv[i];
+  }
+  if( dSpeed < 1 || dSpeed > 1000 || (!chCapture && dSynthHours <= 0) ){
+    usage();
+    return 2;
+  }
+  if( chCapture && !loadCapture(chCapture, packets) ){
+    fprintf(stderr, "Unable to read capture: %s\n", chCapture);
+    return 1;
+  }
+  if( dSynthHours > 0 )synthesizeCapture(dSynthHours, packets);
+  if( packets.empty() ){
+    fprintf(stderr, "Capture is empty\n");
+    return 1;
+  }
+  std::stable_sort(packets.begin(), packets.end(),
+    [](const ReplayPacket &a, const ReplayPacket &b){ return a.Offset < b.Offset; });
+
+  // Wall clock follows the capture, so time sync and lamps behave as recorded
+  long lEpoch = 0;
+  for( const ReplayPacket &pkt : packets ){
+    if( (lEpoch = messageEpoch(pkt.Data)) != 0 ){ lEpoch -= (long)pkt.Offset; break; }
+  }
+  if( !lEpoch )lEpoch = (long)time(NULL);
+  const double dFirst = packets.front().Offset;
+  nativeSetWallClock(lEpoch + (time_t)dFirst);
+  setup();
+  Settings.Config.Wind.slew = iSlew;
+  Settings.Config.Wind.damped = !bLinear;
+
+  // Extra outputs take the free routes, then the gauges start over
+  GaugeRouteSettings &routes = Settings.Config.Routes;
+  size_t iFree = 0;
+  for( const char *chRoute : extraRoutes ){
+    while( iFree < GAUGE_ROUTES && routes.Route[iFree].Field != rfNone )iFree++;
+    if( iFree == GAUGE_ROUTES || !routeParse(chRoute, routes.Route[iFree]) || !routesValid(routes) ){
+      fprintf(stderr, "Bad or too many routes: %s\n", chRoute);
+      return 2;
+    }
+  }
+  if( !extraRoutes.empty() )GaugeRoutes.Begin(routes);
+  HalEvents.clear();
+
+  // Latency per routed output, the wind speed needle is the first PWM
+  // route fed from rapid_wind
+  char chRouteNames[GAUGE_ROUTES][ROUTE_TEXT_LEN];
+  std::vector<LatencyStats> latRoutes(GAUGE_ROUTES);
+  int iNeedleChannel = -1;
+  for( size_t i = 0; i < GAUGE_ROUTES; i++ ){
+    routeFormat(routes.Route[i], chRouteNames[i], sizeof(chRouteNames[i]));
+    latRoutes[i].Name = chRouteNames[i];
+    if( iNeedleChannel < 0 && routes.Route[i].Field == rfWindSpeed && routes.Route[i].Output == roPwm ){
+      iNeedleChannel = routes.Route[i].Channel;
+    }
+  }
+
+  // Wind needle channel operations, slew steps land between datagrams
+  auto countNeedle = [&](void){
+    for( const HalEvent &ev : HalEvents ){
+      if( ev.Channel != iNeedleChannel )continue;
+      if( ev.Type == evPwmWrite )u32NeedleWrites++;
+      else if( ev.Type == evPwmFade )u32NeedleFades++;
+    }
+  };
+
+  // The access point follows the drops, what the firmware made of each
+  // outage is seen from the capture clock
+  bool bLinkUp = true;
+  auto followOutages = [&](double dNow){
+    bool bLink = true;
+    for( ReplayOutage &outage : outages ){
+      if( outage.Link && outage.Active(dNow) )bLink = false;
+      if( dNow < outage.Start || outage.DataBack >= 0 )continue;
+      if( Supervisor.Stale() )outage.Parked = true;
+      if( outage.Link && outage.WifiBack < 0 && !outage.Active(dNow) && wifiConnected() ){
+        outage.WifiBack = dNow - outage.Start - outage.Length;
+      }
+    }
+    if( bLink != bLinkUp )nativeSetLink(bLinkUp = bLink);
+  };
+  auto delivered = [&](double dNow){
+    for( ReplayOutage &outage : outages ){
+      if( dNow >= outage.Start + outage.Length && outage.DataBack < 0 )outage.DataBack = dNow - outage.Start - outage.Length;
+    }
+  };
+
+  const uint32_t u32LedWritesStart = u32ExpanderWrites;
+  const uint32_t u32LedSkipsStart = u32ExpanderWritesSkipped;
+  const uint64_t u64Start = Hal.Clock->Micros();
+  uint64_t u64VirtualMs = 0;
+  for( const ReplayPacket &pkt : packets ){
+    const uint64_t u64Due = u64Start + (uint64_t)((pkt.Offset - dFirst) * 1e6 / dSpeed);
+
+    // Keep the firmware loop spinning until the datagram is due, with the
+    // virtual clock running at the replay speed
+    uint64_t u64Now;
+    while( (u64Now = Hal.Clock->Micros()) < u64Due ){
+      uint64_t u64TargetMs = (uint64_t)((u64Now - u64Start) * dSpeed / 1000);
+      if( u64TargetMs > u64VirtualMs ){
+        nativeAdvanceWallClock((uint32_t)(u64TargetMs - u64VirtualMs));
+        u64VirtualMs = u64TargetMs;
+      }
+      if( !outages.empty() )followOutages(dFirst + u64VirtualMs / 1000.0);
+      loop();
+      countNeedle();
+      HalEvents.clear();
+    }
+
+    int iType = messageType(pkt.Data);
+    uTypeCounts[iType < 0 ? NUM_MSG_TYPES : iType]++;
+
+    // Nothing gets through to a station off the network, or from a silent one
+    if( !outages.empty() ){
+      followOutages(pkt.Offset);
+      bool bSilent = !wifiConnected();
+      for( const ReplayOutage &outage : outages )bSilent |= outage.Active(pkt.Offset);
+      if( bSilent ){
+        u32Lost++;
+        continue;
+      }
+      // The gauges only hear of rapid_wind and obs_st
+      if( iType == 0 || iType == 1 )delivered(pkt.Offset);
+    }
+
+    const uint64_t u64Rx = Hal.Clock->Micros();
+    nativeInjectDatagram(pkt.Data.c_str(), pkt.Data.size(), u64Rx);
+    while( nativePendingDatagrams() )loop();
+    countNeedle();
+    if( iType == 0 )u32WindSamples++;
+
+    // Match the outputs this datagram produced, first write per route
+    bool bMatched[GAUGE_ROUTES] = {false};
+    for( const HalEvent &ev : HalEvents ){
+      bool bPwm = ev.Type == evPwmWrite || ev.Type == evPwmFade;
+      if( !bPwm && ev.Type != evExpanderWrite )continue;
+      for( size_t i = 0; i < GAUGE_ROUTES; i++ ){
+        const GaugeRoute &route = routes.Route[i];
+        if( bMatched[i] || route.Field == rfNone || route.Channel != ev.Channel )continue;
+        if( bPwm != (route.Output == roPwm) )continue;
+        bMatched[i] = true;
+        latRoutes[i].Samples.push_back((uint32_t)(ev.Micros - u64Rx));
+      }
+    }
+    HalEvents.clear();
+  }
+  const double dElapsed = (Hal.Clock->Micros() - u64Start) / 1e6;
+
+  printf("Replayed %u datagrams (%.1f h of data) in %.2f s at %gx\n", (unsigned)packets.size(),
+    (packets.back().Offset - dFirst) / 3600.0, dElapsed, dSpeed);
+  for( size_t i = 0; i < NUM_MSG_TYPES; i++ )printf("  %-14s %8u\n", chMsgTypes[i], uTypeCounts[i]);
+  printf("  %-14s %8u\n", "other", uTypeCounts[NUM_MSG_TYPES]);
+  printf("\noutputs dispatched: rapid_wind %u, obs_st %u\n", (unsigned)GaugeRoutes.Outputs(WX_VALID_RAPID_WIND),
+    (unsigned)GaugeRoutes.Outputs(WX_VALID_OBS_ST));
+  printf("%-32s %8s %10s %10s %10s\n", "output", "count", "p50 us", "p99 us", "max us");
+  for( size_t i = 0; i < GAUGE_ROUTES; i++ ){
+    if( routes.Route[i].Field != rfNone )latRoutes[i].Report(stdout);
+  }
+
+  // Outages, and how soon after each the Wi-Fi and the data were back
+  if( !outages.empty() ){
+    printf("\n%-16s %10s %10s %8s %12s %12s\n", "outage", "start s", "length s", "parked", "wifi back s",
+      "data back s");
+    for( const ReplayOutage &outage : outages )outage.Report(stdout);
+    char chRecovery[32];
+    Supervisor.Recovery(chRecovery, sizeof(chRecovery));
+    printf("%u datagrams lost, wifi outages %u, rejoins %u, data outages %u, listener restarts %u, recovery %s\n",
+      (unsigned)u32Lost, (unsigned)Metrics.Counter(mcWifiOutages), (unsigned)Metrics.Counter(mcWifiReconnects),
+      (unsigned)Metrics.Counter(mcDataOutages), (unsigned)Metrics.Counter(mcListenerRestarts), chRecovery);
+  }
+
+  // Expander I2C transactions, the shadow registers skip unchanged patterns
+  const double dHours = std::max((packets.back().Offset - dFirst) / 3600.0, 1.0 / 3600);
+  const uint32_t u32Writes = u32ExpanderWrites - u32LedWritesStart;
+  const uint32_t u32Skips = u32ExpanderWritesSkipped - u32LedSkipsStart;
+  printf("\nexpander i2c writes: %u issued, %u skipped, %.0f/h saved (%.1f%%)\n", u32Writes, u32Skips,
+    u32Skips / dHours, u32Writes + u32Skips ? 100.0 * u32Skips / (u32Writes + u32Skips) : 0.0);
+
+  // CPU touches of the wind needle channel per rapid_wind sample
+  printf("wind needle updates: %u writes, %u fades, %.1f per sample\n", u32NeedleWrites, u32NeedleFades,
+    u32WindSamples ? (double)(u32NeedleWrites + u32NeedleFades) / u32WindSamples : 0.0);
+
+  // Stage timings as the firmware keeps them (host nanoseconds), and what
+  // the timing itself cost
+  printf("\n%-12s %8s %20s\n", "stage", "count", "p50 / p99");
+  for( int i = 0; i < NUM_METRIC_STAGES; i++ ){
+    char chSummary[32];
+    Metrics.Summary((MetricStage)i, chSummary, sizeof(chSummary));
+    printf("%-12s %8u %20s\n", MetricStageNames[i], (unsigned)Metrics.Stage((MetricStage)i).Count(), chSummary);
+  }
+  printf("metrics overhead: %.3f%% of the run time\n", Metrics.Overhead() * 100);
+  if( chMetricsFile && !writeMetrics(chMetricsFile) )return 1;
+
+  // Rolling wind statistics at the end of the run
+  printf("\n%-6s %8s %8s %8s %8s %12s\n", "wind", "samples", "avg", "gust", "lull", "direction");
+  for( int w = 0; w < NUM_WIND_WINDOWS; w++ ){
+    WindSummary stats = WindStats.Summary((WindWindow)w);
+    printf("%-6s %8u %8.1f %8.1f %8.1f %5.0f +/-%3.0f\n", w == ww2Min ? "2 min" : "10 min", (unsigned)stats.Samples,
+      stats.Average, stats.Gust, stats.Lull, stats.Direction, stats.Variability);
+  }
+
+  // History ring occupancy, and optionally the binary download of one series
+  printf("\nhistory records:");
+  for( int i = 0; i < NUM_HISTORY_SERIES; i++ ){
+    const HistoryRing &ring = History.Ring((HistorySeries)i);
+    printf(" %s %u", HistorySeriesNames[i], (unsigned)(ring.Total - ring.Oldest()));
+  }
+  printf("\n");
+  if( chHistorySeries && !writeHistory(chHistorySeries, chHistoryFile) )return 1;
+  return 0;
+}
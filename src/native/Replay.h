@@ -0,0 +1,7 @@
+#ifndef __Replay__
+#define __Replay__
+
+// Recorded packet replay & latency report, "program replay ..."
+int replayMain(int argc, char **argv);
+
+#endif
@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "App.h"
+#include "HalNative.h"
+#include "Scheduler.h"
+#include "SchedCheck.h"
+
+// ##################################################################
+// # Housekeeping scheduler checks
+// #
+// # Runs the firmware on the virtual clock in the default time zone
+// # (US Eastern) and checks the gauge lamps switch at the set local
+// # times over the 2023 spring forward and fall back weekends,
+// # including lamp times the change skips or repeats, and after the
+// # clock is set by hand or from the station.  Then counts how often
+// # the housekeeping task wakes on an idle station.  Exits 1 if any
+// # check fails.
+// ##################################################################
+
+#define CHECK_STEP_MS 250
+
+struct LampSwitch{
+    time_t Time;
+    bool On;
+};
+
+// A transition expected at Time (or Alt, when the local time is repeated),
+// no later than Slack seconds after
+struct LampExpect{
+    time_t Time;
+    time_t Alt;
+    bool On;
+    int Slack;
+};
+
+static std::vector<LampSwitch> vecSwitches;
+static int iFailures = 0;
+
+static void collectLamps(void){
+  for( const HalEvent &ev : HalEvents ){
+    if( ev.Type != evPwmWrite || ev.Channel != LED1CHANNEL )continue;
+    vecSwitches.push_back({ Hal.Clock->Now(), ev.Value != 0 });
+  }
+  HalEvents.clear();
+}
+
+static void runUntil(time_t tEnd){
+  while( Hal.Clock->Now() < tEnd ){
+    loop();
+    collectLamps();
+    nativeAdvanceWallClock(CHECK_STEP_MS);
+  }
+  loop();
+  collectLamps();
+}
+
+static void setLamps(int iOnHour, int iOnMinute, int iOffHour, int iOffMinute){
+  Settings.Config.GaugeLamps.OnHour = iOnHour;
+  Settings.Config.GaugeLamps.OnMinute = iOnMinute;
+  Settings.Config.GaugeLamps.OffHour = iOffHour;
+  Settings.Config.GaugeLamps.OffMinute = iOffMinute;
+  jobsReschedule();
+}
+
+// Move the wall clock by hand, as a station sync would, and let the lamps settle
+static void jumpTo(time_t tNow){
+  nativeSetWallClock(tNow);
+  jobsReschedule();
+  runUntil(tNow + 2);
+}
+
+static void printLocal(FILE *fOut, time_t tTime){
+  char chTime[32];
+  tm tmTime;
+  strftime(chTime, sizeof(chTime), "%Y-%m-%d %H:%M:%S %Z", localtime_r(&tTime, &tmTime));
+  fputs(chTime, fOut);
+}
+
+static void expectSwitches(const char *chName, const LampExpect *expect, size_t numExpect){
+  bool bPass = vecSwitches.size() == numExpect;
+  for( size_t i = 0; bPass && i < numExpect; i++ ){
+    const LampSwitch &sw = vecSwitches[i];
+    bool bTime = (sw.Time >= expect[i].Time && sw.Time <= expect[i].Time + expect[i].Slack)
+      || (expect[i].Alt && sw.Time >= expect[i].Alt && sw.Time <= expect[i].Alt + expect[i].Slack);
+    bPass = bTime && sw.On == expect[i].On;
+  }
+  printf("%-28s %s\n", chName, bPass ? "ok" : "FAIL");
+  if( !bPass ){
+    iFailures++;
+    for( const LampSwitch &sw : vecSwitches ){
+      printf("    lamps %-3s at ", sw.On ? "on" : "off");
+      printLocal(stdout, sw.Time);
+      printf("\n");
+    }
+    for( size_t i = 0; i < numExpect; i++ ){
+      printf("    expected %-3s at ", expect[i].On ? "on" : "off");
+      printLocal(stdout, expect[i].Time);
+      printf("\n");
+    }
+  }
+  vecSwitches.clear();
+}
+
+// Start a scenario at tStart with the lamps already in their state there
+static void beginScenario(time_t tStart, int iOnHour, int iOnMinute, int iOffHour, int iOffMinute){
+  nativeSetWallClock(tStart);
+  setLamps(iOnHour, iOnMinute, iOffHour, iOffMinute);
+  runUntil(tStart + 2);
+  vecSwitches.clear();
+}
+
+static void checkSpringForward(void){
+  static const LampExpect expect[] = {
+    { 1678492800, 0, true, 1 },     // 03-10 19:00 EST
+    { 1678536000, 0, false, 1 },    // 03-11 07:00 EST
+    { 1678579200, 0, true, 1 },
+    { 1678618800, 0, false, 1 },    // 03-12 07:00 EDT
+    { 1678662000, 0, true, 1 },
+    { 1678705200, 0, false, 1 },
+    { 1678748400, 0, true, 1 },
+    { 1678791600, 0, false, 1 },    // 03-14 07:00 EDT
+  };
+  beginScenario(1678467600, 19, 0, 7, 0);
+  runUntil(1678809600);
+  expectSwitches("spring forward 19:00-07:00", expect, sizeof(expect) / sizeof(expect[0]));
+}
+
+static void checkFallBack(void){
+  static const LampExpect expect[] = {
+    { 1699052400, 0, true, 1 },     // 11-03 19:00 EDT
+    { 1699095600, 0, false, 1 },
+    { 1699138800, 0, true, 1 },
+    { 1699185600, 0, false, 1 },    // 11-05 07:00 EST
+    { 1699228800, 0, true, 1 },
+    { 1699272000, 0, false, 1 },
+    { 1699315200, 0, true, 1 },
+    { 1699358400, 0, false, 1 },    // 11-07 07:00 EST
+  };
+  beginScenario(1699027200, 19, 0, 7, 0);
+  runUntil(1699376400);
+  expectSwitches("fall back 19:00-07:00", expect, sizeof(expect) / sizeof(expect[0]));
+}
+
+// 02:30 does not happen on 03-12, the lamps come on with the jump to 03:00
+static void checkSkippedTime(void){
+  static const LampExpect expect[] = {
+    { 1678604400, 0, true, 1 },     // 03-12 03:00 EDT
+    { 1678618800, 0, false, 1 },
+    { 1678689000, 0, true, 1 },     // 03-13 02:30 EDT
+    { 1678705200, 0, false, 1 },
+  };
+  beginScenario(1678554000, 2, 30, 7, 0);
+  runUntil(1678723200);
+  expectSwitches("skipped on time 02:30", expect, sizeof(expect) / sizeof(expect[0]));
+}
+
+// 01:30 happens twice on 11-05, the lamps come on once
+static void checkRepeatedTime(void){
+  static const LampExpect expect[] = {
+    { 1699162200, 1699165800, true, 1 },    // 11-05 01:30 EDT or EST
+    { 1699185600, 0, false, 1 },
+    { 1699252200, 0, true, 1 },             // 11-06 01:30 EST
+    { 1699272000, 0, false, 1 },
+  };
+  beginScenario(1699113600, 1, 30, 7, 0);
+  runUntil(1699290000);
+  expectSwitches("repeated on time 01:30", expect, sizeof(expect) / sizeof(expect[0]));
+}
+
+// The lamps follow the clock when it is set, by hand or by the station
+static void checkClockJumps(void){
+  char chWind[160];
+  static const LampExpect expectManual[] = {
+    { 1685664000, 0, true, 1 },     // 06-01 20:00 EDT
+    { 1685635200, 0, false, 1 },    // back to 12:00
+  };
+  beginScenario(1685656800, 19, 0, 7, 0);
+  jumpTo(1685664000);
+  jumpTo(1685635200);
+  expectSwitches("clock set by hand", expectManual, sizeof(expectManual) / sizeof(expectManual[0]));
+
+  // First rapid_wind syncs at once, after that within a sync interval
+  static const LampExpect expectStation[] = {
+    { 1685667600, 0, true, 2 },     // 06-01 21:00 EDT
+    { 1685707200, 0, false, 62 },   // 06-02 08:00 EDT
+  };
+  snprintf(chWind, sizeof(chWind), "{\"serial_number\":\"ST-00000512\",\"type\":\"rapid_wind\","
+    "\"hub_sn\":\"HB-00013030\",\"ob\":[%ld,0.27,144]}", 1685667600L);
+  nativeInjectDatagram(chWind, strlen(chWind), Hal.Clock->Micros());
+  runUntil(Hal.Clock->Now() + 2);
+  // Now at 21:00, the station says 08:00 the next day
+  time_t tStation = 1685707200;
+  snprintf(chWind, sizeof(chWind), "{\"serial_number\":\"ST-00000512\",\"type\":\"rapid_wind\","
+    "\"hub_sn\":\"HB-00013030\",\"ob\":[%ld,0.27,144]}", (long)tStation);
+  nativeInjectDatagram(chWind, strlen(chWind), Hal.Clock->Micros());
+  runUntil(Hal.Clock->Now() + 70);
+  expectSwitches("clock set by the station", expectStation, sizeof(expectStation) / sizeof(expectStation[0]));
+}
+
+// Housekeeping wakeups over an hour of an idle station (no browsers)
+static void checkIdleWakeups(uint32_t u32MaxPerMinute){
+  const time_t tStart = 1685800800;
+  beginScenario(tStart, 19, 0, 7, 0);
+  const uint32_t u32Wakeups = Scheduler.Wakeups();
+  const uint32_t u32Runs = Scheduler.Runs();
+  runUntil(tStart + 3600);
+  double dWakeups = (Scheduler.Wakeups() - u32Wakeups) / 60.0;
+  double dRuns = (Scheduler.Runs() - u32Runs) / 60.0;
+  bool bPass = dWakeups <= u32MaxPerMinute;
+  printf("%-28s %s (%.1f wakeups, %.1f job runs per minute)\n", "idle wakeups", bPass ? "ok" : "FAIL",
+    dWakeups, dRuns);
+  if( !bPass )iFailures++;
+}
+
+int schedCheckMain(int argc, char **argv){
+  uint32_t u32MaxPerMinute = 12;
+  for( int i = 1; i < argc; i++ ){
+    if( strcmp(argv[i], "--max-wakeups") == 0 && i + 1 < argc )u32MaxPerMinute = atoi(argv[++i]);
+    else if( strcmp(argv[i], "-v") == 0 )nativeSetConsole(true);
+    else{
+      fprintf(stderr, "usage: program schedcheck [--max-wakeups <per minute>] [-v]\n");
+      return 2;
+    }
+  }
+
+  nativeSetWallClock(1678467600);
+  setup();
+  printf("time zone %s\n", Settings.Config.TimeZone);
+
+  checkSpringForward();
+  checkFallBack();
+  checkSkippedTime();
+  checkRepeatedTime();
+  checkClockJumps();
+  checkIdleWakeups(u32MaxPerMinute);
+
+  printf("%s\n", iFailures ? "FAILED" : "all checks passed");
+  return iFailures ? 1 : 0;
+}
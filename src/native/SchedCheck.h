@@ -0,0 +1,8 @@
+#ifndef __SchedCheck__
+#define __SchedCheck__
+
+// Housekeeping scheduler checks (lamps through DST, clock jumps, idle
+// wakeups), "program schedcheck ..."
+int schedCheckMain(int argc, char **argv);
+
+#endif
@@ -0,0 +1,160 @@
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "HalNative.h"
+#include "StatusFeed.h"
+#include "StatusBench.h"
+
+// ##################################################################
+// # Web status fan-out benchmark
+// #
+// # Pushes weather status updates (the station time every update, the
+// # whole obs_st every 20th) to 1..8 fake websocket clients and reports
+// # the CPU time, heap and frames serialized per update.  With two or
+// # more clients the last one is slow, draining one frame every 10
+// # updates, to show it is coalesced rather than queued.
+// ##################################################################
+
+#define BENCH_QUEUE_LEN 4
+#define BENCH_SLOW_EVERY 10
+
+// Reference counted frame, as AsyncWebSocketMessageBuffer
+struct BenchFrame{
+    char *Data;
+    size_t Len;
+    int Refs;
+};
+
+static void releaseFrame(BenchFrame *frame){
+  if( --frame->Refs > 0 )return;
+  delete[] frame->Data;
+  delete frame;
+}
+
+struct BenchClient{
+    uint32_t Id;
+    bool Slow;
+    BenchFrame *Queue[BENCH_QUEUE_LEN];
+    size_t Queued;
+    size_t MaxQueued;
+    uint32_t Received;
+    size_t Bytes;
+
+    void Drain(size_t count){
+      for( size_t i = 0; i < count && Queued; i++ ){
+        Bytes += Queue[0]->Len;
+        releaseFrame(Queue[0]);
+        memmove(Queue, Queue + 1, --Queued * sizeof(Queue[0]));
+        Received++;
+      }
+    }
+};
+
+class BenchTransport : public StatusTransport{
+  public:
+    BenchClient Clients_[STATUS_MAX_CLIENTS];
+    size_t NumClients = 0;
+
+    size_t Clients(uint32_t *u32Ids, size_t maxClients) override {
+      size_t count = NumClients < maxClients ? NumClients : maxClients;
+      for( size_t i = 0; i < count; i++ )u32Ids[i] = Clients_[i].Id;
+      return count;
+    }
+    bool CanSend(size_t index) override {
+      // Same rule as the board, at most one frame per feed waiting
+      return index < NumClients && Clients_[index].Queued < 2;
+    }
+    char *Begin(size_t len) override {
+      frame = new BenchFrame{ new char[len + 1], len, 1 };
+      return frame->Data;
+    }
+    void Send(size_t index) override {
+      if( index >= NumClients )return;
+      BenchClient *client = &Clients_[index];
+      if( client->Queued >= BENCH_QUEUE_LEN )return;
+      frame->Refs++;
+      client->Queue[client->Queued++] = frame;
+      if( client->Queued > client->MaxQueued )client->MaxQueued = client->Queued;
+    }
+    void End(void) override {
+      releaseFrame(frame);
+      frame = NULL;
+    }
+
+  private:
+    BenchFrame *frame = NULL;
+};
+
+static uint64_t benchNanos(void){
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// One status tick's worth of weather changes
+static void benchUpdate(uint32_t u32Update){
+  WeatherStatus.Setf(wsTime, "2023-11-14 22:%02u:%02u", (unsigned)(u32Update / 60 % 60),
+    (unsigned)(u32Update % 60));
+  if( u32Update % 20 )return;
+  uint32_t u32Obs = u32Update / 20;
+  WeatherStatus.Setf(wsTemperature, "%.1f F", 60 + (u32Obs % 200) / 10.0);
+  WeatherStatus.Setf(wsHumidity, "%u %%", (unsigned)(40 + u32Obs % 30));
+  WeatherStatus.Setf(wsPressure, "%.2f inHg", 29.8 + (u32Obs % 50) / 100.0);
+  WeatherStatus.Setf(wsWind, "%.1f MPH", (u32Obs % 150) / 10.0);
+  WeatherStatus.Setf(wsWindGust, "%.1f MPH", (u32Obs % 220) / 10.0);
+  WeatherStatus.Setf(wsBrightness, "%u lux", (unsigned)(u32Obs * 37 % 90000));
+  WeatherStatus.Setf(wsSolarRadiation, "%u W/m2", (unsigned)(u32Obs * 7 % 900));
+}
+
+int statusBenchMain(int argc, char **argv){
+  uint32_t u32Updates = 20000;
+  for( int i = 1; i < argc; i++ ){
+    if( strcmp(argv[i], "--updates") == 0 && i + 1 < argc )u32Updates = strtoul(argv[++i], NULL, 10);
+  }
+  if( u32Updates == 0 ){
+    fprintf(stderr, "usage: program wsbench [--updates <count>]\n");
+    return 2;
+  }
+
+  printf("%u updates per run\n\n", (unsigned)u32Updates);
+  printf("%-8s %10s %12s %12s %12s %10s %14s\n", "clients", "ns/update", "frames/upd", "allocs/upd",
+    "bytes/upd", "max queue", "slow received");
+  for( size_t numClients = 1; numClients <= STATUS_MAX_CLIENTS; numClients++ ){
+    BenchTransport transport;
+    StatusFanout fanout(WeatherStatus);
+    transport.NumClients = numClients;
+    for( size_t i = 0; i < numClients; i++ ){
+      transport.Clients_[i] = { (uint32_t)(i + 1), numClients > 1 && i == numClients - 1, {}, 0, 0, 0, 0 };
+    }
+
+    uint64_t u64Frames = 0, u64Nanos = 0;
+    const size_t allocsStart = nativeAllocs(), bytesStart = nativeAllocBytes();
+    for( uint32_t u = 0; u < u32Updates; u++ ){
+      benchUpdate(u);
+      uint64_t u64Start = benchNanos();
+      WeatherStatus.Commit();
+      u64Frames += fanout.Push(transport);
+      u64Nanos += benchNanos() - u64Start;
+      // The network takes the frames away between updates
+      for( size_t i = 0; i < numClients; i++ ){
+        BenchClient &client = transport.Clients_[i];
+        if( !client.Slow )client.Drain(BENCH_QUEUE_LEN);
+        else if( u % BENCH_SLOW_EVERY == 0 )client.Drain(1);
+      }
+    }
+
+    size_t maxQueued = 0;
+    for( size_t i = 0; i < numClients; i++ ){
+      if( transport.Clients_[i].MaxQueued > maxQueued )maxQueued = transport.Clients_[i].MaxQueued;
+      transport.Clients_[i].Drain(BENCH_QUEUE_LEN);
+    }
+    const BenchClient &slow = transport.Clients_[numClients - 1];
+    char chSlow[24] = "-";
+    if( slow.Slow )snprintf(chSlow, sizeof(chSlow), "%u", (unsigned)slow.Received);
+    printf("%-8u %10.0f %12.2f %12.2f %12.1f %10u %14s\n", (unsigned)numClients,
+      (double)u64Nanos / u32Updates, (double)u64Frames / u32Updates,
+      (double)(nativeAllocs() - allocsStart) / u32Updates,
+      (double)(nativeAllocBytes() - bytesStart) / u32Updates, (unsigned)maxQueued, chSlow);
+  }
+  return 0;
+}
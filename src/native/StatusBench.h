@@ -0,0 +1,7 @@
+#ifndef __StatusBench__
+#define __StatusBench__
+
+// Web status fan-out cost against the number of clients, "program wsbench ..."
+int statusBenchMain(int argc, char **argv);
+
+#endif
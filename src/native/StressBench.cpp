@@ -0,0 +1,228 @@
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "App.h"
+#include "GaugeTable.h"
+#include "HalNative.h"
+#include "Ingest.h"
+#include "Metrics.h"
+#include "StressBench.h"
+
+// ##################################################################
+// # Ingest stress
+// #
+// # Floods the receive path as a busy LAN would: the station the
+// # gauges follow sends rapid_wind every --wind-ms and obs_st every
+// # second, the rest of the --pps is other hubs' stations and the
+// # device_status, evt_strike and hub_status chatter of them all.  The
+// # gauge side runs once per --batch ms of virtual time, as a gauge
+// # task kept busy that long would, so what arrives in between is
+// # coalesced.  After every batch the wind needle has to show the
+// # newest rapid_wind of the followed station, and nothing from the
+// # other stations may have got through.  Exits 1 if either fails, or
+// # the host took longer than the virtual time to get through it.
+// #
+// # With --open there is no allow list, the needle then follows the
+// # newest rapid_wind of any station.
+// ##################################################################
+
+#define STRESS_STATION "ST-00000512"
+#define STRESS_HUB "HB-00013030"
+#define STRESS_EPOCH 1700000000L
+
+enum StressKind { skWind, skObs, skForeignWind, skForeignObs, skOtherWind, skDeviceStatus, skStrike,
+  skHubStatus, skForeignHub, NUM_STRESS_KINDS };
+#define STRESS_FILLER_FIRST skForeignWind
+
+static const char *chKindNames[NUM_STRESS_KINDS] = { "rapid_wind", "obs_st", "other rapid_wind",
+  "other obs_st", "third rapid_wind", "device_status", "evt_strike", "hub_status", "other hub_status" };
+
+// One broadcast, the followed station's wind moves in steps a float
+// holds exactly, so the expected duty is the one the firmware gets
+static size_t stressPacket(int iKind, uint32_t u32Seq, long lEpoch, char *chOut, size_t maxLen){
+  int iLen = 0;
+  switch( iKind ){
+    case skWind:
+      iLen = snprintf(chOut, maxLen, "{\"serial_number\":\"" STRESS_STATION "\",\"type\":\"rapid_wind\","
+        "\"hub_sn\":\"" STRESS_HUB "\",\"ob\":[%ld,%.2f,%u]}", lEpoch, (u32Seq % 80) * 0.25, (unsigned)(u32Seq * 37 % 360));
+      break;
+    case skObs:
+      iLen = snprintf(chOut, maxLen, "{\"serial_number\":\"" STRESS_STATION "\",\"type\":\"obs_st\","
+        "\"hub_sn\":\"" STRESS_HUB "\",\"obs\":[[%ld,1.2,3.4,5.6,180,3,1017.57,%.2f,50.26,328,0.03,3,"
+        "0.000000,0,0,0,2.410,1]],\"firmware_revision\":129}", lEpoch, 15.0 + (u32Seq % 10));
+      break;
+    case skForeignWind:
+      iLen = snprintf(chOut, maxLen, "{\"serial_number\":\"ST-00020771\",\"type\":\"rapid_wind\","
+        "\"hub_sn\":\"HB-00020400\",\"ob\":[%ld,30.00,%u]}", lEpoch, (unsigned)(u32Seq % 360));
+      break;
+    case skForeignObs:
+      iLen = snprintf(chOut, maxLen, "{\"serial_number\":\"ST-00020771\",\"type\":\"obs_st\","
+        "\"hub_sn\":\"HB-00020400\",\"obs\":[[%ld,9.1,12.2,15.3,90,3,990.10,45.00,20.10,1200,4.1,60,"
+        "0.000000,0,0,0,2.390,1]],\"firmware_revision\":129}", lEpoch);
+      break;
+    case skOtherWind:
+      iLen = snprintf(chOut, maxLen, "{\"serial_number\":\"ST-00031337\",\"type\":\"rapid_wind\","
+        "\"hub_sn\":\"HB-00031000\",\"ob\":[%ld,27.50,%u]}", lEpoch, (unsigned)(u32Seq % 360));
+      break;
+    case skDeviceStatus:
+      iLen = snprintf(chOut, maxLen, "{\"serial_number\":\"" STRESS_STATION "\",\"type\":\"device_status\","
+        "\"hub_sn\":\"" STRESS_HUB "\",\"timestamp\":%ld,\"uptime\":%u,\"voltage\":2.41,"
+        "\"firmware_revision\":129,\"rssi\":-48,\"hub_rssi\":-45,\"sensor_status\":0,\"debug\":0}",
+        lEpoch, (unsigned)u32Seq);
+      break;
+    case skStrike:
+      iLen = snprintf(chOut, maxLen, "{\"serial_number\":\"" STRESS_STATION "\",\"type\":\"evt_strike\","
+        "\"hub_sn\":\"" STRESS_HUB "\",\"evt\":[%ld,%u,3848]}", lEpoch, (unsigned)(5 + u32Seq % 30));
+      break;
+    case skHubStatus:
+    case skForeignHub:
+      iLen = snprintf(chOut, maxLen, "{\"serial_number\":\"%s\",\"type\":\"hub_status\","
+        "\"firmware_revision\":\"171\",\"uptime\":%u,\"rssi\":-62,\"timestamp\":%ld,"
+        "\"reset_flags\":\"BOR,PIN,POR\",\"seq\":%u,\"radio_stats\":[25,1,0,3,16841],"
+        "\"mqtt_stats\":[1,0]}", iKind == skHubStatus ? STRESS_HUB : "HB-00020400", (unsigned)u32Seq, lEpoch,
+        (unsigned)u32Seq);
+      break;
+  }
+  if( iLen < 0 )return 0;
+  return (size_t)iLen < maxLen ? (size_t)iLen : maxLen - 1;
+}
+
+static uint32_t percentile(std::vector<uint32_t> &vecSamples, double dPct){
+  if( vecSamples.empty() )return 0;
+  size_t idx = (size_t)ceil(dPct * vecSamples.size());
+  return vecSamples[idx ? idx - 1 : 0];
+}
+
+int stressBenchMain(int argc, char **argv){
+  uint32_t u32Pps = 1000, u32Seconds = 60, u32BatchMs = 100, u32WindMs = 50;
+  bool bOpen = false;
+  for( int i = 1; i < argc; i++ ){
+    if( strcmp(argv[i], "--pps") == 0 && i + 1 < argc )u32Pps = atoi(argv[++i]);
+    else if( strcmp(argv[i], "--seconds") == 0 && i + 1 < argc )u32Seconds = atoi(argv[++i]);
+    else if( strcmp(argv[i], "--batch") == 0 && i + 1 < argc )u32BatchMs = atoi(argv[++i]);
+    else if( strcmp(argv[i], "--wind-ms") == 0 && i + 1 < argc )u32WindMs = atoi(argv[++i]);
+    else if( strcmp(argv[i], "--open") == 0 )bOpen = true;
+    else if( strcmp(argv[i], "-v") == 0 )nativeSetConsole(true);
+    else u32Pps = 0;
+  }
+  if( !u32Pps || !u32Seconds || !u32BatchMs || !u32WindMs ){
+    fprintf(stderr, "usage: program stress [--pps <datagrams/s>] [--seconds <s>] [--batch <ms>]"
+      " [--wind-ms <ms>] [--open] [-v]\n");
+    return 2;
+  }
+
+  nativeSetWallClock(STRESS_EPOCH);
+  setup();
+  snprintf(Settings.Config.Ingest.Allow, sizeof(Settings.Config.Ingest.Allow), "%s", bOpen ? "" : STRESS_STATION);
+  Ingest.Configure(Settings.Config.Ingest);
+  int iNeedleChannel = -1;
+  for( const GaugeRoute &route : Settings.Config.Routes.Route ){
+    if( iNeedleChannel < 0 && route.Field == rfWindSpeed && route.Output == roPwm )iNeedleChannel = route.Channel;
+  }
+  HalEvents.clear();
+
+  const uint64_t u64Packets = (uint64_t)u32Pps * u32Seconds;
+  uint64_t u64Next = 0;
+  uint32_t u32NextWindMs = 0, u32NextObsMs = u32WindMs / 2;
+  uint32_t u32Seq = 0, u32Rand = 12345;
+  uint32_t u32Kinds[NUM_STRESS_KINDS] = {0};
+  uint32_t u32WindBatches = 0, u32Behind = 0, u32Moved = 0;
+  uint64_t u64BusyUs = 0;
+  std::vector<uint32_t> vecLatency;
+  std::vector<std::string> vecBatch;
+  std::vector<int> vecBatchKinds;
+  char chPacket[512];
+
+  for( uint32_t u32BatchMsAt = 0; u32BatchMsAt < u32Seconds * 1000; u32BatchMsAt += u32BatchMs ){
+    // Everything due in the batch, the followed station on its own
+    // schedule and filler from the rest in between
+    vecBatch.clear();
+    vecBatchKinds.clear();
+    for( ; u64Next < u64Packets; u64Next++ ){
+      const uint32_t u32AtMs = (uint32_t)(u64Next * 1000 / u32Pps);
+      if( u32AtMs >= u32BatchMsAt + u32BatchMs )break;
+      int iKind;
+      if( u32AtMs >= u32NextWindMs ){ iKind = skWind; u32NextWindMs += u32WindMs; }
+      else if( u32AtMs >= u32NextObsMs ){ iKind = skObs; u32NextObsMs += 1000; }
+      else{
+        u32Rand = u32Rand * 1103515245 + 12345;
+        iKind = STRESS_FILLER_FIRST + (int)((u32Rand >> 16) % (NUM_STRESS_KINDS - STRESS_FILLER_FIRST));
+      }
+      size_t len = stressPacket(iKind, u32Seq++, STRESS_EPOCH + u32AtMs / 1000, chPacket, sizeof(chPacket));
+      vecBatch.push_back(std::string(chPacket, len));
+      vecBatchKinds.push_back(iKind);
+      u32Kinds[iKind]++;
+    }
+
+    // Arriving back to back, the newest wind the gauges should show
+    uint32_t u32Expected = 0;
+    uint64_t u64WindRx = 0;
+    bool bWind = false;
+    for( size_t p = 0; p < vecBatch.size(); p++ ){
+      const uint64_t u64Rx = Hal.Clock->Micros();
+      const int iKind = vecBatchKinds[p];
+      nativeInjectDatagram(vecBatch[p].c_str(), vecBatch[p].size(), u64Rx);
+      if( iKind == skWind || (bOpen && (iKind == skForeignWind || iKind == skOtherWind)) ){
+        WxSample expected;
+        wxDecodeJsonFull(vecBatch[p].c_str(), vecBatch[p].size(), expected);
+        u32Expected = WindGauge.Scale(expected.WindSpeed);
+        u64WindRx = u64Rx;
+        bWind = true;
+      }
+    }
+    const uint64_t u64Start = Hal.Clock->Micros();
+    while( nativePendingDatagrams() )loop();
+    u64BusyUs += Hal.Clock->Micros() - u64Start;
+
+    // The needle's last write of the batch
+    const HalEvent *pLast = NULL;
+    for( const HalEvent &ev : HalEvents ){
+      if( ev.Type == evPwmWrite && ev.Channel == iNeedleChannel )pLast = &ev;
+    }
+    if( bWind ){
+      u32WindBatches++;
+      if( !pLast || pLast->Value != u32Expected )u32Behind++;
+      else vecLatency.push_back((uint32_t)(pLast->Micros - u64WindRx));
+    }
+    else if( pLast )u32Moved++;
+    HalEvents.clear();
+    nativeAdvanceWallClock(u32BatchMs);
+  }
+
+  printf("Stressed with %llu datagrams, %u/s for %u s, gauges every %u ms, %s\n", (unsigned long long)u64Packets,
+    (unsigned)u32Pps, (unsigned)u32Seconds, (unsigned)u32BatchMs, bOpen ? "no allow list" : "allow " STRESS_STATION);
+  for( int k = 0; k < NUM_STRESS_KINDS; k++ )printf("  %-18s %8u\n", chKindNames[k], (unsigned)u32Kinds[k]);
+
+  // Per sender as the firmware counted them, nothing from another
+  // station may have been taken
+  uint32_t u32Leaks = 0;
+  printf("\n%-16s %10s %10s %10s\n", "source", "received", "rejected", "replaced");
+  for( uint8_t s = 0; s < Ingest.Sources(); s++ ){
+    const IngestSource &source = Ingest.Source(s);
+    const uint32_t u32Received = source.Datagrams.load(), u32Rejected = source.Rejected.load();
+    printf("%-16s %10u %10u %10u\n", source.Serial, (unsigned)u32Received, (unsigned)u32Rejected,
+      (unsigned)source.Replaced.load());
+    const bool bFollowed = strcmp(source.Serial, STRESS_STATION) == 0 || strcmp(source.Serial, STRESS_HUB) == 0;
+    if( !bOpen && !bFollowed && u32Rejected != u32Received )u32Leaks += u32Received - u32Rejected;
+  }
+  printf("datagrams %u, rejected %u, ignored %u, samples replaced %u\n", (unsigned)Metrics.Counter(mcDatagrams),
+    (unsigned)Metrics.Counter(mcRejected), (unsigned)Metrics.Counter(mcIgnored), (unsigned)Metrics.Counter(mcQueueDrops));
+
+  std::sort(vecLatency.begin(), vecLatency.end());
+  printf("\nwind needle: %u batches with a rapid_wind, %u behind, %u moved without one\n", (unsigned)u32WindBatches,
+    (unsigned)u32Behind, (unsigned)u32Moved);
+  printf("newest rapid_wind to needle: p50 %u us, p99 %u us, max %u us\n", percentile(vecLatency, 0.50),
+    percentile(vecLatency, 0.99), vecLatency.empty() ? 0 : vecLatency.back());
+  const double dLoad = u64BusyUs / (u32Seconds * 1e6);
+  printf("receive & gauge work: %.0f ns per datagram, %.2f%% of real time\n",
+    u64Packets ? u64BusyUs * 1000.0 / u64Packets : 0.0, dLoad * 100);
+
+  const bool bFailed = u32Behind || u32Moved || u32Leaks || dLoad >= 1;
+  if( u32Leaks )printf("%u datagrams from other stations got through\n", (unsigned)u32Leaks);
+  printf("%s\n", bFailed ? "FAILED" : "gauges kept up");
+  return bFailed ? 1 : 0;
+}
@@ -0,0 +1,7 @@
+#ifndef __StressBench__
+#define __StressBench__
+
+// Receive path under a flood of broadcasts from several hubs, "program stress ..."
+int stressBenchMain(int argc, char **argv);
+
+#endif
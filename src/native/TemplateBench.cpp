@@ -0,0 +1,153 @@
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "HalNative.h"
+#include "Template.h"
+#include "TemplateBench.h"
+
+// ##################################################################
+// # Template render benchmark
+// #
+// # Serves a template (web/index.html) repeatedly, the way the web
+// # server used to (scan the whole file for %VAR% on every request,
+// # a string per value through a chain of name compares) against the
+// # compiled template with its cached settings render.  Every 100th
+// # request follows a settings change, so the compiled side pays for
+// # its rebuilds too.  Reports CPU time, heap and bytes per request.
+// # First checks that a template with as many live values as a render
+// # holds compiles with every one of them filled in, and one with more
+// # is refused (and so served uncompiled) rather than cut short.
+// ##################################################################
+
+#define BENCH_CHUNK 1436        // One TCP segment, as the async server fills
+#define BENCH_CHANGE_EVERY 100
+
+static uint64_t benchNanos(void){
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// The old processor: a compare per known name until one matches, the
+// value handed back as a new string
+static std::string legacyProcessor(const std::string &strVar){
+  char chValue[TEMPLATE_VALUE_LEN];
+  for( uint8_t i = 0; i < NUM_TEMPLATE_VARS; i++ ){
+    if( strVar == TemplateVarNames[i] ){
+      templateValue((TemplateVar)i, chValue, sizeof(chValue));
+      return std::string(chValue);
+    }
+  }
+  return std::string("N/A");
+}
+
+// As the async server's template response, the file read in chunks
+// and each placeholder cut out, looked up and spliced back in
+static size_t legacyRender(const std::string &strTemplate){
+  std::string strOut;
+  size_t pos = 0, sent = 0;
+  while( pos < strTemplate.size() ){
+    size_t start = strTemplate.find('%', pos);
+    size_t end = start == std::string::npos ? start : strTemplate.find('%', start + 1);
+    if( end == std::string::npos ){
+      strOut.append(strTemplate, pos, std::string::npos);
+      break;
+    }
+    strOut.append(strTemplate, pos, start - pos);
+    std::string strVar = strTemplate.substr(start + 1, end - start - 1);
+    strOut += legacyProcessor(strVar);
+    pos = end + 1;
+    if( strOut.size() >= BENCH_CHUNK ){
+      sent += strOut.size();
+      strOut.clear();
+      strOut.shrink_to_fit();
+    }
+  }
+  return sent + strOut.size();
+}
+
+static size_t compiledRender(CompiledTemplate &tpl){
+  uint8_t u8Chunk[BENCH_CHUNK];
+  TemplateCursor cursor(tpl.Render());
+  size_t len, sent = 0;
+  while( (len = cursor.Fill(u8Chunk, sizeof(u8Chunk))) > 0 )sent += len;
+  return sent;
+}
+
+// A template of numLive live values back to back (one segment each, so
+// the segments are not what runs out), rendered or refused
+static bool partLimitCheck(size_t numLive, bool bFits){
+  const TemplateVar var = (TemplateVar)TEMPLATE_FIRST_LIVE;
+  std::string strTemplate = "<p>";
+  for( size_t i = 0; i < numLive; i++ )strTemplate += std::string("%") + TemplateVarNames[var] + "%";
+  CompiledTemplate tpl;
+  bool bOk;
+  if( !tpl.Compile(strTemplate.data(), strTemplate.size()) )bOk = !bFits;
+  else{
+    char chValue[TEMPLATE_VALUE_LEN];
+    const size_t valueLen = templateValue(var, chValue, sizeof(chValue));
+    uint8_t u8Chunk[BENCH_CHUNK];
+    TemplateCursor cursor(tpl.Render());
+    std::string strOut;
+    size_t len;
+    while( (len = cursor.Fill(u8Chunk, sizeof(u8Chunk))) > 0 )strOut.append((const char *)u8Chunk, len);
+    bOk = bFits && strOut.size() == strTemplate.size() + numLive * (valueLen - strlen(TemplateVarNames[var]) - 2);
+  }
+  printf("%-28s %s\n", bFits ? "live values at the limit" : "live values past the limit",
+    bOk ? (bFits ? "ok, all rendered" : "ok, refused") : "FAILED");
+  return bOk;
+}
+
+int templateBenchMain(int argc, char **argv){
+  const char *chPath = NULL;
+  uint32_t u32Requests = 20000;
+  for( int i = 1; i < argc; i++ ){
+    if( strcmp(argv[i], "--requests") == 0 && i + 1 < argc )u32Requests = strtoul(argv[++i], NULL, 10);
+    else chPath = argv[i];
+  }
+  if( !chPath || u32Requests == 0 ){
+    fprintf(stderr, "usage: program tplbench <index.html> [--requests <count>]\n");
+    return 2;
+  }
+
+  FILE *fTemplate = fopen(chPath, "rb");
+  if( !fTemplate ){
+    fprintf(stderr, "Unable to open %s\n", chPath);
+    return 1;
+  }
+  std::vector<char> text;
+  char chBuf[4096];
+  size_t len;
+  while( (len = fread(chBuf, 1, sizeof(chBuf), fTemplate)) > 0 )text.insert(text.end(), chBuf, chBuf + len);
+  fclose(fTemplate);
+  const std::string strTemplate(text.begin(), text.end());
+
+  if( !partLimitCheck(TEMPLATE_MAX_PARTS - 1, true) | !partLimitCheck(TEMPLATE_MAX_PARTS, false) )return 1;
+  printf("\n");
+
+  CompiledTemplate tpl;
+  if( !tpl.Compile(text.data(), text.size()) ){
+    fprintf(stderr, "Template %s has too many placeholders\n", chPath);
+    return 1;
+  }
+  printf("%s, %u bytes, %u segments, %u requests per run\n\n", chPath, (unsigned)text.size(),
+    (unsigned)tpl.NumSegments(), (unsigned)u32Requests);
+  printf("%-10s %12s %12s %12s %12s\n", "render", "ns/request", "allocs/req", "heap/req", "bytes/req");
+
+  for( int iCompiled = 0; iCompiled < 2; iCompiled++ ){
+    uint64_t u64Nanos = 0, u64Bytes = 0;
+    const size_t allocsStart = nativeAllocs(), bytesStart = nativeAllocBytes();
+    for( uint32_t r = 0; r < u32Requests; r++ ){
+      if( r % BENCH_CHANGE_EVERY == 0 )u32SettingsGeneration++;
+      uint64_t u64Start = benchNanos();
+      u64Bytes += iCompiled ? compiledRender(tpl) : legacyRender(strTemplate);
+      u64Nanos += benchNanos() - u64Start;
+    }
+    printf("%-10s %12.0f %12.2f %12.1f %12.0f\n", iCompiled ? "compiled" : "processor",
+      (double)u64Nanos / u32Requests, (double)(nativeAllocs() - allocsStart) / u32Requests,
+      (double)(nativeAllocBytes() - bytesStart) / u32Requests, (double)u64Bytes / u32Requests);
+  }
+  return 0;
+}
@@ -0,0 +1,7 @@
+#ifndef __TemplateBench__
+#define __TemplateBench__
+
+// index.html render cost, per request processor vs compiled, "program tplbench ..."
+int templateBenchMain(int argc, char **argv);
+
+#endif
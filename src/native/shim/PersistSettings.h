@@ -0,0 +1,22 @@
+#ifndef __PersistSettings__
+#define __PersistSettings__
+
+// ##################################################################
+// # Native (host) stand-in for lylavoie/PersistSettings, keeps the
+// # configuration in RAM only.
+// ##################################################################
+
+template <class T>
+class PersistSettings{
+  public:
+    T Config;
+    PersistSettings(unsigned int uiVersion) { (void)uiVersion; }
+    void Begin(void) {}
+    void Write(void) { u32Writes++; }
+    void ResetToDefault(void) { Config = T(); }
+    unsigned int Writes(void) { return u32Writes; }
+  private:
+    unsigned int u32Writes = 0;
+};
+
+#endif
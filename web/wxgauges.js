@@ -0,0 +1,265 @@
+/********************************************************************
+ * WeatherFlow Tempest Gauges 
+ * 
+ * Provide interactive calls and handling for the web GUI of
+ * the gauges controller.
+ * 
+ * Copyright: Lincoln Lavoie, 2021
+ ********************************************************************/
+
+var wxGaugesWsGateway = `ws://${window.location.hostname}/ws`;
+var wxGaugesWS;
+
+const fetchValue = id => document.getElementById(id).value;
+
+// Calibration points, "value:pwm, ..." to [[value, pwm], ...]
+const fetchCalPoints = id => fetchValue(id).split(",")
+    .map(point => point.split(":").map(Number))
+    .filter(point => point.length == 2 && !isNaN(point[0]) && !isNaN(point[1]));
+
+// Websocket event handler to update the pages
+function onWsMessage(event){
+    var jsonMsg = JSON.parse(event.data);
+    switch(jsonMsg.type){
+
+        // Update the current weather conditions
+        case "status_weather":
+            for( var key in jsonMsg.status){
+                if( jsonMsg.status.hasOwnProperty(key) ){
+                    document.getElementById(key).innerHTML = jsonMsg.status[key];
+                }
+            }
+            break;
+
+        // Update the current system status and memory use
+        case "status_system":
+        case "status_memory":
+            for( var key in jsonMsg.status){
+                if( jsonMsg.status.hasOwnProperty(key) ){
+                    document.getElementById(key).innerHTML = jsonMsg.status[key];
+                }
+            }
+            break;
+    }
+}
+
+// Update the System Settings
+function submitSystemSettings(){
+    var jsonSettings = {
+        wind: {
+            min: Number(fetchValue("min_wind")),
+            max: Number(fetchValue("max_wind")),
+            step: Number(fetchValue("step_wind")),
+            gain: Number(fetchValue("gain_wind")),
+            threshold: Number(fetchValue("threshold_wind")),
+            cal: fetchCalPoints("cal_wind"),
+            slew: Number(fetchValue("slew_wind")),
+            damped: document.getElementById("damped_wind").checked ? 1 : 0,
+            show: Number(fetchValue("show_wind")),
+            leds: fetchValue("wind_leds").trim().split(/\s+/).map(led => parseInt(led, 16)),
+            arc: document.getElementById("arc_wind").checked ? 1 : 0
+        },
+        temp: {
+            min: Number(fetchValue("min_temp")),
+            max: Number(fetchValue("max_temp")),
+            step: Number(fetchValue("step_temp")),
+            gain: Number(fetchValue("gain_temp")),
+            cal: fetchCalPoints("cal_temp"),
+            slew: Number(fetchValue("slew_temp")),
+            damped: document.getElementById("damped_temp").checked ? 1 : 0
+        },
+        link: {
+            stale: Number(fetchValue("link_stale")),
+            park: Number(fetchValue("link_park")),
+            blank: document.getElementById("link_blank").checked ? 1 : 0
+        },
+        ingest: {
+            allow: fetchValue("ingest_allow").trim()
+        },
+        cal: {
+            mode: fetchValue("cal_mode"),
+            dwell: Number(fetchValue("cal_dwell"))
+        }
+        
+    };
+    var jsonMsg = {
+        type: "updateSettings",
+        payload: jsonSettings
+    };
+    wxGaugesWS.send(JSON.stringify(jsonMsg));
+    console.log(JSON.stringify(jsonMsg));
+    return false;
+}
+
+// Update the WiFi Settings
+function submitWiFi(){
+    // FIXME: Prevent submmitting empty ssid and password
+    var jsonSettings = {
+        wifi:{
+            ssid: fetchValue("ssid"),
+            pw: fetchValue("wifipass"),
+            static: fetchValue("wifi_static").trim()
+        },
+    };
+    var jsonMsg = {
+        type: "updateWiFi",
+        payload: jsonSettings
+    };
+    wxGaugesWS.send(JSON.stringify(jsonMsg));
+    console.log(JSON.stringify(jsonMsg));
+    return false;
+}
+
+// Update the Login Settings
+function submitLogin(){
+    // FIXME: Prevent submmitting empty username and password
+    var jsonSettings = {
+        auth:{
+            user: fetchValue("username"),
+            pass: fetchValue("userpass")
+        },
+    };
+    var jsonMsg = {
+        type: "updateUser",
+        payload: jsonSettings
+    };
+    wxGaugesWS.send(JSON.stringify(jsonMsg));
+    console.log(JSON.stringify(jsonMsg));
+    return false;
+}
+
+// Calibration sweep, move the needle at the current step until it reads
+// true, then save the corrected points once the sweep is over
+function calNudge(duty){
+    var jsonMsg = {
+        type: "calibrate",
+        payload: { action: "nudge", duty: duty }
+    };
+    wxGaugesWS.send(JSON.stringify(jsonMsg));
+    return false;
+}
+
+function calSave(){
+    var jsonMsg = {
+        type: "calibrate",
+        payload: { action: "save" }
+    };
+    wxGaugesWS.send(JSON.stringify(jsonMsg));
+    console.log(JSON.stringify(jsonMsg));
+    return false;
+}
+
+function submitRoutes(){
+    var routes = [];
+    for( var i = 0; i < 8; i++ ){
+        routes.push(fetchValue(`route_${i}`).trim());
+    }
+    var jsonMsg = {
+        type: "updateRoutes",
+        payload: { routes: routes }
+    };
+    wxGaugesWS.send(JSON.stringify(jsonMsg));
+    console.log(JSON.stringify(jsonMsg));
+    return false;
+}
+
+// Fetch a history tier (/history binary download) and chart the last 24
+// hours, min..max as a band with the mean as a line
+function drawHistory(series, canvasId){
+    var xhr = new XMLHttpRequest();
+    xhr.open("GET", `/history?series=${series}&since=${Math.floor(Date.now() / 1000) - 86400}`, true);
+    xhr.responseType = "arraybuffer";
+    xhr.onload = function(){
+        if( xhr.status != 200 )return;
+        var view = new DataView(xhr.response);
+        var recordSize = view.getUint8(5);
+        var points = [];
+        for( var i = 8; i + recordSize <= view.byteLength; i += recordSize ){
+            points.push([view.getUint32(i, true), view.getInt16(i + 4, true) / 100,
+                view.getInt16(i + 6, true) / 100, view.getInt16(i + 8, true) / 100]);
+        }
+        var canvas = document.getElementById(canvasId);
+        var ctx = canvas.getContext("2d");
+        ctx.clearRect(0, 0, canvas.width, canvas.height);
+        if( points.length < 2 )return;
+        var t0 = points[0][0], t1 = points[points.length - 1][0];
+        var lo = Math.min(...points.map(p => p[1])), hi = Math.max(...points.map(p => p[3]));
+        if( hi == lo )hi = lo + 1;
+        const x = t => (t - t0) / (t1 - t0) * canvas.width;
+        const y = v => canvas.height - (v - lo) / (hi - lo) * canvas.height;
+        ctx.fillStyle = "#c8dcf0";
+        ctx.beginPath();
+        points.forEach(p => ctx.lineTo(x(p[0]), y(p[3])));
+        points.slice().reverse().forEach(p => ctx.lineTo(x(p[0]), y(p[1])));
+        ctx.fill();
+        ctx.strokeStyle = "#1f5f9f";
+        ctx.beginPath();
+        points.forEach(p => ctx.lineTo(x(p[0]), y(p[2])));
+        ctx.stroke();
+        ctx.fillStyle = "#000";
+        ctx.fillText(hi.toFixed(1), 2, 10);
+        ctx.fillText(lo.toFixed(1), 2, canvas.height - 2);
+    };
+    xhr.send();
+}
+
+// Firmware upload, the board writes it to flash as it arrives and
+// restarts into it once the image checks out
+function submitUpdate(){
+    var file = document.getElementById("update_src").files[0];
+    if( !file )return false;
+    var progress = document.getElementById("update_progress");
+    var result = document.getElementById("update_result");
+    var form = new FormData();
+    form.append("image", file, file.name);
+    var xhr = new XMLHttpRequest();
+    xhr.open("POST", "/update", true);
+    xhr.upload.onprogress = function(event){
+        if( event.lengthComputable )progress.value = 100 * event.loaded / event.total;
+    };
+    xhr.onload = function(){ result.textContent = xhr.responseText; };
+    xhr.onerror = function(){ result.textContent = "Upload failed"; };
+    result.textContent = "Uploading...";
+    xhr.send(form);
+    return false;
+}
+
+// Debug log viewer, connected the first time the Log tab is opened,
+// keeps the last 500 lines
+var wxLogWS;
+function openLog(){
+    if( wxLogWS )return;
+    var view = document.getElementById("log_view");
+    var lines = [];
+    wxLogWS = new WebSocket(`ws://${window.location.hostname}/log`);
+    wxLogWS.onmessage = function(event){
+        lines.push(...event.data.split(/\r?\n\r?/).filter(line => line.length));
+        if( lines.length > 500 )lines.splice(0, lines.length - 500);
+        view.textContent = lines.join("\n");
+    };
+    wxLogWS.onclose = function(){ wxLogWS = null; };
+}
+
+// Setup websocket connection on page load
+window.addEventListener('load', function() {
+    console.log('Trying to open a WebSocket connection...');
+    wxGaugesWS = new WebSocket(wxGaugesWsGateway);
+    //wxGaugesWS.onopen    = onOpen;
+    //wxGaugesWS.onclose   = onClose;
+    wxGaugesWS.onmessage = onWsMessage; 
+    // Selects rendered with their setting in data-value
+    document.querySelectorAll("select[data-value]").forEach(select => select.value = select.dataset.value);
+    drawHistory("wind_1m", "history_wind");
+    drawHistory("temp_1m", "history_temp");
+    }
+);
+
+// Deal with logging out
+function logout(){
+    var xhr = new XMLHttpRequest();
+    xhr.open("GET", "/logout", true);
+    //xhr.setRequestHeader("Authorization", "Basic NULLandVOID");
+    wxGaugesWS.close(1000, "logging out");
+    xhr.send();
+    setTimeout(function(){ window.open("/logged-out.html","_self"); }, 500);
+}
\ No newline at end of file